@@ -0,0 +1,152 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include <cellcutoff/cell.h>
+#include <cellcutoff/sphere_slice.h>
+
+
+namespace cl = cellcutoff;
+
+
+namespace {
+
+//! Returns the average time in nanoseconds of one bars_cutoff call with a reused vector.
+double time_vector(const cl::Cell& cell, const std::vector<double>& centers,
+    double cutoff, size_t* nint) {
+  std::vector<int> bars;
+  *nint = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t icenter = 0; icenter < centers.size()/3; ++icenter) {
+    bars.clear();
+    cell.bars_cutoff(&centers[3*icenter], cutoff, &bars);
+    *nint += bars.size();
+  }
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(stop - start).count()/
+         static_cast<double>(centers.size()/3);
+}
+
+//! Returns the average time in nanoseconds of one bars_cutoff call with shared geometry.
+double time_geometry(const cl::Cell& cell, const std::vector<double>& centers,
+    double cutoff, size_t* nint) {
+  std::vector<int> bars;
+  *nint = 0;
+  auto start = std::chrono::steady_clock::now();
+  cl::SphereSliceGeometry geometry(cell.gvecs(), cutoff);
+  for (size_t icenter = 0; icenter < centers.size()/3; ++icenter) {
+    bars.clear();
+    cell.bars_cutoff(geometry, &centers[3*icenter], &bars);
+    *nint += bars.size();
+  }
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(stop - start).count()/
+         static_cast<double>(centers.size()/3);
+}
+
+//! Returns the average time in nanoseconds of one bars_cutoff_pruned call.
+double time_pruned(const cl::Cell& cell, const std::vector<double>& centers,
+    double cutoff, size_t* nint) {
+  std::vector<int> bars;
+  *nint = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t icenter = 0; icenter < centers.size()/3; ++icenter) {
+    bars.clear();
+    cell.bars_cutoff_pruned(&centers[3*icenter], cutoff, &bars);
+    *nint += bars.size();
+  }
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(stop - start).count()/
+         static_cast<double>(centers.size()/3);
+}
+
+//! Returns the average time in nanoseconds of one bars_cutoff call with a fixed buffer.
+double time_buffer(const cl::Cell& cell, const std::vector<double>& centers,
+    double cutoff, size_t* nint) {
+  // One buffer, large enough for all centers
+  size_t size = 0;
+  for (size_t icenter = 0; icenter < centers.size()/3; ++icenter) {
+    size_t size_center = cell.bars_cutoff_size(&centers[3*icenter], cutoff);
+    if (size_center > size) size = size_center;
+  }
+  std::vector<int> buffer(size);
+  *nint = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t icenter = 0; icenter < centers.size()/3; ++icenter)
+    *nint += cell.bars_cutoff(&centers[3*icenter], cutoff, buffer.data(), size);
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(stop - start).count()/
+         static_cast<double>(centers.size()/3);
+}
+
+}  // namespace
+
+
+int main() {
+  // A slightly skewed unit cell, such that all spacings are close to one, and a cuboid
+  // cell, for which a closed-form solution is used.
+  const double all_vecs[2][9]{{1.0, 0.1, 0.0, 0.2, 1.0, 0.1, 0.0, 0.1, 1.0},
+                              {1.0, 0.0, 0.0, 0.0, 1.1, 0.0, 0.0, 0.0, 0.9}};
+  const char* names[2]{"skewed", "cuboid"};
+  const double ratios[5]{1.0, 2.0, 5.0, 10.0, 20.0};
+  std::minstd_rand gen(1);
+  std::uniform_real_distribution<double> dis(0.0, 1.0);
+  std::vector<double> centers(3*1000);
+  for (double& x : centers) x = dis(gen);
+
+  printf("# bars_cutoff(_pruned): average time per call [ns]\n");
+  printf("# nint is the number of ints in the bars, without and with pruning.\n");
+  printf("%6s %4s %8s %10s %10s %10s %10s %10s %10s\n", "cell", "nvec", "ratio",
+         "nint", "vector", "buffer", "geometry", "nint", "pruned");
+  for (int icell = 0; icell < 2; ++icell) {
+    for (int nvec = 1; nvec <= 3; ++nvec) {
+      cl::Cell cell(all_vecs[icell], nvec);
+      for (double ratio : ratios) {
+        // Fewer centers for the expensive cases
+        std::vector<double> some_centers(centers.begin(), centers.begin() +
+            3*((nvec == 3) && (ratio > 5.0) ? 100 : 1000));
+        const double cutoff = ratio*cell.spacings()[0];
+        size_t nint_vector;
+        size_t nint_buffer;
+        double t_vector = time_vector(cell, some_centers, cutoff, &nint_vector);
+        double t_buffer = time_buffer(cell, some_centers, cutoff, &nint_buffer);
+        size_t nint_geometry;
+        double t_geometry = time_geometry(cell, some_centers, cutoff, &nint_geometry);
+        size_t nint_pruned;
+        double t_pruned = time_pruned(cell, some_centers, cutoff, &nint_pruned);
+        printf("%6s %4d %8.1f %10zu %10.1f %10.1f %10.1f %10zu %10.1f\n", names[icell],
+               nvec, ratio, nint_vector/(some_centers.size()/3), t_vector, t_buffer,
+               t_geometry, nint_pruned/(some_centers.size()/3), t_pruned);
+        if ((nint_vector != nint_buffer) || (nint_vector != nint_geometry)) {
+          printf("Inconsistent results.\n");
+          return 1;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+// vim: textwidth=90 et ts=2 sw=2
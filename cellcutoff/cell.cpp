@@ -23,6 +23,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <limits>
 #include <stdexcept>
 #include <vector>
 
@@ -32,6 +33,90 @@
 namespace cellcutoff {
 
 
+namespace {
+
+//! Tolerance on the box and slice constraints in box_range, in fractional units.
+const double kBoxEps = 1e-10;
+
+/** @brief
+        Range of one fractional coordinate over a parallelepiped, restricted to a slice
+        in each preceding direction.
+
+    The parallelepiped contains all points `frac_origin + t[0]*frac_edges[0:3] +
+    t[1]*frac_edges[3:6] + t[2]*frac_edges[6:9]`, with all `t[k]` in `[0, 1]`. The
+    extremes are found on the vertices of the intersection with the slices, i.e. on
+    the intersection points of three faces of the parallelepiped or the slices. For the
+    last of three directions, this means ten combinations of three normals, each with
+    eight combinations of the two offsets of a face pair.
+
+    @param slices
+        The integer slices `[slices[jvec], slices[jvec] + 1]` of the preceding
+        directions `jvec < ivec`.
+
+    @return
+        False when no vertex is found, which may only happen due to rounding errors.
+ */
+bool box_range(const double* frac_origin, const double* frac_edges, const int ivec,
+    const int* slices, double* begin, double* end) {
+  // The constraints are linear in t. The first three normals define the parallelepiped,
+  // the others the slices.
+  double normals[18]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  double offsets[10]{0.0, 1.0, 0.0, 1.0, 0.0, 1.0};
+  for (int jvec = 0; jvec <= ivec; ++jvec) {
+    for (int k = 0; k < 3; ++k)
+      normals[3*(3 + jvec) + k] = frac_edges[3*k + jvec];
+    if (jvec < ivec) {
+      offsets[2*(3 + jvec)] = slices[jvec] - frac_origin[jvec];
+      offsets[2*(3 + jvec) + 1] = slices[jvec] + 1 - frac_origin[jvec];
+    }
+  }
+  const double* objective = normals + 3*(3 + ivec);
+  const int nnormal = 3 + ivec;
+  *begin = std::numeric_limits<double>::infinity();
+  *end = -std::numeric_limits<double>::infinity();
+  for (int n0 = 0; n0 < nnormal; ++n0) {
+    for (int n1 = n0 + 1; n1 < nnormal; ++n1) {
+      for (int n2 = n1 + 1; n2 < nnormal; ++n2) {
+        const double* a = normals + 3*n0;
+        const double* b = normals + 3*n1;
+        const double* c = normals + 3*n2;
+        double bc[3];
+        double ca[3];
+        double ab[3];
+        vec3::cross(b, c, bc);
+        vec3::cross(c, a, ca);
+        vec3::cross(a, b, ab);
+        const double det = vec3::dot(a, bc);
+        if (fabs(det) < kBoxEps) continue;
+        for (int icorner = 0; icorner < 8; ++icorner) {
+          // Solve a.t = p, b.t = q and c.t = r with Cramer's rule.
+          double t[3]{0.0, 0.0, 0.0};
+          vec3::iadd(t, bc, offsets[2*n0 + (icorner & 1)]/det);
+          vec3::iadd(t, ca, offsets[2*n1 + ((icorner >> 1) & 1)]/det);
+          vec3::iadd(t, ab, offsets[2*n2 + ((icorner >> 2) & 1)]/det);
+          bool inside = true;
+          for (int n = 0; n < nnormal; ++n) {
+            const double value = vec3::dot(normals + 3*n, t);
+            if ((value < offsets[2*n] - kBoxEps) ||
+                (value > offsets[2*n + 1] + kBoxEps)) {
+              inside = false;
+              break;
+            }
+          }
+          if (!inside) continue;
+          const double value = frac_origin[ivec] + vec3::dot(objective, t);
+          *begin = std::min(*begin, value);
+          *end = std::max(*end, value);
+        }
+      }
+    }
+  }
+  return *begin <= *end;
+}
+
+}  // namespace
+
+
 Cell::Cell(const double* vecs, const int nvec): nvec_(nvec) {
   // check if nvec is sensible
   if ((nvec_ < 0) || (nvec_ > 3))
@@ -291,6 +376,17 @@ size_t Cell::ranges_cutoff(const double* center, const double cutoff,
 
 void Cell::bars_cutoff(const double* center, const double cutoff,
     std::vector<int>* bars) const {
+  // Reserve sufficient space, such that no reallocations are needed.
+  const size_t old_size = bars->size();
+  bars->resize(old_size + bars_cutoff_size(center, cutoff));
+  size_t size = bars_cutoff(center, cutoff, bars->data() + old_size,
+                            bars->size() - old_size);
+  bars->resize(old_size + size);
+}
+
+
+size_t Cell::bars_cutoff(const double* center, const double cutoff, int* bars,
+    size_t size) const {
   // Check arguments
   if (nvec_ == 0) {
     throw std::domain_error("The cell must be at least 1D periodic.");
@@ -298,10 +394,184 @@ void Cell::bars_cutoff(const double* center, const double cutoff,
   if (cutoff <= 0) {
     throw std::domain_error("cutoff must be strictly positive.");
   }
+  // Cuboid cells have a closed-form solution.
+  if (cuboid()) return bars_cutoff_cuboid(center, cutoff, bars, size);
   // For all the heavy work, a SphereSlice object is used that precomputes a lot.
-  SphereSlice sphere_slice(center, gvecs_, cutoff);
-  // Compute bars and return the number of bars
-  bars_cutoff_low(&sphere_slice, 0, bars);
+  SphereSliceGeometry geometry(gvecs_, cutoff);
+  SphereSlice sphere_slice(geometry, center);
+  // Compute bars and return the number of ints written
+  return bars_cutoff_low(&sphere_slice, bars, size);
+}
+
+
+void Cell::bars_cutoff(const SphereSliceGeometry& geometry, const double* center,
+    std::vector<int>* bars) const {
+  const size_t old_size = bars->size();
+  bars->resize(old_size + bars_cutoff_size(center, geometry.radius()));
+  size_t size = bars_cutoff(geometry, center, bars->data() + old_size,
+                            bars->size() - old_size);
+  bars->resize(old_size + size);
+}
+
+
+size_t Cell::bars_cutoff(const SphereSliceGeometry& geometry, const double* center,
+    int* bars, size_t size) const {
+  // Check arguments
+  if (nvec_ == 0) {
+    throw std::domain_error("The cell must be at least 1D periodic.");
+  }
+  if (!std::equal(gvecs_, gvecs_ + 9, geometry.normals())) {
+    throw std::domain_error("The geometry must be based on the reciprocal cell vectors.");
+  }
+  if (cuboid()) return bars_cutoff_cuboid(center, geometry.radius(), bars, size);
+  // Only the center-dependent part of the SphereSlice is computed here.
+  SphereSlice sphere_slice(geometry, center);
+  return bars_cutoff_low(&sphere_slice, bars, size);
+}
+
+
+void Cell::bars_cutoff_pruned(const double* center, const double cutoff,
+    std::vector<int>* bars) const {
+  const size_t old_size = bars->size();
+  bars->resize(old_size + bars_cutoff_size(center, cutoff));
+  size_t size = bars_cutoff_pruned(center, cutoff, bars->data() + old_size,
+                                   bars->size() - old_size);
+  bars->resize(old_size + size);
+}
+
+
+size_t Cell::bars_cutoff_pruned(const double* center, const double cutoff, int* bars,
+    size_t size) const {
+  // Check arguments
+  if (nvec_ == 0) {
+    throw std::domain_error("The cell must be at least 1D periodic.");
+  }
+  if (cutoff <= 0) {
+    throw std::domain_error("cutoff must be strictly positive.");
+  }
+  // The squared Cartesian distance of a relative vector is at least its squared norm
+  // in fractional coordinates, divided by the largest eigenvalue of the metric of the
+  // reciprocal cell vectors. The largest absolute row sum of the metric is an upper
+  // bound for that eigenvalue.
+  double gmetric_max = 0.0;
+  for (int ivec = 0; ivec < nvec_; ++ivec) {
+    double row_sum = 0.0;
+    for (int jvec = 0; jvec < nvec_; ++jvec)
+      row_sum += fabs(vec3::dot(gvecs_ + 3*ivec, gvecs_ + 3*jvec));
+    gmetric_max = std::max(gmetric_max, row_sum);
+  }
+  const double frac_cutoff_sq = cutoff*cutoff*gmetric_max;
+  double frac_center[3];
+  to_frac(center, frac_center);
+  // Squared fractional distance from the center to the slice or bar of the outer loops.
+  double frac_distance_sq[3];
+  frac_distance_sq[0] = 0.0;
+  // Same loops as in bars_cutoff_low, one for each direction except the last.
+  int slice_next[3];
+  int slice_end[3];
+  size_t nint = 0;
+  int ivec = 0;
+  while (true) {
+    // Cells are pruned when they are outside the slab of ranges_cutoff or when the
+    // lower bound on their distance exceeds the cutoff.
+    const double frac_radius = std::min(cutoff/spacings_[ivec],
+        sqrt(std::max(0.0, frac_cutoff_sq - frac_distance_sq[ivec])));
+    int begin = static_cast<int>(floor(frac_center[ivec] - frac_radius));
+    int end = static_cast<int>(ceil(frac_center[ivec] + frac_radius));
+    // Ranges may only become empty due to rounding errors.
+    if (end <= begin) end = begin + 1;
+
+    // Store the current range.
+    if (nint + 2 > size) {
+      throw std::domain_error("The buffer for the bars is too small.");
+    }
+    bars[nint++] = begin;
+    bars[nint++] = end;
+
+    if (ivec < nvec_ - 1) {
+      // Start a new loop over the range of integer fractional coordinates.
+      slice_next[ivec] = begin;
+      slice_end[ivec] = end;
+    } else {
+      // The last direction has no loop, go back to the previous one.
+      --ivec;
+    }
+    // Go back to the first loop that is not finished yet.
+    while ((ivec >= 0) && (slice_next[ivec] >= slice_end[ivec])) --ivec;
+    if (ivec < 0) break;
+    // Fractional distance from the center to the nearest point of the slice.
+    const double frac_distance = std::max(0.0, std::max(
+        slice_next[ivec] - frac_center[ivec], frac_center[ivec] - slice_next[ivec] - 1));
+    frac_distance_sq[ivec + 1] = frac_distance_sq[ivec] + frac_distance*frac_distance;
+    ++slice_next[ivec];
+    ++ivec;
+  }
+  return nint;
+}
+
+
+size_t Cell::bars_cutoff_size(const double* center, const double cutoff) const {
+  if (nvec_ == 0) {
+    throw std::domain_error("The cell must be at least 1D periodic.");
+  }
+  if (cutoff <= 0) {
+    throw std::domain_error("cutoff must be strictly positive.");
+  }
+  double frac_center[3];
+  to_frac(center, frac_center);
+  double frac_radii[3];
+  for (int ivec = 0; ivec < nvec_; ++ivec)
+    frac_radii[ivec] = cutoff/spacings_[ivec];
+  return bars_cutoff_size_low(frac_center, frac_radii);
+}
+
+
+void Cell::bars_cutoff_metric(const double* center, const double* metric,
+    const double cutoff, std::vector<int>* bars) const {
+  const size_t old_size = bars->size();
+  bars->resize(old_size + bars_cutoff_metric_size(center, metric, cutoff));
+  size_t size = bars_cutoff_metric(center, metric, cutoff, bars->data() + old_size,
+                                   bars->size() - old_size);
+  bars->resize(old_size + size);
+}
+
+
+size_t Cell::bars_cutoff_metric(const double* center, const double* metric,
+    const double cutoff, int* bars, size_t size) const {
+  // Check arguments
+  if (nvec_ == 0) {
+    throw std::domain_error("The cell must be at least 1D periodic.");
+  }
+  if (cutoff <= 0) {
+    throw std::domain_error("cutoff must be strictly positive.");
+  }
+  // In the transformed space, the ellipsoid is a sphere, sliced by planes that are no
+  // longer equidistant in Cartesian coordinates but still at integer fractional cuts.
+  double sphere_center[3];
+  double sphere_normals[9];
+  metric_to_sphere(metric, center, gvecs_, sphere_center, sphere_normals);
+  SphereSliceGeometry geometry(sphere_normals, cutoff);
+  SphereSlice sphere_slice(geometry, sphere_center);
+  return bars_cutoff_low(&sphere_slice, bars, size);
+}
+
+
+size_t Cell::bars_cutoff_metric_size(const double* center, const double* metric,
+    const double cutoff) const {
+  if (nvec_ == 0) {
+    throw std::domain_error("The cell must be at least 1D periodic.");
+  }
+  if (cutoff <= 0) {
+    throw std::domain_error("cutoff must be strictly positive.");
+  }
+  double sphere_normals[9];
+  metric_to_sphere(metric, nullptr, gvecs_, nullptr, sphere_normals);
+  double frac_center[3];
+  to_frac(center, frac_center);
+  double frac_radii[3];
+  for (int ivec = 0; ivec < nvec_; ++ivec)
+    frac_radii[ivec] = cutoff*vec3::norm(sphere_normals + 3*ivec);
+  return bars_cutoff_size_low(frac_center, frac_radii);
 }
 
 
@@ -320,27 +590,234 @@ Cell::Cell(const double* vecs, const int nvec, const double* gvecs,
 }
 
 
-void Cell::bars_cutoff_low(SphereSlice* slice, int ivec, std::vector<int>* bars) const {
-  // Use SphereSlice object to solve the hard of problem of finding begin and end.
-  double begin_exact = 0.0;
-  double end_exact = 0.0;
-  slice->solve_range(ivec, &begin_exact, &end_exact);
-  int begin = static_cast<int>(floor(begin_exact));
-  int end = static_cast<int>(ceil(end_exact));
-
-  // Store the current range.
-  bars->push_back(begin);
-  bars->push_back(end);
-  if (ivec < nvec_ - 1) {
-    // If this is not yet the last recursion, iterate over the range of integer
-    // fractional coordinates, and go one recursion deeper in each iteration.
-    for (int i = begin; i < end; ++i) {
-      // Define a slice (two cuts) in the sphere.
-      slice->set_cut_begin_end(ivec, i, i + 1);
-      // Recursive call in which the remaining details of the bar/bars is/are solved.
-      bars_cutoff_low(slice, ivec + 1, bars);
+size_t Cell::bars_cutoff_low(SphereSlice* slice, int* bars, size_t size) const {
+  // Number of slices solved at once with SphereSlice::solve_range_batch.
+  const int kChunk = 32;
+  // State of the nested loops over the slices, one for each direction except the last
+  // two.
+  int slice_next[3];
+  int slice_end[3];
+  size_t nint = 0;
+  int ivec = 0;
+  while (true) {
+    // Use SphereSlice object to solve the hard of problem of finding begin and end.
+    double begin_exact = 0.0;
+    double end_exact = 0.0;
+    slice->solve_range(ivec, &begin_exact, &end_exact);
+    int begin = static_cast<int>(floor(begin_exact));
+    int end = static_cast<int>(ceil(end_exact));
+
+    // Store the current range.
+    if (nint + 2 > size) {
+      throw std::domain_error("The buffer for the bars is too small.");
+    }
+    bars[nint++] = begin;
+    bars[nint++] = end;
+
+    if (ivec < nvec_ - 2) {
+      // Start a new loop over the range of integer fractional coordinates.
+      slice_next[ivec] = begin;
+      slice_end[ivec] = end;
+    } else {
+      if (ivec == nvec_ - 2) {
+        // Solve the ranges of the last direction for all slices at once.
+        if (nint + 2*static_cast<size_t>(end - begin) > size) {
+          throw std::domain_error("The buffer for the bars is too small.");
+        }
+        for (int first = begin; first < end; first += kChunk) {
+          const int nslice = std::min(kChunk, end - first);
+          double cuts[kChunk + 1];
+          double begins_exact[kChunk];
+          double ends_exact[kChunk];
+          for (int icut = 0; icut <= nslice; ++icut) cuts[icut] = first + icut;
+          slice->solve_range_batch(ivec + 1, nslice, cuts, begins_exact, ends_exact);
+          for (int islice = 0; islice < nslice; ++islice) {
+            bars[nint++] = static_cast<int>(floor(begins_exact[islice]));
+            bars[nint++] = static_cast<int>(ceil(ends_exact[islice]));
+          }
+        }
+      }
+      // The last direction has no loop, go back to the previous one.
+      --ivec;
+    }
+    // Go back to the first loop that is not finished yet.
+    while ((ivec >= 0) && (slice_next[ivec] >= slice_end[ivec])) --ivec;
+    if (ivec < 0) break;
+    // Define a slice (two cuts) in the sphere and go one direction deeper.
+    slice->set_cut_begin_end(ivec, slice_next[ivec], slice_next[ivec] + 1);
+    ++slice_next[ivec];
+    ++ivec;
+  }
+  return nint;
+}
+
+
+size_t Cell::bars_cutoff_cuboid(const double* center, const double cutoff, int* bars,
+    size_t size) const {
+  double frac_center[3];
+  to_frac(center, frac_center);
+  // Squared radius of the sphere, the disc in a slice or the line segment in a bar.
+  double radius_sq[3];
+  radius_sq[0] = cutoff*cutoff;
+  // Same loops as in bars_cutoff_low, one for each direction except the last.
+  int slice_next[3];
+  int slice_end[3];
+  size_t nint = 0;
+  int ivec = 0;
+  while (true) {
+    // All cell vectors are orthogonal, so the range follows from the radius.
+    double frac_radius = sqrt(radius_sq[ivec])/spacings_[ivec];
+    int begin = static_cast<int>(floor(frac_center[ivec] - frac_radius));
+    int end = static_cast<int>(ceil(frac_center[ivec] + frac_radius));
+
+    // Store the current range.
+    if (nint + 2 > size) {
+      throw std::domain_error("The buffer for the bars is too small.");
+    }
+    bars[nint++] = begin;
+    bars[nint++] = end;
+
+    if (ivec < nvec_ - 1) {
+      // Start a new loop over the range of integer fractional coordinates.
+      slice_next[ivec] = begin;
+      slice_end[ivec] = end;
+    } else {
+      // The last direction has no loop, go back to the previous one.
+      --ivec;
+    }
+    // Go back to the first loop that is not finished yet.
+    while ((ivec >= 0) && (slice_next[ivec] >= slice_end[ivec])) --ivec;
+    if (ivec < 0) break;
+    // The distance from the center to the nearest point of the slice reduces the
+    // radius in the next direction. Rounding errors may make it slightly negative.
+    const double frac_distance = std::max(0.0, std::max(
+        slice_next[ivec] - frac_center[ivec], frac_center[ivec] - slice_next[ivec] - 1));
+    const double distance = frac_distance*spacings_[ivec];
+    radius_sq[ivec + 1] = std::max(0.0, radius_sq[ivec] - distance*distance);
+    ++slice_next[ivec];
+    ++ivec;
+  }
+  return nint;
+}
+
+
+void Cell::bars_box(const double* origin, const double* edges,
+    std::vector<int>* bars) const {
+  const size_t old_size = bars->size();
+  bars->resize(old_size + bars_box_size(origin, edges));
+  size_t size = bars_box(origin, edges, bars->data() + old_size, bars->size() - old_size);
+  bars->resize(old_size + size);
+}
+
+
+size_t Cell::bars_box(const double* origin, const double* edges, int* bars,
+    size_t size) const {
+  // Check arguments
+  if (nvec_ == 0) {
+    throw std::domain_error("The cell must be at least 1D periodic.");
+  }
+  if (vec3::triple(edges, edges + 3, edges + 6) == 0.0) {
+    throw std::domain_error("The edges of the box must be linearly independent.");
+  }
+  // Box in fractional coordinates
+  double frac_origin[3];
+  to_frac(origin, frac_origin);
+  double frac_edges[9];
+  for (int k = 0; k < 3; ++k)
+    to_frac(edges + 3*k, frac_edges + 3*k);
+  // Same loops as in bars_cutoff_low, one for each direction except the last.
+  int slice_next[3];
+  int slice_end[3];
+  int slices[3]{0, 0, 0};
+  size_t nint = 0;
+  int ivec = 0;
+  while (true) {
+    double begin_exact;
+    double end_exact;
+    if (!box_range(frac_origin, frac_edges, ivec, slices, &begin_exact, &end_exact)) {
+      // Fall back to the range of the whole box.
+      begin_exact = frac_origin[ivec];
+      end_exact = frac_origin[ivec];
+      for (int k = 0; k < 3; ++k) {
+        const double frac_edge = frac_edges[3*k + ivec];
+        if (frac_edge < 0) {
+          begin_exact += frac_edge;
+        } else {
+          end_exact += frac_edge;
+        }
+      }
+    }
+    int begin = static_cast<int>(floor(begin_exact));
+    int end = static_cast<int>(ceil(end_exact));
+    // Ranges may only become empty due to rounding errors.
+    if (end <= begin) end = begin + 1;
+
+    // Store the current range.
+    if (nint + 2 > size) {
+      throw std::domain_error("The buffer for the bars is too small.");
+    }
+    bars[nint++] = begin;
+    bars[nint++] = end;
+
+    if (ivec < nvec_ - 1) {
+      // Start a new loop over the range of integer fractional coordinates.
+      slice_next[ivec] = begin;
+      slice_end[ivec] = end;
+    } else {
+      // The last direction has no loop, go back to the previous one.
+      --ivec;
     }
+    // Go back to the first loop that is not finished yet.
+    while ((ivec >= 0) && (slice_next[ivec] >= slice_end[ivec])) --ivec;
+    if (ivec < 0) break;
+    slices[ivec] = slice_next[ivec];
+    ++slice_next[ivec];
+    ++ivec;
+  }
+  return nint;
+}
+
+
+size_t Cell::bars_box_size(const double* origin, const double* edges) const {
+  if (nvec_ == 0) {
+    throw std::domain_error("The cell must be at least 1D periodic.");
+  }
+  // The fractional extent of the box follows from its corners.
+  double frac_center[3];
+  double frac_radii[3];
+  for (int ivec = 0; ivec < nvec_; ++ivec) {
+    const double* gvec = gvecs_ + 3*ivec;
+    double frac_min = vec3::dot(gvec, origin);
+    double frac_max = frac_min;
+    for (int k = 0; k < 3; ++k) {
+      const double frac_edge = vec3::dot(gvec, edges + 3*k);
+      if (frac_edge < 0) {
+        frac_min += frac_edge;
+      } else {
+        frac_max += frac_edge;
+      }
+    }
+    frac_center[ivec] = 0.5*(frac_min + frac_max);
+    frac_radii[ivec] = 0.5*(frac_max - frac_min);
+  }
+  return bars_cutoff_size_low(frac_center, frac_radii);
+}
+
+
+size_t Cell::bars_cutoff_size_low(const double* frac_center,
+    const double* frac_radii) const {
+  // One (begin, end) pair for the first direction, one pair for each slice along the
+  // first direction, etc. The last direction is not sliced. The number of slices is
+  // taken one larger on both sides for rounding errors.
+  size_t size = 2;
+  size_t nslice = 1;
+  for (int ivec = 0; ivec < nvec_ - 1; ++ivec) {
+    const int begin = static_cast<int>(floor(frac_center[ivec] - frac_radii[ivec]));
+    const int end = static_cast<int>(ceil(frac_center[ivec] + frac_radii[ivec]));
+    nslice *= static_cast<size_t>(end - begin + 2);
+    size += 2*nslice;
   }
+  return size;
 }
 
 
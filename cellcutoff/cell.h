@@ -305,6 +305,123 @@ class Cell {
   void bars_cutoff(const double* center, const double cutoff,
       std::vector<int>* bars) const;
 
+
+  /** @brief
+          Variant of `bars_cutoff` that writes into a buffer provided by the caller.
+
+      @param center
+          A pointer to 3 doubles that specify the center of the cutoff sphere in
+          Cartesian coordinates.
+
+      @param cutoff
+          The cutoff radius.
+
+      @param bars
+          A pointer to `size` ints, to which the bars are written in the same format as
+          for the other `bars_cutoff` method.
+
+      @param size
+          The size of the buffer. When the buffer is too small, an exception of the type
+          `std::domain_error` is raised. A sufficient size is `bars_cutoff_size`.
+
+      @return
+          The number of ints written to the buffer.
+    */
+  size_t bars_cutoff(const double* center, const double cutoff, int* bars,
+      size_t size) const;
+
+
+  /** @brief
+          Variants of `bars_cutoff` for many centers with the same cutoff.
+
+      The geometry is constructed once as `SphereSliceGeometry(cell.gvecs(), cutoff)`
+      and contains everything that does not depend on the center. An exception of the
+      type `std::domain_error` is raised when the geometry was constructed with other
+      normals than the reciprocal cell vectors.
+   */
+  void bars_cutoff(const SphereSliceGeometry& geometry, const double* center,
+      std::vector<int>* bars) const;
+  size_t bars_cutoff(const SphereSliceGeometry& geometry, const double* center,
+      int* bars, size_t size) const;
+
+
+  /** @brief
+          Cheaper but less tight alternative for `bars_cutoff`.
+
+      The cells are taken from the box of `ranges_cutoff` and each cell is pruned with
+      a lower bound on its distance to the center. This bound is computed in
+      fractional coordinates, where every cell is an axis-aligned box, and converted to
+      a Cartesian distance with the metric of the reciprocal cell vectors. For a cubic
+      cell, the bound is exact and the result matches `bars_cutoff`. Otherwise, a few
+      more cells are included, but no SphereSlice object is needed, which pays off for
+      small ratios of cutoff over spacing.
+
+      The arguments and the format of `bars` are the same as for `bars_cutoff`.
+   */
+  void bars_cutoff_pruned(const double* center, const double cutoff,
+      std::vector<int>* bars) const;
+
+  //! Variant of `bars_cutoff_pruned` that writes into a buffer, see `bars_cutoff`.
+  size_t bars_cutoff_pruned(const double* center, const double cutoff, int* bars,
+      size_t size) const;
+
+
+  /** @brief
+          Upper bound on the number of ints written by `bars_cutoff(_pruned)`.
+
+      The bound is derived from the ranges of `ranges_cutoff`, with a margin of one
+      crystal plane on both sides for rounding errors, and is cheap to compute.
+    */
+  size_t bars_cutoff_size(const double* center, const double cutoff) const;
+
+
+  /** @brief
+          Variant of `bars_cutoff` for an ellipsoidal cutoff region.
+
+      The region contains all points x for which `(x - center)^T metric (x - center)`
+      is not larger than `cutoff*cutoff`. The metric is a symmetric positive definite
+      3x3 matrix (row-major), of which only the lower triangle is used. The identity
+      matrix gives the same bars as `bars_cutoff`. The ellipsoid is mapped onto a sphere
+      with `metric_to_sphere`, such that the bars are as tight as for a sphere. An
+      exception of the type `std::domain_error` is raised when the metric is not
+      positive definite.
+
+      The format of `bars` is the same as for `bars_cutoff`.
+   */
+  void bars_cutoff_metric(const double* center, const double* metric,
+      const double cutoff, std::vector<int>* bars) const;
+
+  //! Variant of `bars_cutoff_metric` that writes into a buffer, see `bars_cutoff`.
+  size_t bars_cutoff_metric(const double* center, const double* metric,
+      const double cutoff, int* bars, size_t size) const;
+
+  //! Upper bound on the number of ints written by `bars_cutoff_metric`.
+  size_t bars_cutoff_metric_size(const double* center, const double* metric,
+      const double cutoff) const;
+
+
+  /** @brief
+          Selects the cells inside or intersecting with a box (parallelepiped).
+
+      The box contains all points `origin + t0*edges[0:3] + t1*edges[3:6] +
+      t2*edges[6:9]` with `t0`, `t1` and `t2` in the range `[0, 1]`. For an
+      axis-aligned box, the edges are just multiples of the Cartesian unit vectors. The
+      edges must be linearly independent. Otherwise, an exception of the type
+      `std::domain_error` is raised.
+
+      The format of `bars` is the same as for `bars_cutoff`. The ranges in each slice
+      are tight, i.e. they are derived from the vertices of the intersection of the box
+      with the slice.
+   */
+  void bars_box(const double* origin, const double* edges, std::vector<int>* bars) const;
+
+  //! Variant of `bars_box` that writes into a buffer, see `bars_cutoff`.
+  size_t bars_box(const double* origin, const double* edges, int* bars,
+      size_t size) const;
+
+  //! Upper bound on the number of ints written by `bars_box`.
+  size_t bars_box_size(const double* origin, const double* edges) const;
+
  protected:
   /** @brief
           Constructor that assumes the caller takes care of the consistency of all
@@ -316,18 +433,41 @@ class Cell {
        const double* spacings, const double* gspacings);
 
   /** @brief
-          Low-level functions used by bars_cutoff.
+          Low-level function used by bars_cutoff.
+
+      This method goes through all active cell vectors and divides space along this
+      axis in cells that overlap with the cutoff sphere/circle/line, depending on the
+      dimension at hand. It makes use of the SphereSlice object to find the begin-end
+      range along each cell vector. The ranges along the last cell vector are solved
+      for all slices at once with `SphereSlice::solve_range_batch`. The remaining
+      nested loops over the slices are kept in small arrays instead of a recursion,
+      and the results are written into a buffer of `size` ints. The return value is the
+      number of ints written.
+   */
+  size_t bars_cutoff_low(SphereSlice* slice, int* bars, size_t size) const;
+
+  /** @brief
+          Variant of bars_cutoff_low for cuboid cells.
+
+      When all cell vectors are orthogonal and aligned with the Cartesian axes, the
+      radius of the circle or line segment in each slice follows directly from the
+      distance between the center and the slice. No SphereSlice object is needed.
+   */
+  size_t bars_cutoff_cuboid(const double* center, const double cutoff, int* bars,
+      size_t size) const;
+
+  /** @brief
+          Upper bound on the number of ints in the bars of a region with the given
+          extent along each cell vector.
 
-      TODO. This method may change in future, so I'm not going to try explaining it in
-      detail. This can be fixed after the `sphere_slice` will be completely finalized.
-      (The current implementation sphere_slice and bars_cutoff is good but not optimal.)
+      @param frac_center
+          The center of the region in fractional coordinates.
 
-      This method goes recursively through all active cell vectors and divides space along
-      this axis in cells that overlap with the cutoff sphere/circle/line, depending on
-      the dimension at hand (i.e. the recursion depth). It makes use of the SphereSlice\
-      object to find the begin-end range along each cell vector.
+      @param frac_radii
+          The half widths of the region along each cell vector, in fractional
+          coordinates.
    */
-  void bars_cutoff_low(SphereSlice* slice, int ivec, std::vector<int>* bars) const;
+  size_t bars_cutoff_size_low(const double* frac_center, const double* frac_radii) const;
 
  private:
   double vecs_[9];        //!< cell vectors, one per row, row-major
@@ -0,0 +1,158 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include "cellcutoff/cell_list.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/decomposition.h"
+#include "cellcutoff/iterators.h"
+#include "cellcutoff/vec3.h"
+
+
+namespace cellcutoff {
+
+
+const size_t CellList::kRemoved = std::numeric_limits<size_t>::max();
+
+
+CellList::CellList(const Cell& subcell, const int* shape)
+    : subcell_(subcell.vecs(), subcell.nvec()), shape_{0, 0, 0} {
+  if (subcell.nvec() != 3)
+    throw std::domain_error("A cell list requires a 3D subcell.");
+  if (shape != nullptr)
+    std::copy(shape, shape + 3, shape_);
+}
+
+
+size_t CellList::insert(const double* cart) {
+  size_t ipoint;
+  if (free_.empty()) {
+    ipoint = points_.size();
+    points_.push_back(Point(cart));
+    positions_.push_back(kRemoved);
+  } else {
+    ipoint = free_.back();
+    free_.pop_back();
+    points_[ipoint] = Point(cart);
+  }
+  assign_icell(subcell_, shape_, &points_[ipoint], 1, sizeof(Point));
+  add_to_cell(ipoint);
+  return ipoint;
+}
+
+
+void CellList::remove(size_t ipoint) {
+  if (!contains(ipoint))
+    throw std::domain_error("The point is not in the cell list.");
+  remove_from_cell(ipoint);
+  free_.push_back(ipoint);
+}
+
+
+void CellList::move(size_t ipoint, const double* cart) {
+  if (!contains(ipoint))
+    throw std::domain_error("The point is not in the cell list.");
+  Point moved(cart);
+  assign_icell(subcell_, shape_, &moved, 1, sizeof(Point));
+  const int* icell_old = points_[ipoint].icell_;
+  if (std::equal(moved.icell_, moved.icell_ + 3, icell_old)) {
+    points_[ipoint] = moved;
+  } else {
+    remove_from_cell(ipoint);
+    points_[ipoint] = moved;
+    add_to_cell(ipoint);
+  }
+}
+
+
+const Point& CellList::point(size_t ipoint) const {
+  if (!contains(ipoint))
+    throw std::domain_error("The point is not in the cell list.");
+  return points_[ipoint];
+}
+
+
+const std::vector<size_t>* CellList::cell_points(const int* icell) const {
+  auto it = cells_.find(std::array<int, 3>{icell[0], icell[1], icell[2]});
+  return (it == cells_.end()) ? nullptr : &it->second;
+}
+
+
+void CellList::neighbors(const double* center, double cutoff,
+    std::vector<CellListNeighbor>* neighbors) const {
+  neighbors->clear();
+  std::vector<int> bars;
+  subcell_.bars_cutoff(center, cutoff, &bars);
+  for (BarIterator bit(bars, 3, shape_); bit.busy(); ++bit) {
+    auto it = cells_.find(std::array<int, 3>{bit.icell()[0], bit.icell()[1],
+                                             bit.icell()[2]});
+    if ((it == cells_.end()) || it->second.empty()) continue;
+    // Relative vector from the center to the lower corner of the periodic image.
+    double cell_delta[3];
+    vec3::copy(center, cell_delta);
+    vec3::iscale(cell_delta, -1.0);
+    int translate_icell[3]{bit.coeffs()[0]*shape_[0], bit.coeffs()[1]*shape_[1],
+                           bit.coeffs()[2]*shape_[2]};
+    subcell_.iadd_vec(cell_delta, translate_icell);
+    for (size_t ipoint : it->second) {
+      CellListNeighbor neighbor;
+      neighbor.ipoint = ipoint;
+      vec3::copy(points_[ipoint].cart_, neighbor.delta);
+      vec3::iadd(neighbor.delta, cell_delta);
+      neighbor.distance = vec3::norm(neighbor.delta);
+      if (neighbor.distance <= cutoff)
+        neighbors->push_back(neighbor);
+    }
+  }
+}
+
+
+void CellList::add_to_cell(size_t ipoint) {
+  const int* icell = points_[ipoint].icell_;
+  std::vector<size_t>& cell = cells_[std::array<int, 3>{icell[0], icell[1], icell[2]}];
+  positions_[ipoint] = cell.size();
+  cell.push_back(ipoint);
+}
+
+
+void CellList::remove_from_cell(size_t ipoint) {
+  // Swap with the last point of the same subcell.
+  const int* icell = points_[ipoint].icell_;
+  std::vector<size_t>& cell = cells_.at(std::array<int, 3>{icell[0], icell[1],
+                                                           icell[2]});
+  const size_t position = positions_[ipoint];
+  cell[position] = cell.back();
+  positions_[cell[position]] = position;
+  cell.pop_back();
+  positions_[ipoint] = kRemoved;
+}
+
+
+}  // namespace cellcutoff
+
+// vim: textwidth=90 et ts=2 sw=2
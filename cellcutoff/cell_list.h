@@ -0,0 +1,129 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+/** @file */
+
+
+#ifndef CELLCUTOFF_CELL_LIST_H_
+#define CELLCUTOFF_CELL_LIST_H_
+
+#include <array>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/decomposition.h"
+
+
+namespace cellcutoff {
+
+
+//! A point found by `CellList::neighbors`.
+struct CellListNeighbor {
+  size_t ipoint;     //!< the index of the point in the cell list
+  double delta[3];   //!< relative vector from the center to (an image of) the point
+  double distance;   //!< norm of delta
+};
+
+
+/** @brief
+        Mutable decomposition of points into subcells, for Monte Carlo simulations.
+
+    Unlike the sorted ranges of a `CellMap`, every subcell keeps a small vector of
+    point indexes, and every point knows its position in that vector. Inserting,
+    removing and moving a point are therefore O(1) operations (amortized, and
+    excluding the cost of a hash lookup). Removed indexes are reused by later
+    insertions. Neighborhoods are found with the same bars geometry as `DeltaIterator`.
+ */
+class CellList {
+ public:
+  /** @brief
+          Create an empty cell list.
+
+      @param subcell
+          A 3D subcell, e.g. from `Cell::create_subcell`.
+
+      @param shape
+          The periodic shape, or `nullptr` for a non-periodic system. Points are
+          wrapped into the periodic cell, as in `assign_icell`.
+   */
+  CellList(const Cell& subcell, const int* shape);
+
+  //! Adds a point, returns its index.
+  size_t insert(const double* cart);
+  //! Removes a point. Its index becomes invalid.
+  void remove(size_t ipoint);
+  //! Moves an existing point to new Cartesian coordinates.
+  void move(size_t ipoint, const double* cart);
+
+  //! Returns true if the index refers to a point in the cell list.
+  bool contains(size_t ipoint) const {
+    return (ipoint < positions_.size()) && (positions_[ipoint] != kRemoved);
+  }
+  //! Returns a point, with wrapped Cartesian coordinates and its subcell index.
+  const Point& point(size_t ipoint) const;
+  //! Returns the number of points in the cell list.
+  size_t npoint() const { return points_.size() - free_.size(); }
+  //! Returns an upper bound for all point indexes.
+  size_t capacity() const { return points_.size(); }
+  //! Returns the subcell.
+  const Cell& subcell() const { return subcell_; }
+  //! Returns the periodic shape, all zeros for a non-periodic system.
+  const int* shape() const { return shape_; }
+  //! Returns the indexes of the points in a subcell, `nullptr` if it was never used.
+  const std::vector<size_t>* cell_points(const int* icell) const;
+
+  /** @brief
+          Finds all (periodic images of) points within a cutoff distance of a center.
+
+      @param center
+          The Cartesian coordinates of the center.
+
+      @param cutoff
+          The cutoff distance.
+
+      @param neighbors
+          The neighbors are written to this vector, after clearing it. Points that
+          coincide with the center, e.g. the point for which the neighborhood is
+          computed, are included.
+   */
+  void neighbors(const double* center, double cutoff,
+      std::vector<CellListNeighbor>* neighbors) const;
+
+ private:
+  static const size_t kRemoved;
+  void add_to_cell(size_t ipoint);
+  void remove_from_cell(size_t ipoint);
+
+  Cell subcell_;
+  int shape_[3];
+  std::vector<Point> points_;
+  std::vector<size_t> positions_;  //!< position of each point in its subcell's vector
+  std::vector<size_t> free_;       //!< removed indexes, to be reused
+  std::unordered_map<std::array<int, 3>, std::vector<size_t>, icell_hash> cells_;
+};
+
+
+}  // namespace cellcutoff
+
+
+#endif  // CELLCUTOFF_CELL_LIST_H_
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -0,0 +1,92 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include "cellcutoff/cell_pairs.h"
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/decomposition.h"
+#include "cellcutoff/stencil.h"
+
+
+namespace cellcutoff {
+
+
+template <typename Index>
+std::vector<BasicCellPair<Index>> create_cell_pairs(const Cell& subcell,
+    const int* shape, double cutoff, const BasicCellMap<Index>& cell_map, bool half) {
+  const int no_shape[3]{0, 0, 0};
+  if (shape == nullptr) shape = no_shape;
+  const std::vector<std::array<int, 3>> stencil(create_stencil(subcell, cutoff, half));
+
+  // Loop over the non-empty subcells in the order of the points.
+  std::vector<const typename BasicCellMap<Index>::value_type*> cells;
+  cells.reserve(cell_map.size());
+  for (const auto& kv : cell_map)
+    if (kv.second[0] < kv.second[1]) cells.push_back(&kv);
+  std::sort(cells.begin(), cells.end(), [](
+      const typename BasicCellMap<Index>::value_type* cell0,
+      const typename BasicCellMap<Index>::value_type* cell1) {
+    return cell0->second[0] < cell1->second[0];
+  });
+
+  std::vector<BasicCellPair<Index>> cell_pairs;
+  for (const auto* cell0 : cells) {
+    for (const auto& delta_icell : stencil) {
+      // Find the neighboring subcell and its periodic image.
+      std::array<int, 3> key;
+      int translate_icell[3];
+      BasicCellPair<Index> cell_pair;
+      for (int ivec = 0; ivec < 3; ++ivec) {
+        key[ivec] = robust_wrap(cell0->first[ivec] + delta_icell[ivec], shape[ivec],
+                                &cell_pair.coeffs[ivec]);
+        translate_icell[ivec] = cell_pair.coeffs[ivec]*shape[ivec];
+      }
+      auto it1 = cell_map.find(key);
+      if ((it1 == cell_map.end()) || (it1->second[0] == it1->second[1])) continue;
+      cell_pair.begin0 = cell0->second[0];
+      cell_pair.end0 = cell0->second[1];
+      cell_pair.begin1 = it1->second[0];
+      cell_pair.end1 = it1->second[1];
+      std::fill(cell_pair.translation, cell_pair.translation + 3, 0.0);
+      subcell.iadd_vec(cell_pair.translation, translate_icell);
+      cell_pair.self = (delta_icell == std::array<int, 3>{0, 0, 0});
+      cell_pairs.push_back(cell_pair);
+    }
+  }
+  return cell_pairs;
+}
+
+
+template std::vector<BasicCellPair<size_t>> create_cell_pairs<size_t>(
+    const Cell& subcell, const int* shape, double cutoff,
+    const BasicCellMap<size_t>& cell_map, bool half);
+template std::vector<BasicCellPair<uint32_t>> create_cell_pairs<uint32_t>(
+    const Cell& subcell, const int* shape, double cutoff,
+    const BasicCellMap<uint32_t>& cell_map, bool half);
+
+
+}  // namespace cellcutoff
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -0,0 +1,101 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+/** @file */
+
+
+#ifndef CELLCUTOFF_CELL_PAIRS_H_
+#define CELLCUTOFF_CELL_PAIRS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/decomposition.h"
+
+
+namespace cellcutoff {
+
+
+/** @brief
+        A pair of interacting subcells, as produced by `create_cell_pairs`.
+
+    All points in the first range may interact with all points in the second range,
+    after adding `translation` to the latter. The inner loop over both blocks of points
+    is a dense tile without any further lookups.
+ */
+template <typename Index = size_t>
+struct BasicCellPair {
+  Index begin0;           //!< first point of the first subcell
+  Index end0;             //!< end of the points of the first subcell
+  Index begin1;           //!< first point of the second subcell
+  Index end1;             //!< end of the points of the second subcell
+  double translation[3];  //!< Cartesian vector to be added to the second subcell
+  //! The periodic image of the second subcell, i.e. `translation` in multiples of the
+  //! cell vectors. (These are the divisions computed by `robust_wrap`.)
+  int coeffs[3];
+  //! True if both subcells are the same, without translation. With a half list, only
+  //! pairs with `ipoint0 < ipoint1` must then be considered.
+  bool self;
+};
+
+typedef BasicCellPair<size_t> CellPair;
+typedef BasicCellPair<uint32_t> CellPair32;
+
+
+/** @brief
+        Enumerates all pairs of non-empty subcells that may contain points within a
+        cutoff distance.
+
+    The pairs are derived once from the `create_stencil` of the subcell, instead of
+    computing bars for every point, as a `DeltaIterator` does. This is the preferred
+    way to loop over all pairs of points within a cutoff.
+
+    @param subcell
+        The subcell used by `assign_icell`.
+
+    @param shape
+        The periodic shape used by `assign_icell`, or `nullptr` if not used.
+
+    @param cutoff
+        The cutoff distance.
+
+    @param cell_map
+        The cell map of the points, see `create_cell_map`.
+
+    @param half
+        When true, every pair of (periodic images of) subcells is included once. When
+        false, every subcell is the first one in all of its pairs.
+
+    @return
+        The pairs, sorted by the first point of the first subcell, such that
+        consecutive pairs share the same first subcell.
+ */
+template <typename Index = size_t>
+std::vector<BasicCellPair<Index>> create_cell_pairs(const Cell& subcell,
+    const int* shape, double cutoff, const BasicCellMap<Index>& cell_map, bool half);
+
+
+}  // namespace cellcutoff
+
+
+#endif  // CELLCUTOFF_CELL_PAIRS_H_
+
+// vim: textwidth=90 et ts=2 sw=2
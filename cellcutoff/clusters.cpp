@@ -0,0 +1,197 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include "cellcutoff/clusters.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/cell_pairs.h"
+#include "cellcutoff/decomposition.h"
+#include "cellcutoff/parallel.h"
+#include "cellcutoff/vec3.h"
+
+
+namespace cellcutoff {
+
+
+namespace {
+
+//! Point record with the original index, used for the decomposition.
+struct ClusterPoint {
+  ClusterPoint(const double* cart, size_t index) : point(cart), index(index) {}
+  Point point;
+  size_t index;
+};
+
+typedef std::vector<std::atomic<size_t>> Parents;
+
+//! Finds the root of a point, with lock-free path halving.
+size_t find_root(Parents* parents, size_t ipoint) {
+  size_t iparent;
+  while ((iparent = (*parents)[ipoint].load()) != ipoint) {
+    size_t igrandparent = (*parents)[iparent].load();
+    // Failure is harmless: another thread already shortened the path.
+    (*parents)[ipoint].compare_exchange_weak(iparent, igrandparent);
+    ipoint = igrandparent;
+  }
+  return ipoint;
+}
+
+//! Merges the clusters of two points. The root with the largest index is linked.
+void unite(Parents* parents, size_t ipoint0, size_t ipoint1) {
+  while (true) {
+    ipoint0 = find_root(parents, ipoint0);
+    ipoint1 = find_root(parents, ipoint1);
+    if (ipoint0 == ipoint1) return;
+    if (ipoint0 < ipoint1) std::swap(ipoint0, ipoint1);
+    // Only succeeds if ipoint0 is still a root.
+    size_t expected = ipoint0;
+    if ((*parents)[ipoint0].compare_exchange_strong(expected, ipoint1)) return;
+  }
+}
+
+}  // namespace
+
+
+size_t connected_components(const Cell& cell, const double* carts, size_t npoint,
+    double cutoff, size_t* labels, int* images, size_t nthread) {
+  // Check args
+  if (cutoff <= 0)
+    throw std::domain_error("The cutoff must be strictly positive.");
+  if (npoint == 0) return 0;
+
+  // Decomposition
+  int shape[3];
+  std::unique_ptr<Cell> subcell(cell.create_subcell(cutoff, shape));
+  std::vector<ClusterPoint> points;
+  points.reserve(npoint);
+  for (size_t ipoint = 0; ipoint < npoint; ++ipoint)
+    points.emplace_back(carts + 3*ipoint, ipoint);
+  assign_icell(*subcell, shape, points.data(), npoint, sizeof(ClusterPoint));
+  sort_by_icell(points.data(), npoint, sizeof(ClusterPoint));
+  std::unique_ptr<CellMap> cell_map(
+      create_cell_map(points.data(), npoint, sizeof(ClusterPoint)));
+
+  // Parallel union-find over half a list of subcell pairs.
+  const std::vector<CellPair> cell_pairs(
+      create_cell_pairs(*subcell, shape, cutoff, *cell_map, true));
+  const double cutoff_sq = cutoff*cutoff;
+  Parents parents(npoint);
+  for (size_t ipoint = 0; ipoint < npoint; ++ipoint)
+    parents[ipoint].store(ipoint);
+  parallel_for(cell_pairs.size(), get_nthread(nthread), [&cell_pairs, &points,
+      &parents, cutoff_sq](size_t, size_t icell_pair) {
+    const CellPair& cell_pair = cell_pairs[icell_pair];
+    for (size_t ipoint0 = cell_pair.begin0; ipoint0 < cell_pair.end0; ++ipoint0) {
+      for (size_t ipoint1 = cell_pair.self ? ipoint0 + 1 : cell_pair.begin1;
+           ipoint1 < cell_pair.end1; ++ipoint1) {
+        double delta[3];
+        vec3::delta(points[ipoint0].point.cart_, points[ipoint1].point.cart_, delta);
+        vec3::iadd(delta, cell_pair.translation);
+        if (vec3::normsq(delta) <= cutoff_sq)
+          unite(&parents, ipoint0, ipoint1);
+      }
+    }
+  });
+
+  // Assign labels in order of the original indexes.
+  std::vector<size_t> sorted_indexes(npoint);
+  for (size_t ipoint = 0; ipoint < npoint; ++ipoint)
+    sorted_indexes[points[ipoint].index] = ipoint;
+  std::vector<size_t> root_labels(npoint, std::numeric_limits<size_t>::max());
+  size_t ncluster = 0;
+  for (size_t index = 0; index < npoint; ++index) {
+    size_t root = find_root(&parents, sorted_indexes[index]);
+    if (root_labels[root] == std::numeric_limits<size_t>::max())
+      root_labels[root] = ncluster++;
+    labels[index] = root_labels[root];
+  }
+  if (images == nullptr) return ncluster;
+
+  // Breadth-first search over each cluster to find the periodic images. The image of
+  // a point is expressed in multiples of the cell vectors, relative to its wrapped
+  // position.
+  const std::vector<CellPair> cell_pairs_full(
+      create_cell_pairs(*subcell, shape, cutoff, *cell_map, false));
+  std::vector<std::array<int, 3>> sorted_images(npoint);
+  std::vector<bool> visited(npoint, false);
+  std::deque<size_t> queue;
+  for (size_t index = 0; index < npoint; ++index) {
+    size_t ipoint_first = sorted_indexes[index];
+    if (visited[ipoint_first]) continue;
+    visited[ipoint_first] = true;
+    sorted_images[ipoint_first] = std::array<int, 3>{0, 0, 0};
+    queue.push_back(ipoint_first);
+    while (!queue.empty()) {
+      size_t ipoint0 = queue.front();
+      queue.pop_front();
+      // The pairs of the subcell of ipoint0 are consecutive.
+      auto it_pair = std::upper_bound(cell_pairs_full.begin(), cell_pairs_full.end(),
+          ipoint0, [](size_t ipoint, const CellPair& cell_pair) {
+        return ipoint < cell_pair.begin0;
+      });
+      while ((it_pair != cell_pairs_full.begin()) && ((it_pair - 1)->end0 > ipoint0)) {
+        const CellPair& cell_pair = *(--it_pair);
+        for (size_t ipoint1 = cell_pair.begin1; ipoint1 < cell_pair.end1; ++ipoint1) {
+          if (visited[ipoint1]) continue;
+          double delta[3];
+          vec3::delta(points[ipoint0].point.cart_, points[ipoint1].point.cart_, delta);
+          vec3::iadd(delta, cell_pair.translation);
+          if (vec3::normsq(delta) > cutoff_sq) continue;
+          visited[ipoint1] = true;
+          for (int ivec = 0; ivec < 3; ++ivec) {
+            sorted_images[ipoint1][ivec] = sorted_images[ipoint0][ivec] +
+                                           cell_pair.coeffs[ivec];
+          }
+          queue.push_back(ipoint1);
+        }
+      }
+    }
+  }
+
+  // Correct for the wrapping of the points by assign_icell.
+  for (size_t ipoint = 0; ipoint < npoint; ++ipoint) {
+    const size_t index = points[ipoint].index;
+    double delta[3];
+    vec3::delta(points[ipoint].point.cart_, carts + 3*index, delta);
+    double frac[3];
+    cell.to_frac(delta, frac);
+    for (int ivec = 0; ivec < 3; ++ivec) {
+      int wrap = (ivec < cell.nvec()) ? static_cast<int>(round(frac[ivec])) : 0;
+      images[3*index + ivec] = sorted_images[ipoint][ivec] - wrap;
+    }
+  }
+  return ncluster;
+}
+
+
+}  // namespace cellcutoff
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -0,0 +1,83 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+/** @file */
+
+
+#ifndef CELLCUTOFF_CLUSTERS_H_
+#define CELLCUTOFF_CLUSTERS_H_
+
+#include <cstddef>
+
+#include "cellcutoff/cell.h"
+
+
+namespace cellcutoff {
+
+
+/** @brief
+        Finds clusters of points connected by distances up to a cutoff.
+
+    The points are decomposed with `assign_icell`, `sort_by_icell` and
+    `create_cell_map`, using a subcell with spacings up to the cutoff. Pairs of nearby
+    points are found with a half list of subcell pairs (see `create_cell_pairs`), such
+    that each pair of subcells is processed once. The subcell pairs are distributed over
+    threads, which merge clusters with a lock-free union-find.
+
+    @param cell
+        The periodic cell, may be 0D, 1D, 2D or 3D.
+
+    @param carts
+        Cartesian coordinates of the points, `3*npoint` doubles.
+
+    @param npoint
+        The number of points.
+
+    @param cutoff
+        Two points are connected when their distance, including periodic images, is
+        less than or equal to this value. Must be strictly positive.
+
+    @param labels
+        Output array with `npoint` cluster labels. Clusters are numbered from zero, in
+        order of their first point.
+
+    @param images
+        Output array with `3*npoint` integers, or `nullptr` if not needed. Adding
+        `images[3*ipoint + ivec]` times the cell vector `ivec` to each point gives
+        unwrapped clusters, in which connected points are also close without periodic
+        images. (This is only possible for clusters that do not percolate through the
+        periodic boundaries. For percolating clusters, a spanning tree is unwrapped.)
+        The images are derived from a serial breadth-first search over each cluster.
+
+    @param nthread
+        The number of threads for the union-find, zero means all hardware threads.
+
+    @return
+        The number of clusters.
+ */
+size_t connected_components(const Cell& cell, const double* carts, size_t npoint,
+    double cutoff, size_t* labels, int* images, size_t nthread);
+
+
+}  // namespace cellcutoff
+
+
+#endif  // CELLCUTOFF_CLUSTERS_H_
+
+// vim: textwidth=90 et ts=2 sw=2
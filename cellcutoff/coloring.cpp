@@ -0,0 +1,85 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include "cellcutoff/coloring.h"
+
+#include <stdexcept>
+
+#include "cellcutoff/decomposition.h"
+
+
+namespace cellcutoff {
+
+
+Coloring::Coloring(const int* shape, const int* radius) {
+  for (int ivec = 0; ivec < 3; ++ivec) {
+    shape_[ivec] = (shape == nullptr) ? 0 : shape[ivec];
+    radius_[ivec] = radius[ivec];
+    if (radius_[ivec] < 0)
+      throw std::domain_error("The radius must not be negative.");
+    if (shape_[ivec] < 0)
+      throw std::domain_error("The shape must not be negative.");
+    const int period = 2*radius_[ivec] + 1;
+    nlarge_[ivec] = 0;
+    if (shape_[ivec] == 0) {
+      // Non-periodic: plain modulus.
+      ncolors_[ivec] = period;
+    } else {
+      const int nblock = shape_[ivec]/period;
+      if (nblock < 2) {
+        // Small shape: all subcells along this direction are too close.
+        ncolors_[ivec] = shape_[ivec];
+      } else {
+        // Blocks of size ncolors_ (the first nlarge_) or ncolors_ - 1 (the others).
+        nlarge_[ivec] = shape_[ivec] % nblock;
+        ncolors_[ivec] = shape_[ivec]/nblock + (nlarge_[ivec] > 0);
+      }
+    }
+  }
+}
+
+
+int Coloring::color(const int* icell) const {
+  int result = 0;
+  for (int ivec = 0; ivec < 3; ++ivec) {
+    int color_vec;
+    if (shape_[ivec] == 0) {
+      color_vec = robust_wrap(icell[ivec], ncolors_[ivec]);
+    } else {
+      const int index = robust_wrap(icell[ivec], shape_[ivec]);
+      const int nlarge_cells = nlarge_[ivec]*ncolors_[ivec];
+      if (index < nlarge_cells) {
+        color_vec = index % ncolors_[ivec];
+      } else {
+        // In the small blocks, or in the only block when nlarge_ == 0.
+        const int nsmall = (nlarge_[ivec] > 0) ? ncolors_[ivec] - 1 : ncolors_[ivec];
+        color_vec = (index - nlarge_cells) % nsmall;
+      }
+    }
+    result = result*ncolors_[ivec] + color_vec;
+  }
+  return result;
+}
+
+
+}  // namespace cellcutoff
+
+// vim: textwidth=90 et ts=2 sw=2
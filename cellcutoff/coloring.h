@@ -0,0 +1,127 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+/** @file */
+
+
+#ifndef CELLCUTOFF_COLORING_H_
+#define CELLCUTOFF_COLORING_H_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#include "cellcutoff/decomposition.h"
+#include "cellcutoff/parallel.h"
+
+
+namespace cellcutoff {
+
+
+/** @brief
+        Coloring of subcells, such that subcells of the same color can be processed
+        concurrently.
+
+    A task for one subcell may write to all subcells whose (wrapped) indexes differ by
+    at most `radius` along each direction, e.g. when accumulating forces with a half
+    stencil. Two subcells of the same color are always more than `2*radius` subcells
+    apart along at least one direction, taking into account the periodic wrap, such
+    that their tasks never write to the same subcell.
+
+    Along a non-periodic direction, the color is the index modulo `2*radius + 1`.
+    Along a periodic direction with shape `n`, the subcells are divided into
+    `k = n/(2*radius + 1)` contiguous blocks of nearly equal size and the color is the
+    position within the block. When `k < 2`, no two subcells along this direction can
+    share a color.
+ */
+class Coloring {
+ public:
+  /** @brief
+          Create a coloring.
+
+      @param shape
+          The periodic shape used by `assign_icell`, or `nullptr` if not used.
+
+      @param radius
+          The maximum absolute relative subcell index along each direction to which a
+          task may write, e.g. computed with `stencil_radius`.
+   */
+  Coloring(const int* shape, const int* radius);
+
+  //! Total number of colors.
+  int ncolor() const { return ncolors_[0]*ncolors_[1]*ncolors_[2]; }
+  //! Number of colors along each direction.
+  const int* ncolors() const { return ncolors_; }
+  //! The color of a subcell, in the range `[0, ncolor()[`.
+  int color(const int* icell) const;
+
+ private:
+  int shape_[3];
+  int radius_[3];
+  int ncolors_[3];
+  int nlarge_[3];  //!< number of blocks with one more subcell
+};
+
+
+/** @brief
+        Calls `function(ithread, cell)` for all subcells, one color at a time.
+
+    The subcells of one color are distributed over threads with `parallel_for`. All
+    threads are joined before continuing with the next color, so tasks of different
+    colors never run concurrently. Within a color, the subcells are visited in order of
+    their points.
+
+    @param coloring
+        The coloring of the subcells.
+
+    @param cell_map
+        The cell map of the points, see `create_cell_map`. Each `cell` passed to the
+        function is an element of this map.
+
+    @param nthread
+        The number of threads, see `get_nthread`.
+ */
+template <typename Index, typename Function>
+void parallel_for_colors(const Coloring& coloring, const BasicCellMap<Index>& cell_map,
+    size_t nthread, Function function) {
+  typedef typename BasicCellMap<Index>::value_type CellType;
+  std::vector<std::vector<const CellType*>> color_cells(coloring.ncolor());
+  for (const auto& kv : cell_map)
+    color_cells[coloring.color(kv.first.data())].push_back(&kv);
+  nthread = get_nthread(nthread);
+  for (auto& cells : color_cells) {
+    std::sort(cells.begin(), cells.end(), [](const CellType* cell0,
+        const CellType* cell1) {
+      return cell0->second[0] < cell1->second[0];
+    });
+    parallel_for(cells.size(), nthread, [&cells, &function](size_t ithread,
+        size_t icell) {
+      function(ithread, *cells[icell]);
+    });
+  }
+}
+
+
+}  // namespace cellcutoff
+
+
+#endif  // CELLCUTOFF_COLORING_H_
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -24,6 +24,7 @@
 #include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <limits>
 #include <vector>
 
 #include "cellcutoff/cell.h"
@@ -33,19 +34,26 @@
 namespace cellcutoff {
 
 
-Point::Point(const double* cart) {
-  std::copy(cart, cart + 3, cart_);
+template <typename Real>
+BasicPoint<Real>::BasicPoint(const double* cart) {
+  cart_[0] = static_cast<Real>(cart[0]);
+  cart_[1] = static_cast<Real>(cart[1]);
+  cart_[2] = static_cast<Real>(cart[2]);
   std::fill(icell_, icell_ + 3, 0);
 }
 
 
-Point::Point(const double* cart, const int* icell) {
-  std::copy(cart, cart + 3, cart_);
+template <typename Real>
+BasicPoint<Real>::BasicPoint(const double* cart, const int* icell) {
+  cart_[0] = static_cast<Real>(cart[0]);
+  cart_[1] = static_cast<Real>(cart[1]);
+  cart_[2] = static_cast<Real>(cart[2]);
   std::copy(icell, icell + 3, icell_);
 }
 
 
-bool Point::operator<(const Point& other) const {
+template <typename Real>
+bool BasicPoint<Real>::operator<(const BasicPoint& other) const {
   // Lexicographical less than (equivalent to std::lexicographical_compare but faster)
   if (icell_[0] < other.icell_[0]) return true;
   if (icell_[0] > other.icell_[0]) return false;
@@ -56,6 +64,11 @@ bool Point::operator<(const Point& other) const {
 }
 
 
+template class BasicPoint<double>;
+template class BasicPoint<float>;
+
+
+template <typename PointType>
 void assign_icell(const Cell &subcell, void* points, size_t npoint, size_t point_size) {
   // Check args
   if (!(subcell.nvec() == 3))
@@ -63,9 +76,10 @@ void assign_icell(const Cell &subcell, void* points, size_t npoint, size_t point
   // Loop over all points, compute icell
   char* points_char = reinterpret_cast<char*>(points);  // Ugly sweet hack
   for (size_t ipoint = 0; ipoint < npoint; ++ipoint) {
-    Point* point(reinterpret_cast<Point*>(points_char));  // Ugly sweet hack
+    PointType* point(reinterpret_cast<PointType*>(points_char));  // Ugly sweet hack
+    double cart[3]{point->cart_[0], point->cart_[1], point->cart_[2]};
     double frac[3];
-    subcell.to_frac(point->cart_, frac);
+    subcell.to_frac(cart, frac);
     point->icell_[0] = static_cast<int>(floor(frac[0]));
     point->icell_[1] = static_cast<int>(floor(frac[1]));
     point->icell_[2] = static_cast<int>(floor(frac[2]));
@@ -74,32 +88,40 @@ void assign_icell(const Cell &subcell, void* points, size_t npoint, size_t point
 }
 
 
+template <typename PointType>
 void assign_icell(const Cell &subcell, const int* shape, void* points, size_t npoint,
     size_t point_size) {
+  typedef typename PointType::real_type Real;
   // Check args
   if (!(subcell.nvec() == 3))
     throw std::domain_error("Partitioning is only sensible for 3D subcells.");
   // Loop over all points, compute icell and wrap if needed
   char* points_char = reinterpret_cast<char*>(points);  // Ugly sweet hack
   for (size_t ipoint = 0; ipoint < npoint; ++ipoint) {
-    Point* point(reinterpret_cast<Point*>(points_char));  // Ugly sweet hack
+    PointType* point(reinterpret_cast<PointType*>(points_char));  // Ugly sweet hack
+    // The wrapping is always done in double precision.
+    double cart[3]{point->cart_[0], point->cart_[1], point->cart_[2]};
     double frac[3];
-    subcell.to_frac(point->cart_, frac);
+    subcell.to_frac(cart, frac);
     for (int ivec = 0; ivec < 3; ++ivec) {
       // Compute floored fractional coordinate, optionally wrapped.
       int i = static_cast<int>(floor(frac[ivec]));
       point->icell_[ivec] = robust_wrap(i, shape[ivec]);
       // Wrap point into box
-      vec3::iadd(point->cart_, subcell.vec(ivec), point->icell_[ivec]-i);
+      vec3::iadd(cart, subcell.vec(ivec), point->icell_[ivec]-i);
     }
+    point->cart_[0] = static_cast<Real>(cart[0]);
+    point->cart_[1] = static_cast<Real>(cart[1]);
+    point->cart_[2] = static_cast<Real>(cart[2]);
     points_char += point_size;
   }
 }
 
 
+template <typename PointType>
 static int cmp_points(const void *a, const void* b) {
-  const Point* pa(reinterpret_cast<const Point*>(a));  // Ugly sweet hack
-  const Point* pb(reinterpret_cast<const Point*>(b));  // Ugly sweet hack
+  const PointType* pa(reinterpret_cast<const PointType*>(a));  // Ugly sweet hack
+  const PointType* pb(reinterpret_cast<const PointType*>(b));  // Ugly sweet hack
   // Lexicographical comparison
   int result = pa->icell_[0] - pb->icell_[0];
   if (result != 0) return result;
@@ -109,17 +131,19 @@ static int cmp_points(const void *a, const void* b) {
 }
 
 
+template <typename PointType>
 void sort_by_icell(void* points, size_t npoint, size_t point_size) {
-  qsort(points, npoint, point_size, cmp_points);
+  qsort(points, npoint, point_size, cmp_points<PointType>);
 }
 
 
+template <typename Index>
 static inline void _store_in_cell_map(const int* icell, size_t ibegin, size_t iend,
-    CellMap* cell_map) {
+    BasicCellMap<Index>* cell_map) {
   // Try to store the new range in the cell_map
   auto emplace_output = cell_map->emplace(
     std::array<int, 3>{icell[0], icell[1], icell[2]},
-    std::array<size_t, 2>{ibegin, iend});
+    std::array<Index, 2>{static_cast<Index>(ibegin), static_cast<Index>(iend)});
   // If the is already present, the input for create_cell_map was incorrect.
   if (!emplace_output.second) {
     delete cell_map;
@@ -128,14 +152,20 @@ static inline void _store_in_cell_map(const int* icell, size_t ibegin, size_t ie
 }
 
 
-CellMap* create_cell_map(const void* points, size_t npoint, size_t point_size) {
-  auto cell_map(new CellMap);
+template <typename PointType, typename Index>
+BasicCellMap<Index>* create_cell_map(const void* points, size_t npoint,
+    size_t point_size) {
+  // Check args
+  if (npoint > std::numeric_limits<Index>::max())
+    throw std::domain_error("Too many points for the index type of the cell map.");
+  auto cell_map(new BasicCellMap<Index>);
   const char* points_char = reinterpret_cast<const char*>(points);  // Ugly sweet hack
-  const Point* point(reinterpret_cast<const Point*>(points_char));  // Ugly sweet hack
+  // Ugly sweet hack
+  const PointType* point(reinterpret_cast<const PointType*>(points_char));
   const int* icell_begin = point->icell_;
   size_t ibegin = 0;
   for (size_t ipoint = 0; ipoint < npoint; ++ipoint) {
-    point = reinterpret_cast<const Point*>(points_char);  // Ugly sweet hack
+    point = reinterpret_cast<const PointType*>(points_char);  // Ugly sweet hack
     if ((icell_begin[0] != point->icell_[0]) ||
         (icell_begin[1] != point->icell_[1]) ||
         (icell_begin[2] != point->icell_[2])) {
@@ -153,6 +183,26 @@ CellMap* create_cell_map(const void* points, size_t npoint, size_t point_size) {
 }
 
 
+template void assign_icell<Point>(const Cell &subcell, void* points, size_t npoint,
+    size_t point_size);
+template void assign_icell<PointF>(const Cell &subcell, void* points, size_t npoint,
+    size_t point_size);
+template void assign_icell<Point>(const Cell &subcell, const int* shape, void* points,
+    size_t npoint, size_t point_size);
+template void assign_icell<PointF>(const Cell &subcell, const int* shape, void* points,
+    size_t npoint, size_t point_size);
+template void sort_by_icell<Point>(void* points, size_t npoint, size_t point_size);
+template void sort_by_icell<PointF>(void* points, size_t npoint, size_t point_size);
+template CellMap* create_cell_map<Point, size_t>(const void* points, size_t npoint,
+    size_t point_size);
+template CellMap* create_cell_map<PointF, size_t>(const void* points, size_t npoint,
+    size_t point_size);
+template CellMap32* create_cell_map<Point, uint32_t>(const void* points, size_t npoint,
+    size_t point_size);
+template CellMap32* create_cell_map<PointF, uint32_t>(const void* points, size_t npoint,
+    size_t point_size);
+
+
 }  // namespace cellcutoff
 
 // vim: textwidth=90 et ts=2 sw=2
@@ -24,6 +24,8 @@
 #ifndef CELLCUTOFF_DECOMPOSITION_H_
 #define CELLCUTOFF_DECOMPOSITION_H_
 
+#include <array>
+#include <cstdint>
 #include <vector>
 #include <unordered_map>
 #include <string>
@@ -44,16 +46,30 @@ class points_not_grouped : public std::domain_error {
 };
 
 
-class Point {
+/** @brief
+        A point with Cartesian coordinates and the index of the cell it belongs to.
+
+    The floating point type of the Cartesian coordinates is a template parameter. The
+    single precision version, `PointF`, halves the memory bandwidth of neighbor sweeps.
+    All functions that accept points through a `void*` and a `point_size` have a
+    template parameter for the point type, which defaults to `Point`.
+ */
+template <typename Real>
+class BasicPoint {
  public:
-  explicit Point(const double* cart);
-  Point(const double* cart, const int* icell);
-  bool operator<(const Point& other) const;
+  typedef Real real_type;
 
-  double cart_[3];
+  explicit BasicPoint(const double* cart);
+  BasicPoint(const double* cart, const int* icell);
+  bool operator<(const BasicPoint& other) const;
+
+  Real cart_[3];
   int icell_[3];
 };
 
+typedef BasicPoint<double> Point;
+typedef BasicPoint<float> PointF;
+
 
 // A typedef for cell_map objects
 struct icell_hash {
@@ -67,18 +83,38 @@ struct icell_hash {
     return (((d0-3)*(d0-2)*(d0-1))/6 + ((d1-2)*(d1-1))/2 + (x-1))*8 + small;
   }
 };
-typedef std::unordered_map<std::array<int, 3>, std::array<size_t, 2>, icell_hash> CellMap;
+
+/** @brief
+        A mapping from cell indices to the range of points in that cell.
+
+    Each cell stores a half-open range `[begin, end[` of point indexes. The index type
+    of the ranges is a template parameter. `CellMap32` is sufficient for less than 2^32
+    points and halves the size of the ranges themselves, not of the whole map: the keys
+    and the node overhead of the hash map are unchanged. Offset-only ranges, with the
+    end of a cell taken from the begin of the next one, are not used because cells have
+    no successor in a hash map.
+ */
+template <typename Index>
+using BasicCellMap = std::unordered_map<std::array<int, 3>, std::array<Index, 2>,
+                                        icell_hash>;
+typedef BasicCellMap<size_t> CellMap;
+typedef BasicCellMap<uint32_t> CellMap32;
 
 //! Assigns all cell indexes
+template <typename PointType = Point>
 void assign_icell(const Cell &subcell, void* points, size_t npoint, size_t point_size);
+template <typename PointType = Point>
 void assign_icell(const Cell &subcell, const int* shape, void* points, size_t npoint,
     size_t point_size);
 
 //! Sort function for Point array
+template <typename PointType = Point>
 void sort_by_icell(void* points, size_t npoint, size_t point_size);
 
 //! Create a mapping from cell indices to a list of points
-CellMap* create_cell_map(const void* points, size_t npoint, size_t point_size);
+template <typename PointType = Point, typename Index = size_t>
+BasicCellMap<Index>* create_cell_map(const void* points, size_t npoint,
+    size_t point_size);
 
 //! Safe modulus operation with compatible division
 inline int robust_wrap(int index, const int size, int* division) {
@@ -0,0 +1,72 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include "cellcutoff/ewald.h"
+
+#include <cmath>
+#include <stdexcept>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/pair.h"
+
+
+namespace cellcutoff {
+
+
+namespace {
+
+//! The erfc-screened Coulomb interaction, as a functor for `pair_potential`.
+class EwaldPotential {
+ public:
+  EwaldPotential(const double* charges, double alpha)
+      : charges_(charges), alpha_(alpha), prefactor_(2.0*alpha/sqrt(M_PI)) {}
+
+  double operator()(size_t ipoint0, size_t ipoint1, double distance_sq,
+      double* dvdr) const {
+    const double distance = sqrt(distance_sq);
+    const double qq = charges_[ipoint0]*charges_[ipoint1];
+    const double energy = qq*erfc(alpha_*distance)/distance;
+    *dvdr = -(energy + qq*prefactor_*exp(-alpha_*alpha_*distance_sq))/distance;
+    return energy;
+  }
+
+ private:
+  const double* charges_;
+  double alpha_;
+  double prefactor_;
+};
+
+}  // namespace
+
+
+double ewald_real_space(const Cell& cell, const double* carts, const double* charges,
+    size_t npoint, double alpha, double cutoff, double* forces, double* virial,
+    size_t nthread) {
+  if (alpha <= 0)
+    throw std::domain_error("alpha must be strictly positive.");
+  return pair_potential(cell, carts, npoint, cutoff, EwaldPotential(charges, alpha),
+                        forces, virial, nthread);
+}
+
+
+}  // namespace cellcutoff
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -0,0 +1,86 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+/** @file */
+
+
+#ifndef CELLCUTOFF_EWALD_H_
+#define CELLCUTOFF_EWALD_H_
+
+#include <cstddef>
+
+#include "cellcutoff/cell.h"
+
+
+namespace cellcutoff {
+
+
+/** @brief
+        Computes the real-space part of the Ewald sum of point charges.
+
+    The energy is the sum over all pairs of (periodic images of) points within the
+    cutoff distance of `q_i q_j erfc(alpha r)/r`, excluding the interaction of a point
+    with itself. This is a thin wrapper around `pair_potential`, which explains how
+    the pairs are distributed over threads.
+
+    @param cell
+        The periodic cell, may be 0D, 1D, 2D or 3D.
+
+    @param carts
+        Cartesian coordinates of the points, `3*npoint` doubles.
+
+    @param charges
+        The charges of the points, `npoint` doubles.
+
+    @param npoint
+        The number of points.
+
+    @param alpha
+        The Ewald splitting parameter, must be strictly positive.
+
+    @param cutoff
+        The real-space cutoff, must be strictly positive.
+
+    @param forces
+        Output array with `3*npoint` doubles for the forces, i.e. minus the gradient of
+        the energy, or `nullptr` if not needed.
+
+    @param virial
+        Output array with 9 doubles for the virial tensor, or `nullptr` if not needed.
+        This is the sum over all pairs of the outer product of the relative vector (from
+        the first to the second point) with the force on the second point, which is
+        also minus the derivative of the energy with respect to a homogeneous strain.
+
+    @param nthread
+        The number of threads, zero means all hardware threads.
+
+    @return
+        The real-space energy.
+ */
+double ewald_real_space(const Cell& cell, const double* carts, const double* charges,
+    size_t npoint, double alpha, double cutoff, double* forces, double* virial,
+    size_t nthread);
+
+
+}  // namespace cellcutoff
+
+
+#endif  // CELLCUTOFF_EWALD_H_
+
+// vim: textwidth=90 et ts=2 sw=2
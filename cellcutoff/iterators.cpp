@@ -22,11 +22,13 @@
 #include "cellcutoff/iterators.h"
 
 #include <algorithm>
+#include <cmath>
 #include <stdexcept>
 #include <vector>
 
 #include "cellcutoff/cell.h"
 #include "cellcutoff/decomposition.h"
+#include "cellcutoff/sphere_slice.h"
 #include "cellcutoff/vec3.h"
 
 
@@ -115,15 +117,31 @@ void BarIterator::increment(const int ivec) {
 }
 
 
-// DeltaIterator
+void BarIterator::jump(const int icell_last) {
+  const int ivec = nvec_ - 1;
+  if (icell_last < icell_unwrapped_[ivec])
+    throw std::logic_error("BarIterator cannot jump backwards.");
+  if (icell_last >= ranges_end_[ivec]) {
+    // Let increment take care of moving to the next bar.
+    icell_unwrapped_[ivec] = ranges_end_[ivec] - 1;
+    increment(ivec);
+  } else {
+    icell_unwrapped_[ivec] = icell_last;
+    icell_[ivec] = robust_wrap(icell_last, shape_[ivec], &coeffs_[ivec]);
+  }
+}
+
 
-DeltaIterator::DeltaIterator(const Cell& subcell, const int* shape, const double* center,
-    const double cutoff, const void* points, const size_t npoint, const size_t point_size,
-    const CellMap& cell_map)
+// CellWalker
+
+template <typename PointType, typename Index>
+BasicCellWalker<PointType, Index>::BasicCellWalker(const Cell& subcell, const int* shape,
+    const double* origin, const std::vector<int>& bars, const void* points,
+    const size_t npoint, const size_t point_size, const BasicCellMap<Index>& cell_map)
     : subcell_(subcell),
       shape_(nullptr),
-      center_{center[0], center[1], center[2]},
-      cutoff_(cutoff),
+      origin_{origin[0], origin[1], origin[2]},
+      bars_(bars),
       points_char_(reinterpret_cast<const char*>(points)),
       npoint_(npoint),
       point_size_(point_size),
@@ -131,12 +149,9 @@ DeltaIterator::DeltaIterator(const Cell& subcell, const int* shape, const double
       bar_iterator_(nullptr),
       point_(nullptr),
       cell_delta_{NAN, NAN, NAN},
-      delta_{NAN, NAN, NAN},
-      distance_(NAN),
+      initialization_(true),
       ipoint_(0),
-      ibegin_(1),
       iend_(1) {
-
   int nvec = subcell_.nvec();
   shape_ = new int[nvec];
   // Initialize shape
@@ -146,90 +161,993 @@ DeltaIterator::DeltaIterator(const Cell& subcell, const int* shape, const double
     std::copy(shape, shape + nvec, shape_);
   }
   // Set up the bar_iterator_
-  subcell_.bars_cutoff(center_, cutoff_, &bars_);
   bar_iterator_ = new BarIterator(bars_, nvec, shape_);
-  // Prepare first iteration
-  increment(true);
 }
 
 
-DeltaIterator::~DeltaIterator() {
+template <typename PointType, typename Index>
+BasicCellWalker<PointType, Index>::~BasicCellWalker() {
   if (shape_ != nullptr) delete[] shape_;
   if (bar_iterator_ != nullptr) delete bar_iterator_;
 }
 
 
-DeltaIterator& DeltaIterator::operator++() {
-  increment(false);
+template <typename PointType, typename Index>
+template <typename Skip>
+void BasicCellWalker<PointType, Index>::next(Skip skip) {
+  // Just move one point further
+  ++ipoint_;
+  // If we moved past the last point in the cell, then do the outer loop
+  if (ipoint_ == iend_) {
+    do {
+      // Move to the next cell, if any
+      if (!initialization_) {
+        ++(*bar_iterator_);
+      } else {
+        initialization_ = false;
+      }
+      skip();
+      // Check if there is a next cell.
+      if (!bar_iterator_->busy()) {
+        point_ = nullptr;
+        return;
+      }
+      // Take all relevant data from bar_iterator_ and cell_map_.
+      // - the cell index
+      std::array<int, 3> key{
+        bar_iterator_->icell()[0],
+        bar_iterator_->icell()[1],
+        bar_iterator_->icell()[2]};
+      // - the next range of points, if any. If the next range of points is not in
+      //   cell_map_, the while loop will try the next cell.
+      auto it = cell_map_.find(key);
+      if (it != cell_map_.end()) {
+        // The range points + reset ipoint_ to the beginning if that range
+        ipoint_ = it->second[0];
+        iend_ = it->second[1];
+      }
+    } while (ipoint_ == iend_);
+    // When we get here, a new cell with some points is found.
+    // Compute the relative vector of the origin to the lower corner of the periodic
+    // cell. (This is called the cell_delta_ vector, as it is, for a given cell, a
+    // constant part of the relative vector from origin to a point within a given cell.)
+    cell_delta_[0] = -origin_[0];
+    cell_delta_[1] = -origin_[1];
+    cell_delta_[2] = -origin_[2];
+    int translate_icell[3]{
+      bar_iterator_->coeffs()[0]*shape_[0],
+      bar_iterator_->coeffs()[1]*shape_[1],
+      bar_iterator_->coeffs()[2]*shape_[2],
+    };
+    subcell_.iadd_vec(cell_delta_, translate_icell);
+  }
+  point_ = reinterpret_cast<const PointType*>(points_char_ + ipoint_*point_size_);
+}
+
+
+template <typename PointType, typename Index>
+void BasicCellWalker<PointType, Index>::next() {
+  next([]() {});
+}
+
+
+template <typename PointType, typename Index>
+void BasicCellWalker<PointType, Index>::delta(double* delta) const {
+  // The sum is computed in double precision, such that a large translation is not
+  // rounded to the precision of the point first.
+  delta[0] = point_->cart_[0] + cell_delta_[0];
+  delta[1] = point_->cart_[1] + cell_delta_[1];
+  delta[2] = point_->cart_[2] + cell_delta_[2];
+}
+
+
+template class BasicCellWalker<Point, size_t>;
+template class BasicCellWalker<PointF, size_t>;
+template class BasicCellWalker<Point, uint32_t>;
+template class BasicCellWalker<PointF, uint32_t>;
+
+
+// DeltaIterator
+
+template <typename PointType, typename Index>
+BasicDeltaIterator<PointType, Index>::BasicDeltaIterator(const Cell& subcell,
+    const int* shape, const double* center, const double* metric, const double cutoff,
+    const void* points, const size_t npoint, const size_t point_size,
+    const BasicCellMap<Index>& cell_map)
+    : has_metric_(metric != nullptr),
+      metric_{NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN},
+      cutoff_(cutoff),
+      cell_walker_(nullptr),
+      delta_{NAN, NAN, NAN},
+      distance_(NAN) {
+  // Set up the cell_walker_, with the bars of the sphere or the ellipsoid.
+  std::vector<int> bars;
+  if (has_metric_) {
+    std::copy(metric, metric + 9, metric_);
+    subcell.bars_cutoff_metric(center, metric_, cutoff_, &bars);
+  } else {
+    subcell.bars_cutoff(center, cutoff_, &bars);
+  }
+  cell_walker_ = new BasicCellWalker<PointType, Index>(subcell, shape, center, bars,
+      points, npoint, point_size, cell_map);
+  // Prepare first iteration
+  increment();
+}
+
+
+template <typename PointType, typename Index>
+BasicDeltaIterator<PointType, Index>::~BasicDeltaIterator() {
+  if (cell_walker_ != nullptr) delete cell_walker_;
+}
+
+
+template <typename PointType, typename Index>
+BasicDeltaIterator<PointType, Index>&
+BasicDeltaIterator<PointType, Index>::operator++() {
+  increment();
   return *this;
 }
 
 
-DeltaIterator DeltaIterator::operator++(int) {
+template <typename PointType, typename Index>
+BasicDeltaIterator<PointType, Index>
+BasicDeltaIterator<PointType, Index>::operator++(int) {
   throw std::logic_error("Don't use the post-increment operator of DeltaIterator.");
   return *this;
 }
 
 
-void DeltaIterator::increment(bool initialization) {
+template <typename PointType, typename Index>
+void BasicDeltaIterator<PointType, Index>::increment() {
   do {
-    // Just move one point further
-    ++ipoint_;
-    // If we moved past the last point in the cell, then do the outer loop
-    if (ipoint_ == iend_) {
-      do {
-        // Move to the next cell, if any
-        if (!initialization) {
-          ++(*bar_iterator_);
-        } else {
-          initialization = false;
-        }
-        // Check if there is a next cell.
-        if (!bar_iterator_->busy()) {
-          delta_[0] = NAN;
-          delta_[1] = NAN;
-          delta_[2] = NAN;
-          distance_ = NAN;
-          return;
-        }
-        // Take all relevant data from bar_iterator_ and cell_map_.
-        // - the cell index
-        std::array<int, 3> key{
-          bar_iterator_->icell()[0],
-          bar_iterator_->icell()[1],
-          bar_iterator_->icell()[2]};
-        // - the next range of points, if any. If the next range of points is not in
-        //   cell_map_, the while loop will try the next cell.
-        auto it = cell_map_.find(key);
-        if (it != cell_map_.end()) {
-          // The range points + reset ipoint_ to the beginning if that range
-          ibegin_ = it->second[0];
-          iend_ = it->second[1];
-          ipoint_ = ibegin_;
-        }
-      } while (ipoint_ == iend_);
-      // When we get here, a new cell with some points is found.
-      // Compute the relative vector of the cutoff center to the lower corner of the
-      // periodic cell. (This is called the cell_delta_ vector, as it is, for a given
-      // cell, a constant part of the relative vector from center to a point within a
-      // given cell.)
-      cell_delta_[0] = -center_[0];
-      cell_delta_[1] = -center_[1];
-      cell_delta_[2] = -center_[2];
-      int translate_icell[3]{
-        bar_iterator_->coeffs()[0]*shape_[0],
-        bar_iterator_->coeffs()[1]*shape_[1],
-        bar_iterator_->coeffs()[2]*shape_[2],
-      };
-      subcell_.iadd_vec(cell_delta_, translate_icell);
-    }
-    // When we reach this point, a new point is found, either in a new cell or not. Some
-    // additional properties of that point are computed here. If the distance from the
-    // center is beyond the cutoff, we just move to the next point.
-    point_ = reinterpret_cast<const Point*>(points_char_ + ipoint_*point_size_);
-    vec3::copy(point_->cart_, delta_);
-    vec3::iadd(delta_, cell_delta_);
-    distance_ = vec3::norm(delta_);
+    cell_walker_->next();
+    if (!cell_walker_->busy()) {
+      delta_[0] = NAN;
+      delta_[1] = NAN;
+      delta_[2] = NAN;
+      distance_ = NAN;
+      return;
+    }
+    // If the distance from the center is beyond the cutoff, we just move to the next
+    // point. Only the final relative vector is rounded to Real.
+    double delta[3];
+    cell_walker_->delta(delta);
+    delta_[0] = static_cast<Real>(delta[0]);
+    delta_[1] = static_cast<Real>(delta[1]);
+    delta_[2] = static_cast<Real>(delta[2]);
+    if (has_metric_) {
+      // Only the lower triangle of the metric is used.
+      distance_ = static_cast<Real>(std::sqrt(
+          metric_[0]*delta[0]*delta[0] +
+          metric_[4]*delta[1]*delta[1] +
+          metric_[8]*delta[2]*delta[2] +
+          2*(metric_[3]*delta[0]*delta[1] +
+             metric_[6]*delta[0]*delta[2] +
+             metric_[7]*delta[1]*delta[2])));
+    } else {
+      distance_ = std::sqrt(delta_[0]*delta_[0] + delta_[1]*delta_[1] +
+                            delta_[2]*delta_[2]);
+    }
+  } while (distance_ > cutoff_);
+}
+
+
+template class BasicDeltaIterator<Point, size_t>;
+template class BasicDeltaIterator<PointF, size_t>;
+template class BasicDeltaIterator<Point, uint32_t>;
+template class BasicDeltaIterator<PointF, uint32_t>;
+
+
+// LevelDeltaIterator
+
+namespace {
+
+//! Checks the cutoffs of BasicLevelDeltaIterator and returns them as a vector.
+std::vector<double> check_cutoffs(const double* cutoffs, const int nlevel) {
+  if (nlevel <= 0)
+    throw std::domain_error("The number of levels must be strictly positive.");
+  if (cutoffs[0] <= 0)
+    throw std::domain_error("The cutoffs must be strictly positive.");
+  for (int ilevel = 1; ilevel < nlevel; ++ilevel) {
+    if (cutoffs[ilevel] <= cutoffs[ilevel - 1])
+      throw std::domain_error("The cutoffs must be strictly increasing.");
+  }
+  return std::vector<double>(cutoffs, cutoffs + nlevel);
+}
+
+}  // namespace
+
+
+template <typename PointType, typename Index>
+BasicLevelDeltaIterator<PointType, Index>::BasicLevelDeltaIterator(const Cell& subcell,
+    const int* shape, const double* center, const double* cutoffs, const int nlevel,
+    const void* points, const size_t npoint, const size_t point_size,
+    const BasicCellMap<Index>& cell_map)
+    : cutoffs_(check_cutoffs(cutoffs, nlevel)),
+      delta_iterator_(new BasicDeltaIterator<PointType, Index>(subcell, shape, center,
+          cutoffs_.back(), points, npoint, point_size, cell_map)),
+      level_(-1) {
+  update_level();
+}
+
+
+template <typename PointType, typename Index>
+BasicLevelDeltaIterator<PointType, Index>::~BasicLevelDeltaIterator() {
+  if (delta_iterator_ != nullptr) delete delta_iterator_;
+}
+
+
+template <typename PointType, typename Index>
+BasicLevelDeltaIterator<PointType, Index>&
+BasicLevelDeltaIterator<PointType, Index>::operator++() {
+  ++(*delta_iterator_);
+  update_level();
+  return *this;
+}
+
+
+template <typename PointType, typename Index>
+BasicLevelDeltaIterator<PointType, Index>
+BasicLevelDeltaIterator<PointType, Index>::operator++(int) {
+  throw std::logic_error("Don't use the post-increment operator of LevelDeltaIterator.");
+  return *this;
+}
+
+
+template <typename PointType, typename Index>
+void BasicLevelDeltaIterator<PointType, Index>::update_level() {
+  if (!delta_iterator_->busy()) {
+    level_ = -1;
+    return;
+  }
+  // The distance never exceeds the last cutoff, so a level is always found.
+  const double distance = delta_iterator_->distance();
+  level_ = static_cast<int>(std::lower_bound(cutoffs_.begin(), cutoffs_.end() - 1,
+                                             distance) - cutoffs_.begin());
+}
+
+
+template class BasicLevelDeltaIterator<Point, size_t>;
+template class BasicLevelDeltaIterator<PointF, size_t>;
+template class BasicLevelDeltaIterator<Point, uint32_t>;
+template class BasicLevelDeltaIterator<PointF, uint32_t>;
+
+
+template <typename PointType, typename Index>
+void neighbors_by_level(const Cell& subcell, const int* shape, const double* center,
+    const double* cutoffs, const int nlevel, const void* points, const size_t npoint,
+    const size_t point_size, const BasicCellMap<Index>& cell_map, size_t* level_offsets,
+    std::vector<Index>* ipoints, std::vector<double>* distances) {
+  // Single pass over all neighbors within the largest cutoff
+  std::vector<Index> unsorted_ipoints;
+  std::vector<double> unsorted_distances;
+  std::vector<int> levels;
+  std::fill(level_offsets, level_offsets + nlevel + 1, 0);
+  for (BasicLevelDeltaIterator<PointType, Index> ldit(subcell, shape, center, cutoffs,
+       nlevel, points, npoint, point_size, cell_map); ldit.busy(); ++ldit) {
+    unsorted_ipoints.push_back(ldit.ipoint());
+    unsorted_distances.push_back(ldit.distance());
+    levels.push_back(ldit.level());
+    ++level_offsets[ldit.level() + 1];
+  }
+  // Counting sort by level, which keeps the order within one level.
+  for (int ilevel = 0; ilevel < nlevel; ++ilevel)
+    level_offsets[ilevel + 1] += level_offsets[ilevel];
+  ipoints->resize(levels.size());
+  distances->resize(levels.size());
+  std::vector<size_t> next(level_offsets, level_offsets + nlevel);
+  for (size_t ineighbor = 0; ineighbor < levels.size(); ++ineighbor) {
+    const size_t isorted = next[levels[ineighbor]]++;
+    (*ipoints)[isorted] = unsorted_ipoints[ineighbor];
+    (*distances)[isorted] = unsorted_distances[ineighbor];
+  }
+}
+
+
+template void neighbors_by_level<Point, size_t>(const Cell& subcell, const int* shape,
+    const double* center, const double* cutoffs, const int nlevel, const void* points,
+    const size_t npoint, const size_t point_size, const CellMap& cell_map,
+    size_t* level_offsets, std::vector<size_t>* ipoints, std::vector<double>* distances);
+template void neighbors_by_level<PointF, size_t>(const Cell& subcell, const int* shape,
+    const double* center, const double* cutoffs, const int nlevel, const void* points,
+    const size_t npoint, const size_t point_size, const CellMap& cell_map,
+    size_t* level_offsets, std::vector<size_t>* ipoints, std::vector<double>* distances);
+template void neighbors_by_level<Point, uint32_t>(const Cell& subcell, const int* shape,
+    const double* center, const double* cutoffs, const int nlevel, const void* points,
+    const size_t npoint, const size_t point_size, const CellMap32& cell_map,
+    size_t* level_offsets, std::vector<uint32_t>* ipoints,
+    std::vector<double>* distances);
+template void neighbors_by_level<PointF, uint32_t>(const Cell& subcell,
+    const int* shape, const double* center, const double* cutoffs, const int nlevel,
+    const void* points, const size_t npoint, const size_t point_size,
+    const CellMap32& cell_map, size_t* level_offsets, std::vector<uint32_t>* ipoints,
+    std::vector<double>* distances);
+
+
+// ShellIterator
+
+template <typename PointType, typename Index>
+BasicShellIterator<PointType, Index>::BasicShellIterator(const Cell& subcell,
+    const int* shape, const double* center, const double inner, const double outer,
+    const void* points, const size_t npoint, const size_t point_size,
+    const BasicCellMap<Index>& cell_map)
+    : subcell_(subcell),
+      center_{center[0], center[1], center[2]},
+      inner_(inner),
+      outer_(outer),
+      cell_walker_(nullptr),
+      delta_{NAN, NAN, NAN},
+      distance_(NAN),
+      inner_begin_(0),
+      inner_end_(0) {
+  // Argument checking
+  if (subcell_.nvec() != 3)
+    throw std::domain_error("ShellIterator requires a 3D subcell.");
+  if ((inner_ < 0) || (inner_ >= outer_))
+    throw std::domain_error("The radii must satisfy 0 <= inner < outer.");
+  // Set up the cell_walker_ with the bars of the outer sphere.
+  std::vector<int> bars;
+  subcell_.bars_cutoff(center_, outer_, &bars);
+  cell_walker_ = new BasicCellWalker<PointType, Index>(subcell, shape, center, bars,
+      points, npoint, point_size, cell_map);
+  // Prepare first iteration
+  increment();
+}
+
+
+template <typename PointType, typename Index>
+BasicShellIterator<PointType, Index>::~BasicShellIterator() {
+  if (cell_walker_ != nullptr) delete cell_walker_;
+}
+
+
+template <typename PointType, typename Index>
+BasicShellIterator<PointType, Index>&
+BasicShellIterator<PointType, Index>::operator++() {
+  increment();
+  return *this;
+}
+
+
+template <typename PointType, typename Index>
+BasicShellIterator<PointType, Index>
+BasicShellIterator<PointType, Index>::operator++(int) {
+  throw std::logic_error("Don't use the post-increment operator of ShellIterator.");
+  return *this;
+}
+
+
+template <typename PointType, typename Index>
+bool BasicShellIterator<PointType, Index>::inside_inner(const int* icell) const {
+  // Relative vector from the center to the lower corner of the subcell.
+  double corner[3]{-center_[0], -center_[1], -center_[2]};
+  subcell_.iadd_vec(corner, icell);
+  // A subcell is convex, so it is inside the inner sphere when all its vertices are.
+  const double inner_sq = inner_*inner_;
+  const double* vecs = subcell_.vecs();
+  for (int ivertex = 0; ivertex < 8; ++ivertex) {
+    double vertex[3];
+    vec3::copy(corner, vertex);
+    if (ivertex & 1) vec3::iadd(vertex, vecs);
+    if (ivertex & 2) vec3::iadd(vertex, vecs + 3);
+    if (ivertex & 4) vec3::iadd(vertex, vecs + 6);
+    if (vec3::normsq(vertex) >= inner_sq) return false;
+  }
+  return true;
+}
+
+
+template <typename PointType, typename Index>
+void BasicShellIterator<PointType, Index>::update_inner_run() {
+  const BarIterator* bar_iterator = cell_walker_->bar_iterator();
+  const int* icell = bar_iterator->icell_unwrapped();
+  const int bar_begin = bar_iterator->ranges_begin()[2];
+  const int bar_end = bar_iterator->ranges_end()[2];
+  inner_begin_ = bar_end;
+  inner_end_ = bar_end;
+  // Relative vector from the center to the lower corner of the subcell with index zero
+  // in the last direction.
+  double corner[3]{-center_[0], -center_[1], -center_[2]};
+  int icell_base[3]{icell[0], icell[1], 0};
+  subcell_.iadd_vec(corner, icell_base);
+  // The lower vertex of the cell t along the last direction is at corner + t*vecs[2],
+  // for each of the four edges parallel to that direction. Such an edge is inside the
+  // inner sphere for t in ]root_low, root_high[. A cell t is inside when t and t + 1
+  // are within these intervals for all four edges.
+  const double* vecs = subcell_.vecs();
+  const double a = vec3::normsq(vecs + 6);
+  double low = -INFINITY;
+  double high = INFINITY;
+  for (int iedge = 0; iedge < 4; ++iedge) {
+    double edge[3];
+    vec3::copy(corner, edge);
+    if (iedge & 1) vec3::iadd(edge, vecs);
+    if (iedge & 2) vec3::iadd(edge, vecs + 3);
+    const double b = vec3::dot(edge, vecs + 6);
+    const double discriminant = b*b - a*(vec3::normsq(edge) - inner_*inner_);
+    if (discriminant <= 0) return;
+    const double sqrt_discriminant = std::sqrt(discriminant);
+    low = std::max(low, (-b - sqrt_discriminant)/a);
+    high = std::min(high, (-b + sqrt_discriminant)/a);
+  }
+  // Integer cells t with low < t and t + 1 < high, clipped to the bar.
+  const double begin = std::max(std::floor(low) + 1, static_cast<double>(bar_begin));
+  const double end = std::min(std::ceil(high - 1), static_cast<double>(bar_end));
+  if (begin >= end) return;
+  inner_begin_ = static_cast<int>(begin);
+  inner_end_ = static_cast<int>(end);
+  // Guard against rounding errors: the ends of the run are tested explicitly. Due to
+  // convexity, all cells in between are then inside the inner sphere too.
+  int icell_test[3]{icell[0], icell[1], inner_begin_};
+  while ((inner_begin_ < inner_end_) && !inside_inner(icell_test))
+    icell_test[2] = ++inner_begin_;
+  icell_test[2] = inner_end_ - 1;
+  while ((inner_begin_ < inner_end_) && !inside_inner(icell_test))
+    icell_test[2] = --inner_end_ - 1;
+}
+
+
+template <typename PointType, typename Index>
+void BasicShellIterator<PointType, Index>::skip_inner() {
+  BarIterator* bar_iterator = cell_walker_->bar_iterator();
+  while (bar_iterator->busy()) {
+    const int icell_last = bar_iterator->icell_unwrapped()[2];
+    if (icell_last == bar_iterator->ranges_begin()[2])
+      update_inner_run();
+    if ((icell_last < inner_begin_) || (icell_last >= inner_end_)) return;
+    bar_iterator->jump(inner_end_);
+  }
+}
+
+
+template <typename PointType, typename Index>
+void BasicShellIterator<PointType, Index>::increment() {
+  while (true) {
+    // Jump over subcells inside the inner sphere, before any lookup.
+    cell_walker_->next([this]() { if (inner_ > 0) skip_inner(); });
+    if (!cell_walker_->busy()) {
+      delta_[0] = NAN;
+      delta_[1] = NAN;
+      delta_[2] = NAN;
+      distance_ = NAN;
+      return;
+    }
+    // Only the final relative vector is rounded to Real, as in BasicDeltaIterator.
+    double delta[3];
+    cell_walker_->delta(delta);
+    delta_[0] = static_cast<Real>(delta[0]);
+    delta_[1] = static_cast<Real>(delta[1]);
+    delta_[2] = static_cast<Real>(delta[2]);
+    distance_ = std::sqrt(delta_[0]*delta_[0] + delta_[1]*delta_[1] +
+                          delta_[2]*delta_[2]);
+    if ((distance_ >= inner_) && (distance_ < outer_)) return;
+  }
+}
+
+
+template class BasicShellIterator<Point, size_t>;
+template class BasicShellIterator<PointF, size_t>;
+template class BasicShellIterator<Point, uint32_t>;
+template class BasicShellIterator<PointF, uint32_t>;
+
+
+// BoxIterator
+
+template <typename PointType, typename Index>
+BasicBoxIterator<PointType, Index>::BasicBoxIterator(const Cell& subcell,
+    const int* shape, const double* origin, const double* edges, const void* points,
+    const size_t npoint, const size_t point_size, const BasicCellMap<Index>& cell_map)
+    : box_(edges, 3),
+      cell_walker_(nullptr),
+      delta_{NAN, NAN, NAN},
+      box_frac_{NAN, NAN, NAN} {
+  if (subcell.nvec() != 3)
+    throw std::domain_error("BoxIterator requires a 3D subcell.");
+  // Set up the cell_walker_
+  std::vector<int> bars;
+  subcell.bars_box(origin, edges, &bars);
+  cell_walker_ = new BasicCellWalker<PointType, Index>(subcell, shape, origin, bars,
+      points, npoint, point_size, cell_map);
+  // Prepare first iteration
+  increment();
+}
+
+
+template <typename PointType, typename Index>
+BasicBoxIterator<PointType, Index>::~BasicBoxIterator() {
+  if (cell_walker_ != nullptr) delete cell_walker_;
+}
+
+
+template <typename PointType, typename Index>
+BasicBoxIterator<PointType, Index>& BasicBoxIterator<PointType, Index>::operator++() {
+  increment();
+  return *this;
+}
+
+
+template <typename PointType, typename Index>
+BasicBoxIterator<PointType, Index> BasicBoxIterator<PointType, Index>::operator++(int) {
+  throw std::logic_error("Don't use the post-increment operator of BoxIterator.");
+  return *this;
+}
+
+
+template <typename PointType, typename Index>
+void BasicBoxIterator<PointType, Index>::increment() {
+  while (true) {
+    cell_walker_->next();
+    if (!cell_walker_->busy()) {
+      delta_[0] = NAN;
+      delta_[1] = NAN;
+      delta_[2] = NAN;
+      box_frac_[0] = NAN;
+      box_frac_[1] = NAN;
+      box_frac_[2] = NAN;
+      return;
+    }
+    // Exact test of the point against the box, in double precision.
+    double delta[3];
+    cell_walker_->delta(delta);
+    box_.to_frac(delta, box_frac_);
+    if ((box_frac_[0] >= 0) && (box_frac_[0] <= 1) &&
+        (box_frac_[1] >= 0) && (box_frac_[1] <= 1) &&
+        (box_frac_[2] >= 0) && (box_frac_[2] <= 1)) {
+      delta_[0] = static_cast<Real>(delta[0]);
+      delta_[1] = static_cast<Real>(delta[1]);
+      delta_[2] = static_cast<Real>(delta[2]);
+      return;
+    }
+  }
+}
+
+
+template class BasicBoxIterator<Point, size_t>;
+template class BasicBoxIterator<PointF, size_t>;
+template class BasicBoxIterator<Point, uint32_t>;
+template class BasicBoxIterator<PointF, uint32_t>;
+
+
+// SortedDeltaIterator
+
+template <typename PointType, typename Index>
+BasicSortedDeltaIterator<PointType, Index>::BasicSortedDeltaIterator(
+    const Cell& subcell, const int* shape, const double* center, const double cutoff,
+    const void* points, const size_t npoint, const size_t point_size,
+    const BasicCellMap<Index>& cell_map)
+    : subcell_(subcell),
+      shape_{0, 0, 0},
+      center_{center[0], center[1], center[2]},
+      cutoff_(cutoff),
+      points_char_(reinterpret_cast<const char*>(points)),
+      npoint_(npoint),
+      point_size_(point_size),
+      cell_map_(cell_map),
+      frac_center_{NAN, NAN, NAN},
+      delta_{NAN, NAN, NAN},
+      distance_(NAN),
+      ipoint_(0),
+      nlookup_(0),
+      busy_(true) {
+  // Argument checking
+  if (subcell_.nvec() != 3)
+    throw std::domain_error("SortedDeltaIterator requires a 3D subcell.");
+  if (shape != nullptr)
+    std::copy(shape, shape + 3, shape_);
+  // The fractional coordinates of the center, to compute lower bounds on the distances.
+  subcell_.to_frac(center_, frac_center_);
+  // Put all bars within the cutoff sphere in the queue, without any lookups. The
+  // BarIterator just jumps from one bar to the next.
+  std::vector<int> bars;
+  subcell_.bars_cutoff(center_, cutoff_, &bars);
+  for (BarIterator bit(bars, 3, shape_); bit.busy(); bit.jump(bit.ranges_end()[2])) {
+    CellEntry entry;
+    entry.bar = true;
+    std::copy(bit.icell_unwrapped(), bit.icell_unwrapped() + 3, entry.icell);
+    entry.icell_end = bit.ranges_end()[2];
+    const int icell_end[3]{entry.icell[0] + 1, entry.icell[1] + 1, entry.icell_end};
+    entry.distance_min = distance_min(entry.icell, icell_end);
+    entry.ibegin = 0;
+    entry.iend = 0;
+    cell_queue_.push_back(entry);
+  }
+  std::make_heap(cell_queue_.begin(), cell_queue_.end());
+  // Prepare first iteration
+  increment();
+}
+
+
+template <typename PointType, typename Index>
+BasicSortedDeltaIterator<PointType, Index>&
+BasicSortedDeltaIterator<PointType, Index>::operator++() {
+  increment();
+  return *this;
+}
+
+
+template <typename PointType, typename Index>
+BasicSortedDeltaIterator<PointType, Index>
+BasicSortedDeltaIterator<PointType, Index>::operator++(int) {
+  throw std::logic_error("Don't use the post-increment operator of SortedDeltaIterator.");
+  return *this;
+}
+
+
+template <typename PointType, typename Index>
+double BasicSortedDeltaIterator<PointType, Index>::distance_min(const int* icell,
+    const int* icell_end) const {
+  // The distance to a block of subcells is at least its distance to the slab between
+  // the lattice planes of the block, for each cell vector.
+  double result = 0.0;
+  for (int ivec = 0; ivec < 3; ++ivec) {
+    double frac_distance = std::max(icell[ivec] - frac_center_[ivec],
+                                    frac_center_[ivec] - icell_end[ivec]);
+    result = std::max(result, frac_distance*subcell_.spacings()[ivec]);
+  }
+  return result;
+}
+
+
+template <typename PointType, typename Index>
+void BasicSortedDeltaIterator<PointType, Index>::split_bar(const CellEntry& bar_entry) {
+  CellEntry entry;
+  entry.bar = false;
+  entry.icell[0] = bar_entry.icell[0];
+  entry.icell[1] = bar_entry.icell[1];
+  entry.icell_end = 0;
+  std::array<int, 3> key{
+    robust_wrap(entry.icell[0], shape_[0]),
+    robust_wrap(entry.icell[1], shape_[1]),
+    0};
+  for (entry.icell[2] = bar_entry.icell[2]; entry.icell[2] < bar_entry.icell_end;
+       ++entry.icell[2]) {
+    key[2] = robust_wrap(entry.icell[2], shape_[2]);
+    ++nlookup_;
+    auto it = cell_map_.find(key);
+    if ((it == cell_map_.end()) || (it->second[0] == it->second[1])) continue;
+    entry.ibegin = it->second[0];
+    entry.iend = it->second[1];
+    const int icell_end[3]{entry.icell[0] + 1, entry.icell[1] + 1, entry.icell[2] + 1};
+    entry.distance_min = distance_min(entry.icell, icell_end);
+    cell_queue_.push_back(entry);
+    std::push_heap(cell_queue_.begin(), cell_queue_.end());
+  }
+}
+
+
+template <typename PointType, typename Index>
+void BasicSortedDeltaIterator<PointType, Index>::buffer_points(
+    const CellEntry& cell_entry) {
+  // Relative vector from the center to the lower corner of the periodic image.
+  double cell_delta[3]{-center_[0], -center_[1], -center_[2]};
+  int translate_icell[3];
+  for (int ivec = 0; ivec < 3; ++ivec) {
+    translate_icell[ivec] = cell_entry.icell[ivec] -
+                            robust_wrap(cell_entry.icell[ivec], shape_[ivec]);
+  }
+  subcell_.iadd_vec(cell_delta, translate_icell);
+  for (Index ipoint = cell_entry.ibegin; ipoint < cell_entry.iend; ++ipoint) {
+    const PointType* point(reinterpret_cast<const PointType*>(  // Ugly sweet hack
+        points_char_ + ipoint*point_size_));
+    PointEntry entry;
+    entry.ipoint = ipoint;
+    // Sum in double precision, as in BasicDeltaIterator.
+    for (int ivec = 0; ivec < 3; ++ivec) {
+      entry.delta[ivec] = static_cast<Real>(point->cart_[ivec] + cell_delta[ivec]);
+    }
+    entry.distance = std::sqrt(entry.delta[0]*entry.delta[0] +
+                               entry.delta[1]*entry.delta[1] +
+                               entry.delta[2]*entry.delta[2]);
+    if (entry.distance <= cutoff_) {
+      point_queue_.push_back(entry);
+      std::push_heap(point_queue_.begin(), point_queue_.end());
+    }
+  }
+}
+
+
+template <typename PointType, typename Index>
+void BasicSortedDeltaIterator<PointType, Index>::increment() {
+  while (true) {
+    // Return the closest buffered point, if no bar or subcell in the queue can be
+    // closer.
+    if (!point_queue_.empty() && (cell_queue_.empty() ||
+        (point_queue_.front().distance <= cell_queue_.front().distance_min))) {
+      std::pop_heap(point_queue_.begin(), point_queue_.end());
+      const PointEntry& entry = point_queue_.back();
+      std::copy(entry.delta, entry.delta + 3, delta_);
+      distance_ = entry.distance;
+      ipoint_ = entry.ipoint;
+      point_queue_.pop_back();
+      return;
+    }
+    // Check if there is a next bar or subcell.
+    if (cell_queue_.empty()) {
+      busy_ = false;
+      delta_[0] = NAN;
+      delta_[1] = NAN;
+      delta_[2] = NAN;
+      distance_ = NAN;
+      return;
+    }
+    // Split the closest bar into subcells, or buffer all points of the closest subcell
+    // within the cutoff sphere.
+    std::pop_heap(cell_queue_.begin(), cell_queue_.end());
+    const CellEntry cell_entry = cell_queue_.back();
+    cell_queue_.pop_back();
+    if (cell_entry.bar) {
+      split_bar(cell_entry);
+    } else {
+      buffer_points(cell_entry);
+    }
+  }
+}
+
+
+template class BasicSortedDeltaIterator<Point, size_t>;
+template class BasicSortedDeltaIterator<PointF, size_t>;
+template class BasicSortedDeltaIterator<Point, uint32_t>;
+template class BasicSortedDeltaIterator<PointF, uint32_t>;
+
+
+// TripletIterator
+
+template <typename PointType, typename Index>
+BasicTripletIterator<PointType, Index>::BasicTripletIterator(const Cell& subcell,
+    const int* shape, const double cutoff, const void* points, const size_t npoint,
+    const size_t point_size, const BasicCellMap<Index>& cell_map, const bool symmetric)
+    : subcell_(subcell),
+      shape_{0, 0, 0},
+      has_shape_(shape != nullptr),
+      cutoff_(cutoff),
+      points_(points),
+      npoint_(npoint),
+      point_size_(point_size),
+      cell_map_(cell_map),
+      symmetric_(symmetric),
+      ineighbor0_(0),
+      ineighbor1_(0),
+      delta01_{NAN, NAN, NAN},
+      distance01_(NAN) {
+  if (subcell_.nvec() != 3)
+    throw std::domain_error("TripletIterator requires a 3D subcell.");
+  if (has_shape_)
+    std::copy(shape, shape + 3, shape_);
+}
+
+
+template <typename PointType, typename Index>
+void BasicTripletIterator<PointType, Index>::reset(const double* center) {
+  // Collect all neighbors, keeping the capacity of the buffer.
+  neighbors_.clear();
+  for (BasicDeltaIterator<PointType, Index> dit(subcell_, has_shape_ ? shape_ : nullptr,
+       center, cutoff_, points_, npoint_, point_size_, cell_map_); dit.busy(); ++dit) {
+    if (dit.distance() == 0) continue;
+    Neighbor neighbor;
+    neighbor.ipoint = dit.ipoint();
+    std::copy(dit.delta(), dit.delta() + 3, neighbor.delta);
+    neighbor.distance = dit.distance();
+    neighbors_.push_back(neighbor);
+  }
+  // Prepare first iteration
+  increment(true);
+}
+
+
+template <typename PointType, typename Index>
+BasicTripletIterator<PointType, Index>&
+BasicTripletIterator<PointType, Index>::operator++() {
+  increment(false);
+  return *this;
+}
+
+
+template <typename PointType, typename Index>
+BasicTripletIterator<PointType, Index>
+BasicTripletIterator<PointType, Index>::operator++(int) {
+  throw std::logic_error("Don't use the post-increment operator of TripletIterator.");
+  return *this;
+}
+
+
+template <typename PointType, typename Index>
+void BasicTripletIterator<PointType, Index>::increment(bool initialization) {
+  const size_t nneighbor = neighbors_.size();
+  if (initialization) {
+    ineighbor0_ = 0;
+    ineighbor1_ = 0;
+  }
+  // Move to the next pair of distinct neighbors.
+  do {
+    if (initialization) {
+      initialization = false;
+    } else {
+      ++ineighbor1_;
+    }
+    if (ineighbor1_ >= nneighbor) {
+      ++ineighbor0_;
+      ineighbor1_ = symmetric_ ? ineighbor0_ + 1 : 0;
+    }
+    if (symmetric_ && (ineighbor1_ <= ineighbor0_))
+      ineighbor1_ = ineighbor0_ + 1;
+  } while ((ineighbor0_ < nneighbor) &&
+           ((ineighbor1_ >= nneighbor) || (ineighbor0_ == ineighbor1_)));
+  if (ineighbor0_ >= nneighbor) {
+    ineighbor0_ = nneighbor;
+    delta01_[0] = NAN;
+    delta01_[1] = NAN;
+    delta01_[2] = NAN;
+    distance01_ = NAN;
+    return;
+  }
+  // Relative vector between both neighbors
+  const Real* delta0 = neighbors_[ineighbor0_].delta;
+  const Real* delta1 = neighbors_[ineighbor1_].delta;
+  delta01_[0] = delta1[0] - delta0[0];
+  delta01_[1] = delta1[1] - delta0[1];
+  delta01_[2] = delta1[2] - delta0[2];
+  distance01_ = std::sqrt(delta01_[0]*delta01_[0] + delta01_[1]*delta01_[1] +
+                          delta01_[2]*delta01_[2]);
+}
+
+
+template class BasicTripletIterator<Point, size_t>;
+template class BasicTripletIterator<PointF, size_t>;
+template class BasicTripletIterator<Point, uint32_t>;
+template class BasicTripletIterator<PointF, uint32_t>;
+
+
+// GridIterator
+
+GridIterator::GridIterator(const Cell& grid_cell, const int* shape, const double* center,
+    const double* metric, const double cutoff)
+    : grid_cell_(grid_cell),
+      shape_{shape[0], shape[1], shape[2]},
+      center_{center[0], center[1], center[2]},
+      has_metric_(metric != nullptr),
+      cutoff_(cutoff),
+      sphere_slice_(nullptr),
+      delta_{NAN, NAN, NAN},
+      distance_(NAN),
+      ipoint_(0),
+      busy_(true) {
+  // Argument checking
+  if (grid_cell_.nvec() != 3)
+    throw std::domain_error("GridIterator requires a 3D periodic grid cell.");
+  if ((shape_[0] <= 0) || (shape_[1] <= 0) || (shape_[2] <= 0))
+    throw std::domain_error("The grid shape must be strictly positive.");
+  if (cutoff_ <= 0)
+    throw std::domain_error("The cutoff must be strictly positive.");
+  if (has_metric_) {
+    // The SphereSlice object works in the space where the ellipsoid is a sphere.
+    std::copy(metric, metric + 9, metric_);
+    double sphere_normals[9];
+    metric_to_sphere(metric_, center_, grid_cell_.gvecs(), sphere_center_,
+                     sphere_normals);
+    sphere_slice_ = new SphereSlice(sphere_center_, sphere_normals, cutoff_);
+  } else if (grid_cell_.cuboid()) {
+    // Cuboid grids have a closed-form solution for the ranges, see take_range.
+    grid_cell_.to_frac(center_, frac_center_);
+    radius_sq_[0] = cutoff_*cutoff_;
+  } else {
+    // The SphereSlice object computes intersections of the cutoff sphere with the
+    // lattice planes and lines through the grid points.
+    sphere_slice_ = new SphereSlice(center_, grid_cell_.gvecs(), cutoff_);
+  }
+  // Prepare first iteration
+  increment(true);
+}
+
+
+GridIterator::~GridIterator() {
+  if (sphere_slice_ != nullptr) delete sphere_slice_;
+}
+
+
+GridIterator& GridIterator::operator++() {
+  increment(false);
+  return *this;
+}
+
+
+GridIterator GridIterator::operator++(int) {
+  throw std::logic_error("Don't use the post-increment operator of GridIterator.");
+  return *this;
+}
+
+
+void GridIterator::take_range(const int ivec) {
+  // Find the interval along grid vector ivec where the cutoff sphere is cut by the
+  // lattice plane (ivec == 1) or line (ivec == 2) of the preceding grid indexes.
+  double begin_exact = NAN;
+  double end_exact = NAN;
+  if (sphere_slice_ == nullptr) {
+    // Cuboid grid: the radius of the circle (ivec == 1) or line segment (ivec == 2)
+    // follows from the distance between the center and the preceding plane or line.
+    if (ivec > 0) {
+      const double distance = (igrid_unwrapped_[ivec - 1] - frac_center_[ivec - 1])*
+                              grid_cell_.spacings()[ivec - 1];
+      radius_sq_[ivec] = radius_sq_[ivec - 1] - distance*distance;
+    }
+    if (radius_sq_[ivec] >= 0) {
+      const double frac_radius = sqrt(radius_sq_[ivec])/grid_cell_.spacings()[ivec];
+      begin_exact = frac_center_[ivec] - frac_radius;
+      end_exact = frac_center_[ivec] + frac_radius;
+    }
+  } else if (ivec == 0) {
+    sphere_slice_->solve_full_low(0, &begin_exact, &end_exact);
+  } else if (ivec == 1) {
+    sphere_slice_->solve_plane_low(1, 0, igrid_unwrapped_[0], &begin_exact, &end_exact);
+  } else {
+    sphere_slice_->solve_line_low(2, 0, 1, igrid_unwrapped_[0], igrid_unwrapped_[1],
+        &begin_exact, &end_exact);
+  }
+  if (std::isnan(begin_exact) || std::isnan(end_exact)) {
+    // The plane or line does not intersect with the sphere: empty range.
+    ranges_begin_[ivec] = 0;
+    ranges_end_[ivec] = 0;
+  } else {
+    // Only the grid points within the interval are relevant.
+    ranges_begin_[ivec] = static_cast<int>(ceil(begin_exact));
+    ranges_end_[ivec] = static_cast<int>(floor(end_exact)) + 1;
+  }
+  igrid_unwrapped_[ivec] = ranges_begin_[ivec];
+}
+
+
+void GridIterator::increment(bool initialization) {
+  do {
+    // Move to the next candidate grid point, which is done with a non-recursive version
+    // of three nested loops over the ranges.
+    int depth = 2;
+    if (initialization) {
+      take_range(0);
+      depth = 0;
+      initialization = false;
+    } else {
+      ++igrid_unwrapped_[2];
+    }
+    while ((depth < 2) || (igrid_unwrapped_[2] >= ranges_end_[2])) {
+      if (igrid_unwrapped_[depth] < ranges_end_[depth]) {
+        // Go one loop deeper.
+        ++depth;
+        take_range(depth);
+      } else if (depth == 0) {
+        // All loops are done.
+        busy_ = false;
+        delta_[0] = NAN;
+        delta_[1] = NAN;
+        delta_[2] = NAN;
+        distance_ = NAN;
+        return;
+      } else {
+        // Go one loop up.
+        --depth;
+        ++igrid_unwrapped_[depth];
+      }
+    }
+    // When we get here, a new candidate is found. Compute the wrapped grid indexes,
+    // the relative vector and the distance.
+    for (int ivec = 0; ivec < 3; ++ivec)
+      igrid_[ivec] = robust_wrap(igrid_unwrapped_[ivec], shape_[ivec], &coeffs_[ivec]);
+    ipoint_ = static_cast<size_t>(igrid_[0])*shape_[1] + igrid_[1];
+    ipoint_ = ipoint_*shape_[2] + igrid_[2];
+    delta_[0] = -center_[0];
+    delta_[1] = -center_[1];
+    delta_[2] = -center_[2];
+    grid_cell_.iadd_vec(delta_, igrid_unwrapped_);
+    if (has_metric_) {
+      // Only the lower triangle of the metric is used.
+      distance_ = sqrt(metric_[0]*delta_[0]*delta_[0] +
+                       metric_[4]*delta_[1]*delta_[1] +
+                       metric_[8]*delta_[2]*delta_[2] +
+                       2*(metric_[3]*delta_[0]*delta_[1] +
+                          metric_[6]*delta_[0]*delta_[2] +
+                          metric_[7]*delta_[1]*delta_[2]));
+    } else {
+      distance_ = vec3::norm(delta_);
+    }
+    // Due to rounding errors, a candidate may be just outside the cutoff sphere.
   } while (distance_ > cutoff_);
 }
 
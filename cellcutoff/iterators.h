@@ -26,9 +26,11 @@
 
 #include <vector>
 #include <array>
+#include <cstdint>
 
 #include "cellcutoff/cell.h"
 #include "cellcutoff/decomposition.h"
+#include "cellcutoff/sphere_slice.h"
 
 
 namespace cellcutoff {
@@ -47,6 +49,18 @@ class BarIterator {
 
   const int* icell() const { return icell_; }
   const int* coeffs() const { return coeffs_; }
+  const int* icell_unwrapped() const { return icell_unwrapped_; }
+  const int* ranges_begin() const { return ranges_begin_; }
+  const int* ranges_end() const { return ranges_end_; }
+
+  /** @brief
+          Skip cells in the last direction of the current bar.
+
+      The iterator moves to the unwrapped icell `icell_last` in the last direction.
+      When this lies beyond the current bar, it continues with the next bar instead.
+      Jumping backwards is not allowed.
+   */
+  void jump(const int icell_last);
 
  private:
   void take_range(const int ivec);
@@ -65,49 +79,540 @@ class BarIterator {
 };
 
 
-class DeltaIterator {
+/** @brief
+        Walks over all points in the subcells of a set of bars, using a cell map.
+
+    This is the loop over subcells and points shared by the iterators below, which only
+    add their own filter on the points. The subcells are visited with a `BarIterator`
+    and empty subcells are skipped. For every point, the relative vector from `origin`
+    to its periodic image is computed in double precision.
+
+    The template parameters are the same as for `BasicDeltaIterator`.
+ */
+template <typename PointType, typename Index = size_t>
+class BasicCellWalker {
+ public:
+  BasicCellWalker(const Cell& subcell, const int* shape, const double* origin,
+      const std::vector<int>& bars, const void* points, const size_t npoint,
+      const size_t point_size, const BasicCellMap<Index>& cell_map);
+  ~BasicCellWalker();
+
+  bool busy() const { return bar_iterator_->busy(); }
+  //! Moves to the next point. The first call moves to the first point.
+  void next();
+  /** @brief
+          Moves to the next point, calling `skip()` before each lookup in the cell map.
+
+      The function `skip` may advance the bar iterator, e.g. with `BarIterator::jump`,
+      to leave out subcells without looking them up.
+   */
+  template <typename Skip>
+  void next(Skip skip);
+
+  BarIterator* bar_iterator() const { return bar_iterator_; }
+  const PointType* point() const { return point_; }
+  Index ipoint() const { return ipoint_; }
+  //! Relative vector from the origin to the periodic image of the current point.
+  void delta(double* delta) const;
+
+ private:
+  // Provided through constructor
+  const Cell& subcell_;
+  int* shape_;
+  const double origin_[3];
+  const std::vector<int> bars_;
+  const char* points_char_;
+  const size_t npoint_;
+  const size_t point_size_;
+  const BasicCellMap<Index>& cell_map_;
+
+  // Internal data
+  BarIterator* bar_iterator_;
+  const PointType* point_;
+  double cell_delta_[3];
+  bool initialization_;
+  Index ipoint_;
+  Index iend_;
+};
+
+
+typedef BasicCellWalker<Point> CellWalker;
+typedef BasicCellWalker<PointF> CellWalkerF;
+typedef BasicCellWalker<Point, uint32_t> CellWalker32;
+typedef BasicCellWalker<PointF, uint32_t> CellWalkerF32;
+
+
+/** @brief
+        Iterates over all points within a cutoff sphere, using a cell map.
+
+    The first template parameter is the type of the points, e.g. `Point` or `PointF`.
+    The relative vectors and distances have the same floating point type as the
+    Cartesian coordinates of the points. The periodic translations of the cells
+    (`cell_delta_`) are always accumulated in double precision and added to the point
+    in double precision, such that the single precision version only rounds the final
+    relative vector.
+
+    The second template parameter is the index type of the cell map, e.g. `uint32_t`
+    when used with `CellMap32`. The same type is used for the point indexes.
+
+    When a metric is given, the cutoff sphere becomes an ellipsoid, see
+    `Cell::bars_cutoff_metric`, and `distance()` is the corresponding metric distance,
+    i.e. `sqrt(delta^T metric delta)`. The relative vector `delta()` is still Cartesian.
+ */
+template <typename PointType, typename Index = size_t>
+class BasicDeltaIterator {
  public:
-  DeltaIterator(const Cell& subcell, const int* shape, const double* center,
+  typedef typename PointType::real_type Real;
+
+  BasicDeltaIterator(const Cell& subcell, const int* shape, const double* center,
+      const double* metric, const double cutoff, const void* points,
+      const size_t npoint, const size_t point_size, const BasicCellMap<Index>& cell_map);
+  BasicDeltaIterator(const Cell& subcell, const int* shape, const double* center,
       const double cutoff, const void* points, const size_t npoint,
-      const size_t point_size, const CellMap& cell_map);
-  DeltaIterator(const Cell& subcell, const double* center,
+      const size_t point_size, const BasicCellMap<Index>& cell_map)
+      : BasicDeltaIterator(subcell, shape, center, nullptr, cutoff, points, npoint,
+        point_size, cell_map) {}
+  BasicDeltaIterator(const Cell& subcell, const double* center,
       const double cutoff, const void* points, const size_t npoint,
-      const size_t point_size, const CellMap& cell_map)
-      : DeltaIterator(subcell, nullptr, center, cutoff, points, npoint, point_size,
+      const size_t point_size, const BasicCellMap<Index>& cell_map)
+      : BasicDeltaIterator(subcell, nullptr, center, cutoff, points, npoint, point_size,
         cell_map) {}
-  ~DeltaIterator();
+  ~BasicDeltaIterator();
 
-  bool busy() const { return bar_iterator_->busy(); }
-  DeltaIterator& operator++();
-  DeltaIterator operator++(int);
+  bool busy() const { return cell_walker_->busy(); }
+  BasicDeltaIterator& operator++();
+  BasicDeltaIterator operator++(int);
 
-  const double* delta() const { return delta_; }
-  double distance() const { return distance_; }
-  size_t ipoint() const { return ipoint_; }
+  const Real* delta() const { return delta_; }
+  Real distance() const { return distance_; }
+  Index ipoint() const { return cell_walker_->ipoint(); }
 
  private:
-  void increment(bool initialization);
+  void increment();
+
+  // Provided through constructor
+  const bool has_metric_;
+  double metric_[9];
+  const double cutoff_;
+
+  // Internal data
+  BasicCellWalker<PointType, Index>* cell_walker_;
+  Real delta_[3];
+  Real distance_;
+};
+
+typedef BasicDeltaIterator<Point> DeltaIterator;
+typedef BasicDeltaIterator<PointF> DeltaIteratorF;
+typedef BasicDeltaIterator<Point, uint32_t> DeltaIterator32;
+typedef BasicDeltaIterator<PointF, uint32_t> DeltaIteratorF32;
+
+
+/** @brief
+        Iterates over all points within several cutoff spheres at once.
+
+    The cutoffs must be strictly positive and strictly increasing. A single
+    `BasicDeltaIterator` with the largest cutoff is used, such that the bars and the
+    lookups in the cell map are shared by all levels. Each point is tagged with its
+    level, i.e. the index of the smallest cutoff for which `distance <= cutoff`. Hence,
+    the points within cutoff `ilevel` are those with `level() <= ilevel`. The other
+    arguments and the template parameters are the same as for `BasicDeltaIterator`.
+ */
+template <typename PointType, typename Index = size_t>
+class BasicLevelDeltaIterator {
+ public:
+  typedef typename PointType::real_type Real;
+
+  BasicLevelDeltaIterator(const Cell& subcell, const int* shape, const double* center,
+      const double* cutoffs, const int nlevel, const void* points, const size_t npoint,
+      const size_t point_size, const BasicCellMap<Index>& cell_map);
+  ~BasicLevelDeltaIterator();
+
+  bool busy() const { return delta_iterator_->busy(); }
+  BasicLevelDeltaIterator& operator++();
+  BasicLevelDeltaIterator operator++(int);
+
+  const Real* delta() const { return delta_iterator_->delta(); }
+  Real distance() const { return delta_iterator_->distance(); }
+  Index ipoint() const { return delta_iterator_->ipoint(); }
+  //! The smallest level whose cutoff includes the current point.
+  int level() const { return level_; }
+
+ private:
+  void update_level();
+
+  // Provided through constructor
+  const std::vector<double> cutoffs_;
+
+  // Internal data
+  BasicDeltaIterator<PointType, Index>* delta_iterator_;
+  int level_;
+};
+
+typedef BasicLevelDeltaIterator<Point> LevelDeltaIterator;
+typedef BasicLevelDeltaIterator<PointF> LevelDeltaIteratorF;
+typedef BasicLevelDeltaIterator<Point, uint32_t> LevelDeltaIterator32;
+typedef BasicLevelDeltaIterator<PointF, uint32_t> LevelDeltaIteratorF32;
+
+
+/** @brief
+        Collects the neighbors of a center for several cutoffs in one pass.
+
+    The neighbors are found with a `BasicLevelDeltaIterator` and sorted by level with a
+    counting sort, i.e. in compressed sparse row format. The neighbors within cutoff
+    `ilevel` are just the first `level_offsets[ilevel + 1]` ones. All arguments up to
+    `cell_map` have the same meaning as for `BasicLevelDeltaIterator`.
+
+    @param level_offsets
+        Output array of size `nlevel + 1`. The neighbors at level `ilevel` are stored
+        in the range `[level_offsets[ilevel], level_offsets[ilevel + 1][`.
+
+    @param ipoints
+        The indexes of the neighbors are written to this vector, after clearing it.
+
+    @param distances
+        The distances of the neighbors are written to this vector, after clearing it.
+ */
+template <typename PointType = Point, typename Index = size_t>
+void neighbors_by_level(const Cell& subcell, const int* shape, const double* center,
+    const double* cutoffs, const int nlevel, const void* points, const size_t npoint,
+    const size_t point_size, const BasicCellMap<Index>& cell_map, size_t* level_offsets,
+    std::vector<Index>* ipoints, std::vector<double>* distances);
+
+
+/** @brief
+        Iterates over all points within a spherical shell, using a cell map.
+
+    Only points with `inner <= distance < outer` are visited. The subcells are taken
+    from the `bars_cutoff` of the outer sphere. Within each bar (along the last cell
+    vector), the run of subcells lying entirely inside the inner sphere is computed
+    analytically and jumped over, without visiting these subcells at all. This saves
+    most of the work for thin shells at large radii, e.g. when computing a histogram of
+    distances in radial bins. An inner radius of zero is allowed. The other arguments
+    and the template parameters are the same as for `BasicDeltaIterator`.
+ */
+template <typename PointType, typename Index = size_t>
+class BasicShellIterator {
+ public:
+  typedef typename PointType::real_type Real;
+
+  BasicShellIterator(const Cell& subcell, const int* shape, const double* center,
+      const double inner, const double outer, const void* points, const size_t npoint,
+      const size_t point_size, const BasicCellMap<Index>& cell_map);
+  ~BasicShellIterator();
+
+  bool busy() const { return cell_walker_->busy(); }
+  BasicShellIterator& operator++();
+  BasicShellIterator operator++(int);
+
+  const Real* delta() const { return delta_; }
+  Real distance() const { return distance_; }
+  Index ipoint() const { return cell_walker_->ipoint(); }
+
+ private:
+  void increment();
+  //! Jumps over the subcells of the current bar that lie within the inner sphere.
+  void skip_inner();
+  //! Computes the run of subcells of the current bar within the inner sphere.
+  void update_inner_run();
+  //! Tests if a subcell (unwrapped icell) lies entirely within the inner sphere.
+  bool inside_inner(const int* icell) const;
 
   // Provided through constructor
   const Cell& subcell_;
-  int* shape_;
+  const double center_[3];
+  const double inner_;
+  const double outer_;
+
+  // Internal data
+  BasicCellWalker<PointType, Index>* cell_walker_;
+  Real delta_[3];
+  Real distance_;
+  int inner_begin_;  //!< first unwrapped icell of the current bar inside the inner sphere
+  int inner_end_;    //!< end of the run of icells inside the inner sphere
+};
+
+typedef BasicShellIterator<Point> ShellIterator;
+typedef BasicShellIterator<PointF> ShellIteratorF;
+typedef BasicShellIterator<Point, uint32_t> ShellIterator32;
+typedef BasicShellIterator<PointF, uint32_t> ShellIteratorF32;
+
+
+/** @brief
+        Iterates over all points within a box (parallelepiped), using a cell map.
+
+    The box is defined as in `Cell::bars_box`. Only the subcells of `bars_box` are
+    visited and every point in them is tested exactly against the box. Periodic images
+    are included in the same way as in `BasicDeltaIterator`, i.e. a point may be
+    visited several times when the box is larger than the periodic cell. The template
+    parameters are also the same as for `BasicDeltaIterator`.
+ */
+template <typename PointType, typename Index = size_t>
+class BasicBoxIterator {
+ public:
+  typedef typename PointType::real_type Real;
+
+  BasicBoxIterator(const Cell& subcell, const int* shape, const double* origin,
+      const double* edges, const void* points, const size_t npoint,
+      const size_t point_size, const BasicCellMap<Index>& cell_map);
+  ~BasicBoxIterator();
+
+  bool busy() const { return cell_walker_->busy(); }
+  BasicBoxIterator& operator++();
+  BasicBoxIterator operator++(int);
+
+  //! Relative vector from the origin of the box to the (periodic image of the) point.
+  const Real* delta() const { return delta_; }
+  //! Coordinates of the point in units of the edges, all in the range `[0, 1]`.
+  const double* box_frac() const { return box_frac_; }
+  Index ipoint() const { return cell_walker_->ipoint(); }
+
+ private:
+  void increment();
+
+  // Provided through constructor
+  const Cell box_;
+
+  // Internal data
+  BasicCellWalker<PointType, Index>* cell_walker_;
+  Real delta_[3];
+  double box_frac_[3];
+};
+
+typedef BasicBoxIterator<Point> BoxIterator;
+typedef BasicBoxIterator<PointF> BoxIteratorF;
+typedef BasicBoxIterator<Point, uint32_t> BoxIterator32;
+typedef BasicBoxIterator<PointF, uint32_t> BoxIteratorF32;
+
+
+/** @brief
+        Iterates over all points within a cutoff sphere, in order of increasing distance.
+
+    The arguments are the same as for `BasicDeltaIterator`, except that the subcell
+    must be 3D. All bars within the cutoff sphere are put in a priority queue, ordered
+    by a lower bound on their distance to the center. Only when a bar reaches the top
+    of the queue, its non-empty subcells are looked up in the cell map and pushed back
+    onto the queue, with their own lower bounds. Points are only taken from a subcell
+    when it reaches the top of the queue, and they are buffered in a second priority
+    queue. A point is returned as soon as it is closer than the lower bound of the next
+    bar or subcell, such that only points near the current distance are kept in memory.
+    Consumers can just stop iterating when the remaining (more distant) points are not
+    needed, which also avoids the lookups of the distant subcells.
+ */
+template <typename PointType, typename Index = size_t>
+class BasicSortedDeltaIterator {
+ public:
+  typedef typename PointType::real_type Real;
+
+  BasicSortedDeltaIterator(const Cell& subcell, const int* shape, const double* center,
+      const double cutoff, const void* points, const size_t npoint,
+      const size_t point_size, const BasicCellMap<Index>& cell_map);
+  BasicSortedDeltaIterator(const Cell& subcell, const double* center,
+      const double cutoff, const void* points, const size_t npoint,
+      const size_t point_size, const BasicCellMap<Index>& cell_map)
+      : BasicSortedDeltaIterator(subcell, nullptr, center, cutoff, points, npoint,
+        point_size, cell_map) {}
+
+  bool busy() const { return busy_; }
+  BasicSortedDeltaIterator& operator++();
+  BasicSortedDeltaIterator operator++(int);
+
+  const Real* delta() const { return delta_; }
+  Real distance() const { return distance_; }
+  Index ipoint() const { return ipoint_; }
+  //! The number of lookups in the cell map so far.
+  size_t nlookup() const { return nlookup_; }
+
+ private:
+  //! A bar or a subcell in the queue, with a lower bound on the distance to the center.
+  struct CellEntry {
+    double distance_min;
+    bool bar;
+    int icell[3];   //!< unwrapped icell of the (first) subcell
+    int icell_end;  //!< end of a bar in the last direction
+    Index ibegin;   //!< first point of a subcell
+    Index iend;     //!< end of the points of a subcell
+    bool operator<(const CellEntry& other) const {
+      return distance_min > other.distance_min;
+    }
+  };
+  //! A buffered point within the cutoff sphere.
+  struct PointEntry {
+    Real distance;
+    Index ipoint;
+    Real delta[3];
+    bool operator<(const PointEntry& other) const { return distance > other.distance; }
+  };
+
+  void increment();
+  //! Lower bound on the distance to the subcells from icell to icell_end (exclusive).
+  double distance_min(const int* icell, const int* icell_end) const;
+  //! Looks up the subcells of a bar and puts the non-empty ones in the queue.
+  void split_bar(const CellEntry& bar_entry);
+  //! Puts the points of a subcell within the cutoff sphere in the point queue.
+  void buffer_points(const CellEntry& cell_entry);
+
+  // Provided through constructor
+  const Cell& subcell_;
+  int shape_[3];
   const double center_[3];
   const double cutoff_;
   const char* points_char_;
   const size_t npoint_;
   const size_t point_size_;
-  const CellMap& cell_map_;
+  const BasicCellMap<Index>& cell_map_;
 
   // Internal data
-  std::vector<int> bars_;
-  BarIterator* bar_iterator_;
-  const Point* point_;
-  double cell_delta_[3];
+  double frac_center_[3];
+  std::vector<CellEntry> cell_queue_;
+  std::vector<PointEntry> point_queue_;
+  Real delta_[3];
+  Real distance_;
+  Index ipoint_;
+  size_t nlookup_;
+  bool busy_;
+};
+
+typedef BasicSortedDeltaIterator<Point> SortedDeltaIterator;
+typedef BasicSortedDeltaIterator<PointF> SortedDeltaIteratorF;
+
+
+/** @brief
+        Iterates over all pairs of neighbors of a center, e.g. for three-body terms.
+
+    For every center, set with `reset`, all neighbors within the cutoff sphere are
+    collected once into a compact buffer with a `BasicDeltaIterator`. The iterator then
+    runs over all pairs of (distinct) neighbors `0` and `1`, with both relative vectors
+    from the center and the relative vector from neighbor `0` to neighbor `1`. The
+    buffer is reused for the next center, such that no allocations are needed once it
+    is large enough. Neighbors at zero distance, e.g. the center itself, are skipped.
+
+    When `symmetric` is true, each pair is visited only once, with the first neighbor
+    preceding the second in the buffer. Otherwise, both orders are visited.
+ */
+template <typename PointType, typename Index = size_t>
+class BasicTripletIterator {
+ public:
+  typedef typename PointType::real_type Real;
+
+  BasicTripletIterator(const Cell& subcell, const int* shape, const double cutoff,
+      const void* points, const size_t npoint, const size_t point_size,
+      const BasicCellMap<Index>& cell_map, const bool symmetric);
+
+  //! Collects the neighbors of a new center and moves to the first pair.
+  void reset(const double* center);
+
+  bool busy() const { return ineighbor0_ < neighbors_.size(); }
+  BasicTripletIterator& operator++();
+  BasicTripletIterator operator++(int);
+
+  //! The number of neighbors of the current center.
+  size_t nneighbor() const { return neighbors_.size(); }
+  Index ipoint0() const { return neighbors_[ineighbor0_].ipoint; }
+  Index ipoint1() const { return neighbors_[ineighbor1_].ipoint; }
+  const Real* delta0() const { return neighbors_[ineighbor0_].delta; }
+  const Real* delta1() const { return neighbors_[ineighbor1_].delta; }
+  Real distance0() const { return neighbors_[ineighbor0_].distance; }
+  Real distance1() const { return neighbors_[ineighbor1_].distance; }
+  //! Relative vector from the first to the second neighbor.
+  const Real* delta01() const { return delta01_; }
+  Real distance01() const { return distance01_; }
+
+ private:
+  //! A neighbor of the current center.
+  struct Neighbor {
+    Index ipoint;
+    Real delta[3];
+    Real distance;
+  };
+
+  void increment(bool initialization);
+
+  // Provided through constructor
+  const Cell& subcell_;
+  int shape_[3];
+  const bool has_shape_;
+  const double cutoff_;
+  const void* points_;
+  const size_t npoint_;
+  const size_t point_size_;
+  const BasicCellMap<Index>& cell_map_;
+  const bool symmetric_;
+
+  // Internal data
+  std::vector<Neighbor> neighbors_;
+  size_t ineighbor0_;
+  size_t ineighbor1_;
+  Real delta01_[3];
+  Real distance01_;
+};
+
+typedef BasicTripletIterator<Point> TripletIterator;
+typedef BasicTripletIterator<PointF> TripletIteratorF;
+
+
+/** @brief
+        Iterates over all points of a periodic regular grid within a cutoff sphere.
+
+    The grid points are not stored. They are located at integer linear combinations of
+    the (three) vectors of `grid_cell`, with indices in the range `[0, shape[ivec][`
+    along each vector. For a grid with a different origin, just subtract that origin
+    from the center. The candidate grid indexes are derived directly from the
+    intersections of the cutoff sphere with the lattice planes and lines, such that no
+    `assign_icell`, `sort_by_icell` or `create_cell_map` is needed.
+
+    When a metric is given, the cutoff sphere becomes an ellipsoid, see
+    `Cell::bars_cutoff_metric`, and `distance()` is the corresponding metric distance,
+    i.e. `sqrt(delta^T metric delta)`. The relative vector `delta()` is still Cartesian.
+ */
+class GridIterator {
+ public:
+  GridIterator(const Cell& grid_cell, const int* shape, const double* center,
+      const double* metric, const double cutoff);
+  GridIterator(const Cell& grid_cell, const int* shape, const double* center,
+      const double cutoff)
+      : GridIterator(grid_cell, shape, center, nullptr, cutoff) {}
+  ~GridIterator();
+
+  bool busy() const { return busy_; }
+  GridIterator& operator++();
+  GridIterator operator++(int);
+
+  const double* delta() const { return delta_; }
+  double distance() const { return distance_; }
+  //! Row-major index of the grid point, i.e. `(igrid[0]*shape[1] + igrid[1])*shape[2]
+  //! + igrid[2]`.
+  size_t ipoint() const { return ipoint_; }
+  //! Grid indexes of the current point, wrapped in the range `[0, shape[ivec][`.
+  const int* igrid() const { return igrid_; }
+  //! Integer multiples of the periodic grid translations, see BarIterator::coeffs.
+  const int* coeffs() const { return coeffs_; }
+
+ private:
+  void take_range(const int ivec);
+  void increment(bool initialization);
+
+  // Provided through constructor
+  const Cell& grid_cell_;
+  const int shape_[3];
+  const double center_[3];
+  const bool has_metric_;
+  double metric_[9];
+  const double cutoff_;
+
+  // Internal data
+  SphereSlice* sphere_slice_;  //!< Only used for non-cuboid grids or with a metric
+  double sphere_center_[3];    //!< Only used with a metric
+  double frac_center_[3];      //!< Only used for cuboid grids
+  double radius_sq_[3];        //!< Only used for cuboid grids
+  int ranges_begin_[3];
+  int ranges_end_[3];
+  int igrid_unwrapped_[3];
+  int igrid_[3];
+  int coeffs_[3];
   double delta_[3];
   double distance_;
   size_t ipoint_;
-  size_t ibegin_;
-  size_t iend_;
+  bool busy_;
 };
 
 
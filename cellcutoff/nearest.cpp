@@ -0,0 +1,177 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include "cellcutoff/nearest.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/decomposition.h"
+
+
+namespace cellcutoff {
+
+
+namespace {
+
+//! A candidate neighbor in the bounded max-heap.
+template <typename Index>
+struct Neighbor {
+  double distance;
+  Index ipoint;
+  double delta[3];
+  bool operator<(const Neighbor& other) const { return distance < other.distance; }
+};
+
+}  // namespace
+
+
+template <typename PointType, typename Index>
+size_t nearest_neighbors(const Cell& subcell, const int* shape, const double* center,
+    size_t k, const void* points, size_t npoint, size_t point_size,
+    const BasicCellMap<Index>& cell_map, Index* ipoints, double* distances,
+    double* deltas) {
+  // Check args
+  if (subcell.nvec() != 3)
+    throw std::domain_error("nearest_neighbors requires a 3D subcell.");
+  int shape_safe[3]{0, 0, 0};
+  if (shape != nullptr)
+    std::copy(shape, shape + 3, shape_safe);
+  const bool periodic = (shape_safe[0] > 0) || (shape_safe[1] > 0) || (shape_safe[2] > 0);
+  if ((k == 0) || (npoint == 0) || cell_map.empty()) return 0;
+
+  // The (unwrapped) subcell of the center and the distances to its faces, in fractional
+  // coordinates.
+  double frac[3];
+  subcell.to_frac(center, frac);
+  int icell_center[3];
+  double frac_face[3];
+  for (int ivec = 0; ivec < 3; ++ivec) {
+    icell_center[ivec] = static_cast<int>(floor(frac[ivec]));
+    double frac_rel = frac[ivec] - icell_center[ivec];
+    frac_face[ivec] = std::min(frac_rel, 1.0 - frac_rel);
+  }
+
+  std::vector<Neighbor<Index>> heap;
+  heap.reserve(k);
+  size_t ncell_found = 0;
+  const char* points_char = reinterpret_cast<const char*>(points);  // Ugly sweet hack
+  for (int ishell = 0; ; ++ishell) {
+    if (ishell > 0) {
+      // Without periodic images, every subcell in the cell map is found at most once.
+      // Stop when all of them are found, as all further shells are empty. (The cell map
+      // may cover just a subset of the points.)
+      if (!periodic && (ncell_found == cell_map.size())) break;
+      // Stop when no point in this shell can be closer than the k-th neighbor. Such a
+      // point is separated from the center by at least ishell - 1 layers of subcells,
+      // plus the distance to the face of the subcell of the center.
+      if (heap.size() == k) {
+        double distance_min = INFINITY;
+        for (int ivec = 0; ivec < 3; ++ivec) {
+          distance_min = std::min(distance_min,
+              (ishell - 1 + frac_face[ivec])*subcell.spacings()[ivec]);
+        }
+        if (distance_min > heap.front().distance) break;
+      }
+    }
+    // Loop over all subcells in the shell. Only the first and the last subcell are
+    // included in the inner loop, unless one of the outer loops is at the boundary.
+    int delta_icell[3];
+    for (delta_icell[0] = -ishell; delta_icell[0] <= ishell; ++delta_icell[0]) {
+      for (delta_icell[1] = -ishell; delta_icell[1] <= ishell; ++delta_icell[1]) {
+        bool boundary = (abs(delta_icell[0]) == ishell) ||
+                        (abs(delta_icell[1]) == ishell);
+        int step = boundary ? 1 : 2*ishell;
+        for (delta_icell[2] = -ishell; delta_icell[2] <= ishell; delta_icell[2] += step) {
+          // Look up the points in the wrapped subcell.
+          std::array<int, 3> key;
+          int coeffs[3];
+          for (int ivec = 0; ivec < 3; ++ivec) {
+            key[ivec] = robust_wrap(icell_center[ivec] + delta_icell[ivec],
+                                    shape_safe[ivec], &coeffs[ivec]);
+          }
+          auto it = cell_map.find(key);
+          if (it == cell_map.end()) continue;
+          ++ncell_found;
+          // Relative vector of the center to the periodic image of the subcell.
+          double cell_delta[3]{-center[0], -center[1], -center[2]};
+          int translate_icell[3]{coeffs[0]*shape_safe[0], coeffs[1]*shape_safe[1],
+                                 coeffs[2]*shape_safe[2]};
+          subcell.iadd_vec(cell_delta, translate_icell);
+          // Update the heap with all points in the subcell.
+          for (Index ipoint = it->second[0]; ipoint < it->second[1]; ++ipoint) {
+            const PointType* point(reinterpret_cast<const PointType*>(  // Ugly sweet hack
+                points_char + ipoint*point_size));
+            Neighbor<Index> neighbor;
+            neighbor.ipoint = ipoint;
+            for (int ivec = 0; ivec < 3; ++ivec)
+              neighbor.delta[ivec] = point->cart_[ivec] + cell_delta[ivec];
+            neighbor.distance = sqrt(neighbor.delta[0]*neighbor.delta[0] +
+                                     neighbor.delta[1]*neighbor.delta[1] +
+                                     neighbor.delta[2]*neighbor.delta[2]);
+            if (heap.size() < k) {
+              heap.push_back(neighbor);
+              std::push_heap(heap.begin(), heap.end());
+            } else if (neighbor.distance < heap.front().distance) {
+              std::pop_heap(heap.begin(), heap.end());
+              heap.back() = neighbor;
+              std::push_heap(heap.begin(), heap.end());
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Copy the results in increasing order of distance.
+  std::sort_heap(heap.begin(), heap.end());
+  for (size_t ineighbor = 0; ineighbor < heap.size(); ++ineighbor) {
+    ipoints[ineighbor] = heap[ineighbor].ipoint;
+    distances[ineighbor] = heap[ineighbor].distance;
+    if (deltas != nullptr)
+      std::copy(heap[ineighbor].delta, heap[ineighbor].delta + 3, deltas + 3*ineighbor);
+  }
+  return heap.size();
+}
+
+
+template size_t nearest_neighbors<Point, size_t>(const Cell& subcell, const int* shape,
+    const double* center, size_t k, const void* points, size_t npoint, size_t point_size,
+    const CellMap& cell_map, size_t* ipoints, double* distances, double* deltas);
+template size_t nearest_neighbors<PointF, size_t>(const Cell& subcell, const int* shape,
+    const double* center, size_t k, const void* points, size_t npoint, size_t point_size,
+    const CellMap& cell_map, size_t* ipoints, double* distances, double* deltas);
+template size_t nearest_neighbors<Point, uint32_t>(const Cell& subcell, const int* shape,
+    const double* center, size_t k, const void* points, size_t npoint, size_t point_size,
+    const CellMap32& cell_map, uint32_t* ipoints, double* distances, double* deltas);
+template size_t nearest_neighbors<PointF, uint32_t>(const Cell& subcell, const int* shape,
+    const double* center, size_t k, const void* points, size_t npoint, size_t point_size,
+    const CellMap32& cell_map, uint32_t* ipoints, double* distances, double* deltas);
+
+
+}  // namespace cellcutoff
+
+// vim: textwidth=90 et ts=2 sw=2
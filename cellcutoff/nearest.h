@@ -0,0 +1,83 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+/** @file */
+
+
+#ifndef CELLCUTOFF_NEAREST_H_
+#define CELLCUTOFF_NEAREST_H_
+
+#include <cstddef>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/decomposition.h"
+
+
+namespace cellcutoff {
+
+
+/** @brief
+        Finds the k nearest (periodic images of) points to a center.
+
+    The search expands outward over shells of subcells around the subcell of the
+    center. A shell consists of all subcells whose (unwrapped) indexes differ by exactly
+    `ishell` from those of the center, in at least one direction. The k closest points
+    encountered so far are kept in a bounded max-heap. The search stops as soon as the
+    lower bound on the distance to any point in the next shell, derived from the
+    `spacings()` of the subcell, exceeds the k-th smallest distance in the heap.
+
+    The arguments `subcell`, `shape`, `points`, `npoint`, `point_size` and `cell_map`
+    have the same meaning as for `DeltaIterator`. When some directions are periodic,
+    the same point may be found several times, as different periodic images.
+
+    @param center
+        The Cartesian coordinates of the center.
+
+    @param k
+        The number of neighbors to find.
+
+    @param ipoints
+        Output array of size `k` with the indexes of the nearest points.
+
+    @param distances
+        Output array of size `k` with the distances to the nearest points, in
+        increasing order.
+
+    @param deltas
+        Output array of size `3*k` with the relative vectors from the center to the
+        nearest points, or `nullptr` if not needed.
+
+    @return
+        The number of neighbors found, which is only smaller than `k` when there are no
+        periodic directions and less than `k` points in the cell map, or when the cell
+        map is empty.
+ */
+template <typename PointType = Point, typename Index = size_t>
+size_t nearest_neighbors(const Cell& subcell, const int* shape, const double* center,
+    size_t k, const void* points, size_t npoint, size_t point_size,
+    const BasicCellMap<Index>& cell_map, Index* ipoints, double* distances,
+    double* deltas);
+
+
+}  // namespace cellcutoff
+
+
+#endif  // CELLCUTOFF_NEAREST_H_
+
+// vim: textwidth=90 et ts=2 sw=2
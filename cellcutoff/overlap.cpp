@@ -0,0 +1,183 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include "cellcutoff/overlap.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/cell_list.h"
+#include "cellcutoff/cell_pairs.h"
+#include "cellcutoff/decomposition.h"
+#include "cellcutoff/iterators.h"
+#include "cellcutoff/parallel.h"
+#include "cellcutoff/vec3.h"
+
+
+namespace cellcutoff {
+
+
+namespace {
+
+//! Sphere record with the original index, used for the decomposition.
+struct Sphere {
+  Sphere(const double* cart, size_t index, double radius)
+      : point(cart), index(index), radius(radius) {}
+  Point point;
+  size_t index;
+  double radius;
+};
+
+/** @brief
+        Calls `function(ithread, sphere0, sphere1, distance)` for all overlapping pairs.
+
+    The loop over subcell pairs stops early when `function` returns true.
+ */
+template <typename Function>
+void loop_overlaps(const Cell& cell, const double* carts, const double* radii,
+    size_t npoint, size_t nthread, Function function) {
+  // Check args
+  double radius_max = 0.0;
+  for (size_t ipoint = 0; ipoint < npoint; ++ipoint) {
+    if (!(radii[ipoint] >= 0))
+      throw std::domain_error("The radii must not be negative.");
+    radius_max = std::max(radius_max, radii[ipoint]);
+  }
+  if (radius_max == 0.0) return;
+
+  // Decomposition
+  const double cutoff = 2*radius_max;
+  int shape[3];
+  std::unique_ptr<Cell> subcell(cell.create_subcell(cutoff, shape));
+  std::vector<Sphere> spheres;
+  spheres.reserve(npoint);
+  for (size_t ipoint = 0; ipoint < npoint; ++ipoint)
+    spheres.emplace_back(carts + 3*ipoint, ipoint, radii[ipoint]);
+  assign_icell(*subcell, shape, spheres.data(), npoint, sizeof(Sphere));
+  sort_by_icell(spheres.data(), npoint, sizeof(Sphere));
+  std::unique_ptr<CellMap> cell_map(create_cell_map(spheres.data(), npoint,
+                                                    sizeof(Sphere)));
+  const std::vector<CellPair> cell_pairs(
+      create_cell_pairs(*subcell, shape, cutoff, *cell_map, true));
+
+  // Loop over all pairs of spheres, until some thread requests to stop.
+  std::atomic<bool> stop(false);
+  parallel_for(cell_pairs.size(), get_nthread(nthread), [&cell_pairs, &spheres, &stop,
+      &function](size_t ithread, size_t icell_pair) {
+    if (stop.load(std::memory_order_relaxed)) return;
+    const CellPair& cell_pair = cell_pairs[icell_pair];
+    for (size_t isphere0 = cell_pair.begin0; isphere0 < cell_pair.end0; ++isphere0) {
+      const Sphere& sphere0 = spheres[isphere0];
+      for (size_t isphere1 = cell_pair.self ? isphere0 + 1 : cell_pair.begin1;
+           isphere1 < cell_pair.end1; ++isphere1) {
+        const Sphere& sphere1 = spheres[isphere1];
+        double delta[3];
+        vec3::delta(sphere0.point.cart_, sphere1.point.cart_, delta);
+        vec3::iadd(delta, cell_pair.translation);
+        const double radius_sum = sphere0.radius + sphere1.radius;
+        const double distance_sq = vec3::normsq(delta);
+        if (distance_sq >= radius_sum*radius_sum) continue;
+        if (function(ithread, sphere0, sphere1, sqrt(distance_sq))) {
+          stop.store(true, std::memory_order_relaxed);
+          return;
+        }
+      }
+    }
+  });
+}
+
+}  // namespace
+
+
+std::vector<Overlap> find_overlaps(const Cell& cell, const double* carts,
+    const double* radii, size_t npoint, size_t nthread) {
+  nthread = get_nthread(nthread);
+  std::vector<std::vector<Overlap>> thread_overlaps(nthread);
+  loop_overlaps(cell, carts, radii, npoint, nthread, [&thread_overlaps](
+      size_t ithread, const Sphere& sphere0, const Sphere& sphere1, double distance) {
+    thread_overlaps[ithread].push_back(Overlap{std::min(sphere0.index, sphere1.index),
+        std::max(sphere0.index, sphere1.index), distance});
+    return false;
+  });
+  std::vector<Overlap> overlaps;
+  for (const auto& overlaps_part : thread_overlaps)
+    overlaps.insert(overlaps.end(), overlaps_part.begin(), overlaps_part.end());
+  std::sort(overlaps.begin(), overlaps.end(), [](const Overlap& overlap0,
+      const Overlap& overlap1) {
+    if (overlap0.ipoint0 != overlap1.ipoint0) return overlap0.ipoint0 < overlap1.ipoint0;
+    if (overlap0.ipoint1 != overlap1.ipoint1) return overlap0.ipoint1 < overlap1.ipoint1;
+    return overlap0.distance < overlap1.distance;
+  });
+  return overlaps;
+}
+
+
+bool any_overlap(const Cell& cell, const double* carts, const double* radii,
+    size_t npoint, size_t nthread) {
+  std::atomic<bool> found(false);
+  loop_overlaps(cell, carts, radii, npoint, nthread, [&found](
+      size_t, const Sphere&, const Sphere&, double) {
+    found.store(true);
+    return true;
+  });
+  return found.load();
+}
+
+
+bool any_overlap(const CellList& cell_list, const double* radii, double radius_max,
+    const double* center, double radius, size_t iskip) {
+  if (!(radius >= 0) || !(radius_max >= 0))
+    throw std::domain_error("The radii must not be negative.");
+  const Cell& subcell = cell_list.subcell();
+  const int* shape = cell_list.shape();
+  std::vector<int> bars;
+  subcell.bars_cutoff(center, radius + radius_max, &bars);
+  for (BarIterator bit(bars, 3, shape); bit.busy(); ++bit) {
+    const std::vector<size_t>* cell_points = cell_list.cell_points(bit.icell());
+    if ((cell_points == nullptr) || cell_points->empty()) continue;
+    // Relative vector from the center to the lower corner of the periodic image.
+    double cell_delta[3];
+    vec3::copy(center, cell_delta);
+    vec3::iscale(cell_delta, -1.0);
+    int translate_icell[3]{bit.coeffs()[0]*shape[0], bit.coeffs()[1]*shape[1],
+                           bit.coeffs()[2]*shape[2]};
+    subcell.iadd_vec(cell_delta, translate_icell);
+    for (size_t ipoint : *cell_points) {
+      if (ipoint == iskip) continue;
+      double delta[3];
+      vec3::copy(cell_list.point(ipoint).cart_, delta);
+      vec3::iadd(delta, cell_delta);
+      const double radius_sum = radius + radii[ipoint];
+      if (vec3::normsq(delta) < radius_sum*radius_sum) return true;
+    }
+  }
+  return false;
+}
+
+
+}  // namespace cellcutoff
+
+// vim: textwidth=90 et ts=2 sw=2
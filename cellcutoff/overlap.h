@@ -0,0 +1,126 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+/** @file */
+
+
+#ifndef CELLCUTOFF_OVERLAP_H_
+#define CELLCUTOFF_OVERLAP_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/cell_list.h"
+
+
+namespace cellcutoff {
+
+
+//! An overlapping pair of spheres, as found by `find_overlaps`.
+struct Overlap {
+  size_t ipoint0;   //!< index of the first sphere
+  size_t ipoint1;   //!< index of the second sphere, never smaller than ipoint0
+  double distance;  //!< distance between (the periodic images of) both centers
+};
+
+
+/** @brief
+        Finds all pairs of overlapping spheres.
+
+    Two spheres overlap when the distance between their centers is strictly smaller
+    than the sum of their radii. The spheres are decomposed with a subcell whose
+    spacings are up to twice the largest radius. Each pair of (periodic images of)
+    spheres is tested once, using a half list of subcell pairs (see
+    `create_cell_pairs`). When a sphere is large compared to the cell, it may overlap
+    with several periodic images of another sphere, or even with its own images
+    (`ipoint0 == ipoint1`). Each image then gives a separate record.
+
+    @param cell
+        The periodic cell, may be 0D, 1D, 2D or 3D.
+
+    @param carts
+        Cartesian coordinates of the centers, `3*npoint` doubles.
+
+    @param radii
+        The radii of the spheres, `npoint` non-negative doubles.
+
+    @param npoint
+        The number of spheres.
+
+    @param nthread
+        The number of threads, zero means all hardware threads.
+
+    @return
+        The overlapping pairs, sorted by `ipoint0`, `ipoint1` and `distance`.
+ */
+std::vector<Overlap> find_overlaps(const Cell& cell, const double* carts,
+    const double* radii, size_t npoint, size_t nthread);
+
+
+/** @brief
+        Tests if any pair of spheres overlaps.
+
+    This is equivalent to `!find_overlaps(...).empty()`, except that all threads stop
+    as soon as one overlap is found. The arguments are the same as for
+    `find_overlaps`. For Monte Carlo moves, the overload with a `CellList` avoids
+    rebuilding the decomposition for every trial.
+ */
+bool any_overlap(const Cell& cell, const double* carts, const double* radii,
+    size_t npoint, size_t nthread);
+
+
+/** @brief
+        Tests if a trial sphere overlaps with any sphere in a cell list.
+
+    Only the subcells within `radius + radius_max` of the trial center are visited and
+    the search stops at the first overlap. The cell list is reused between calls, so
+    a Monte Carlo move costs O(1) instead of rebuilding the decomposition. Overlaps
+    of the trial sphere with its own periodic images are not considered.
+
+    @param cell_list
+        The centers of the spheres.
+
+    @param radii
+        The radii of the spheres, indexed like the cell list, at least
+        `cell_list.capacity()` non-negative doubles.
+
+    @param radius_max
+        An upper bound for all radii in the cell list.
+
+    @param center
+        The Cartesian coordinates of the trial sphere.
+
+    @param radius
+        The radius of the trial sphere.
+
+    @param iskip
+        A point of the cell list to ignore, e.g. the old position of a moved sphere.
+        Use `cell_list.capacity()` to test against all spheres.
+ */
+bool any_overlap(const CellList& cell_list, const double* radii, double radius_max,
+    const double* center, double radius, size_t iskip);
+
+
+}  // namespace cellcutoff
+
+
+#endif  // CELLCUTOFF_OVERLAP_H_
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -0,0 +1,220 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+/** @file */
+
+
+#ifndef CELLCUTOFF_PAIR_H_
+#define CELLCUTOFF_PAIR_H_
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/cell_pairs.h"
+#include "cellcutoff/decomposition.h"
+#include "cellcutoff/parallel.h"
+#include "cellcutoff/vec3.h"
+
+
+namespace cellcutoff {
+
+
+/** @brief
+        Computes the energy, forces and virial of a pair potential.
+
+    The energy is the sum of the pair potential over all pairs of (periodic images of)
+    points within the cutoff distance, excluding the interaction of a point with
+    itself. Each pair is evaluated once, using a half list of subcell pairs (see
+    `create_cell_pairs`), and Newton's third law is used for the forces. The pairs of
+    one point with a neighboring subcell are collected in a batch, for which the
+    potential is evaluated in a separate loop. The subcell pairs are distributed over
+    threads, which accumulate forces in thread-local buffers. These buffers are reduced
+    in a fixed thread order, such that the result is reproducible for a given number of
+    threads.
+
+    @param cell
+        The periodic cell, may be 0D, 1D, 2D or 3D.
+
+    @param carts
+        Cartesian coordinates of the points, `3*npoint` doubles.
+
+    @param npoint
+        The number of points.
+
+    @param cutoff
+        The cutoff distance, must be strictly positive.
+
+    @param potential
+        A functor with the signature
+        `double potential(size_t ipoint0, size_t ipoint1, double distance_sq,
+        double* dvdr)`. It returns the pair energy and writes its derivative towards
+        the distance to `dvdr`. The indexes of the points allow for type- or
+        charge-dependent potentials. The functor is called concurrently from several
+        threads.
+
+    @param forces
+        Output array with `3*npoint` doubles for the forces, i.e. minus the gradient of
+        the energy, or `nullptr` if not needed.
+
+    @param virial
+        Output array with 9 doubles for the virial tensor, or `nullptr` if not needed.
+        This is the sum over all pairs of the outer product of the relative vector (from
+        the first to the second point) with the force on the second point, which is
+        also minus the derivative of the energy with respect to a homogeneous strain.
+
+    @param nthread
+        The number of threads, zero means all hardware threads.
+
+    @return
+        The total energy.
+ */
+template <typename Potential>
+double pair_potential(const Cell& cell, const double* carts, size_t npoint,
+    double cutoff, const Potential& potential, double* forces, double* virial,
+    size_t nthread) {
+  // Check args
+  if (cutoff <= 0)
+    throw std::domain_error("The cutoff must be strictly positive.");
+  if (forces != nullptr) std::fill(forces, forces + 3*npoint, 0.0);
+  if (virial != nullptr) std::fill(virial, virial + 9, 0.0);
+  if (npoint == 0) return 0.0;
+
+  // Point record with the original index, used for the decomposition.
+  struct IndexedPoint {
+    IndexedPoint(const double* cart, size_t index) : point(cart), index(index) {}
+    Point point;
+    size_t index;
+  };
+
+  // Thread-local accumulators and batches of pairs.
+  struct Buffer {
+    double energy;
+    std::vector<double> forces;
+    double virial[9];
+    std::vector<size_t> batch_ipoints;
+    std::vector<double> batch_deltas;
+    std::vector<double> batch_distances_sq;
+    std::vector<double> batch_energies;
+    std::vector<double> batch_dvdrs;
+  };
+
+  // Decomposition
+  int shape[3];
+  std::unique_ptr<Cell> subcell(cell.create_subcell(cutoff, shape));
+  std::vector<IndexedPoint> points;
+  points.reserve(npoint);
+  for (size_t ipoint = 0; ipoint < npoint; ++ipoint)
+    points.emplace_back(carts + 3*ipoint, ipoint);
+  assign_icell(*subcell, shape, points.data(), npoint, sizeof(IndexedPoint));
+  sort_by_icell(points.data(), npoint, sizeof(IndexedPoint));
+  std::unique_ptr<CellMap> cell_map(
+      create_cell_map(points.data(), npoint, sizeof(IndexedPoint)));
+
+  // Loop over half a list of subcell pairs.
+  const std::vector<CellPair> cell_pairs(
+      create_cell_pairs(*subcell, shape, cutoff, *cell_map, true));
+  const double cutoff_sq = cutoff*cutoff;
+  nthread = get_nthread(nthread);
+  std::vector<Buffer> buffers(nthread);
+  for (auto& buffer : buffers) {
+    buffer.energy = 0.0;
+    if (forces != nullptr) buffer.forces.resize(3*npoint, 0.0);
+    std::fill(buffer.virial, buffer.virial + 9, 0.0);
+  }
+  parallel_for(cell_pairs.size(), nthread, [&cell_pairs, &points, &buffers, &potential,
+      forces, virial, cutoff_sq](size_t ithread, size_t icell_pair) {
+    Buffer& buffer = buffers[ithread];
+    const CellPair& cell_pair = cell_pairs[icell_pair];
+    for (size_t ipoint0 = cell_pair.begin0; ipoint0 < cell_pair.end0; ++ipoint0) {
+      const IndexedPoint& point0 = points[ipoint0];
+      // Collect a batch of pairs within the cutoff.
+      buffer.batch_ipoints.clear();
+      buffer.batch_deltas.clear();
+      buffer.batch_distances_sq.clear();
+      for (size_t ipoint1 = cell_pair.self ? ipoint0 + 1 : cell_pair.begin1;
+           ipoint1 < cell_pair.end1; ++ipoint1) {
+        double delta[3];
+        vec3::delta(point0.point.cart_, points[ipoint1].point.cart_, delta);
+        vec3::iadd(delta, cell_pair.translation);
+        double distance_sq = vec3::normsq(delta);
+        if (distance_sq > cutoff_sq) continue;
+        buffer.batch_ipoints.push_back(points[ipoint1].index);
+        buffer.batch_deltas.insert(buffer.batch_deltas.end(), delta, delta + 3);
+        buffer.batch_distances_sq.push_back(distance_sq);
+      }
+      // Evaluate the potential for the whole batch at once.
+      const size_t nbatch = buffer.batch_ipoints.size();
+      buffer.batch_energies.resize(nbatch);
+      buffer.batch_dvdrs.resize(nbatch);
+      for (size_t ibatch = 0; ibatch < nbatch; ++ibatch) {
+        buffer.batch_energies[ibatch] = potential(
+            point0.index, buffer.batch_ipoints[ibatch],
+            buffer.batch_distances_sq[ibatch], &buffer.batch_dvdrs[ibatch]);
+      }
+      // Accumulate energy, forces and virial.
+      for (size_t ibatch = 0; ibatch < nbatch; ++ibatch) {
+        buffer.energy += buffer.batch_energies[ibatch];
+        if ((forces == nullptr) && (virial == nullptr)) continue;
+        const double* delta = &buffer.batch_deltas[3*ibatch];
+        double force[3];
+        vec3::copy(delta, force);
+        vec3::iscale(force, -buffer.batch_dvdrs[ibatch]/
+                            sqrt(buffer.batch_distances_sq[ibatch]));
+        if (forces != nullptr) {
+          vec3::iadd(&buffer.forces[3*buffer.batch_ipoints[ibatch]], force);
+          vec3::iadd(&buffer.forces[3*point0.index], force, -1.0);
+        }
+        if (virial != nullptr) {
+          for (int irow = 0; irow < 3; ++irow)
+            for (int icol = 0; icol < 3; ++icol)
+              buffer.virial[3*irow + icol] += delta[irow]*force[icol];
+        }
+      }
+    }
+  });
+
+  // Deterministic reduction, in order of the threads.
+  double energy = 0.0;
+  for (const auto& buffer : buffers) {
+    energy += buffer.energy;
+    if (forces != nullptr) {
+      for (size_t i = 0; i < 3*npoint; ++i)
+        forces[i] += buffer.forces[i];
+    }
+    if (virial != nullptr) {
+      for (int i = 0; i < 9; ++i)
+        virial[i] += buffer.virial[i];
+    }
+  }
+  return energy;
+}
+
+
+}  // namespace cellcutoff
+
+
+#endif  // CELLCUTOFF_PAIR_H_
+
+// vim: textwidth=90 et ts=2 sw=2
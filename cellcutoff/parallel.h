@@ -0,0 +1,92 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+/** @file */
+
+
+#ifndef CELLCUTOFF_PARALLEL_H_
+#define CELLCUTOFF_PARALLEL_H_
+
+#include <cstddef>
+#include <exception>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+
+namespace cellcutoff {
+
+
+//! Returns the number of threads to use, where zero means all hardware threads.
+inline size_t get_nthread(size_t nthread) {
+  if (nthread == 0)
+    nthread = std::thread::hardware_concurrency();
+  return (nthread == 0) ? 1 : nthread;
+}
+
+
+/** @brief
+        Calls `function(ithread, iitem)` for all items, distributed over threads.
+
+    Thread `ithread` handles the items `ithread`, `ithread + nthread`, ... This
+    interleaving keeps the load balanced when the cost per item varies smoothly. The
+    function may use `ithread` to select thread-local buffers, which the caller merges
+    afterwards. An exception raised in any thread is rethrown after all threads have
+    finished.
+
+    @param nitem
+        The number of items.
+
+    @param nthread
+        The number of threads, see `get_nthread`. Never more threads than items are
+        started. With one thread, no threads are started at all.
+ */
+template <typename Function>
+void parallel_for(size_t nitem, size_t nthread, Function function) {
+  if (nthread > nitem) nthread = nitem;
+  if (nthread <= 1) {
+    for (size_t iitem = 0; iitem < nitem; ++iitem)
+      function(0, iitem);
+    return;
+  }
+  std::vector<std::exception_ptr> errors(nthread);
+  std::vector<std::thread> threads;
+  threads.reserve(nthread);
+  for (size_t ithread = 0; ithread < nthread; ++ithread) {
+    threads.emplace_back([ithread, nitem, nthread, &function, &errors]() {
+      try {
+        for (size_t iitem = ithread; iitem < nitem; iitem += nthread)
+          function(ithread, iitem);
+      } catch (...) {
+        errors[ithread] = std::current_exception();
+      }
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+  for (const auto& error : errors)
+    if (error) std::rethrow_exception(error);
+}
+
+
+}  // namespace cellcutoff
+
+
+#endif  // CELLCUTOFF_PARALLEL_H_
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -0,0 +1,206 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include "cellcutoff/rdf.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/decomposition.h"
+#include "cellcutoff/parallel.h"
+#include "cellcutoff/stencil.h"
+
+
+namespace cellcutoff {
+
+
+RadialDistribution::RadialDistribution(double rmax, size_t nbin, int ntype)
+    : rmax_(rmax), nbin_(nbin), ntype_(ntype), nframe_(0), slot_scale_(0.0) {
+  // Check args
+  if (rmax <= 0)
+    throw std::domain_error("rmax must be strictly positive.");
+  if (nbin == 0)
+    throw std::domain_error("The number of bins must be strictly positive.");
+  if (ntype <= 0)
+    throw std::domain_error("The number of types must be strictly positive.");
+  // Squared bin edges
+  const double bin_width = rmax_/static_cast<double>(nbin_);
+  edges_sq_.resize(nbin_ + 1);
+  for (size_t ibin = 0; ibin <= nbin_; ++ibin) {
+    double edge = static_cast<double>(ibin)*bin_width;
+    edges_sq_[ibin] = edge*edge;
+  }
+  edges_sq_[nbin_] = rmax_*rmax_;
+  // Lookup table for the first bin of each slot of squared distances. With four slots
+  // per bin, only the slots near zero distance span more than one bin.
+  const size_t nslot = 4*nbin_;
+  slot_scale_ = static_cast<double>(nslot)/(rmax_*rmax_);
+  slot_bins_.resize(nslot + 1);
+  size_t ibin = 0;
+  for (size_t islot = 0; islot <= nslot; ++islot) {
+    double slot_begin = static_cast<double>(islot)/slot_scale_;
+    while ((ibin < nbin_ - 1) && (edges_sq_[ibin + 1] <= slot_begin)) ++ibin;
+    slot_bins_[islot] = ibin;
+  }
+  counts_.resize(static_cast<size_t>(ntype_)*ntype_*nbin_, 0);
+  pair_densities_.resize(static_cast<size_t>(ntype_)*ntype_, 0.0);
+}
+
+
+template <typename PointType, typename Index>
+void RadialDistribution::add_frame(const Cell& subcell, const int* shape,
+    const void* points, size_t npoint, size_t point_size,
+    const BasicCellMap<Index>& cell_map, const int* types, size_t nthread) {
+  // Check args
+  if (subcell.nvec() != 3)
+    throw std::domain_error("The RDF requires a 3D subcell.");
+  if ((shape == nullptr) || (shape[0] <= 0) || (shape[1] <= 0) || (shape[2] <= 0))
+    throw std::domain_error("The RDF requires a periodic shape in all directions.");
+  std::vector<size_t> npoint_types(ntype_, 0);
+  for (size_t ipoint = 0; ipoint < npoint; ++ipoint) {
+    int type = (types == nullptr) ? 0 : types[ipoint];
+    if ((type < 0) || (type >= ntype_))
+      throw std::domain_error("Point type out of range.");
+    ++npoint_types[type];
+  }
+
+  // Stencil of relative subcell indexes that may contain points within rmax.
+  const std::vector<std::array<int, 3>> stencil(create_stencil(subcell, rmax_, false));
+
+  // List of non-empty subcells, to be distributed over the threads.
+  std::vector<const typename BasicCellMap<Index>::value_type*> cells;
+  cells.reserve(cell_map.size());
+  for (const auto& kv : cell_map)
+    if (kv.second[0] < kv.second[1]) cells.push_back(&kv);
+
+  // Loop over all pairs of subcells and all pairs of points in them.
+  nthread = get_nthread(nthread);
+  std::vector<std::vector<uint64_t>> thread_counts(
+      std::min(nthread, std::max(cells.size(), static_cast<size_t>(1))),
+      std::vector<uint64_t>(counts_.size(), 0));
+  const char* points_char = reinterpret_cast<const char*>(points);  // Ugly sweet hack
+  const double rmax_sq = rmax_*rmax_;
+  parallel_for(cells.size(), nthread, [this, &thread_counts, &cells, &stencil,
+      &cell_map, &subcell, shape, points_char, point_size, types, rmax_sq](
+      size_t ithread, size_t icell) {
+    std::vector<uint64_t>& my_counts = thread_counts[ithread];
+    const auto& cell0 = *cells[icell];
+    for (const auto& delta_icell : stencil) {
+      // Wrapped index of the second subcell and the corresponding translation.
+      std::array<int, 3> key;
+      int translate_icell[3];
+      for (int ivec = 0; ivec < 3; ++ivec) {
+        int coeff;
+        key[ivec] = robust_wrap(cell0.first[ivec] + delta_icell[ivec], shape[ivec],
+                                &coeff);
+        translate_icell[ivec] = coeff*shape[ivec];
+      }
+      auto it = cell_map.find(key);
+      if (it == cell_map.end()) continue;
+      double translation[3]{0.0, 0.0, 0.0};
+      subcell.iadd_vec(translation, translate_icell);
+      const bool self = (translate_icell[0] == 0) && (translate_icell[1] == 0) &&
+                        (translate_icell[2] == 0);
+      for (Index ipoint0 = cell0.second[0]; ipoint0 < cell0.second[1]; ++ipoint0) {
+        const PointType* point0(reinterpret_cast<const PointType*>(  // Ugly sweet hack
+            points_char + ipoint0*point_size));
+        const double origin[3]{point0->cart_[0] - translation[0],
+                               point0->cart_[1] - translation[1],
+                               point0->cart_[2] - translation[2]};
+        const size_t offset0 = offset((types == nullptr) ? 0 : types[ipoint0], 0);
+        for (Index ipoint1 = it->second[0]; ipoint1 < it->second[1]; ++ipoint1) {
+          if (self && (ipoint0 == ipoint1)) continue;
+          const PointType* point1(reinterpret_cast<const PointType*>(  // Ugly sweet hack
+              points_char + ipoint1*point_size));
+          const double d0 = point1->cart_[0] - origin[0];
+          const double d1 = point1->cart_[1] - origin[1];
+          const double d2 = point1->cart_[2] - origin[2];
+          const double distance_sq = d0*d0 + d1*d1 + d2*d2;
+          if (distance_sq >= rmax_sq) continue;
+          const int type1 = (types == nullptr) ? 0 : types[ipoint1];
+          ++my_counts[offset0 + type1*nbin_ + find_bin(distance_sq)];
+        }
+      }
+    }
+  });
+
+  // Merge the thread-local histograms and update the normalization.
+  for (const auto& my_counts : thread_counts)
+    for (size_t i = 0; i < counts_.size(); ++i)
+      counts_[i] += my_counts[i];
+  const double volume = subcell.volume()*shape[0]*shape[1]*shape[2];
+  for (int type0 = 0; type0 < ntype_; ++type0) {
+    for (int type1 = 0; type1 < ntype_; ++type1) {
+      double npair = static_cast<double>(npoint_types[type0]);
+      npair *= static_cast<double>(npoint_types[type1]) - (type0 == type1);
+      pair_densities_[type0*ntype_ + type1] += npair/volume;
+    }
+  }
+  ++nframe_;
+}
+
+
+const uint64_t* RadialDistribution::counts(int type0, int type1) const {
+  if ((type0 < 0) || (type0 >= ntype_) || (type1 < 0) || (type1 >= ntype_))
+    throw std::domain_error("Point type out of range.");
+  return counts_.data() + offset(type0, type1);
+}
+
+
+void RadialDistribution::compute_rdf(int type0, int type1, double* rdf) const {
+  const uint64_t* my_counts = counts(type0, type1);
+  const double pair_density = pair_densities_[type0*ntype_ + type1];
+  for (size_t ibin = 0; ibin < nbin_; ++ibin) {
+    // Volume of the spherical shell of the bin
+    double r0 = sqrt(edges_sq_[ibin]);
+    double r1 = sqrt(edges_sq_[ibin + 1]);
+    double shell = 4.0*M_PI/3.0*(r1*r1*r1 - r0*r0*r0);
+    if (pair_density > 0) {
+      rdf[ibin] = static_cast<double>(my_counts[ibin])/(pair_density*shell);
+    } else {
+      rdf[ibin] = 0.0;
+    }
+  }
+}
+
+
+template void RadialDistribution::add_frame<Point, size_t>(const Cell& subcell,
+    const int* shape, const void* points, size_t npoint, size_t point_size,
+    const CellMap& cell_map, const int* types, size_t nthread);
+template void RadialDistribution::add_frame<PointF, size_t>(const Cell& subcell,
+    const int* shape, const void* points, size_t npoint, size_t point_size,
+    const CellMap& cell_map, const int* types, size_t nthread);
+template void RadialDistribution::add_frame<Point, uint32_t>(const Cell& subcell,
+    const int* shape, const void* points, size_t npoint, size_t point_size,
+    const CellMap32& cell_map, const int* types, size_t nthread);
+template void RadialDistribution::add_frame<PointF, uint32_t>(const Cell& subcell,
+    const int* shape, const void* points, size_t npoint, size_t point_size,
+    const CellMap32& cell_map, const int* types, size_t nthread);
+
+
+}  // namespace cellcutoff
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -0,0 +1,132 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+/** @file */
+
+
+#ifndef CELLCUTOFF_RDF_H_
+#define CELLCUTOFF_RDF_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/decomposition.h"
+
+
+namespace cellcutoff {
+
+
+/** @brief
+        Accumulates pair-distance histograms and radial distribution functions.
+
+    The histograms count ordered pairs of points, including all periodic images, for
+    every pair of point types. Each frame is processed with a stencil of subcell pairs
+    that is computed once, so no per-point cutoff spheres are constructed. Distances are
+    binned by their squares, with a lookup table and a few comparisons instead of a
+    square root. The subcells are distributed over threads, each with its own
+    histogram. These histograms are added at the end of the frame.
+ */
+class RadialDistribution {
+ public:
+  /** @brief
+          Create an empty accumulator.
+
+      @param rmax
+          The largest distance, which must be strictly positive.
+
+      @param nbin
+          The number of bins of width `rmax/nbin`, which must be strictly positive.
+
+      @param ntype
+          The number of point types, which must be strictly positive.
+   */
+  RadialDistribution(double rmax, size_t nbin, int ntype);
+  explicit RadialDistribution(double rmax, size_t nbin)
+      : RadialDistribution(rmax, nbin, 1) {}
+
+  /** @brief
+          Add the pair distances of one frame to the histograms.
+
+      @param subcell, shape, points, npoint, point_size, cell_map
+          The periodic decomposition of the points, as for `DeltaIterator`. All three
+          directions must be periodic.
+
+      @param types
+          The type of each point, in the range `[0, ntype[`, in the same (sorted) order
+          as the points. When `nullptr`, all points have type zero.
+
+      @param nthread
+          The number of threads, zero means all hardware threads.
+   */
+  template <typename PointType = Point, typename Index = size_t>
+  void add_frame(const Cell& subcell, const int* shape, const void* points,
+      size_t npoint, size_t point_size, const BasicCellMap<Index>& cell_map,
+      const int* types, size_t nthread);
+
+  double rmax() const { return rmax_; }
+  size_t nbin() const { return nbin_; }
+  int ntype() const { return ntype_; }
+  size_t nframe() const { return nframe_; }
+
+  //! Returns the histogram of distances from points of type0 to points of type1.
+  const uint64_t* counts(int type0, int type1) const;
+
+  /** @brief
+          Compute the radial distribution function, averaged over all frames.
+
+      The counts in each bin are divided by the number of pairs expected for an ideal
+      gas with the same densities, using the periodic volume of each frame.
+
+      @param rdf
+          Output array with `nbin` values.
+   */
+  void compute_rdf(int type0, int type1, double* rdf) const;
+
+ private:
+  //! Returns the bin of a squared distance, which must be less than rmax squared.
+  size_t find_bin(double distance_sq) const {
+    size_t ibin = slot_bins_[static_cast<size_t>(distance_sq*slot_scale_)];
+    // Correct for rounding errors in the slot and for slots spanning several bins.
+    while ((ibin > 0) && (distance_sq < edges_sq_[ibin])) --ibin;
+    while (distance_sq >= edges_sq_[ibin + 1]) ++ibin;
+    return ibin;
+  }
+  size_t offset(int type0, int type1) const {
+    return (static_cast<size_t>(type0)*ntype_ + type1)*nbin_;
+  }
+
+  const double rmax_;
+  const size_t nbin_;
+  const int ntype_;
+  size_t nframe_;
+  std::vector<double> edges_sq_;      //!< squared bin edges, nbin + 1 values
+  std::vector<size_t> slot_bins_;     //!< first bin for each slot of squared distances
+  double slot_scale_;                 //!< number of slots per unit of squared distance
+  std::vector<uint64_t> counts_;      //!< histograms for all pairs of types
+  std::vector<double> pair_densities_;  //!< sum over frames of n0*n1/volume
+};
+
+
+}  // namespace cellcutoff
+
+
+#endif  // CELLCUTOFF_RDF_H_
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -21,7 +21,10 @@
 
 #include "cellcutoff/sphere_slice.h"
 
+#include <algorithm>
 #include <cmath>
+#include <initializer_list>
+#include <limits>
 #include <memory>
 
 #include "cellcutoff/vec3.h"
@@ -34,18 +37,57 @@ namespace cellcutoff {
     if ((ARG < 0) || (ARG >= 3)) throw std::domain_error(#ARG " must be 0, 1 or 2.")
 
 
-SphereSlice::SphereSlice(const double* center, const double* normals, double radius)
-    : center_(center), normals_(normals), radius_(radius) {
+namespace {
+
+//! Masked solutions are +inf (begin) or -inf (end), instead of NaN as in solve_*.
+const double kInf = std::numeric_limits<double>::infinity();
+
+//! Number of cut planes that is handled at once by solve_range_batch.
+const int kChunk = 32;
+
+/** @brief
+        Merge solutions found on cut planes into the slices on both sides of each plane.
+
+    @param offset
+        The index of the first plane.
+ */
+void merge_edges(const int offset, const int nedge, const int nslice,
+    const double* edge_begins, const double* edge_ends, double* begins, double* ends) {
+  for (int iedge = 0; iedge < nedge; ++iedge) {
+    const int islice = offset + iedge;
+    if (islice > 0) {
+      begins[islice - 1] = std::min(begins[islice - 1], edge_begins[iedge]);
+      ends[islice - 1] = std::max(ends[islice - 1], edge_ends[iedge]);
+    }
+    if (islice < nslice) {
+      begins[islice] = std::min(begins[islice], edge_begins[iedge]);
+      ends[islice] = std::max(ends[islice], edge_ends[iedge]);
+    }
+  }
+}
+
+//! Merge a solution into the slice that contains frac_cut, if any.
+void merge_inside(const double frac_cut, const double work, const int nslice,
+    const double* cuts, double* values, const bool is_begin) {
+  for (int islice = 0; islice < nslice; ++islice) {
+    if ((frac_cut > cuts[islice]) && (frac_cut < cuts[islice + 1])) {
+      values[islice] = is_begin ? std::min(values[islice], work)
+                                : std::max(values[islice], work);
+    }
+  }
+}
+
+}  // namespace
+
+
+SphereSliceGeometry::SphereSliceGeometry(const double* normals, double radius)
+    : radius_(radius) {
   // Check sanity of arguments
   if (radius_ <= 0)
     throw std::domain_error("radius must be strictly positive.");
-  if (vec3::triple(normals_, normals_ + 3, normals_ + 6) == 0.0)
+  if (vec3::triple(normals, normals + 3, normals + 6) == 0.0)
     throw std::domain_error("The three normals must be linearly independent.");
-  // Initialize variable data members
-  cut_begin[0] = 0.0;
-  cut_begin[1] = 0.0;
-  cut_end[0] = 0.0;
-  cut_end[1] = 0.0;
+  std::copy(normals, normals + 9, normals_);
   // Compute from derived data members
   radius_sq_ = radius_*radius_;
   for (int id_axis=0; id_axis < 3; ++id_axis) {
@@ -57,15 +99,8 @@ SphereSlice::SphereSlice(const double* center, const double* normals, double rad
     norms_sq_[id_axis] = vec3::normsq(axis);
     norms_[id_axis] = sqrt(norms_sq_[id_axis]);
     frac_radii_[id_axis] = radius_*norms_[id_axis];
-    frac_center_[id_axis] = vec3::dot(center_, axis);
-    sphere_frac_begin_[id_axis] = frac_center_[id_axis] - frac_radii_[id_axis];
-    sphere_frac_end_[id_axis] = frac_center_[id_axis] + frac_radii_[id_axis];
     vec3::copy(axis, radius_normals_ + 3*id_axis);
     vec3::iscale(radius_normals_ + 3*id_axis, radius_/norms_[id_axis]);
-    vec3::copy(center_, sphere_point_begin_ + 3*id_axis);
-    vec3::iadd(sphere_point_begin_ + 3*id_axis, radius_normals_ + 3*id_axis, -1);
-    vec3::copy(center_, sphere_point_end_ + 3*id_axis);
-    vec3::iadd(sphere_point_end_ + 3*id_axis, radius_normals_ + 3*id_axis);
   }
   for (int id_axis=0; id_axis < 3; ++id_axis) {
     for (int id_cut=0; id_cut < 3; ++id_cut) {
@@ -102,6 +137,41 @@ SphereSlice::SphereSlice(const double* center, const double* normals, double rad
 }
 
 
+SphereSlice::SphereSlice(const double* center, const double* normals, double radius)
+    : own_geometry_(new SphereSliceGeometry(normals, radius)),
+      geometry_(*own_geometry_) {
+  recenter(center);
+}
+
+
+SphereSlice::SphereSlice(const SphereSliceGeometry& geometry, const double* center)
+    : geometry_(geometry) {
+  recenter(center);
+}
+
+
+void SphereSlice::recenter(const double* center) {
+  center_ = center;
+  // Initialize variable data members
+  cut_begin[0] = 0.0;
+  cut_begin[1] = 0.0;
+  cut_end[0] = 0.0;
+  cut_end[1] = 0.0;
+  // Only these depend on the center, the rest is precomputed in geometry_.
+  for (int id_axis=0; id_axis < 3; ++id_axis) {
+    const double* axis = geometry_.normals_ + 3*id_axis;
+    const double* radius_normal = geometry_.radius_normals_ + 3*id_axis;
+    frac_center_[id_axis] = vec3::dot(center_, axis);
+    sphere_frac_begin_[id_axis] = frac_center_[id_axis] - geometry_.frac_radii_[id_axis];
+    sphere_frac_end_[id_axis] = frac_center_[id_axis] + geometry_.frac_radii_[id_axis];
+    vec3::copy(center_, sphere_point_begin_ + 3*id_axis);
+    vec3::iadd(sphere_point_begin_ + 3*id_axis, radius_normal, -1);
+    vec3::copy(center_, sphere_point_end_ + 3*id_axis);
+    vec3::iadd(sphere_point_end_ + 3*id_axis, radius_normal);
+  }
+}
+
+
 void SphereSlice::solve_range(const int ncut, double* begin, double* end) const {
   switch (ncut) {
     case 0: {
@@ -134,6 +204,73 @@ void SphereSlice::set_cut_begin_end(const int icut, double new_begin, double new
 }
 
 
+void SphereSlice::solve_range_batch(const int ncut, const int nslice,
+    const double* cuts, double* begins, double* ends) const {
+  if ((ncut != 1) && (ncut != 2))
+    throw std::domain_error("ncut must be 1 or 2.");
+  if (nslice < 0)
+    throw std::domain_error("nslice must be positive.");
+  const int id_axis = ncut;
+  const int id_cut = ncut - 1;
+  std::fill(begins, begins + nslice, kInf);
+  std::fill(ends, ends + nslice, -kInf);
+
+  // Solutions on the cut planes, each shared by two slices. In case of one cut, these
+  // correspond to cases A and B of solve_range_1. In case of two cuts, these are cases
+  // A-D, G and H of solve_range_2.
+  double edge_begins[kChunk];
+  double edge_ends[kChunk];
+  for (int offset = 0; offset <= nslice; offset += kChunk) {
+    const int nedge = std::min(kChunk, nslice + 1 - offset);
+    if (ncut == 1) {
+      solve_plane_batch(id_axis, id_cut, nedge, cuts + offset, edge_begins, edge_ends);
+      merge_edges(offset, nedge, nslice, edge_begins, edge_ends, begins, ends);
+    } else {
+      solve_line_batch(id_axis, 0, id_cut, cut_begin[0], nedge, cuts + offset,
+                       edge_begins, edge_ends);
+      merge_edges(offset, nedge, nslice, edge_begins, edge_ends, begins, ends);
+      solve_line_batch(id_axis, 0, id_cut, cut_end[0], nedge, cuts + offset,
+                       edge_begins, edge_ends);
+      merge_edges(offset, nedge, nslice, edge_begins, edge_ends, begins, ends);
+      solve_plane_batch(id_axis, id_cut, nedge, cuts + offset, edge_begins, edge_ends,
+                        0);
+      merge_edges(offset, nedge, nslice, edge_begins, edge_ends, begins, ends);
+    }
+  }
+
+  // Solutions that do not depend on the slice, each one is only valid in the slice
+  // that contains it: the whole-sphere solution and, with two cuts, cases E and F of
+  // solve_range_2.
+  const double* cut_normal = geometry_.normals_ + 3*id_cut;
+  double work_begin, work_end;
+  double point_begin[3];
+  double point_end[3];
+  solve_full_low(id_axis, &work_begin, &work_end, point_begin, point_end);
+  if ((ncut == 1) || inside_cuts(0, point_begin))
+    merge_inside(vec3::dot(point_begin, cut_normal), work_begin, nslice, cuts, begins,
+                 true);
+  if ((ncut == 1) || inside_cuts(0, point_end))
+    merge_inside(vec3::dot(point_end, cut_normal), work_end, nslice, cuts, ends, false);
+  if (ncut == 2) {
+    for (const double frac_cut0 : {cut_begin[0], cut_end[0]}) {
+      solve_plane_low(id_axis, 0, frac_cut0, &work_begin, &work_end, point_begin,
+                      point_end);
+      if (std::isfinite(work_begin))
+        merge_inside(vec3::dot(point_begin, cut_normal), work_begin, nslice, cuts,
+                     begins, true);
+      if (std::isfinite(work_end))
+        merge_inside(vec3::dot(point_end, cut_normal), work_end, nslice, cuts, ends,
+                     false);
+    }
+  }
+
+  for (int islice = 0; islice < nslice; ++islice) {
+    if ((begins[islice] == kInf) || (ends[islice] == -kInf))
+      throw no_solution_found("No solution found in solve_range_batch.");
+  }
+}
+
+
 void SphereSlice::solve_range_0(double* begin, double* end) const {
   // Start out with NaNs in begin and end, as to indicate that they are not
   // found yet.
@@ -259,10 +396,10 @@ void SphereSlice::solve_plane_low(const int id_axis, const int id_cut,
     double* point_begin, double* point_end) const {
   // Get the axis
   CHECK_ID(id_axis);
-  const double* axis = normals_ + 3*id_axis;
+  const double* axis = geometry_.normals_ + 3*id_axis;
   // Get the cut_normal
   CHECK_ID(id_cut);
-  const double* cut_normal = normals_ + 3*id_cut;
+  const double* cut_normal = geometry_.normals_ + 3*id_cut;
 
   /* Define the parameters of a circle that is the intersection of
        - the sphere
@@ -272,9 +409,9 @@ void SphereSlice::solve_plane_low(const int id_axis, const int id_cut,
   // and the center of the circle.
   double delta_cut = frac_cut - frac_center_[id_cut];
   // The amount lost from the total radius squared.
-  double lost_radius_sq = delta_cut*delta_cut/norms_sq_[id_cut];
+  double lost_radius_sq = delta_cut*delta_cut/geometry_.norms_sq_[id_cut];
   // The rest of the radius squared is for the size of the circle.
-  double circle_radius_sq = radius_sq_ - lost_radius_sq;
+  double circle_radius_sq = geometry_.radius_sq_ - lost_radius_sq;
   // Check if an intersecting circle exists, if not return;
   if (circle_radius_sq < 0) {
     *begin = NAN;
@@ -287,11 +424,11 @@ void SphereSlice::solve_plane_low(const int id_axis, const int id_cut,
   // Compute the center of the circle
   double circle_center[3];
   vec3::copy(center_, circle_center);
-  vec3::iadd(circle_center, cut_normal, delta_cut/norms_sq_[id_cut]);
+  vec3::iadd(circle_center, cut_normal, delta_cut/geometry_.norms_sq_[id_cut]);
 
   // Get a vector orthogonal to cut_normal, in the plane of axis;
   double ortho[3];
-  vec3::copy(cut_ortho_ + 3*id_axis + 9*id_cut, ortho);
+  vec3::copy(geometry_.cut_ortho_ + 3*id_axis + 9*id_cut, ortho);
   // Normalize to circle_radius
   vec3::iscale(ortho, circle_radius);
   // Compute projection on axis of two solutions, optionally compute points;
@@ -319,9 +456,9 @@ void SphereSlice::solve_line_low(const int id_axis, const int id_cut0, const int
   CHECK_ID(id_cut1);
 
   // Select the vectors
-  const double* axis = normals_ + 3*id_axis;
-  const double* cut0_normal = normals_ + 3*id_cut0;
-  const double* cut1_normal = normals_ + 3*id_cut1;
+  const double* axis = geometry_.normals_ + 3*id_axis;
+  const double* cut0_normal = geometry_.normals_ + 3*id_cut0;
+  const double* cut1_normal = geometry_.normals_ + 3*id_cut1;
 
   // Cuts relative to the center
   double delta_cut0 = frac_cut0 - frac_center_[id_cut0];
@@ -333,7 +470,7 @@ void SphereSlice::solve_line_low(const int id_axis, const int id_cut0, const int
   vec3::iadd(line_center, center_);
 
   // Compute the remaining line radius
-  double line_radius_sq = radius_sq_ - lost_radius_sq;
+  double line_radius_sq = geometry_.radius_sq_ - lost_radius_sq;
   if (line_radius_sq < 0) {
     *begin = NAN;
     *end = NAN;
@@ -353,6 +490,97 @@ void SphereSlice::solve_line_low(const int id_axis, const int id_cut0, const int
 }
 
 
+void SphereSlice::solve_plane_batch(const int id_axis, const int id_cut,
+    const int nedge, const double* cuts, double* begins, double* ends,
+    const int id_check) const {
+  CHECK_ID(id_axis);
+  CHECK_ID(id_cut);
+  const double* axis = geometry_.normals_ + 3*id_axis;
+  const double* cut_normal = geometry_.normals_ + 3*id_cut;
+  const double* ortho = geometry_.cut_ortho_ + 3*id_axis + 9*id_cut;
+  // Without a check, all points pass with these cuts.
+  const double* check_normal = geometry_.normals_;
+  double check_begin = -kInf;
+  double check_end = kInf;
+  if (id_check != -1) {
+    CHECK_ID(id_check);
+    check_normal = geometry_.normals_ + 3*id_check;
+    check_begin = cut_begin[id_check];
+    check_end = cut_end[id_check];
+  }
+  // Same as solve_plane_low, written without branches such that the loop over the
+  // planes can be vectorized.
+  for (int iedge = 0; iedge < nedge; ++iedge) {
+    const double delta_cut = cuts[iedge] - frac_center_[id_cut];
+    const double circle_radius_sq = geometry_.radius_sq_ -
+                                    delta_cut*delta_cut/geometry_.norms_sq_[id_cut];
+    const bool exists = circle_radius_sq >= 0;
+    const double circle_radius = sqrt(exists ? circle_radius_sq : 0.0);
+    const double shift = delta_cut/geometry_.norms_sq_[id_cut];
+    double point_begin[3];
+    double point_end[3];
+    for (int i = 0; i < 3; ++i) {
+      const double circle_center = center_[i] + shift*cut_normal[i];
+      point_begin[i] = circle_center - ortho[i]*circle_radius;
+      point_end[i] = circle_center + ortho[i]*circle_radius;
+    }
+    const double check_frac_begin = vec3::dot(point_begin, check_normal);
+    const double check_frac_end = vec3::dot(point_end, check_normal);
+    const bool valid_begin = exists && (check_frac_begin > check_begin) &&
+                             (check_frac_begin < check_end);
+    const bool valid_end = exists && (check_frac_end > check_begin) &&
+                           (check_frac_end < check_end);
+    begins[iedge] = valid_begin ? vec3::dot(point_begin, axis) : kInf;
+    ends[iedge] = valid_end ? vec3::dot(point_end, axis) : -kInf;
+  }
+}
+
+
+void SphereSlice::solve_line_batch(const int id_axis, const int id_cut0,
+    const int id_cut1, const double frac_cut0, const int nedge, const double* cuts1,
+    double* begins, double* ends) const {
+  CHECK_ID(id_axis);
+  CHECK_ID(id_cut0);
+  CHECK_ID(id_cut1);
+  const double* axis = geometry_.normals_ + 3*id_axis;
+  const double* cut0_normal = geometry_.normals_ + 3*id_cut0;
+  const double* cut1_normal = geometry_.normals_ + 3*id_cut1;
+  // Direction of the line, independent of the cuts.
+  double basis[3];
+  vec3::cross(cut0_normal, cut1_normal, basis);
+  const double basis_norm = vec3::norm(basis);
+  const bool flip = vec3::dot(axis, basis) < 0;
+  // Same as solve_line_low, written without branches such that the loop over the
+  // planes can be vectorized.
+  const double dot00 = geometry_.norms_sq_[id_cut0];
+  const double dot01 = geometry_.dots_[id_cut0 + 3*id_cut1];
+  const double dot11 = geometry_.norms_sq_[id_cut1];
+  const double denom = geometry_.denoms_[id_cut0 + 3*id_cut1];
+  const double delta_cut0 = frac_cut0 - frac_center_[id_cut0];
+  for (int iedge = 0; iedge < nedge; ++iedge) {
+    const double delta_cut1 = cuts1[iedge] - frac_center_[id_cut1];
+    const double ratio0 = (delta_cut1*dot01 - delta_cut0*dot11)/denom;
+    const double ratio1 = (delta_cut0*dot01 - delta_cut1*dot00)/denom;
+    const double lost_radius_sq = ratio0*ratio0*dot00 + 2*ratio0*ratio1*dot01 +
+                                  ratio1*ratio1*dot11;
+    const double line_radius_sq = geometry_.radius_sq_ - lost_radius_sq;
+    const bool exists = line_radius_sq >= 0;
+    double scale = sqrt(exists ? line_radius_sq : 0.0)/basis_norm;
+    if (flip) scale *= -1;
+    double begin = 0.0;
+    double end = 0.0;
+    for (int i = 0; i < 3; ++i) {
+      const double line_center = cut0_normal[i]*ratio0 + cut1_normal[i]*ratio1 +
+                                 center_[i];
+      begin += (line_center - basis[i]*scale)*axis[i];
+      end += (line_center + basis[i]*scale)*axis[i];
+    }
+    begins[iedge] = exists ? begin : kInf;
+    ends[iedge] = exists ? end : -kInf;
+  }
+}
+
+
 double SphereSlice::compute_plane_intersection(const int id_cut0, const int id_cut1,
     const double cut0, const double cut1, double* other_center) const {
 
@@ -360,14 +588,14 @@ double SphereSlice::compute_plane_intersection(const int id_cut0, const int id_c
   CHECK_ID(id_cut1);
 
   // Select the vectors
-  const double* cut0_normal = normals_ + 3*id_cut0;
-  const double* cut1_normal = normals_ + 3*id_cut1;
+  const double* cut0_normal = geometry_.normals_ + 3*id_cut0;
+  const double* cut1_normal = geometry_.normals_ + 3*id_cut1;
 
   // Find the nearest point where the two planes cross
-  double dot00 = norms_sq_[id_cut0];
-  double dot01 = dots_[id_cut0 + 3*id_cut1];
-  double dot11 = norms_sq_[id_cut1];
-  double denom = denoms_[id_cut0 + 3*id_cut1];
+  double dot00 = geometry_.norms_sq_[id_cut0];
+  double dot01 = geometry_.dots_[id_cut0 + 3*id_cut1];
+  double dot11 = geometry_.norms_sq_[id_cut1];
+  double denom = geometry_.denoms_[id_cut0 + 3*id_cut1];
   double ratio0 = (cut1*dot01 - cut0*dot11)/denom;
   double ratio1 = (cut0*dot01 - cut1*dot00)/denom;
   if (other_center != nullptr) {
@@ -386,7 +614,7 @@ bool SphereSlice::inside_cuts(const int id_cut, const double* point) const {
   // if id_cut == -1, the test always passes, i.e. bounds are not imposed.
   if (id_cut == -1) return true;
   CHECK_ID(id_cut);
-  const double* cut_normal = normals_ + 3*id_cut;
+  const double* cut_normal = geometry_.normals_ + 3*id_cut;
   double frac_cut = vec3::dot(point, cut_normal);
   return (frac_cut > cut_begin[id_cut]) && (frac_cut < cut_end[id_cut]);
 }
@@ -436,6 +664,41 @@ void update_begin_end(const double work_begin, const double work_end,
 }
 
 
+void metric_to_sphere(const double* metric, const double* center, const double* normals,
+    double* sphere_center, double* sphere_normals) {
+  // Cholesky decomposition metric = L L^T, with L lower triangular (row-major).
+  double factor[9]{0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+  for (int irow = 0; irow < 3; ++irow) {
+    for (int icol = 0; icol <= irow; ++icol) {
+      double sum = metric[3*irow + icol];
+      for (int k = 0; k < icol; ++k)
+        sum -= factor[3*irow + k]*factor[3*icol + k];
+      if (irow == icol) {
+        if (!(sum > 0))
+          throw std::domain_error("The metric must be positive definite.");
+        factor[3*irow + icol] = sqrt(sum);
+      } else {
+        factor[3*irow + icol] = sum/factor[3*icol + icol];
+      }
+    }
+  }
+  // The center is mapped with y = L^T x.
+  if (center != nullptr) vec3::tmatvec(factor, center, sphere_center);
+  // Each normal n is mapped to the solution of L n' = n, by forward substitution, such
+  // that n.x = n'.y.
+  for (int inormal = 0; inormal < 3; ++inormal) {
+    const double* normal = normals + 3*inormal;
+    double* sphere_normal = sphere_normals + 3*inormal;
+    for (int irow = 0; irow < 3; ++irow) {
+      double sum = normal[irow];
+      for (int k = 0; k < irow; ++k)
+        sum -= factor[3*irow + k]*sphere_normal[k];
+      sphere_normal[irow] = sum/factor[3*irow + irow];
+    }
+  }
+}
+
+
 }  // namespace cellcutoff
 
 // vim: textwidth=90 et ts=2 sw=2
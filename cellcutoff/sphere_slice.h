@@ -24,6 +24,7 @@
 #ifndef CELLCUTOFF_SPHERE_SLICE_H_
 #define CELLCUTOFF_SPHERE_SLICE_H_
 
+#include <memory>
 #include <stdexcept>
 #include <string>
 
@@ -41,19 +42,59 @@ class no_solution_found : public std::domain_error {
 };
 
 
+/** @brief
+        The part of a SphereSlice that only depends on the normals and the radius.
+
+    When many spheres with the same radius are sliced by the same planes, e.g. in
+    repeated calls to Cell::bars_cutoff, this is computed once and shared by all
+    SphereSlice objects. The normals are copied.
+ */
+class SphereSliceGeometry {
+ public:
+  SphereSliceGeometry(const double* normals, double radius);
+
+  const double* normals() const { return normals_; }
+  double radius() const { return radius_; }
+
+ private:
+  friend class SphereSlice;
+
+  double normals_[9];
+  double radius_;
+  double radius_sq_;
+  double norms_sq_[3];
+  double norms_[3];
+  double frac_radii_[3];
+  double radius_normals_[9];
+  double dots_[9];
+  double denoms_[9];
+  double cut_ortho_[27];
+};
+
+
 class SphereSlice {
  public:
   SphereSlice(const double* center, const double* normals, double radius);
+  //! Uses a precomputed geometry, which must outlive the SphereSlice.
+  SphereSlice(const SphereSliceGeometry& geometry, const double* center);
 
-  /* Move-constructor and assignment make no sense as the SphereSlice is
-     constant after construction! Just pass a reference or a pointer instead. If needed,
-     a copy can be made to guarantee that the data remains available. */
+  /* Move-constructor and assignment make no sense as the SphereSlice refers to
+     external data! Just pass a reference or a pointer instead. If needed, a copy can
+     be made to guarantee that the data remains available. */
   SphereSlice(SphereSlice&&) = delete;
   SphereSlice& operator=(const SphereSlice&) = delete;
 
   // Main API
+  //! Moves the sphere to a new center and resets the cuts. The geometry is kept.
+  void recenter(const double* center);
   void solve_range(const int ncut, double* begin, double* end) const;
   void set_cut_begin_end(const int icut, double new_begin, double new_end);
+  /* Same as solve_range(ncut, ...) for nslice adjacent slices along normal ncut - 1,
+     where slice i lies between cuts[i] and cuts[i + 1]. The cuts array has nslice + 1
+     increasing elements and replaces the cut set with set_cut_begin_end(ncut - 1, ...).
+     Solutions on the cut planes are shared by neighboring slices. */
+  void solve_range_batch(const int ncut, const int nslice, const double* cuts,
+      double* begins, double* ends) const;
 
   // Auxiliary API, could also be useful and there is no need to really
   // make this private. Having it public also facilitates testing.
@@ -77,35 +118,37 @@ class SphereSlice {
   void solve_line_low(const int id_axis, const int id_cut0, const int id_cut1,
       const double frac_cut0, const double frac_cut1, double* begin, double* end,
       double* point_begin = nullptr, double* point_end = nullptr) const;
+
+  void solve_plane_batch(const int id_axis, const int id_cut, const int nedge,
+      const double* cuts, double* begins, double* ends, const int id_check = -1) const;
+  void solve_line_batch(const int id_axis, const int id_cut0, const int id_cut1,
+      const double frac_cut0, const int nedge, const double* cuts1, double* begins,
+      double* ends) const;
+
   double compute_plane_intersection(const int id_cut0, int const id_cut1,
       const double cut0, const double cut1, double* other_center) const;
 
   bool inside_cuts(const int id_cut, const double* point) const;
 
  private:
-  // Constant independent data members
+  // Data members that only depend on the normals and the radius. The geometry is
+  // only owned when the first constructor is used.
+  std::unique_ptr<SphereSliceGeometry> own_geometry_;
+  const SphereSliceGeometry& geometry_;
+
+  // Center, set upon construction or with recenter
   const double* center_;
-  const double* normals_;
-  const double radius_;
 
   // Configurable data members
   double cut_begin[2];
   double cut_end[2];
 
-  // Derived from constant data members upon construction
-  double radius_sq_;
-  double norms_sq_[3];
-  double norms_[3];
-  double frac_radii_[3];
+  // Derived from the center
   double frac_center_[3];
   double sphere_frac_begin_[3];
   double sphere_frac_end_[3];
-  double radius_normals_[9];
   double sphere_point_begin_[9];
   double sphere_point_end_[9];
-  double dots_[9];
-  double denoms_[9];
-  double cut_ortho_[27];
 };
 
 void compute_begin_end(const double* other_center, const double* ortho,
@@ -115,6 +158,28 @@ void compute_begin_end(const double* other_center, const double* ortho,
 void update_begin_end(const double work_begin, const double work_end,
     double* begin, double* end);
 
+/** @brief
+        Transforms an ellipsoid and a set of planes such that the ellipsoid becomes a
+        sphere.
+
+    The ellipsoid contains all points x for which `(x - center)^T metric (x - center)`
+    is not larger than the squared radius. The metric is a symmetric positive definite
+    3x3 matrix (row-major), of which only the lower triangle is used. With the Cholesky
+    decomposition `metric = L L^T`, the map `y = L^T x` turns the ellipsoid into a
+    sphere with the same radius. A plane `n.x = c` becomes `n'.y = c`, where `L n' = n`.
+    Hence, a SphereSlice with the transformed center and normals slices the ellipsoid
+    at the original (fractional) cuts. An exception of the type `std::domain_error` is
+    raised when the metric is not positive definite.
+
+    @param center
+        A pointer to 3 doubles. May be `nullptr` when only the normals are needed.
+
+    @param normals
+        A pointer to 9 doubles, three normals, one per row.
+ */
+void metric_to_sphere(const double* metric, const double* center, const double* normals,
+    double* sphere_center, double* sphere_normals);
+
 
 }  // namespace cellcutoff
 
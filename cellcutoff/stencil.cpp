@@ -0,0 +1,170 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include "cellcutoff/stencil.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/vec3.h"
+
+
+namespace cellcutoff {
+
+
+namespace {
+
+//! Solves a linear system of at most three equations, in-place, with partial pivoting.
+bool solve_small(int size, double* matrix, double* rhs) {
+  for (int icol = 0; icol < size; ++icol) {
+    int ipivot = icol;
+    for (int irow = icol + 1; irow < size; ++irow)
+      if (fabs(matrix[irow*3 + icol]) > fabs(matrix[ipivot*3 + icol])) ipivot = irow;
+    if (matrix[ipivot*3 + icol] == 0.0) return false;
+    if (ipivot != icol) {
+      for (int jcol = 0; jcol < size; ++jcol)
+        std::swap(matrix[icol*3 + jcol], matrix[ipivot*3 + jcol]);
+      std::swap(rhs[icol], rhs[ipivot]);
+    }
+    for (int irow = icol + 1; irow < size; ++irow) {
+      double factor = matrix[irow*3 + icol]/matrix[icol*3 + icol];
+      for (int jcol = icol; jcol < size; ++jcol)
+        matrix[irow*3 + jcol] -= factor*matrix[icol*3 + jcol];
+      rhs[irow] -= factor*rhs[icol];
+    }
+  }
+  for (int irow = size - 1; irow >= 0; --irow) {
+    for (int jcol = irow + 1; jcol < size; ++jcol)
+      rhs[irow] -= matrix[irow*3 + jcol]*rhs[jcol];
+    rhs[irow] /= matrix[irow*3 + irow];
+  }
+  return true;
+}
+
+}  // namespace
+
+
+double subcell_distance(const Cell& subcell, const int* delta_icell) {
+  if (subcell.nvec() != 3)
+    throw std::domain_error("subcell_distance requires a 3D subcell.");
+  // The relative fractional coordinates are in the box ]delta_icell - 1,
+  // delta_icell + 1[. When this box contains the origin, the subcells touch.
+  double frac_low[3];
+  double frac_high[3];
+  bool touching = true;
+  for (int ivec = 0; ivec < 3; ++ivec) {
+    frac_low[ivec] = delta_icell[ivec] - 1.0;
+    frac_high[ivec] = delta_icell[ivec] + 1.0;
+    touching &= (frac_low[ivec] <= 0.0) && (frac_high[ivec] >= 0.0);
+  }
+  if (touching) return 0.0;
+  // Metric tensor of the subcell
+  double metric[9];
+  for (int ivec = 0; ivec < 3; ++ivec)
+    for (int jvec = 0; jvec < 3; ++jvec)
+      metric[ivec*3 + jvec] = vec3::dot(subcell.vec(ivec), subcell.vec(jvec));
+  // Loop over all faces, edges and corners of the box. Each fractional coordinate is
+  // either free (0), fixed at the lower bound (1) or fixed at the upper bound (2). The
+  // minimum of a convex function in a box is the unconstrained minimum within one of
+  // these, so the smallest feasible candidate is the exact result.
+  double distance_sq_min = INFINITY;
+  for (int icase = 0; icase < 27; ++icase) {
+    int kinds[3]{icase % 3, (icase/3) % 3, icase/9};
+    if ((kinds[0] == 0) && (kinds[1] == 0) && (kinds[2] == 0)) continue;
+    double frac[3];
+    int free[3];
+    int nfree = 0;
+    for (int ivec = 0; ivec < 3; ++ivec) {
+      if (kinds[ivec] == 0) {
+        free[nfree++] = ivec;
+        frac[ivec] = 0.0;
+      } else {
+        frac[ivec] = (kinds[ivec] == 1) ? frac_low[ivec] : frac_high[ivec];
+      }
+    }
+    // Minimize over the free coordinates: metric_ff frac_f = -metric_fc frac_c
+    if (nfree > 0) {
+      double matrix[9];
+      double rhs[3];
+      for (int ifree = 0; ifree < nfree; ++ifree) {
+        rhs[ifree] = 0.0;
+        for (int ivec = 0; ivec < 3; ++ivec)
+          if (kinds[ivec] != 0) rhs[ifree] -= metric[free[ifree]*3 + ivec]*frac[ivec];
+        for (int jfree = 0; jfree < nfree; ++jfree)
+          matrix[ifree*3 + jfree] = metric[free[ifree]*3 + free[jfree]];
+      }
+      if (!solve_small(nfree, matrix, rhs)) continue;
+      bool feasible = true;
+      for (int ifree = 0; ifree < nfree; ++ifree) {
+        int ivec = free[ifree];
+        frac[ivec] = rhs[ifree];
+        feasible &= (frac[ivec] >= frac_low[ivec]) && (frac[ivec] <= frac_high[ivec]);
+      }
+      if (!feasible) continue;
+    }
+    double delta[3];
+    subcell.to_cart(frac, delta);
+    distance_sq_min = std::min(distance_sq_min, vec3::normsq(delta));
+  }
+  return sqrt(distance_sq_min);
+}
+
+
+std::vector<std::array<int, 3>> create_stencil(const Cell& subcell, double cutoff,
+    bool half) {
+  if (subcell.nvec() != 3)
+    throw std::domain_error("create_stencil requires a 3D subcell.");
+  // Relative fractional coordinates are at most cutoff/spacing in absolute value, which
+  // gives a box of candidates.
+  int nmax[3];
+  for (int ivec = 0; ivec < 3; ++ivec)
+    nmax[ivec] = static_cast<int>(ceil(cutoff/subcell.spacings()[ivec]));
+  std::vector<std::array<int, 3>> stencil;
+  std::array<int, 3> delta_icell;
+  for (delta_icell[0] = -nmax[0]; delta_icell[0] <= nmax[0]; ++delta_icell[0]) {
+    for (delta_icell[1] = -nmax[1]; delta_icell[1] <= nmax[1]; ++delta_icell[1]) {
+      for (delta_icell[2] = -nmax[2]; delta_icell[2] <= nmax[2]; ++delta_icell[2]) {
+        if (half && (delta_icell < std::array<int, 3>{0, 0, 0})) continue;
+        if (subcell_distance(subcell, delta_icell.data()) <= cutoff)
+          stencil.push_back(delta_icell);
+      }
+    }
+  }
+  return stencil;
+}
+
+
+void stencil_radius(const std::vector<std::array<int, 3>>& stencil, int* radius) {
+  std::fill(radius, radius + 3, 0);
+  for (const auto& delta_icell : stencil)
+    for (int ivec = 0; ivec < 3; ++ivec)
+      radius[ivec] = std::max(radius[ivec], std::abs(delta_icell[ivec]));
+}
+
+
+}  // namespace cellcutoff
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -0,0 +1,92 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+/** @file */
+
+
+#ifndef CELLCUTOFF_STENCIL_H_
+#define CELLCUTOFF_STENCIL_H_
+
+#include <array>
+#include <vector>
+
+#include "cellcutoff/cell.h"
+
+
+namespace cellcutoff {
+
+
+/** @brief
+        Minimal distance between any two points of two subcells.
+
+    @param subcell
+        A 3D subcell.
+
+    @param delta_icell
+        The relative index of the second subcell with respect to the first.
+
+    @return
+        The minimal distance between points in the parallelepipeds
+        `[0, 1[^3` and `delta_icell + [0, 1[^3`, in fractional coordinates. This is
+        computed exactly by minimizing the norm of the relative vector over all faces,
+        edges and corners of the box of relative fractional coordinates.
+ */
+double subcell_distance(const Cell& subcell, const int* delta_icell);
+
+
+/** @brief
+        Relative subcell indexes of all subcells that may contain points within a cutoff
+        distance of any point in a given subcell.
+
+    @param subcell
+        A 3D subcell.
+
+    @param cutoff
+        The cutoff distance.
+
+    @param half
+        When true, only the relative index `{0, 0, 0}` and the relative indexes that
+        are lexicographically positive are kept. Every pair of subcells then occurs only
+        once, which is useful for half neighbor lists.
+
+    @return
+        The relative indexes in lexicographical order.
+ */
+std::vector<std::array<int, 3>> create_stencil(const Cell& subcell, double cutoff,
+    bool half);
+
+
+/** @brief
+        Computes the largest absolute relative subcell index along each direction.
+
+    @param stencil
+        A stencil, e.g. from `create_stencil`.
+
+    @param radius
+        Output array with 3 ints.
+ */
+void stencil_radius(const std::vector<std::array<int, 3>>& stencil, int* radius);
+
+
+}  // namespace cellcutoff
+
+
+#endif  // CELLCUTOFF_STENCIL_H_
+
+// vim: textwidth=90 et ts=2 sw=2
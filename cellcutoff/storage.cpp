@@ -0,0 +1,420 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include "cellcutoff/storage.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/decomposition.h"
+#include "cellcutoff/streaming.h"
+
+
+namespace cellcutoff {
+
+
+namespace {
+
+const char kMagic[8] = {'C', 'C', 'D', 'E', 'C', 'O', 'M', 'P'};
+const uint32_t kVersion = 2;
+const uint32_t kByteOrder = 0x01020304;
+const uint64_t kAlignment = 64;
+
+uint64_t round_up(uint64_t size, uint64_t alignment) {
+  return ((size + alignment - 1)/alignment)*alignment;
+}
+
+void write_or_throw(const void* data, size_t size, FILE* file) {
+  if ((size > 0) && (fwrite(data, 1, size, file) != size))
+    throw io_error("Could not write decomposition file.");
+}
+
+void write_zeros(size_t size, FILE* file) {
+  const char zeros[kAlignment] = {0};
+  for (size_t done = 0; done < size; done += kAlignment)
+    write_or_throw(zeros, std::min<size_t>(size - done, kAlignment), file);
+}
+
+//! Fill in the header, given the lowest and highest icell when there are points.
+template <typename PointType>
+void init_header(const Cell& subcell, const int* shape, size_t point_size, size_t npoint,
+    const int* icell_begin, const int* icell_last, DecompositionHeader* header) {
+  memset(header, 0, sizeof(DecompositionHeader));
+  std::copy(kMagic, kMagic + 8, header->magic);
+  header->version = kVersion;
+  header->byte_order = kByteOrder;
+  std::copy(subcell.vecs(), subcell.vecs() + 9, header->vecs);
+  header->has_shape = (shape != nullptr);
+  for (int ivec = 0; ivec < 3; ++ivec)
+    header->shape[ivec] = (shape == nullptr) ? 0 : shape[ivec];
+  header->point_size = point_size;
+  header->real_size = sizeof(typename PointType::real_type);
+  header->npoint = npoint;
+  if (npoint > 0) {
+    header->ncell = 1;
+    for (int ivec = 0; ivec < 3; ++ivec) {
+      const int64_t extent = static_cast<int64_t>(icell_last[ivec]) -
+                             icell_begin[ivec] + 1;
+      if ((extent > std::numeric_limits<int32_t>::max()) ||
+          (header->ncell > std::numeric_limits<uint64_t>::max()/
+                           static_cast<uint64_t>(extent)))
+        throw std::domain_error("The points are spread over too many cells.");
+      header->icell_begin[ivec] = icell_begin[ivec];
+      header->icell_shape[ivec] = static_cast<int32_t>(extent);
+      header->ncell *= static_cast<uint64_t>(extent);
+    }
+  }
+  // The sparse table has at most npoint entries, which are four times larger.
+  header->sparse_table = (header->ncell >= 4*static_cast<uint64_t>(npoint));
+  header->points_begin = round_up(sizeof(DecompositionHeader), kAlignment);
+  header->table_begin = round_up(header->points_begin + npoint*point_size,
+                                 sizeof(uint64_t));
+}
+
+//! Write the header and the padding up to the first point.
+void write_prefix(const DecompositionHeader& header, FILE* file) {
+  write_or_throw(&header, sizeof(header), file);
+  write_zeros(header.points_begin - sizeof(header), file);
+}
+
+//! Row-major index of an icell in the dense offset table.
+uint64_t dense_index(const DecompositionHeader& header, const int* icell) {
+  uint64_t index = 0;
+  for (int ivec = 0; ivec < 3; ++ivec) {
+    index = index*header.icell_shape[ivec];
+    index += icell[ivec] - header.icell_begin[ivec];
+  }
+  return index;
+}
+
+//! Sequential writer of the table of cells, given the non-empty cells in order.
+class TableWriter {
+ public:
+  TableWriter(const DecompositionHeader& header, FILE* file)
+      : header_(header), file_(file), ncell_written_(0) {}
+
+  //! Add a non-empty cell, after all cells with a lower index.
+  void add_range(const int* icell, size_t begin, size_t end) {
+    if (header_.sparse_table) {
+      DecompositionTableEntry entry{{icell[0], icell[1], icell[2]}, 0, begin, end};
+      write_or_throw(&entry, sizeof(entry), file_);
+    } else {
+      write_until(dense_index(header_, icell), begin);
+    }
+  }
+
+  //! Complete the table.
+  void finish() {
+    if (!header_.sparse_table) write_until(header_.ncell, header_.npoint);
+  }
+
+ private:
+  //! Write the given offset for all cells up to and including the given index.
+  void write_until(uint64_t index, uint64_t offset) {
+    for (; ncell_written_ <= index; ++ncell_written_)
+      write_or_throw(&offset, sizeof(offset), file_);
+  }
+
+  const DecompositionHeader& header_;
+  FILE* file_;
+  uint64_t ncell_written_;
+};
+
+//! Temporary file that is removed again when it goes out of scope.
+class TemporaryFile {
+ public:
+  explicit TemporaryFile(const std::string& filename) : filename_(filename) {
+    file_ = fopen(filename_.c_str(), "w+b");
+    if (file_ == nullptr)
+      throw io_error("Could not create temporary file " + filename_ + ".");
+  }
+  ~TemporaryFile() {
+    fclose(file_);
+    remove(filename_.c_str());
+  }
+
+  TemporaryFile(const TemporaryFile&) = delete;
+  TemporaryFile& operator=(const TemporaryFile&) = delete;
+
+  FILE* file() const { return file_; }
+
+ private:
+  std::string filename_;
+  FILE* file_;
+};
+
+}  // namespace
+
+
+template <typename PointType>
+void save_decomposition(const std::string& filename, const Cell& subcell,
+    const int* shape, const void* points, size_t npoint, size_t point_size) {
+  // Check arguments
+  if (point_size < sizeof(PointType))
+    throw std::domain_error("point_size must be at least sizeof(PointType).");
+  if (subcell.nvec() != 3)
+    throw std::domain_error("Partitioning is only sensible for 3D subcells.");
+
+  // Determine the box of icells and check the order of the points.
+  const char* points_char = reinterpret_cast<const char*>(points);  // Ugly sweet hack
+  int icell_begin[3]{0, 0, 0};
+  int icell_last[3]{0, 0, 0};
+  for (size_t ipoint = 0; ipoint < npoint; ++ipoint) {
+    const PointType* point(reinterpret_cast<const PointType*>(  // Ugly sweet hack
+        points_char + ipoint*point_size));
+    if (ipoint == 0) {
+      std::copy(point->icell_, point->icell_ + 3, icell_begin);
+      std::copy(point->icell_, point->icell_ + 3, icell_last);
+    } else {
+      const PointType* previous(reinterpret_cast<const PointType*>(  // Ugly sweet hack
+          points_char + (ipoint - 1)*point_size));
+      if (*point < *previous)
+        throw points_not_grouped("The given points are not sorted by icell.");
+      for (int ivec = 0; ivec < 3; ++ivec) {
+        icell_begin[ivec] = std::min(icell_begin[ivec], point->icell_[ivec]);
+        icell_last[ivec] = std::max(icell_last[ivec], point->icell_[ivec]);
+      }
+    }
+  }
+  DecompositionHeader header;
+  init_header<PointType>(subcell, shape, point_size, npoint, icell_begin, icell_last,
+                         &header);
+
+  // Write everything. The offset table is written directly from the sorted points.
+  FILE* file = fopen(filename.c_str(), "wb");
+  if (file == nullptr)
+    throw io_error("Could not open " + filename + " for writing.");
+  try {
+    write_prefix(header, file);
+    write_or_throw(points, npoint*point_size, file);
+    write_zeros(header.table_begin - header.points_begin - npoint*point_size, file);
+    TableWriter table_writer(header, file);
+    size_t ibegin = 0;
+    for (size_t ipoint = 1; ipoint <= npoint; ++ipoint) {
+      const PointType* first(reinterpret_cast<const PointType*>(  // Ugly sweet hack
+          points_char + ibegin*point_size));
+      if (ipoint < npoint) {
+        const PointType* point(reinterpret_cast<const PointType*>(  // Ugly sweet hack
+            points_char + ipoint*point_size));
+        if (!(*first < *point)) continue;
+      }
+      table_writer.add_range(first->icell_, ibegin, ipoint);
+      ibegin = ipoint;
+    }
+    table_writer.finish();
+  } catch (...) {
+    fclose(file);
+    throw;
+  }
+  if (fclose(file) != 0)
+    throw io_error("Could not close " + filename + ".");
+}
+
+
+template <typename PointType>
+void save_decomposition_streaming(const std::string& filename, const Cell& subcell,
+    const int* shape, PointSource* source, size_t point_size, size_t memory_budget) {
+  // The header is written after the first pass, when the box of icells is known. The
+  // offset table can only follow the sorted points, so it is collected in a temporary
+  // file in the meantime.
+  DecompositionHeader header;
+  TemporaryFile table(filename + ".table");
+  TableWriter table_writer(header, table.file());
+  stream_decomposition<PointType>(subcell, shape, source, point_size, filename,
+      memory_budget, [&table_writer](const int* icell, size_t begin, size_t end) {
+    table_writer.add_range(icell, begin, end);
+  }, [&subcell, shape, point_size, &header](size_t npoint, const int* icell_begin,
+      const int* icell_last, FILE* file) {
+    init_header<PointType>(subcell, shape, point_size, npoint, icell_begin, icell_last,
+                           &header);
+    write_prefix(header, file);
+  });
+  table_writer.finish();
+
+  // Append the offset table to the sorted points.
+  FILE* file = fopen(filename.c_str(), "ab");
+  if (file == nullptr)
+    throw io_error("Could not open " + filename + " for writing.");
+  try {
+    write_zeros(header.table_begin - header.points_begin - header.npoint*point_size,
+                file);
+    if (fflush(table.file()) != 0)
+      throw io_error("Could not write temporary file.");
+    rewind(table.file());
+    std::vector<char> buffer(std::max<size_t>(memory_budget, sizeof(uint64_t)));
+    size_t nread;
+    while ((nread = fread(buffer.data(), 1, buffer.size(), table.file())) > 0)
+      write_or_throw(buffer.data(), nread, file);
+    if (ferror(table.file()))
+      throw io_error("Could not read temporary file.");
+  } catch (...) {
+    fclose(file);
+    throw;
+  }
+  if (fclose(file) != 0)
+    throw io_error("Could not close " + filename + ".");
+}
+
+
+template <typename PointType>
+BasicMappedDecomposition<PointType>::BasicMappedDecomposition(const std::string& filename)
+    : mapped_file_(filename), subcell_(nullptr), shape_{0, 0, 0}, has_shape_(false),
+      points_(nullptr), npoint_(0), point_size_(0), cell_map_(nullptr) {
+  // Validate the header
+  const char* data = reinterpret_cast<const char*>(mapped_file_.data());
+  if (mapped_file_.size() < sizeof(DecompositionHeader))
+    throw io_error(filename + " is too small for a decomposition file.");
+  const DecompositionHeader* header(reinterpret_cast<const DecompositionHeader*>(data));
+  if (!std::equal(kMagic, kMagic + 8, header->magic))
+    throw io_error(filename + " is not a decomposition file.");
+  if (header->version != kVersion)
+    throw io_error(filename + " has an unsupported version.");
+  if (header->byte_order != kByteOrder)
+    throw io_error(filename + " was written with a different byte order.");
+  if (header->real_size != sizeof(typename PointType::real_type))
+    throw io_error(filename + " was written with a different point type.");
+  // The products below are only computed when they cannot overflow.
+  if ((header->point_size < sizeof(PointType)) ||
+      (header->points_begin < sizeof(DecompositionHeader)) ||
+      (header->table_begin % sizeof(uint64_t) != 0) ||
+      (header->points_begin > header->table_begin) ||
+      (header->npoint > (header->table_begin - header->points_begin)/
+                        header->point_size) ||
+      (header->table_begin > mapped_file_.size()))
+    throw io_error(filename + " has inconsistent sizes.");
+  const uint64_t table_size = mapped_file_.size() - header->table_begin;
+  if (header->sparse_table) {
+    if ((table_size % sizeof(DecompositionTableEntry) != 0) ||
+        (table_size/sizeof(DecompositionTableEntry) > header->npoint))
+      throw io_error(filename + " has inconsistent sizes.");
+  } else {
+    if ((header->ncell >= table_size/sizeof(uint64_t)) ||
+        ((header->ncell + 1)*sizeof(uint64_t) != table_size))
+      throw io_error(filename + " has inconsistent sizes.");
+  }
+  // The box of icells must match the number of cells. An empty file has no box at all.
+  uint64_t ncell = 1;
+  for (int ivec = 0; ivec < 3; ++ivec) {
+    const int32_t extent = header->icell_shape[ivec];
+    if ((header->ncell == 0) ? (extent != 0) : (extent <= 0))
+      throw io_error(filename + " has an inconsistent box of icells.");
+    if (extent > 0) {
+      if (ncell > header->ncell/static_cast<uint64_t>(extent))
+        throw io_error(filename + " has an inconsistent box of icells.");
+      ncell *= static_cast<uint64_t>(extent);
+    }
+  }
+  if ((header->ncell != 0) && (ncell != header->ncell))
+    throw io_error(filename + " has an inconsistent box of icells.");
+
+  // Convert the table of cells into a cell map.
+  std::unique_ptr<CellMap> cell_map(new CellMap);
+  if (header->sparse_table) {
+    const DecompositionTableEntry* entries(
+        reinterpret_cast<const DecompositionTableEntry*>(  // Ugly sweet hack
+        data + header->table_begin));
+    const uint64_t nentry = table_size/sizeof(DecompositionTableEntry);
+    std::array<int, 3> previous{0, 0, 0};
+    uint64_t end = 0;
+    for (uint64_t ientry = 0; ientry < nentry; ++ientry) {
+      const DecompositionTableEntry& entry = entries[ientry];
+      // The cells must be in the box, in increasing order, with contiguous ranges.
+      std::array<int, 3> key{entry.icell[0], entry.icell[1], entry.icell[2]};
+      for (int ivec = 0; ivec < 3; ++ivec) {
+        if ((key[ivec] < header->icell_begin[ivec]) ||
+            (static_cast<int64_t>(key[ivec]) - header->icell_begin[ivec] >=
+             header->icell_shape[ivec]))
+          throw io_error(filename + " has an inconsistent table of cells.");
+      }
+      if (((ientry > 0) && !(previous < key)) || (entry.begin != end) ||
+          (entry.end <= entry.begin))
+        throw io_error(filename + " has an inconsistent table of cells.");
+      previous = key;
+      end = entry.end;
+      cell_map->emplace(key, std::array<size_t, 2>{entry.begin, entry.end});
+    }
+    if (end != header->npoint)
+      throw io_error(filename + " has an inconsistent table of cells.");
+  } else {
+    const uint64_t* offsets(reinterpret_cast<const uint64_t*>(  // Ugly sweet hack
+        data + header->table_begin));
+    if ((offsets[0] != 0) || (offsets[header->ncell] != header->npoint))
+      throw io_error(filename + " has an inconsistent table of cells.");
+    for (uint64_t icell = 0; icell < header->ncell; ++icell) {
+      if (offsets[icell] > offsets[icell + 1])
+        throw io_error(filename + " has an inconsistent table of cells.");
+      if (offsets[icell] == offsets[icell + 1]) continue;
+      std::array<int, 3> key;
+      uint64_t rest = icell;
+      for (int ivec = 2; ivec >= 0; --ivec) {
+        key[ivec] = header->icell_begin[ivec] +
+                    static_cast<int>(rest % header->icell_shape[ivec]);
+        rest /= header->icell_shape[ivec];
+      }
+      cell_map->emplace(key, std::array<size_t, 2>{offsets[icell], offsets[icell + 1]});
+    }
+  }
+
+  // Everything is fine, fill in the data members.
+  std::copy(header->shape, header->shape + 3, shape_);
+  has_shape_ = (header->has_shape != 0);
+  points_ = data + header->points_begin;
+  npoint_ = header->npoint;
+  point_size_ = header->point_size;
+  subcell_ = new Cell(header->vecs, 3);
+  cell_map_ = cell_map.release();
+}
+
+
+template <typename PointType>
+BasicMappedDecomposition<PointType>::~BasicMappedDecomposition() {
+  if (subcell_ != nullptr) delete subcell_;
+  if (cell_map_ != nullptr) delete cell_map_;
+}
+
+
+template void save_decomposition<Point>(const std::string& filename,
+    const Cell& subcell, const int* shape, const void* points, size_t npoint,
+    size_t point_size);
+template void save_decomposition<PointF>(const std::string& filename,
+    const Cell& subcell, const int* shape, const void* points, size_t npoint,
+    size_t point_size);
+template void save_decomposition_streaming<Point>(const std::string& filename,
+    const Cell& subcell, const int* shape, PointSource* source, size_t point_size,
+    size_t memory_budget);
+template void save_decomposition_streaming<PointF>(const std::string& filename,
+    const Cell& subcell, const int* shape, PointSource* source, size_t point_size,
+    size_t memory_budget);
+template class BasicMappedDecomposition<Point>;
+template class BasicMappedDecomposition<PointF>;
+
+
+}  // namespace cellcutoff
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -0,0 +1,205 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+/** @file */
+
+
+#ifndef CELLCUTOFF_STORAGE_H_
+#define CELLCUTOFF_STORAGE_H_
+
+#include <cstdint>
+#include <string>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/decomposition.h"
+#include "cellcutoff/streaming.h"
+
+
+namespace cellcutoff {
+
+
+/** @brief
+        Fixed-size header of a decomposition file.
+
+    A decomposition file consists of three parts, all in native byte order:
+
+    1. This header.
+    2. The sorted point records, starting at byte `points_begin`, which is a multiple
+       of 64 to keep the records aligned.
+    3. The table of cells, starting at byte `table_begin`. The table follows the
+       points, such that both can be written in one sequential pass.
+
+    The table of cells comes in two kinds. The dense table has `ncell + 1` offsets
+    (uint64). Cells are numbered in row-major order over the box of icells
+    `[icell_begin, icell_begin + icell_shape[`, which is the same order as
+    `sort_by_icell`. The points of cell `i` are found in the range
+    `[offsets[i], offsets[i+1][`. When the points are spread over a box with many more
+    cells than points, `sparse_table` is set and the table is a list of
+    `DecompositionTableEntry`, one for each non-empty cell, in the same order. The
+    sparse table is used when `ncell >= 4*npoint`, i.e. when it cannot be larger than
+    the dense one.
+ */
+struct DecompositionHeader {
+  char magic[8];            //!< always "CCDECOMP"
+  uint32_t version;         //!< file format version
+  uint32_t byte_order;      //!< 0x01020304 when written, to detect byte-order mismatch
+  double vecs[9];           //!< subcell vectors, one per row
+  int32_t shape[3];         //!< periodic shape, zero for non-periodic directions
+  int32_t icell_begin[3];   //!< lowest icell of all points
+  int32_t icell_shape[3];   //!< extent of the box of icells of all points
+  int32_t has_shape;        //!< 1 if a periodic shape was used, 0 otherwise
+  uint64_t point_size;      //!< size of one point record in bytes
+  uint64_t real_size;       //!< size of the Cartesian coordinates, 8 for Point
+  uint64_t npoint;          //!< number of point records
+  uint64_t ncell;           //!< number of cells in the box of icells
+  uint64_t points_begin;    //!< byte offset of the first point record
+  uint64_t table_begin;     //!< byte offset of the table of cells
+  uint64_t sparse_table;    //!< 1 if the table only lists the non-empty cells
+};
+
+
+//! Entry of the sparse table of cells in a decomposition file.
+struct DecompositionTableEntry {
+  int32_t icell[3];         //!< the non-empty cell
+  uint32_t padding;         //!< always zero
+  uint64_t begin;           //!< index of the first point in the cell
+  uint64_t end;             //!< index of the first point after the cell
+};
+
+
+/** @brief
+        Write sorted points and a table of cells to a file.
+
+    @param filename
+        The file to be written.
+
+    @param subcell
+        The subcell used by `assign_icell`.
+
+    @param shape
+        The periodic shape used by `assign_icell`, or `nullptr` if not used.
+
+    @param points
+        Points sorted by icell, e.g. with `sort_by_icell`. Otherwise an exception of the
+        type `points_not_grouped` is raised.
+
+    @param npoint
+        The number of points.
+
+    @param point_size
+        The size of one point record in bytes.
+
+    The point type is a template parameter, `Point` by default, as in `assign_icell`.
+    The size of its Cartesian coordinates is recorded in the file, such that the file
+    can only be loaded with the same point type.
+ */
+template <typename PointType = Point>
+void save_decomposition(const std::string& filename, const Cell& subcell,
+    const int* shape, const void* points, size_t npoint, size_t point_size);
+
+
+/** @brief
+        Out-of-core equivalent of `save_decomposition`, using `stream_decomposition`.
+
+    The points are decomposed and sorted with a bounded memory budget and written
+    directly behind the header. The table of cells is collected in a temporary
+    file and appended at the end, so no memory proportional to the number of cells or
+    points is needed. The result can be loaded with `MappedDecomposition`, which maps
+    the sorted points without copying them.
+
+    @param filename
+        The file to be written. Temporary files are created by appending a suffix.
+
+    @param subcell
+        The subcell used for the decomposition, as in `assign_icell`.
+
+    @param shape
+        When not `nullptr`, the points are wrapped into the periodic cell, as in
+        `assign_icell`.
+
+    @param source
+        The source of the points.
+
+    @param point_size
+        The size of one point record in bytes.
+
+    @param memory_budget
+        The amount of memory in bytes used for buffering points and counts, see
+        `stream_decomposition`.
+
+    The point type is a template parameter, as in `save_decomposition`.
+ */
+template <typename PointType = Point>
+void save_decomposition_streaming(const std::string& filename, const Cell& subcell,
+    const int* shape, PointSource* source, size_t point_size, size_t memory_budget);
+
+
+/** @brief
+        Zero-copy view on a decomposition file written by `save_decomposition`.
+
+    The file is mapped into memory. The points are used in-place, while a cell map is
+    derived from the table of cells upon construction. The cost of loading is
+    proportional to the number of non-empty cells, not to the number of points. An
+    exception of the type `io_error` is raised when the file was written with another
+    point type.
+ */
+template <typename PointType>
+class BasicMappedDecomposition {
+ public:
+  explicit BasicMappedDecomposition(const std::string& filename);
+  ~BasicMappedDecomposition();
+
+  BasicMappedDecomposition(const BasicMappedDecomposition&) = delete;
+  BasicMappedDecomposition& operator=(const BasicMappedDecomposition&) = delete;
+
+  //! Returns the subcell.
+  const Cell& subcell() const { return *subcell_; }
+  //! Returns the periodic shape, or `nullptr` when no shape was used.
+  const int* shape() const { return has_shape_ ? shape_ : nullptr; }
+  //! Returns the sorted points (read-only memory).
+  const void* points() const { return points_; }
+  //! Returns the number of points.
+  size_t npoint() const { return npoint_; }
+  //! Returns the size of one point record in bytes.
+  size_t point_size() const { return point_size_; }
+  //! Returns the cell map for the points.
+  const CellMap& cell_map() const { return *cell_map_; }
+
+ private:
+  MappedFile mapped_file_;
+  Cell* subcell_;
+  int shape_[3];
+  bool has_shape_;
+  const void* points_;
+  size_t npoint_;
+  size_t point_size_;
+  CellMap* cell_map_;
+};
+
+typedef BasicMappedDecomposition<Point> MappedDecomposition;
+typedef BasicMappedDecomposition<PointF> MappedDecompositionF;
+
+
+}  // namespace cellcutoff
+
+
+#endif  // CELLCUTOFF_STORAGE_H_
+
+// vim: textwidth=90 et ts=2 sw=2
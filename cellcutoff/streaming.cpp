@@ -0,0 +1,516 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include "cellcutoff/streaming.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/decomposition.h"
+
+
+namespace cellcutoff {
+
+
+//
+// FilePointSource
+//
+
+FilePointSource::FilePointSource(const std::string& filename) : file_(nullptr) {
+  file_ = fopen(filename.c_str(), "rb");
+  if (file_ == nullptr)
+    throw io_error("Could not open " + filename + " for reading.");
+}
+
+
+FilePointSource::~FilePointSource() {
+  if (file_ != nullptr) fclose(file_);
+}
+
+
+size_t FilePointSource::read(void* points, size_t npoint, size_t point_size) {
+  size_t nread = fread(points, point_size, npoint, file_);
+  if (ferror(file_))
+    throw io_error("Could not read points from file.");
+  return nread;
+}
+
+
+void FilePointSource::rewind() {
+  ::rewind(file_);
+}
+
+
+//
+// MappedFile
+//
+
+MappedFile::MappedFile(const std::string& filename) : data_(nullptr), size_(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1)
+    throw io_error("Could not open " + filename + " for reading.");
+  struct stat sb;
+  if (fstat(fd, &sb) == -1) {
+    close(fd);
+    throw io_error("Could not get the size of " + filename + ".");
+  }
+  size_ = static_cast<size_t>(sb.st_size);
+  // Mapping an empty file is not allowed, so data_ remains nullptr in that case.
+  if (size_ > 0) {
+    data_ = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (data_ == MAP_FAILED) {
+      data_ = nullptr;
+      close(fd);
+      throw io_error("Could not map " + filename + " into memory.");
+    }
+  }
+  // The mapping remains valid after closing the file descriptor.
+  close(fd);
+}
+
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) munmap(data_, size_);
+}
+
+
+//
+// stream_decomposition
+//
+
+namespace {
+
+//! Point source that assigns the icells of the points read from another source.
+template <typename PointType>
+class IcellSource : public PointSource {
+ public:
+  IcellSource(const Cell& subcell, const int* shape, PointSource* source)
+      : subcell_(subcell), shape_(shape), source_(source) {}
+
+  size_t read(void* points, size_t npoint, size_t point_size) {
+    size_t nread = source_->read(points, npoint, point_size);
+    if (nread > npoint)
+      throw io_error("The point source returned more points than requested.");
+    if (shape_ == nullptr) {
+      assign_icell<PointType>(subcell_, points, nread, point_size);
+    } else {
+      assign_icell<PointType>(subcell_, shape_, points, nread, point_size);
+    }
+    return nread;
+  }
+
+  void rewind() { source_->rewind(); }
+
+ private:
+  const Cell& subcell_;
+  const int* shape_;
+  PointSource* source_;
+};
+
+//! Point source that reads back a temporary block file.
+class BlockSource : public PointSource {
+ public:
+  explicit BlockSource(FILE* file) : file_(file) {}
+
+  size_t read(void* points, size_t npoint, size_t point_size) {
+    size_t nread = fread(points, point_size, npoint, file_);
+    if (ferror(file_))
+      throw io_error("Could not read points from temporary file.");
+    return nread;
+  }
+
+  void rewind() {
+    if (fflush(file_) != 0)
+      throw io_error("Could not write points to temporary file.");
+    ::rewind(file_);
+  }
+
+ private:
+  FILE* file_;
+};
+
+std::string block_filename(const std::string& filename, size_t iblock) {
+  return filename + ".block" + std::to_string(iblock);
+}
+
+void write_or_throw(const char* data, size_t size, FILE* file) {
+  if ((size > 0) && (fwrite(data, 1, size, file) != size))
+    throw io_error("Could not write points to file.");
+}
+
+//! Temporary block files, kept open until they are sorted.
+class BlockFiles {
+ public:
+  BlockFiles(const std::string& filename, size_t nblock)
+      : filename_(filename), files_(nblock, nullptr) {
+    for (size_t iblock = 0; iblock < nblock; ++iblock) {
+      files_[iblock] = fopen(block_filename(filename_, iblock).c_str(), "w+b");
+      if (files_[iblock] == nullptr) {
+        close_and_remove();
+        throw io_error("Could not create temporary file for " + filename_ + ".");
+      }
+    }
+  }
+  ~BlockFiles() { close_and_remove(); }
+
+  BlockFiles(const BlockFiles&) = delete;
+  BlockFiles& operator=(const BlockFiles&) = delete;
+
+  FILE* operator[](size_t iblock) const { return files_[iblock]; }
+
+ private:
+  void close_and_remove() {
+    for (size_t iblock = 0; iblock < files_.size(); ++iblock) {
+      if (files_[iblock] == nullptr) continue;
+      fclose(files_[iblock]);
+      files_[iblock] = nullptr;
+      remove(block_filename(filename_, iblock).c_str());
+    }
+  }
+
+  std::string filename_;
+  std::vector<FILE*> files_;
+};
+
+//! Numbering of the cells in a box of icells, in the same order as sort_by_icell.
+class IcellBox {
+ public:
+  IcellBox(const int* icell_begin, const int* icell_last) : size_(1) {
+    for (int ivec = 0; ivec < 3; ++ivec) {
+      begin_[ivec] = icell_begin[ivec];
+      shape_[ivec] = static_cast<uint64_t>(static_cast<int64_t>(icell_last[ivec]) -
+                                           icell_begin[ivec] + 1);
+      if (size_ > std::numeric_limits<uint64_t>::max()/shape_[ivec])
+        throw std::domain_error("The points are spread over too many cells.");
+      size_ *= shape_[ivec];
+    }
+  }
+
+  //! The number of cells in the box.
+  uint64_t size() const { return size_; }
+
+  //! The number of a cell in the box, or size() when the cell is not in the box.
+  uint64_t index(const int* icell) const {
+    uint64_t result = 0;
+    for (int ivec = 0; ivec < 3; ++ivec) {
+      const int64_t delta = static_cast<int64_t>(icell[ivec]) - begin_[ivec];
+      if ((delta < 0) || (static_cast<uint64_t>(delta) >= shape_[ivec])) return size_;
+      result = result*shape_[ivec] + static_cast<uint64_t>(delta);
+    }
+    return result;
+  }
+
+ private:
+  int begin_[3];
+  uint64_t shape_[3];
+  uint64_t size_;
+};
+
+/** @brief
+        Recursive external sort of points over a range of cell numbers.
+
+    All memory is allocated upon construction, except for the tile counts (one per
+    level of recursion, of which only one is in use at a time) and a few numbers per
+    block.
+ */
+template <typename PointType>
+class ExternalSort {
+ public:
+  ExternalSort(const IcellBox& box, size_t point_size, size_t memory_budget,
+      const CellRangeCallback& add_range, FILE* output)
+      : box_(box), point_size_(point_size),
+        ntile_max_(std::max<size_t>(2, memory_budget/4/sizeof(size_t))),
+        nchunk_(std::max<size_t>(1, (memory_budget - memory_budget/4)/
+                                    (2*point_size + sizeof(keys_[0])))),
+        buffer0_(nchunk_*point_size), buffer1_(nchunk_*point_size), keys_(nchunk_),
+        add_range_(add_range), output_(output), offset_(0) {}
+
+  //! Sort all points of source, with cell numbers in `[cell_begin, cell_end[`.
+  void sort(PointSource* source, size_t npoint, uint64_t cell_begin, uint64_t cell_end,
+      const std::string& filename);
+
+ private:
+  //! The cell number of a point, checked against the given range.
+  uint64_t cell_number(const char* point_char, uint64_t cell_begin,
+      uint64_t cell_end) const;
+  //! Sort the points in buffer0_ in memory and append them to the output.
+  void sort_in_memory(size_t npoint);
+
+  const IcellBox& box_;
+  const size_t point_size_;
+  const size_t ntile_max_;
+  const size_t nchunk_;
+  std::vector<char> buffer0_;
+  std::vector<char> buffer1_;
+  std::vector<std::pair<uint64_t, size_t>> keys_;
+  const CellRangeCallback& add_range_;
+  FILE* output_;
+  size_t offset_;  //!< number of points written to the output so far
+};
+
+
+template <typename PointType>
+uint64_t ExternalSort<PointType>::cell_number(const char* point_char,
+    uint64_t cell_begin, uint64_t cell_end) const {
+  const PointType* point(reinterpret_cast<const PointType*>(  // Ugly sweet hack
+      point_char));
+  uint64_t result = box_.index(point->icell_);
+  if ((result < cell_begin) || (result >= cell_end))
+    throw io_error("The point source returned different points in a later pass.");
+  return result;
+}
+
+
+template <typename PointType>
+void ExternalSort<PointType>::sort(PointSource* source, size_t npoint,
+    uint64_t cell_begin, uint64_t cell_end, const std::string& filename) {
+  // Count the number of points per tile. Tiles are equal ranges of cell numbers.
+  const uint64_t ntile = std::min<uint64_t>(cell_end - cell_begin, ntile_max_);
+  const uint64_t tile_width = (cell_end - cell_begin + ntile - 1)/ntile;
+  std::vector<size_t> tiles(ntile, 0);
+  size_t npoint_counted = 0;
+  size_t nread;
+  source->rewind();
+  while ((nread = source->read(buffer0_.data(), nchunk_, point_size_)) > 0) {
+    for (size_t ipoint = 0; ipoint < nread; ++ipoint) {
+      const char* point_char = buffer0_.data() + ipoint*point_size_;
+      ++tiles[(cell_number(point_char, cell_begin, cell_end) - cell_begin)/tile_width];
+    }
+    npoint_counted += nread;
+  }
+  if (npoint_counted != npoint)
+    throw io_error("The point source returned a different number of points.");
+
+  // Group consecutive tiles into blocks of at most nchunk_ points. Tiles with more
+  // points get a block of their own. From here on, tiles contains the block of each
+  // tile.
+  std::vector<uint64_t> block_tiles;  // first tile of each block
+  std::vector<size_t> block_sizes;    // number of points in each block
+  for (uint64_t itile = 0; itile < ntile; ++itile) {
+    if (block_tiles.empty() || (block_sizes.back() + tiles[itile] > nchunk_)) {
+      block_tiles.push_back(itile);
+      block_sizes.push_back(0);
+    }
+    block_sizes.back() += tiles[itile];
+    tiles[itile] = block_tiles.size() - 1;
+  }
+  const size_t nblock = block_tiles.size();
+  block_tiles.push_back(ntile);
+
+  // Spill the points into the block files. Each chunk is first grouped by block
+  // (counting sort), such that every block file receives one contiguous write.
+  BlockFiles block_files(filename, nblock);
+  std::vector<size_t> block_counts(nblock + 1);
+  source->rewind();
+  while ((nread = source->read(buffer0_.data(), nchunk_, point_size_)) > 0) {
+    std::fill(block_counts.begin(), block_counts.end(), 0);
+    for (size_t ipoint = 0; ipoint < nread; ++ipoint) {
+      const char* point_char = buffer0_.data() + ipoint*point_size_;
+      uint64_t itile = (cell_number(point_char, cell_begin, cell_end) - cell_begin)/
+                       tile_width;
+      ++block_counts[tiles[itile] + 1];
+      keys_[ipoint].second = tiles[itile];
+    }
+    std::partial_sum(block_counts.begin(), block_counts.end(), block_counts.begin());
+    std::vector<size_t> positions(block_counts.begin(), block_counts.end() - 1);
+    for (size_t ipoint = 0; ipoint < nread; ++ipoint) {
+      memcpy(buffer1_.data() + (positions[keys_[ipoint].second]++)*point_size_,
+             buffer0_.data() + ipoint*point_size_, point_size_);
+    }
+    for (size_t iblock = 0; iblock < nblock; ++iblock) {
+      size_t nblock_point = block_counts[iblock + 1] - block_counts[iblock];
+      write_or_throw(buffer1_.data() + block_counts[iblock]*point_size_,
+                     nblock_point*point_size_, block_files[iblock]);
+    }
+  }
+  std::vector<size_t>().swap(tiles);
+
+  // Sort each block and append it to the output.
+  for (size_t iblock = 0; iblock < nblock; ++iblock) {
+    BlockSource block_source(block_files[iblock]);
+    const size_t nblock_point = block_sizes[iblock];
+    const uint64_t block_begin = cell_begin + block_tiles[iblock]*tile_width;
+    const uint64_t block_end = std::min(cell_end,
+                                        cell_begin + block_tiles[iblock + 1]*tile_width);
+    if (nblock_point <= nchunk_) {
+      block_source.rewind();
+      if (block_source.read(buffer0_.data(), nchunk_, point_size_) != nblock_point)
+        throw io_error("Unexpected number of points in a temporary file for " +
+                       filename + ".");
+      sort_in_memory(nblock_point);
+    } else if (block_end - block_begin > 1) {
+      // A tile with too many points, which is split further.
+      sort(&block_source, nblock_point, block_begin, block_end,
+           block_filename(filename, iblock));
+    } else {
+      // A single large cell, which is sorted already: just copy.
+      size_t npoint_read = 0;
+      block_source.rewind();
+      while ((nread = block_source.read(buffer0_.data(), nchunk_, point_size_)) > 0) {
+        if (npoint_read == 0) {
+          const PointType* point(reinterpret_cast<const PointType*>(  // Ugly sweet hack
+              buffer0_.data()));
+          add_range_(point->icell_, offset_, offset_ + nblock_point);
+        }
+        write_or_throw(buffer0_.data(), nread*point_size_, output_);
+        npoint_read += nread;
+      }
+      if (npoint_read != nblock_point)
+        throw io_error("Unexpected number of points in a temporary file for " +
+                       filename + ".");
+      offset_ += nblock_point;
+    }
+  }
+}
+
+
+template <typename PointType>
+void ExternalSort<PointType>::sort_in_memory(size_t npoint) {
+  // Index sort on the cell number and the original position, which keeps the order of
+  // the points within one cell.
+  for (size_t ipoint = 0; ipoint < npoint; ++ipoint) {
+    const PointType* point(reinterpret_cast<const PointType*>(  // Ugly sweet hack
+        buffer0_.data() + ipoint*point_size_));
+    keys_[ipoint].first = box_.index(point->icell_);
+    keys_[ipoint].second = ipoint;
+  }
+  std::sort(keys_.begin(), keys_.begin() + npoint);
+  for (size_t ipoint = 0; ipoint < npoint; ++ipoint) {
+    memcpy(buffer1_.data() + ipoint*point_size_,
+           buffer0_.data() + keys_[ipoint].second*point_size_, point_size_);
+  }
+  write_or_throw(buffer1_.data(), npoint*point_size_, output_);
+  // Report the ranges of consecutive points in the same cell.
+  size_t ibegin = 0;
+  for (size_t ipoint = 1; ipoint <= npoint; ++ipoint) {
+    if ((ipoint < npoint) && (keys_[ipoint].first == keys_[ibegin].first)) continue;
+    const PointType* point(reinterpret_cast<const PointType*>(  // Ugly sweet hack
+        buffer1_.data() + ibegin*point_size_));
+    add_range_(point->icell_, offset_ + ibegin, offset_ + ipoint);
+    ibegin = ipoint;
+  }
+  offset_ += npoint;
+}
+
+}  // namespace
+
+
+template <typename PointType>
+void stream_decomposition(const Cell& subcell, const int* shape, PointSource* source,
+    size_t point_size, const std::string& filename, size_t memory_budget,
+    const CellRangeCallback& add_range) {
+  stream_decomposition<PointType>(subcell, shape, source, point_size, filename,
+                                  memory_budget, add_range, PrefixCallback());
+}
+
+
+template <typename PointType>
+void stream_decomposition(const Cell& subcell, const int* shape, PointSource* source,
+    size_t point_size, const std::string& filename, size_t memory_budget,
+    const CellRangeCallback& add_range, const PrefixCallback& write_prefix) {
+  // Check arguments
+  if (point_size < sizeof(PointType))
+    throw std::domain_error("point_size must be at least sizeof(PointType).");
+  if (memory_budget < 4*point_size)
+    throw std::domain_error("The memory budget must be large enough for four points.");
+  if (subcell.nvec() != 3)
+    throw std::domain_error("Partitioning is only sensible for 3D subcells.");
+
+  // First pass: count the points and find the box of icells.
+  IcellSource<PointType> icell_source(subcell, shape, source);
+  const size_t nchunk = memory_budget/point_size;
+  size_t npoint = 0;
+  int icell_begin[3]{0, 0, 0};
+  int icell_last[3]{0, 0, 0};
+  {
+    std::vector<char> buffer(nchunk*point_size);
+    size_t nread;
+    icell_source.rewind();
+    while ((nread = icell_source.read(buffer.data(), nchunk, point_size)) > 0) {
+      for (size_t ipoint = 0; ipoint < nread; ++ipoint) {
+        const PointType* point(reinterpret_cast<const PointType*>(  // Ugly sweet hack
+            buffer.data() + ipoint*point_size));
+        for (int ivec = 0; ivec < 3; ++ivec) {
+          const bool first = (npoint == 0) && (ipoint == 0);
+          icell_begin[ivec] = first ? point->icell_[ivec] :
+                              std::min(icell_begin[ivec], point->icell_[ivec]);
+          icell_last[ivec] = first ? point->icell_[ivec] :
+                             std::max(icell_last[ivec], point->icell_[ivec]);
+        }
+      }
+      npoint += nread;
+    }
+  }
+
+  // Sort the points into the output, behind the prefix.
+  FILE* output = fopen(filename.c_str(), "wb");
+  if (output == nullptr)
+    throw io_error("Could not open " + filename + " for writing.");
+  try {
+    if (write_prefix) write_prefix(npoint, icell_begin, icell_last, output);
+    if (npoint > 0) {
+      IcellBox box(icell_begin, icell_last);
+      ExternalSort<PointType> external_sort(box, point_size, memory_budget, add_range,
+                                            output);
+      external_sort.sort(&icell_source, npoint, 0, box.size(), filename);
+    }
+  } catch (...) {
+    fclose(output);
+    throw;
+  }
+  if (fclose(output) != 0)
+    throw io_error("Could not close " + filename + ".");
+}
+
+
+template void stream_decomposition<Point>(const Cell& subcell, const int* shape,
+    PointSource* source, size_t point_size, const std::string& filename,
+    size_t memory_budget, const CellRangeCallback& add_range);
+template void stream_decomposition<PointF>(const Cell& subcell, const int* shape,
+    PointSource* source, size_t point_size, const std::string& filename,
+    size_t memory_budget, const CellRangeCallback& add_range);
+template void stream_decomposition<Point>(const Cell& subcell, const int* shape,
+    PointSource* source, size_t point_size, const std::string& filename,
+    size_t memory_budget, const CellRangeCallback& add_range,
+    const PrefixCallback& write_prefix);
+template void stream_decomposition<PointF>(const Cell& subcell, const int* shape,
+    PointSource* source, size_t point_size, const std::string& filename,
+    size_t memory_budget, const CellRangeCallback& add_range,
+    const PrefixCallback& write_prefix);
+
+
+}  // namespace cellcutoff
+
+// vim: textwidth=90 et ts=2 sw=2
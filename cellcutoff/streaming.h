@@ -0,0 +1,214 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+/** @file */
+
+
+#ifndef CELLCUTOFF_STREAMING_H_
+#define CELLCUTOFF_STREAMING_H_
+
+#include <cstdio>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+#include "cellcutoff/cell.h"
+#include "cellcutoff/decomposition.h"
+
+
+namespace cellcutoff {
+
+
+/** @brief
+        An exception for failures to read or write files.
+ */
+class io_error : public std::runtime_error {
+ public:
+  explicit io_error(const std::string& what_arg)
+      : std::runtime_error(what_arg) {}
+};
+
+
+/** @brief
+        Abstract source of points that can be read in chunks.
+
+    Derive from this class to feed points from a callback, e.g. a generator or another
+    file format. The records must have the same layout as for `assign_icell`, i.e. a
+    `Point` (or the point type given to `stream_decomposition`) optionally followed by
+    user data, with a total size of `point_size` bytes.
+ */
+class PointSource {
+ public:
+  virtual ~PointSource() {}
+
+  /** @brief
+          Read the next chunk of points.
+
+      @param points
+          Buffer in which at most `npoint` records of `point_size` bytes are written.
+
+      @return
+          The number of records written. Zero is only returned at the end of the source.
+   */
+  virtual size_t read(void* points, size_t npoint, size_t point_size) = 0;
+
+  //! Restart reading from the first point.
+  virtual void rewind() = 0;
+};
+
+
+/** @brief
+        Reads points from a binary file with consecutive records of `point_size` bytes.
+ */
+class FilePointSource : public PointSource {
+ public:
+  explicit FilePointSource(const std::string& filename);
+  ~FilePointSource();
+
+  FilePointSource(const FilePointSource&) = delete;
+  FilePointSource& operator=(const FilePointSource&) = delete;
+
+  size_t read(void* points, size_t npoint, size_t point_size);
+  void rewind();
+
+ private:
+  FILE* file_;
+};
+
+
+/** @brief
+        Read-only memory map of a complete file.
+
+    This provides zero-copy access, e.g. to the sorted points written by
+    `stream_decomposition`. The pages are only loaded when used and they are shared
+    with other processes mapping the same file.
+ */
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& filename);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  //! Returns a pointer to the contents, `nullptr` in case of an empty file.
+  const void* data() const { return data_; }
+  //! Returns the size of the file in bytes.
+  size_t size() const { return size_; }
+
+ private:
+  void* data_;
+  size_t size_;
+};
+
+
+/** @brief
+        Receives the range of points of a non-empty cell from `stream_decomposition`.
+
+    The arguments are the icell (three ints) and the range `[begin, end[` of the points
+    of that cell in the output. Cells are reported in the order of `sort_by_icell`.
+ */
+typedef std::function<void(const int* icell, size_t begin, size_t end)> CellRangeCallback;
+
+
+/** @brief
+        Writes a prefix before the sorted points in `stream_decomposition`.
+
+    The arguments are the total number of points, the lowest and the highest icell in
+    each direction (all zero without points) and the output file.
+ */
+typedef std::function<void(size_t npoint, const int* icell_begin, const int* icell_last,
+    FILE* file)> PrefixCallback;
+
+
+/** @brief
+        Out-of-core equivalent of `assign_icell`, `sort_by_icell` and `create_cell_map`.
+
+    The points are read three times from the source, in chunks. The first pass assigns
+    the icells and determines the box of icells in which all points lie. The cells in
+    this box are numbered in the order of `sort_by_icell` and this range of numbers is
+    split into tiles. The second pass counts the number of points per tile, and
+    consecutive tiles are grouped into blocks that fit into the memory budget. The
+    third pass spills the points into one temporary file per block. These files remain
+    open until the block is sorted, so the number of blocks is limited by the number of
+    open files. Finally, each block is sorted in memory and appended to the output
+    file. A block with too many points, i.e. a single tile, is split again into tiles
+    in the same way, unless it contains just one cell.
+
+    The ranges of the points in each cell are passed to a callback instead of being
+    stored, such that no memory proportional to the number of cells or points is
+    needed. Apart from a few bytes per block, at most `memory_budget` bytes are
+    allocated, of which one quarter is used for the tile counts.
+
+    The point type is a template parameter, `Point` by default, as in `assign_icell`.
+
+    @param subcell
+        The subcell used for the decomposition, as in `assign_icell`.
+
+    @param shape
+        When not `nullptr`, the points are wrapped into the periodic cell, as in
+        `assign_icell`.
+
+    @param source
+        The source of the points.
+
+    @param point_size
+        The size of one point record in bytes.
+
+    @param filename
+        The output file to which the sorted points are written. Temporary files are
+        created by appending a suffix to this filename.
+
+    @param memory_budget
+        The amount of memory in bytes used for buffering points and counts. It must be
+        large enough to hold at least four points.
+
+    @param add_range
+        Called with every non-empty cell and its range of points in the output file.
+ */
+template <typename PointType = Point>
+void stream_decomposition(const Cell& subcell, const int* shape, PointSource* source,
+    size_t point_size, const std::string& filename, size_t memory_budget,
+    const CellRangeCallback& add_range);
+
+
+/** @brief
+        Variant of `stream_decomposition` that writes a prefix before the sorted points.
+
+    @param write_prefix
+        Called once, after the first pass. All bytes written by this function precede
+        the sorted points, e.g. the header of a decomposition file (see
+        `save_decomposition_streaming`). The ranges passed to `add_range` count points
+        from the end of the prefix.
+
+    All other arguments are the same as in the basic version.
+ */
+template <typename PointType = Point>
+void stream_decomposition(const Cell& subcell, const int* shape, PointSource* source,
+    size_t point_size, const std::string& filename, size_t memory_budget,
+    const CellRangeCallback& add_range, const PrefixCallback& write_prefix);
+
+
+}  // namespace cellcutoff
+
+
+#endif  // CELLCUTOFF_STREAMING_H_
+
+// vim: textwidth=90 et ts=2 sw=2
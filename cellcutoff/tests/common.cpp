@@ -21,11 +21,14 @@
 
 #include "common.h"
 
+#include <unistd.h>
+
 #include <algorithm>
 #include <cmath>
 #include <limits>
 #include <random>
 #include <stdexcept>
+#include <string>
 
 #include <gtest/gtest.h>
 
@@ -99,6 +102,20 @@ unsigned int fill_random_permutation(const unsigned int seed, int* array,
 }
 
 
+unsigned int fill_random_metric(const unsigned int seed, double* metric) {
+  double factor[9];
+  unsigned int next_seed = fill_random_double(seed, factor, 9, -1.0, 1.0);
+  for (int irow = 0; irow < 3; ++irow) {
+    for (int icol = 0; icol < 3; ++icol) {
+      metric[3*irow + icol] = (irow == icol) ? 0.1 : 0.0;
+      for (int k = 0; k < 3; ++k)
+        metric[3*irow + icol] += factor[3*k + irow]*factor[3*k + icol];
+    }
+  }
+  return next_seed;
+}
+
+
 std::unique_ptr<cl::Cell> create_random_cell_nvec(unsigned int seed, const int nvec,
     const double scale, const double ratio, const bool cuboid) {
   // Range check
@@ -140,6 +157,16 @@ unsigned int random_point(unsigned int seed,  const double* center,
 }
 
 
+std::string create_temporary_file() {
+  char filename[] = "/tmp/cellcutoff_XXXXXX";
+  int fd = mkstemp(filename);
+  if (fd == -1)
+    throw std::runtime_error("Could not create a temporary file.");
+  close(fd);
+  return filename;
+}
+
+
 TEST(CommonTest, domain) {
   EXPECT_THROW(fill_random_double(0, nullptr, 0, 0.0, 1.0), std::domain_error);
   EXPECT_THROW(fill_random_double(0, nullptr, -1, 0.0, 1.0), std::domain_error);
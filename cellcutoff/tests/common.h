@@ -23,6 +23,7 @@
 #define CELLCUTOFF_TESTS_COMMON_H_
 
 #include <memory>
+#include <string>
 
 #include "cellcutoff/cell.h"
 
@@ -57,6 +58,9 @@ unsigned int fill_random_int(const unsigned int seed, int* array, const int size
 //! Fills and array of int with a random permutation
 unsigned int fill_random_permutation(const unsigned int seed, int* array, const int size);
 
+//! Fills a 3x3 array with a random symmetric positive definite matrix, A^T A + 0.1 I
+unsigned int fill_random_metric(const unsigned int seed, double* metric);
+
 //! Random cell with a volume larger than (ratio*scale)**nvec
 std::unique_ptr<cl::Cell> create_random_cell_nvec(const unsigned int seed, const int nvec,
     const double scale = 1.0, const double ratio = 0.1, const bool cuboid = false);
@@ -65,6 +69,9 @@ std::unique_ptr<cl::Cell> create_random_cell_nvec(const unsigned int seed, const
 unsigned int random_point(const unsigned int seed,  const double* center,
     const double cutoff, double* point, double* norm);
 
+//! Creates a new empty temporary file and returns its name.
+std::string create_temporary_file();
+
 
 #endif  // CELLCUTOFF_TESTS_COMMON_H_
 
@@ -19,8 +19,11 @@
 // --
 
 
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <memory>
+#include <set>
 #include <stdexcept>
 #include <vector>
 
@@ -28,6 +31,7 @@
 
 #include <cellcutoff/cell.h>
 #include <cellcutoff/iterators.h>
+#include <cellcutoff/sphere_slice.h>
 #include <cellcutoff/vec3.h>
 
 #include "common.h"
@@ -1113,6 +1117,349 @@ TEST_P(CellTestP, bars_cutoff_random) {
 }
 
 
+TEST_P(CellTestP, bars_cutoff_buffer) {
+  for (int irep = 0; irep < NREP; ++irep) {
+    std::unique_ptr<cl::Cell> cell(create_random_cell(2*irep));
+    double cutoff = (irep + 1)*0.1;
+    double center[3];
+    fill_random_double(47332 + irep, center, 3, -1.0, 1.0);
+    // The vector variant appends to existing data.
+    std::vector<int> bars{7};
+    cell->bars_cutoff(center, cutoff, &bars);
+    EXPECT_EQ(7, bars[0]);
+    bars.erase(bars.begin());
+    // The size prediction is an upper bound.
+    size_t size = cell->bars_cutoff_size(center, cutoff);
+    EXPECT_LE(bars.size(), size);
+    // The buffer variant gives the same result.
+    std::vector<int> buffer(size);
+    EXPECT_EQ(bars.size(), cell->bars_cutoff(center, cutoff, buffer.data(), size));
+    EXPECT_TRUE(std::equal(bars.begin(), bars.end(), buffer.begin()));
+    // Too small buffers are detected.
+    EXPECT_THROW(cell->bars_cutoff(center, cutoff, buffer.data(), bars.size() - 1),
+                 std::domain_error);
+  }
+}
+
+
+TEST_P(CellTestP, bars_cutoff_geometry) {
+  for (int irep = 0; irep < NREP; ++irep) {
+    // One geometry for several centers.
+    std::unique_ptr<cl::Cell> cell(create_random_cell(2*irep + 1));
+    double cutoff = (irep + 1)*0.1;
+    cl::SphereSliceGeometry geometry(cell->gvecs(), cutoff);
+    for (int icenter = 0; icenter < 3; ++icenter) {
+      double center[3];
+      fill_random_double(47332 + 3*irep + icenter, center, 3, -1.0, 1.0);
+      std::vector<int> bars;
+      cell->bars_cutoff(center, cutoff, &bars);
+      std::vector<int> bars_geometry;
+      cell->bars_cutoff(geometry, center, &bars_geometry);
+      EXPECT_EQ(bars, bars_geometry);
+    }
+    // A geometry of another cell is not accepted.
+    std::unique_ptr<cl::Cell> other_cell(create_random_cell(2*irep + 2));
+    cl::SphereSliceGeometry other_geometry(other_cell->gvecs(), cutoff);
+    std::vector<int> bars;
+    const double center[3]{0.0, 0.0, 0.0};
+    EXPECT_THROW(cell->bars_cutoff(other_geometry, center, &bars), std::domain_error);
+  }
+}
+
+
+TEST_P(CellTestP, bars_cutoff_metric) {
+  size_t npoint_total = 0;
+  for (int irep = 0; irep < NREP; ++irep) {
+    std::unique_ptr<cl::Cell> cell(create_random_cell(2*irep + 1));
+    double cutoff = 0.2 + irep*0.01;
+    double center[3];
+    fill_random_double(47332 + irep, center, 3, -1.0, 1.0);
+
+    // The identity matrix gives the same result as bars_cutoff.
+    const double identity[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+    std::vector<int> bars;
+    cell->bars_cutoff(center, cutoff, &bars);
+    std::vector<int> bars_identity;
+    cell->bars_cutoff_metric(center, identity, cutoff, &bars_identity);
+    EXPECT_EQ(bars, bars_identity);
+
+    // Cells of a random ellipsoid
+    double metric[9];
+    fill_random_metric(irep + 1, metric);
+    std::vector<int> bars_metric;
+    EXPECT_THROW(cell->bars_cutoff_metric(center, metric, 0.0, &bars_metric),
+                 std::domain_error);
+    cell->bars_cutoff_metric(center, metric, cutoff, &bars_metric);
+    EXPECT_LE(bars_metric.size(), cell->bars_cutoff_metric_size(center, metric, cutoff));
+    std::set<std::array<int, 3>> icells;
+    for (cl::BarIterator bit(bars_metric, nvec); bit.busy(); ++bit) {
+      std::array<int, 3> icell{0, 0, 0};
+      std::copy(bit.icell(), bit.icell() + nvec, icell.begin());
+      icells.insert(icell);
+    }
+
+    // Random points in the ellipsoid must be in one of the cells. With the unit
+    // vectors as normals, metric_to_sphere gives the transpose of the inverse
+    // Cholesky factor, which maps the unit sphere onto the ellipsoid.
+    double inv_factor_t[9];
+    cl::metric_to_sphere(metric, nullptr, identity, nullptr, inv_factor_t);
+    unsigned int seed = irep + 2;
+    for (int isample = 0; isample < 100; ++isample) {
+      double sphere_delta[3];
+      seed = fill_random_double(seed, sphere_delta, 3, -cutoff, cutoff);
+      if (vec3::norm(sphere_delta) >= cutoff) continue;
+      double point[3];
+      vec3::matvec(inv_factor_t, sphere_delta, point);
+      vec3::iadd(point, center);
+      double frac[3];
+      cell->to_frac(point, frac);
+      std::array<int, 3> icell{0, 0, 0};
+      for (int ivec = 0; ivec < nvec; ++ivec)
+        icell[ivec] = static_cast<int>(floor(frac[ivec]));
+      EXPECT_EQ(1u, icells.count(icell));
+      ++npoint_total;
+    }
+
+    // The buffer variant gives the same result.
+    std::vector<int> buffer(bars_metric.size());
+    EXPECT_EQ(bars_metric.size(), cell->bars_cutoff_metric(center, metric, cutoff,
+              buffer.data(), buffer.size()));
+    EXPECT_EQ(bars_metric, buffer);
+    EXPECT_THROW(cell->bars_cutoff_metric(center, metric, cutoff, buffer.data(),
+                 buffer.size() - 1), std::domain_error);
+
+    // The metric must be positive definite.
+    const double bad_metric[9]{1.0, 0.0, 0.0, 0.0, -1.0, 0.0, 0.0, 0.0, 1.0};
+    EXPECT_THROW(cell->bars_cutoff_metric(center, bad_metric, cutoff, &bars_metric),
+                 std::domain_error);
+  }
+  // Sufficiency check
+  EXPECT_LE(NREP*30, npoint_total);
+}
+
+
+TEST_P(CellTestP, bars_box_example) {
+  // Unit cube subcells and an axis-aligned box
+  const double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell cell(vecs, nvec);
+  const double origin[3]{0.5, -1.5, 0.2};
+  const double edges[9]{2.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 0.5};
+  std::vector<int> bars;
+  cell.bars_box(origin, edges, &bars);
+  std::vector<int> expected;
+  if (nvec == 1) {
+    expected = {0, 3};
+  } else if (nvec == 2) {
+    expected = {0, 3, -2, 0, -2, 0, -2, 0};
+  } else {
+    expected = {0, 3, -2, 0, 0, 1, 0, 1, -2, 0, 0, 1, 0, 1, -2, 0, 0, 1, 0, 1};
+  }
+  EXPECT_EQ(expected, bars);
+}
+
+
+TEST_P(CellTestP, bars_box_random) {
+  size_t npoint_total = 0;
+  size_t ncell_total = 0;
+  size_t ncell_ranges_total = 0;
+  for (int irep = 0; irep < NREP; ++irep) {
+    std::unique_ptr<cl::Cell> cell(create_random_cell(irep + 1));
+    double origin[3];
+    fill_random_double(47332 + irep, origin, 3, -1.0, 1.0);
+    double edges[9];
+    fill_random_double(17 + irep, edges, 9, -1.0, 1.0);
+    if (fabs(vec3::triple(edges, edges + 3, edges + 6)) < 0.01) continue;
+
+    std::vector<int> bars;
+    cell->bars_box(origin, edges, &bars);
+    EXPECT_LE(bars.size(), cell->bars_box_size(origin, edges));
+    std::set<std::array<int, 3>> icells;
+    for (cl::BarIterator bit(bars, nvec); bit.busy(); ++bit) {
+      std::array<int, 3> icell{0, 0, 0};
+      std::copy(bit.icell(), bit.icell() + nvec, icell.begin());
+      icells.insert(icell);
+    }
+    ncell_total += icells.size();
+
+    // Random points in the box must be in one of the cells.
+    unsigned int seed = irep + 2;
+    for (int isample = 0; isample < 100; ++isample) {
+      double box_frac[3];
+      seed = fill_random_double(seed, box_frac, 3, 0.0, 1.0);
+      double point[3];
+      vec3::copy(origin, point);
+      for (int k = 0; k < 3; ++k)
+        vec3::iadd(point, edges + 3*k, box_frac[k]);
+      double frac[3];
+      cell->to_frac(point, frac);
+      std::array<int, 3> icell{0, 0, 0};
+      for (int ivec = 0; ivec < nvec; ++ivec)
+        icell[ivec] = static_cast<int>(floor(frac[ivec]));
+      EXPECT_EQ(1u, icells.count(icell));
+      ++npoint_total;
+    }
+
+    // The cells are a subset of the box of fractional ranges.
+    std::array<int, 3> ranges_begin{0, 0, 0};
+    std::array<int, 3> ranges_end{1, 1, 1};
+    for (int ivec = 0; ivec < nvec; ++ivec) {
+      double frac_min = vec3::dot(cell->gvec(ivec), origin);
+      double frac_max = frac_min;
+      for (int k = 0; k < 3; ++k) {
+        double frac_edge = vec3::dot(cell->gvec(ivec), edges + 3*k);
+        frac_min += std::min(frac_edge, 0.0);
+        frac_max += std::max(frac_edge, 0.0);
+      }
+      ranges_begin[ivec] = static_cast<int>(floor(frac_min));
+      ranges_end[ivec] = static_cast<int>(ceil(frac_max));
+    }
+    for (const std::array<int, 3>& icell : icells) {
+      for (int ivec = 0; ivec < nvec; ++ivec) {
+        EXPECT_LE(ranges_begin[ivec], icell[ivec]);
+        EXPECT_GT(ranges_end[ivec], icell[ivec]);
+      }
+    }
+    ncell_ranges_total += (ranges_end[0] - ranges_begin[0])*
+                          (ranges_end[1] - ranges_begin[1])*
+                          (ranges_end[2] - ranges_begin[2]);
+
+    // The buffer variant gives the same result.
+    std::vector<int> buffer(bars.size());
+    EXPECT_EQ(bars.size(), cell->bars_box(origin, edges, buffer.data(), buffer.size()));
+    EXPECT_EQ(bars, buffer);
+    EXPECT_THROW(cell->bars_box(origin, edges, buffer.data(), buffer.size() - 1),
+                 std::domain_error);
+  }
+  // Sufficiency check and the bars must be tighter than the ranges.
+  EXPECT_LE(NREP*50, npoint_total);
+  if (nvec > 1) {
+    EXPECT_GT(ncell_ranges_total, ncell_total);
+  }
+}
+
+
+TEST_P(CellTestP, bars_box_domain) {
+  const double origin[3]{0.0, 0.0, 0.0};
+  const double edges[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 1.0, 1.0, 0.0};
+  std::vector<int> bars;
+  EXPECT_THROW(mycell->bars_box(origin, edges, &bars), std::domain_error);
+  cl::Cell cell0;
+  const double good_edges[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  EXPECT_THROW(cell0.bars_box(origin, good_edges, &bars), std::domain_error);
+}
+
+
+TEST_P(CellTestP, bars_cutoff_cuboid) {
+  size_t nint_total = 0;
+  for (int irep = 0; irep < NREP; ++irep) {
+    // Random cuboid cell and the same cell with permuted Cartesian axes, for which the
+    // general algorithm is used.
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(2*irep, nvec, 1.0, 0.1, true));
+    ASSERT_TRUE(cell->cuboid());
+    double vecs_permuted[9];
+    for (int ivec = 0; ivec < 3; ++ivec) {
+      for (int icart = 0; icart < 3; ++icart)
+        vecs_permuted[3*ivec + (icart + 1)%3] = cell->vecs()[3*ivec + icart];
+    }
+    cl::Cell cell_permuted(vecs_permuted, nvec);
+    ASSERT_FALSE(cell_permuted.cuboid());
+    double cutoff = (irep + 1)*0.1;
+    double center[3];
+    fill_random_double(47332 + irep, center, 3, -1.0, 1.0);
+    const double center_permuted[3]{center[2], center[0], center[1]};
+
+    // Both must give the same bars.
+    std::vector<int> bars;
+    cell->bars_cutoff(center, cutoff, &bars);
+    std::vector<int> bars_permuted;
+    cell_permuted.bars_cutoff(center_permuted, cutoff, &bars_permuted);
+    EXPECT_EQ(bars_permuted, bars);
+    nint_total += bars.size();
+  }
+  // Sufficiency check
+  EXPECT_LE(NREP*nvec*2, nint_total);
+}
+
+
+TEST_P(CellTestP, bars_cutoff_pruned) {
+  size_t ncell_pruned_total = 0;
+  size_t ncell_ranges_total = 0;
+  for (int irep = 0; irep < NREP; ++irep) {
+    std::unique_ptr<cl::Cell> cell(create_random_cell(2*irep));
+    double cutoff = 0.1 + irep*0.01;
+    double center[3];
+    fill_random_double(47332 + irep, center, 3, -1.0, 1.0);
+
+    // Collect the cells of both variants.
+    std::vector<int> bars;
+    EXPECT_THROW(cell->bars_cutoff_pruned(center, 0.0, &bars), std::domain_error);
+    cell->bars_cutoff(center, cutoff, &bars);
+    std::set<std::array<int, 3>> icells;
+    for (cl::BarIterator bit(bars, nvec); bit.busy(); ++bit) {
+      std::array<int, 3> icell{0, 0, 0};
+      std::copy(bit.icell(), bit.icell() + nvec, icell.begin());
+      icells.insert(icell);
+    }
+    std::vector<int> bars_pruned;
+    cell->bars_cutoff_pruned(center, cutoff, &bars_pruned);
+    EXPECT_LE(bars_pruned.size(), cell->bars_cutoff_size(center, cutoff));
+    std::set<std::array<int, 3>> icells_pruned;
+    for (cl::BarIterator bit(bars_pruned, nvec); bit.busy(); ++bit) {
+      std::array<int, 3> icell{0, 0, 0};
+      std::copy(bit.icell(), bit.icell() + nvec, icell.begin());
+      icells_pruned.insert(icell);
+    }
+
+    // The pruned cells must include all cells of bars_cutoff and they must be
+    // part of the ranges_cutoff box.
+    EXPECT_TRUE(std::includes(icells_pruned.begin(), icells_pruned.end(),
+                              icells.begin(), icells.end()));
+    int ranges_begin[3];
+    int ranges_end[3];
+    ncell_ranges_total += cell->ranges_cutoff(center, cutoff, ranges_begin, ranges_end);
+    for (const std::array<int, 3>& icell : icells_pruned) {
+      for (int ivec = 0; ivec < nvec; ++ivec) {
+        EXPECT_LE(ranges_begin[ivec], icell[ivec]);
+        EXPECT_GT(ranges_end[ivec], icell[ivec]);
+      }
+    }
+    ncell_pruned_total += icells_pruned.size();
+
+    // The buffer variant gives the same result.
+    std::vector<int> buffer(bars_pruned.size());
+    EXPECT_EQ(bars_pruned.size(), cell->bars_cutoff_pruned(center, cutoff,
+              buffer.data(), buffer.size()));
+    EXPECT_EQ(bars_pruned, buffer);
+    EXPECT_THROW(cell->bars_cutoff_pruned(center, cutoff, buffer.data(),
+                 buffer.size() - 1), std::domain_error);
+  }
+  // Pruning must be effective.
+  if (nvec > 1) {
+    EXPECT_GT(ncell_ranges_total, ncell_pruned_total);
+  }
+}
+
+
+TEST_P(CellTestP, bars_cutoff_pruned_cubic) {
+  // For cubic cells, the lower bound on the distance is exact.
+  for (int irep = 0; irep < NREP; ++irep) {
+    double vecs[9]{0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    fill_random_double(irep, vecs, 1, 0.5, 2.0);
+    vecs[4] = vecs[0];
+    vecs[8] = vecs[0];
+    cl::Cell cell(vecs, nvec);
+    double cutoff = (irep + 1)*0.1;
+    double center[3];
+    fill_random_double(47332 + irep, center, 3, -1.0, 1.0);
+    std::vector<int> bars;
+    cell.bars_cutoff(center, cutoff, &bars);
+    std::vector<int> bars_pruned;
+    cell.bars_cutoff_pruned(center, cutoff, &bars_pruned);
+    EXPECT_EQ(bars, bars_pruned);
+  }
+}
+
+
 TEST_F(CellTest1, bars_cutoff_corners) {
   for (int irep = 0; irep < NREP; ++irep) {
     // Test parameters:
@@ -0,0 +1,169 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include <algorithm>
+#include <array>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <cellcutoff/cell.h>
+#include <cellcutoff/cell_list.h>
+#include <cellcutoff/decomposition.h>
+#include <cellcutoff/iterators.h>
+
+#include "common.h"
+
+
+namespace cl = cellcutoff;
+
+
+TEST(CellListTest, exceptions) {
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell2(vecs, 2);
+  EXPECT_THROW(cl::CellList(subcell2, nullptr), std::domain_error);
+  cl::Cell subcell(vecs, 3);
+  cl::CellList cell_list(subcell, nullptr);
+  double cart[3]{0.5, 0.5, 0.5};
+  size_t ipoint = cell_list.insert(cart);
+  EXPECT_THROW(cell_list.remove(ipoint + 1), std::domain_error);
+  EXPECT_THROW(cell_list.move(ipoint + 1, cart), std::domain_error);
+  EXPECT_THROW(cell_list.point(ipoint + 1), std::domain_error);
+  cell_list.remove(ipoint);
+  EXPECT_THROW(cell_list.remove(ipoint), std::domain_error);
+  EXPECT_FALSE(cell_list.contains(ipoint));
+}
+
+
+TEST(CellListTest, example) {
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell(vecs, 3);
+  int shape[3]{5, 5, 5};
+  cl::CellList cell_list(subcell, shape);
+  double cart0[3]{0.5, 0.5, 0.5};
+  double cart1[3]{4.5, 0.5, 0.5};
+  double cart2[3]{7.5, 0.5, 0.5};
+  EXPECT_EQ(0, cell_list.insert(cart0));
+  EXPECT_EQ(1, cell_list.insert(cart1));
+  EXPECT_EQ(2, cell_list.insert(cart2));
+  EXPECT_EQ(3, cell_list.npoint());
+  // Points are wrapped.
+  EXPECT_EQ(2, cell_list.point(2).icell_[0]);
+  EXPECT_DOUBLE_EQ(2.5, cell_list.point(2).cart_[0]);
+  // Neighbors of point 0, through the periodic boundary
+  std::vector<cl::CellListNeighbor> neighbors;
+  cell_list.neighbors(cart0, 1.5, &neighbors);
+  ASSERT_EQ(2, neighbors.size());
+  std::sort(neighbors.begin(), neighbors.end(), [](const cl::CellListNeighbor& n0,
+      const cl::CellListNeighbor& n1) { return n0.ipoint < n1.ipoint; });
+  EXPECT_EQ(0, neighbors[0].ipoint);
+  EXPECT_DOUBLE_EQ(0.0, neighbors[0].distance);
+  EXPECT_EQ(1, neighbors[1].ipoint);
+  EXPECT_DOUBLE_EQ(-1.0, neighbors[1].delta[0]);
+  // Move point 2 next to point 0 and remove point 1. Its index is reused.
+  double cart3[3]{0.5, 1.5, 0.5};
+  cell_list.move(2, cart3);
+  cell_list.remove(1);
+  EXPECT_EQ(2, cell_list.npoint());
+  cell_list.neighbors(cart0, 1.5, &neighbors);
+  ASSERT_EQ(2, neighbors.size());
+  EXPECT_EQ(1, cell_list.insert(cart1));
+  EXPECT_EQ(3, cell_list.capacity());
+}
+
+
+TEST(CellListTest, random_operations) {
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, 3, 10.0, 0.5));
+    int shape[3];
+    std::unique_ptr<cl::Cell> subcell(cell->create_subcell(1.0, shape));
+    cl::CellList cell_list(*subcell, shape);
+    // Reference: original Cartesian coordinates of all points in the cell list.
+    std::map<size_t, std::array<double, 3>> carts;
+    unsigned int seed = irep + 2713;
+    for (int istep = 0; istep < 3*NPOINT; ++istep) {
+      int operation;
+      seed = fill_random_int(seed, &operation, 1, 0, 2);
+      double cart[3];
+      seed = fill_random_double(seed, cart, 3, -5.0, 5.0);
+      if ((operation == 0) || (carts.size() < 10)) {
+        size_t ipoint = cell_list.insert(cart);
+        EXPECT_EQ(0, carts.count(ipoint));
+        carts[ipoint] = std::array<double, 3>{cart[0], cart[1], cart[2]};
+      } else {
+        int ichoice;
+        seed = fill_random_int(seed, &ichoice, 1, 0, static_cast<int>(carts.size()) - 1);
+        auto it = carts.begin();
+        std::advance(it, ichoice);
+        if (operation == 1) {
+          cell_list.move(it->first, cart);
+          it->second = std::array<double, 3>{cart[0], cart[1], cart[2]};
+        } else {
+          cell_list.remove(it->first);
+          carts.erase(it);
+        }
+      }
+    }
+    ASSERT_EQ(carts.size(), cell_list.npoint());
+
+    // Compare neighbors with a DeltaIterator on a new decomposition.
+    struct IndexedPoint {
+      cl::Point point;
+      size_t index;
+    };
+    std::vector<IndexedPoint> points;
+    for (const auto& kv : carts)
+      points.push_back(IndexedPoint{cl::Point(kv.second.data()), kv.first});
+    cl::assign_icell(*subcell, shape, points.data(), points.size(), sizeof(IndexedPoint));
+    cl::sort_by_icell(points.data(), points.size(), sizeof(IndexedPoint));
+    std::unique_ptr<cl::CellMap> cell_map(
+        cl::create_cell_map(points.data(), points.size(), sizeof(IndexedPoint)));
+    for (int icenter = 0; icenter < 10; ++icenter) {
+      double center[3];
+      seed = fill_random_double(seed, center, 3, -5.0, 5.0);
+      const double cutoff = 2.0 + 0.3*icenter;
+      std::vector<std::array<double, 2>> results_ref;
+      for (cl::DeltaIterator dit(*subcell, shape, center, cutoff, points.data(),
+           points.size(), sizeof(IndexedPoint), *cell_map); dit.busy(); ++dit) {
+        results_ref.push_back(std::array<double, 2>{
+          static_cast<double>(points[dit.ipoint()].index), dit.distance()});
+      }
+      std::sort(results_ref.begin(), results_ref.end());
+      std::vector<cl::CellListNeighbor> neighbors;
+      cell_list.neighbors(center, cutoff, &neighbors);
+      std::vector<std::array<double, 2>> results;
+      for (const auto& neighbor : neighbors) {
+        results.push_back(std::array<double, 2>{
+          static_cast<double>(neighbor.ipoint), neighbor.distance});
+      }
+      std::sort(results.begin(), results.end());
+      ASSERT_EQ(results_ref.size(), results.size());
+      for (size_t iresult = 0; iresult < results.size(); ++iresult) {
+        EXPECT_EQ(results_ref[iresult][0], results[iresult][0]);
+        EXPECT_NEAR(results_ref[iresult][1], results[iresult][1], EPS);
+      }
+    }
+  }
+}
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -0,0 +1,147 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <cellcutoff/cell.h>
+#include <cellcutoff/cell_pairs.h>
+#include <cellcutoff/decomposition.h>
+#include <cellcutoff/iterators.h>
+#include <cellcutoff/vec3.h>
+
+#include "common.h"
+
+
+namespace cl = cellcutoff;
+namespace vec3 = cellcutoff::vec3;
+
+
+typedef std::array<double, 3> PairRecord;
+
+
+//! All pairs (ipoint0, ipoint1, distance) within the cutoff, found with cell pairs.
+std::vector<PairRecord> cell_pairs_records(const std::vector<cl::CellPair>& cell_pairs,
+    const std::vector<cl::Point>& points, double cutoff, bool half) {
+  std::vector<PairRecord> records;
+  for (const cl::CellPair& cell_pair : cell_pairs) {
+    for (size_t ipoint0 = cell_pair.begin0; ipoint0 < cell_pair.end0; ++ipoint0) {
+      for (size_t ipoint1 = cell_pair.begin1; ipoint1 < cell_pair.end1; ++ipoint1) {
+        if (cell_pair.self && ((half && (ipoint1 <= ipoint0)) || (ipoint1 == ipoint0)))
+          continue;
+        double delta[3];
+        vec3::delta(points[ipoint0].cart_, points[ipoint1].cart_, delta);
+        vec3::iadd(delta, cell_pair.translation);
+        double distance = vec3::norm(delta);
+        if (distance >= cutoff) continue;
+        records.push_back(PairRecord{static_cast<double>(ipoint0),
+                                     static_cast<double>(ipoint1), distance});
+        if (half) {
+          records.push_back(PairRecord{static_cast<double>(ipoint1),
+                                       static_cast<double>(ipoint0), distance});
+        }
+      }
+    }
+  }
+  std::sort(records.begin(), records.end());
+  return records;
+}
+
+
+void check_records(const std::vector<PairRecord>& records_ref,
+    const std::vector<PairRecord>& records) {
+  ASSERT_EQ(records_ref.size(), records.size());
+  for (size_t irecord = 0; irecord < records.size(); ++irecord) {
+    EXPECT_EQ(records_ref[irecord][0], records[irecord][0]);
+    EXPECT_EQ(records_ref[irecord][1], records[irecord][1]);
+    EXPECT_NEAR(records_ref[irecord][2], records[irecord][2], EPS);
+  }
+}
+
+
+TEST(CellPairsTest, random) {
+  size_t npair_total = 0;
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    // Random points in a random (partially) periodic system
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, irep % 4, 6.0, 0.5));
+    int shape[3];
+    std::unique_ptr<cl::Cell> subcell(cell->create_subcell(1.0, shape));
+    std::vector<cl::Point> points;
+    for (int ipoint = 0; ipoint < 300; ++ipoint) {
+      double cart[3];
+      fill_random_double(irep*NPOINT + ipoint, cart, 3, -5.0, 5.0);
+      points.push_back(cl::Point(cart));
+    }
+    cl::assign_icell(*subcell, shape, points.data(), points.size(), sizeof(cl::Point));
+    cl::sort_by_icell(points.data(), points.size(), sizeof(cl::Point));
+    std::unique_ptr<cl::CellMap> cell_map(
+        cl::create_cell_map(points.data(), points.size(), sizeof(cl::Point)));
+    const double cutoff = 1.5 + 0.2*irep;
+
+    // Reference results with one DeltaIterator per point
+    std::vector<PairRecord> records_ref;
+    for (size_t ipoint0 = 0; ipoint0 < points.size(); ++ipoint0) {
+      for (cl::DeltaIterator dit(*subcell, shape, points[ipoint0].cart_, cutoff,
+           points.data(), points.size(), sizeof(cl::Point), *cell_map);
+           dit.busy(); ++dit) {
+        if ((dit.ipoint() == ipoint0) && (dit.distance() == 0.0)) continue;
+        records_ref.push_back(PairRecord{static_cast<double>(ipoint0),
+                                         static_cast<double>(dit.ipoint()),
+                                         dit.distance()});
+      }
+    }
+    std::sort(records_ref.begin(), records_ref.end());
+
+    // Full and half list of cell pairs
+    for (bool half : {false, true}) {
+      std::vector<cl::CellPair> cell_pairs(
+          cl::create_cell_pairs(*subcell, shape, cutoff, *cell_map, half));
+      for (size_t icell_pair = 0; icell_pair < cell_pairs.size(); ++icell_pair) {
+        const cl::CellPair& cell_pair = cell_pairs[icell_pair];
+        if (icell_pair > 0) {
+          EXPECT_LE(cell_pairs[icell_pair - 1].begin0, cell_pair.begin0);
+        }
+        // The translation is consistent with the periodic image.
+        double translation[3]{0.0, 0.0, 0.0};
+        cell->iadd_vec(translation, cell_pair.coeffs);
+        EXPECT_NEAR(translation[0], cell_pair.translation[0], EPS);
+        EXPECT_NEAR(translation[1], cell_pair.translation[1], EPS);
+        EXPECT_NEAR(translation[2], cell_pair.translation[2], EPS);
+      }
+      check_records(records_ref, cell_pairs_records(cell_pairs, points, cutoff, half));
+    }
+
+    // The index type has no effect.
+    std::unique_ptr<cl::CellMap32> cell_map32(cl::create_cell_map<cl::Point, uint32_t>(
+        points.data(), points.size(), sizeof(cl::Point)));
+    EXPECT_EQ(cl::create_cell_pairs(*subcell, shape, cutoff, *cell_map, true).size(),
+              cl::create_cell_pairs(*subcell, shape, cutoff, *cell_map32, true).size());
+    npair_total += records_ref.size();
+  }
+  // Sufficiency check
+  EXPECT_LE(NREP*100, npair_total);
+}
+
+// vim: textwidth=90 et ts=2 sw=2
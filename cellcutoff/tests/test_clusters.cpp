@@ -0,0 +1,188 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <cellcutoff/cell.h>
+#include <cellcutoff/clusters.h>
+#include <cellcutoff/vec3.h>
+
+#include "common.h"
+
+
+namespace cl = cellcutoff;
+namespace vec3 = cellcutoff::vec3;
+
+
+//! Serial brute-force reference for the cluster labels, over all relevant images.
+std::vector<size_t> brute_force_labels(const cl::Cell& cell, const double* carts,
+    size_t npoint, double cutoff) {
+  int ranges_begin[3]{0, 0, 0};
+  int ranges_end[3]{0, 0, 0};
+  double origin[3]{0.0, 0.0, 0.0};
+  cell.ranges_cutoff(origin, cutoff, ranges_begin, ranges_end);
+  for (int ivec = 0; ivec < cell.nvec(); ++ivec) {
+    // Relative vectors are wrapped, so their fractional coordinates are in [-0.5, 0.5[.
+    --ranges_begin[ivec];
+    ++ranges_end[ivec];
+  }
+  std::vector<size_t> labels(npoint);
+  for (size_t ipoint = 0; ipoint < npoint; ++ipoint)
+    labels[ipoint] = ipoint;
+  for (size_t ipoint0 = 0; ipoint0 < npoint; ++ipoint0) {
+    for (size_t ipoint1 = 0; ipoint1 < ipoint0; ++ipoint1) {
+      double delta_wrapped[3];
+      vec3::delta(carts + 3*ipoint0, carts + 3*ipoint1, delta_wrapped);
+      cell.iwrap_mic(delta_wrapped);
+      bool connected = false;
+      int coeffs[3];
+      for (coeffs[0] = ranges_begin[0]; coeffs[0] <= ranges_end[0]; ++coeffs[0]) {
+        for (coeffs[1] = ranges_begin[1]; coeffs[1] <= ranges_end[1]; ++coeffs[1]) {
+          for (coeffs[2] = ranges_begin[2]; coeffs[2] <= ranges_end[2]; ++coeffs[2]) {
+            double delta[3];
+            std::copy(delta_wrapped, delta_wrapped + 3, delta);
+            cell.iadd_vec(delta, coeffs);
+            connected |= (vec3::norm(delta) <= cutoff);
+          }
+        }
+      }
+      if (!connected) continue;
+      // Merge the labels of both points.
+      size_t label0 = labels[ipoint0];
+      size_t label1 = labels[ipoint1];
+      for (size_t ipoint = 0; ipoint < npoint; ++ipoint)
+        if (labels[ipoint] == label0) labels[ipoint] = label1;
+    }
+  }
+  return labels;
+}
+
+
+//! Cartesian coordinates of a point after adding the unwrapping images.
+void unwrap(const cl::Cell& cell, const double* carts, const int* images, size_t ipoint,
+    double* cart) {
+  std::copy(carts + 3*ipoint, carts + 3*ipoint + 3, cart);
+  cell.iadd_vec(cart, images + 3*ipoint);
+}
+
+
+TEST(ClustersTest, exceptions) {
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell cell(vecs, 3);
+  EXPECT_THROW(cl::connected_components(cell, vecs, 3, 0.0, nullptr, nullptr, 1),
+               std::domain_error);
+  EXPECT_EQ(0, cl::connected_components(cell, nullptr, 0, 1.0, nullptr, nullptr, 1));
+}
+
+
+TEST(ClustersTest, example_chain) {
+  // A chain crossing the periodic boundary and one isolated point.
+  double vecs[9]{10.0, 0.0, 0.0, 0.0, 10.0, 0.0, 0.0, 0.0, 10.0};
+  cl::Cell cell(vecs, 3);
+  double carts[15]{
+    8.0, 5.0, 5.0,
+    5.0, 5.0, 5.0,
+    1.0, 5.0, 5.0,
+    9.5, 5.0, 5.0,
+    0.5, 5.0, 5.0};
+  size_t labels[5];
+  int images[15];
+  EXPECT_EQ(2, cl::connected_components(cell, carts, 5, 1.6, labels, images, 2));
+  EXPECT_EQ(0, labels[0]);
+  EXPECT_EQ(1, labels[1]);
+  EXPECT_EQ(0, labels[2]);
+  EXPECT_EQ(0, labels[3]);
+  EXPECT_EQ(0, labels[4]);
+  // After unwrapping, the chain is contiguous: 8.0, 9.5, 10.5, 11.0.
+  double x[5];
+  for (size_t ipoint = 0; ipoint < 5; ++ipoint) {
+    double cart[3];
+    unwrap(cell, carts, images, ipoint, cart);
+    x[ipoint] = cart[0];
+    EXPECT_EQ(0, images[3*ipoint + 1]);
+    EXPECT_EQ(0, images[3*ipoint + 2]);
+  }
+  EXPECT_NEAR(1.5, x[3] - x[0], 1e-10);
+  EXPECT_NEAR(1.0, x[4] - x[3], 1e-10);
+  EXPECT_NEAR(0.5, x[2] - x[4], 1e-10);
+}
+
+
+TEST(ClustersTest, random_brute) {
+  for (int irep = 0; irep < NREP; ++irep) {
+    const int nvec = irep % 4;
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, nvec, 6.0, 0.5));
+    const size_t npoint = 80;
+    std::vector<double> carts(3*npoint);
+    fill_random_double(irep + 4513, carts.data(), static_cast<int>(3*npoint), -5.0, 5.0);
+    const double cutoff = 1.0 + 0.01*irep;
+
+    // Compare with brute force, for different numbers of threads.
+    std::vector<size_t> labels_brute(
+        brute_force_labels(*cell, carts.data(), npoint, cutoff));
+    for (size_t nthread = 1; nthread < 5; nthread += 3) {
+      std::vector<size_t> labels(npoint);
+      std::vector<int> images(3*npoint);
+      size_t ncluster = cl::connected_components(*cell, carts.data(), npoint, cutoff,
+          labels.data(), images.data(), nthread);
+      size_t max_label = 0;
+      for (size_t ipoint0 = 0; ipoint0 < npoint; ++ipoint0) {
+        EXPECT_LE(labels[ipoint0], max_label);
+        if (labels[ipoint0] == max_label) ++max_label;
+        for (size_t ipoint1 = 0; ipoint1 < ipoint0; ++ipoint1) {
+          EXPECT_EQ(labels_brute[ipoint0] == labels_brute[ipoint1],
+                    labels[ipoint0] == labels[ipoint1]);
+        }
+      }
+      EXPECT_EQ(max_label, ncluster);
+
+      // Images: every point, except the first of each cluster, has an unwrapped
+      // neighbor in the same cluster within the cutoff.
+      for (size_t ipoint0 = 0; ipoint0 < npoint; ++ipoint0) {
+        for (int ivec = nvec; ivec < 3; ++ivec)
+          EXPECT_EQ(0, images[3*ipoint0 + ivec]);
+        bool first = true;
+        bool bonded = false;
+        double cart0[3];
+        unwrap(*cell, carts.data(), images.data(), ipoint0, cart0);
+        for (size_t ipoint1 = 0; ipoint1 < npoint; ++ipoint1) {
+          if ((ipoint1 == ipoint0) || (labels[ipoint1] != labels[ipoint0])) continue;
+          if (ipoint1 < ipoint0) first = false;
+          double cart1[3];
+          unwrap(*cell, carts.data(), images.data(), ipoint1, cart1);
+          double delta[3];
+          vec3::delta(cart0, cart1, delta);
+          bonded |= (vec3::norm(delta) <= cutoff);
+        }
+        if (!first) {
+          EXPECT_TRUE(bonded);
+        }
+      }
+    }
+  }
+}
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -0,0 +1,188 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <cellcutoff/cell.h>
+#include <cellcutoff/coloring.h>
+#include <cellcutoff/decomposition.h>
+#include <cellcutoff/iterators.h>
+#include <cellcutoff/stencil.h>
+#include <cellcutoff/vec3.h>
+
+#include "common.h"
+
+
+namespace cl = cellcutoff;
+namespace vec3 = cellcutoff::vec3;
+
+
+TEST(ColoringTest, exceptions) {
+  int shape[3]{3, 3, 3};
+  int radius[3]{1, -1, 1};
+  EXPECT_THROW(cl::Coloring(shape, radius), std::domain_error);
+  int shape_neg[3]{3, -3, 3};
+  int radius_ok[3]{1, 1, 1};
+  EXPECT_THROW(cl::Coloring(shape_neg, radius_ok), std::domain_error);
+}
+
+
+TEST(ColoringTest, examples) {
+  int radius[3]{1, 1, 0};
+  // Non-periodic: plain modulus
+  cl::Coloring coloring0(nullptr, radius);
+  EXPECT_EQ(9, coloring0.ncolor());
+  int icell0[3]{-1, 4, 7};
+  EXPECT_EQ(2*3 + 1, coloring0.color(icell0));
+  // Periodic: blocks of sizes 4, 4 and 3 for shape 11, too small for shape 5.
+  int shape[3]{11, 5, 1};
+  cl::Coloring coloring1(shape, radius);
+  EXPECT_EQ(4, coloring1.ncolors()[0]);
+  EXPECT_EQ(5, coloring1.ncolors()[1]);
+  EXPECT_EQ(1, coloring1.ncolors()[2]);
+  int icell1[3]{9, 7, 3};
+  EXPECT_EQ(1*5 + 2, coloring1.color(icell1));
+}
+
+
+TEST(ColoringTest, random_conflicts) {
+  for (int irep = 0; irep < NREP; ++irep) {
+    int shape[3];
+    fill_random_int(irep + 3137, shape, 3, 0, 9);
+    int radius[3];
+    fill_random_int(irep + 9173, radius, 3, 0, 2);
+    cl::Coloring coloring(shape, radius);
+    // All subcells in a box, which covers one period along periodic directions.
+    int begin[3];
+    int end[3];
+    for (int ivec = 0; ivec < 3; ++ivec) {
+      begin[ivec] = (shape[ivec] == 0) ? -5 : 0;
+      end[ivec] = (shape[ivec] == 0) ? 5 : shape[ivec];
+    }
+    std::vector<std::array<int, 3>> icells;
+    std::array<int, 3> icell;
+    for (icell[0] = begin[0]; icell[0] < end[0]; ++icell[0])
+      for (icell[1] = begin[1]; icell[1] < end[1]; ++icell[1])
+        for (icell[2] = begin[2]; icell[2] < end[2]; ++icell[2])
+          icells.push_back(icell);
+    for (size_t i0 = 0; i0 < icells.size(); ++i0) {
+      int color0 = coloring.color(icells[i0].data());
+      EXPECT_LE(0, color0);
+      EXPECT_GT(coloring.ncolor(), color0);
+      for (size_t i1 = 0; i1 < i0; ++i1) {
+        if (color0 != coloring.color(icells[i1].data())) continue;
+        // Same color: far enough apart along at least one direction.
+        bool separated = false;
+        for (int ivec = 0; ivec < 3; ++ivec) {
+          int distance = std::abs(icells[i0][ivec] - icells[i1][ivec]);
+          if (shape[ivec] > 0)
+            distance = std::min(distance, shape[ivec] - distance);
+          separated |= (distance > 2*radius[ivec]);
+        }
+        EXPECT_TRUE(separated);
+      }
+    }
+  }
+}
+
+
+TEST(ColoringTest, random_parallel_for_colors) {
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    // Random points in a random periodic system, with small shapes
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, 3, 4.0 + irep, 0.5));
+    int shape[3];
+    std::unique_ptr<cl::Cell> subcell(cell->create_subcell(1.0, shape));
+    std::vector<cl::Point> points;
+    for (int ipoint = 0; ipoint < NPOINT; ++ipoint) {
+      double cart[3];
+      fill_random_double(irep*NPOINT + ipoint, cart, 3, -5.0, 5.0);
+      points.push_back(cl::Point(cart));
+    }
+    cl::assign_icell(*subcell, shape, points.data(), points.size(), sizeof(cl::Point));
+    cl::sort_by_icell(points.data(), points.size(), sizeof(cl::Point));
+    std::unique_ptr<cl::CellMap> cell_map(
+        cl::create_cell_map(points.data(), points.size(), sizeof(cl::Point)));
+    const double cutoff = 1.5;
+    const std::vector<std::array<int, 3>> stencil(
+        cl::create_stencil(*subcell, cutoff, true));
+    int radius[3];
+    cl::stencil_radius(stencil, radius);
+    cl::Coloring coloring(shape, radius);
+
+    // Count neighbors with a half stencil, writing to both points of a pair without
+    // atomics.
+    for (size_t nthread = 1; nthread < 5; nthread += 3) {
+      std::vector<int> counts(points.size(), 0);
+      std::vector<int> visits(points.size(), 0);
+      cl::parallel_for_colors(coloring, *cell_map, nthread, [&stencil, &cell_map,
+          &subcell, &shape, &points, &counts, &visits, cutoff](
+          size_t, const cl::CellMap::value_type& cell0) {
+        ++visits[cell0.second[0]];
+        for (const auto& delta_icell : stencil) {
+          std::array<int, 3> key;
+          int translate_icell[3];
+          for (int ivec = 0; ivec < 3; ++ivec) {
+            int coeff;
+            key[ivec] = cl::robust_wrap(cell0.first[ivec] + delta_icell[ivec],
+                                        shape[ivec], &coeff);
+            translate_icell[ivec] = coeff*shape[ivec];
+          }
+          auto it1 = cell_map->find(key);
+          if (it1 == cell_map->end()) continue;
+          double translation[3]{0.0, 0.0, 0.0};
+          subcell->iadd_vec(translation, translate_icell);
+          bool same = (delta_icell == std::array<int, 3>{0, 0, 0});
+          for (size_t ipoint0 = cell0.second[0]; ipoint0 < cell0.second[1]; ++ipoint0) {
+            for (size_t ipoint1 = same ? ipoint0 + 1 : it1->second[0];
+                 ipoint1 < it1->second[1]; ++ipoint1) {
+              double delta[3];
+              vec3::delta(points[ipoint0].cart_, points[ipoint1].cart_, delta);
+              vec3::iadd(delta, translation);
+              if (vec3::norm(delta) > cutoff) continue;
+              ++counts[ipoint0];
+              ++counts[ipoint1];
+            }
+          }
+        }
+      });
+      // Every subcell is visited once.
+      for (const auto& kv : *cell_map)
+        EXPECT_EQ(1, visits[kv.second[0]]);
+      // Compare with one DeltaIterator per point.
+      for (size_t ipoint = 0; ipoint < points.size(); ++ipoint) {
+        int count_ref = -1;
+        for (cl::DeltaIterator dit(*subcell, shape, points[ipoint].cart_, cutoff,
+             points.data(), points.size(), sizeof(cl::Point), *cell_map);
+             dit.busy(); ++dit)
+          ++count_ref;
+        EXPECT_EQ(count_ref, counts[ipoint]);
+      }
+    }
+  }
+}
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -295,6 +295,49 @@ TEST(DecompositionTest, random_cell_map) {
 }
 
 
+TEST(DecompositionTest, random_cell_map_float) {
+  for (int irep = 0; irep < NREP; ++irep) {
+    // Same points in single and double precision, wrapped in a periodic cell
+    std::vector<cl::Point> points;
+    std::vector<cl::PointF> points_float;
+    for (int ipoint = 0; ipoint < NPOINT; ++ipoint) {
+      double cart[3];
+      fill_random_double(ipoint+3157, cart, 3, -5.0, 5.0);
+      points.push_back(cl::Point(cart));
+      points_float.push_back(cl::PointF(cart));
+    }
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep*NPOINT, 3, 2));
+    int shape[3];
+    std::unique_ptr<cl::Cell> subcell(cell->create_subcell(0.2, shape));
+    cl::assign_icell(*subcell, shape, points.data(), points.size(), sizeof(cl::Point));
+    cl::assign_icell<cl::PointF>(*subcell, shape, points_float.data(), points_float.size(),
+        sizeof(cl::PointF));
+    // The single precision version only differs by rounding of the wrapped coordinates.
+    for (int ipoint = 0; ipoint < NPOINT; ++ipoint) {
+      for (int ivec = 0; ivec < 3; ++ivec) {
+        EXPECT_EQ(points[ipoint].icell_[ivec], points_float[ipoint].icell_[ivec]);
+        EXPECT_NEAR(points[ipoint].cart_[ivec], points_float[ipoint].cart_[ivec], 1e-5);
+      }
+    }
+    cl::sort_by_icell<cl::PointF>(points_float.data(), points_float.size(),
+        sizeof(cl::PointF));
+    std::unique_ptr<cl::CellMap> cell_map(cl::create_cell_map<cl::PointF>(
+        points_float.data(), points_float.size(), sizeof(cl::PointF)));
+    // Check consistency of results: loop over map
+    size_t npoint_total = 0;
+    for (const auto& kv : *cell_map) {
+      for (size_t ipoint = kv.second[0]; ipoint < kv.second[1]; ++ipoint) {
+        EXPECT_EQ(kv.first[0], points_float.at(ipoint).icell_[0]);
+        EXPECT_EQ(kv.first[1], points_float.at(ipoint).icell_[1]);
+        EXPECT_EQ(kv.first[2], points_float.at(ipoint).icell_[2]);
+      }
+      npoint_total += kv.second[1] - kv.second[0];
+    }
+    EXPECT_EQ(NPOINT, npoint_total);
+  }
+}
+
+
 // robust_wrap
 // ~~~~~~~~~~~
 
@@ -0,0 +1,166 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <cellcutoff/cell.h>
+#include <cellcutoff/ewald.h>
+#include <cellcutoff/vec3.h>
+
+#include "common.h"
+
+
+namespace cl = cellcutoff;
+namespace vec3 = cellcutoff::vec3;
+
+
+//! Brute-force reference over all relevant periodic images.
+double ewald_real_space_brute(const cl::Cell& cell, const double* carts,
+    const double* charges, size_t npoint, double alpha, double cutoff, double* forces,
+    double* virial) {
+  int ranges_begin[3]{0, 0, 0};
+  int ranges_end[3]{0, 0, 0};
+  double origin[3]{0.0, 0.0, 0.0};
+  cell.ranges_cutoff(origin, cutoff, ranges_begin, ranges_end);
+  for (int ivec = 0; ivec < cell.nvec(); ++ivec) {
+    // Relative vectors are wrapped, so their fractional coordinates are in [-0.5, 0.5[.
+    --ranges_begin[ivec];
+    ++ranges_end[ivec];
+  }
+  std::fill(forces, forces + 3*npoint, 0.0);
+  std::fill(virial, virial + 9, 0.0);
+  double energy = 0.0;
+  // Loop over ordered pairs, such that every pair is counted twice.
+  for (size_t ipoint0 = 0; ipoint0 < npoint; ++ipoint0) {
+    for (size_t ipoint1 = 0; ipoint1 < npoint; ++ipoint1) {
+      double delta_wrapped[3];
+      vec3::delta(carts + 3*ipoint0, carts + 3*ipoint1, delta_wrapped);
+      cell.iwrap_mic(delta_wrapped);
+      int coeffs[3];
+      for (coeffs[0] = ranges_begin[0]; coeffs[0] <= ranges_end[0]; ++coeffs[0]) {
+        for (coeffs[1] = ranges_begin[1]; coeffs[1] <= ranges_end[1]; ++coeffs[1]) {
+          for (coeffs[2] = ranges_begin[2]; coeffs[2] <= ranges_end[2]; ++coeffs[2]) {
+            double delta[3];
+            std::copy(delta_wrapped, delta_wrapped + 3, delta);
+            cell.iadd_vec(delta, coeffs);
+            double distance = vec3::norm(delta);
+            if ((distance > cutoff) || (distance == 0.0)) continue;
+            double qq = charges[ipoint0]*charges[ipoint1];
+            double pot = qq*erfc(alpha*distance)/distance;
+            energy += 0.5*pot;
+            double scale = (pot + qq*2.0*alpha/sqrt(M_PI)*exp(-alpha*alpha*distance*distance))
+                           /(distance*distance);
+            for (int irow = 0; irow < 3; ++irow) {
+              forces[3*ipoint1 + irow] += scale*delta[irow];
+              for (int icol = 0; icol < 3; ++icol)
+                virial[3*irow + icol] += 0.5*scale*delta[irow]*delta[icol];
+            }
+          }
+        }
+      }
+    }
+  }
+  return energy;
+}
+
+
+TEST(EwaldTest, exceptions) {
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell cell(vecs, 3);
+  EXPECT_THROW(cl::ewald_real_space(cell, vecs, vecs, 3, 0.0, 1.0, nullptr, nullptr, 1),
+               std::domain_error);
+  EXPECT_THROW(cl::ewald_real_space(cell, vecs, vecs, 3, 1.0, 0.0, nullptr, nullptr, 1),
+               std::domain_error);
+  EXPECT_EQ(0.0, cl::ewald_real_space(cell, nullptr, nullptr, 0, 1.0, 1.0, nullptr,
+                                      nullptr, 1));
+}
+
+
+TEST(EwaldTest, random_brute) {
+  for (int irep = 0; irep < NREP/2; ++irep) {
+    const int nvec = irep % 4;
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, nvec, 5.0, 0.5));
+    const size_t npoint = 40;
+    std::vector<double> carts(3*npoint);
+    std::vector<double> charges(npoint);
+    unsigned int seed = fill_random_double(irep + 6089, carts.data(),
+                                           static_cast<int>(3*npoint), -5.0, 5.0);
+    fill_random_double(seed, charges.data(), static_cast<int>(npoint), -1.0, 1.0);
+    const double alpha = 0.8;
+    const double cutoff = 2.0 + 0.02*irep;
+
+    std::vector<double> forces_brute(3*npoint);
+    double virial_brute[9];
+    double energy_brute = ewald_real_space_brute(*cell, carts.data(), charges.data(),
+        npoint, alpha, cutoff, forces_brute.data(), virial_brute);
+    for (size_t nthread = 1; nthread < 5; nthread += 3) {
+      std::vector<double> forces(3*npoint);
+      double virial[9];
+      double energy = cl::ewald_real_space(*cell, carts.data(), charges.data(), npoint,
+          alpha, cutoff, forces.data(), virial, nthread);
+      EXPECT_NEAR(energy_brute, energy, 1e-10);
+      for (size_t i = 0; i < 3*npoint; ++i)
+        EXPECT_NEAR(forces_brute[i], forces[i], 1e-10);
+      for (int i = 0; i < 9; ++i)
+        EXPECT_NEAR(virial_brute[i], virial[i], 1e-10);
+      // The virial is symmetric and the total force vanishes.
+      EXPECT_NEAR(virial[1], virial[3], 1e-10);
+      EXPECT_NEAR(virial[2], virial[6], 1e-10);
+      EXPECT_NEAR(virial[5], virial[7], 1e-10);
+      double total[3]{0.0, 0.0, 0.0};
+      for (size_t ipoint = 0; ipoint < npoint; ++ipoint)
+        vec3::iadd(total, &forces[3*ipoint]);
+      EXPECT_NEAR(0.0, vec3::norm(total), 1e-10);
+      // Without optional outputs, the energy is the same.
+      EXPECT_EQ(energy, cl::ewald_real_space(*cell, carts.data(), charges.data(),
+          npoint, alpha, cutoff, nullptr, nullptr, nthread));
+    }
+  }
+}
+
+
+TEST(EwaldTest, reproducible) {
+  std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(11, 3, 5.0, 0.5));
+  const size_t npoint = NPOINT;
+  std::vector<double> carts(3*npoint);
+  std::vector<double> charges(npoint);
+  unsigned int seed = fill_random_double(4759, carts.data(), static_cast<int>(3*npoint),
+                                         -5.0, 5.0);
+  fill_random_double(seed, charges.data(), static_cast<int>(npoint), -1.0, 1.0);
+  std::vector<double> forces0(3*npoint);
+  std::vector<double> forces1(3*npoint);
+  double virial0[9];
+  double virial1[9];
+  double energy0 = cl::ewald_real_space(*cell, carts.data(), charges.data(), npoint, 1.0,
+      2.5, forces0.data(), virial0, 4);
+  double energy1 = cl::ewald_real_space(*cell, carts.data(), charges.data(), npoint, 1.0,
+      2.5, forces1.data(), virial1, 4);
+  EXPECT_EQ(energy0, energy1);
+  EXPECT_EQ(forces0, forces1);
+  EXPECT_TRUE(std::equal(virial0, virial0 + 9, virial1));
+}
+
+// vim: textwidth=90 et ts=2 sw=2
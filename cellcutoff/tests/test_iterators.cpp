@@ -19,6 +19,8 @@
 // --
 
 
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <vector>
 
@@ -27,11 +29,13 @@
 #include <cellcutoff/cell.h>
 #include <cellcutoff/decomposition.h>
 #include <cellcutoff/iterators.h>
+#include <cellcutoff/vec3.h>
 
 #include "common.h"
 
 
 namespace cl = cellcutoff;
+namespace vec3 = cellcutoff::vec3;
 
 
 class BarIteratorTestP : public ::testing::TestWithParam<int> {
@@ -113,6 +117,36 @@ TEST(BarIteratorTest, example_1_shape) {
 }
 
 
+TEST(BarIteratorTest, jump) {
+  const std::vector<int> bars{0, 2, 1, 5, -2, 3};
+  const int shape[2]{3, 3};
+  cl::BarIterator it(bars, 2, shape);
+  EXPECT_EQ(it.icell()[1], 1);
+  it.jump(3);
+  EXPECT_TRUE(it.busy());
+  EXPECT_EQ(it.icell()[0], 0);
+  EXPECT_EQ(it.icell()[1], 0);
+  EXPECT_EQ(it.coeffs()[1], 1);
+  EXPECT_EQ(it.icell_unwrapped()[1], 3);
+  // Jumping past the end of a bar continues with the next bar.
+  it.jump(7);
+  EXPECT_TRUE(it.busy());
+  EXPECT_EQ(it.icell()[0], 1);
+  EXPECT_EQ(it.icell()[1], 1);
+  EXPECT_EQ(it.coeffs()[1], -1);
+  EXPECT_EQ(it.icell_unwrapped()[1], -2);
+  EXPECT_EQ(it.ranges_begin()[1], -2);
+  EXPECT_EQ(it.ranges_end()[1], 3);
+  EXPECT_THROW(it.jump(-3), std::logic_error);
+  it.jump(2);
+  EXPECT_TRUE(it.busy());
+  EXPECT_EQ(it.icell()[1], 2);
+  EXPECT_EQ(it.coeffs()[1], 0);
+  ++it;
+  EXPECT_FALSE(it.busy());
+}
+
+
 TEST(BarIteratorTest, example_2) {
   const std::vector<int> bars{
     1, 3,
@@ -430,6 +464,1060 @@ TEST(DeltaIteratorTest, examples) {
 }
 
 
+//! Point with an additional index, to compare results after sorting.
+template <typename PointType>
+struct IndexedPoint {
+  PointType point;
+  size_t index;
+};
+
+
+//! Random points in a random periodic system, decomposed with a cell map.
+struct RandomSystem {
+  RandomSystem(int irep, double cell_size, int npoint)
+      : cell(create_random_cell_nvec(irep, 3, cell_size, 0.5)) {
+    subcell.reset(cell->create_subcell(1.0, shape));
+    for (int ipoint = 0; ipoint < npoint; ++ipoint) {
+      double cart[3];
+      fill_random_double(irep*NPOINT + ipoint, cart, 3, -5.0, 5.0);
+      points.push_back(cl::Point(cart));
+    }
+    cl::assign_icell(*subcell, shape, points.data(), points.size(), sizeof(cl::Point));
+    cl::sort_by_icell(points.data(), points.size(), sizeof(cl::Point));
+    cell_map.reset(cl::create_cell_map(points.data(), points.size(), sizeof(cl::Point)));
+  }
+
+  std::unique_ptr<cl::Cell> cell;
+  int shape[3];
+  std::unique_ptr<cl::Cell> subcell;
+  std::vector<cl::Point> points;
+  std::unique_ptr<cl::CellMap> cell_map;
+};
+
+
+template <typename PointType, typename Index = size_t>
+std::vector<std::array<double, 2>> delta_iterator_results(
+    const cl::Cell& subcell, const int* shape, const double* center, double cutoff,
+    const std::vector<std::array<double, 3>>& carts) {
+  // Points with their original index.
+  std::vector<IndexedPoint<PointType>> points;
+  for (size_t ipoint = 0; ipoint < carts.size(); ++ipoint)
+    points.push_back(IndexedPoint<PointType>{PointType(carts[ipoint].data()), ipoint});
+  const size_t point_size = sizeof(IndexedPoint<PointType>);
+  cl::assign_icell<PointType>(subcell, shape, points.data(), points.size(), point_size);
+  cl::sort_by_icell<PointType>(points.data(), points.size(), point_size);
+  std::unique_ptr<cl::BasicCellMap<Index>> cell_map(
+      cl::create_cell_map<PointType, Index>(points.data(), points.size(), point_size));
+  // Iterate and collect the original indexes and distances.
+  std::vector<std::array<double, 2>> results;
+  for (cl::BasicDeltaIterator<PointType, Index> dit(subcell, shape, center, cutoff,
+       points.data(), points.size(), point_size, *cell_map); dit.busy(); ++dit) {
+    const IndexedPoint<PointType>& point = points[dit.ipoint()];
+    results.push_back(std::array<double, 2>{
+      static_cast<double>(point.index), static_cast<double>(dit.distance())});
+  }
+  std::sort(results.begin(), results.end());
+  return results;
+}
+
+
+template <typename PointType, typename Index = size_t>
+std::vector<std::array<double, 2>> delta_iterator_random_results(
+    const cl::Cell& subcell, const int* shape, const double* center, double cutoff,
+    unsigned int seed) {
+  std::vector<std::array<double, 3>> carts(NPOINT);
+  for (int ipoint = 0; ipoint < NPOINT; ++ipoint)
+    fill_random_double(seed + ipoint, carts[ipoint].data(), 3, -5.0, 5.0);
+  return delta_iterator_results<PointType, Index>(subcell, shape, center, cutoff, carts);
+}
+
+
+TEST(DeltaIteratorTest, random_float) {
+  size_t npoint_total = 0;
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, 3, 10.0, 0.5));
+    int shape[3];
+    std::unique_ptr<cl::Cell> subcell(cell->create_subcell(1.0, shape));
+    double center[3];
+    fill_random_double(irep + 5, center, 3, -5.0, 5.0);
+    double cutoff = 2.0 + irep*0.5;
+    auto results = delta_iterator_random_results<cl::Point>(
+        *subcell, shape, center, cutoff, irep*NPOINT);
+    auto results_float = delta_iterator_random_results<cl::PointF>(
+        *subcell, shape, center, cutoff, irep*NPOINT);
+    // Points very close to the cutoff sphere may be missing in one of both.
+    const double eps_float = 1e-4;
+    size_t iresult_float = 0;
+    for (const auto& result : results) {
+      while ((iresult_float < results_float.size()) &&
+             (results_float[iresult_float][0] < result[0])) {
+        EXPECT_LT(cutoff - eps_float, results_float[iresult_float][1]);
+        ++iresult_float;
+      }
+      if ((iresult_float < results_float.size()) &&
+          (results_float[iresult_float][0] == result[0])) {
+        EXPECT_NEAR(result[1], results_float[iresult_float][1], eps_float);
+        ++iresult_float;
+      } else {
+        EXPECT_LT(cutoff - eps_float, result[1]);
+      }
+    }
+    for (; iresult_float < results_float.size(); ++iresult_float)
+      EXPECT_LT(cutoff - eps_float, results_float[iresult_float][1]);
+    npoint_total += results.size();
+  }
+  // Sufficiency check
+  EXPECT_LE(NREP*10, npoint_total);
+}
+
+
+TEST(DeltaIteratorTest, float_large_translation) {
+  // Points in a large periodic cell are wrapped to the far side of the cell, such that
+  // their images near the center need a large periodic translation. The coordinates
+  // are exact in single precision, so only the translation could cause rounding errors.
+  double vecs[9]{1000.0, 0.0, 0.0, 0.0, 1000.0, 0.0, 0.0, 0.0, 1000.0};
+  cl::Cell cell(vecs, 3);
+  int shape[3];
+  std::unique_ptr<cl::Cell> subcell(cell.create_subcell(1.0, shape));
+  std::vector<int> ints(3*NPOINT);
+  fill_random_int(17, ints.data(), 3*NPOINT, -128, 128);
+  std::vector<std::array<double, 3>> carts(NPOINT);
+  for (int ipoint = 0; ipoint < NPOINT; ++ipoint) {
+    for (int ivec = 0; ivec < 3; ++ivec)
+      carts[ipoint][ivec] = ints[3*ipoint + ivec]/64.0;
+  }
+  const double center[3]{0.3, 0.7, 0.1};
+  const double cutoff = 1.5;
+  auto results = delta_iterator_results<cl::Point>(*subcell, shape, center, cutoff,
+                                                   carts);
+  auto results_float = delta_iterator_results<cl::PointF>(*subcell, shape, center,
+                                                          cutoff, carts);
+  // Rounding the translation (about 1000) to single precision would give errors of
+  // about 3e-5, while only the relative vector (about 1) should be rounded.
+  ASSERT_EQ(results.size(), results_float.size());
+  for (size_t iresult = 0; iresult < results.size(); ++iresult) {
+    EXPECT_EQ(results[iresult][0], results_float[iresult][0]);
+    EXPECT_NEAR(results[iresult][1], results_float[iresult][1], 1e-6);
+  }
+  EXPECT_LT(0, results.size());
+}
+
+
+TEST(DeltaIteratorTest, random_index32) {
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, 3, 10.0, 0.5));
+    int shape[3];
+    std::unique_ptr<cl::Cell> subcell(cell->create_subcell(1.0, shape));
+    double center[3];
+    fill_random_double(irep + 5, center, 3, -5.0, 5.0);
+    double cutoff = 2.0 + irep*0.5;
+    auto results = delta_iterator_random_results<cl::Point>(
+        *subcell, shape, center, cutoff, irep*NPOINT);
+    auto results32 = delta_iterator_random_results<cl::Point, uint32_t>(
+        *subcell, shape, center, cutoff, irep*NPOINT);
+    // The index type has no effect on the results.
+    EXPECT_EQ(results, results32);
+    EXPECT_LT(0, results.size());
+  }
+}
+
+
+TEST(DeltaIteratorTest, random_metric) {
+  size_t npoint_total = 0;
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    // Random points without periodic boundary conditions.
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, 3, 10.0, 0.5));
+    int shape[3];
+    std::unique_ptr<cl::Cell> subcell(cell->create_subcell(1.0, shape));
+    std::vector<cl::Point> points;
+    for (int ipoint = 0; ipoint < NPOINT; ++ipoint) {
+      double cart[3];
+      fill_random_double(irep*NPOINT + ipoint, cart, 3, -5.0, 5.0);
+      points.push_back(cl::Point(cart));
+    }
+    cl::assign_icell(*subcell, points.data(), points.size(), sizeof(cl::Point));
+    cl::sort_by_icell(points.data(), points.size(), sizeof(cl::Point));
+    std::unique_ptr<cl::CellMap> cell_map(
+        cl::create_cell_map(points.data(), points.size(), sizeof(cl::Point)));
+    double center[3];
+    fill_random_double(irep + 5, center, 3, -2.0, 2.0);
+    double metric[9];
+    fill_random_metric(irep + 7, metric);
+    const double cutoff = 2.5 + irep*0.1;
+
+    // Brute force reference
+    std::vector<std::array<double, 2>> results_ref;
+    for (size_t ipoint = 0; ipoint < points.size(); ++ipoint) {
+      double delta[3];
+      vec3::copy(points[ipoint].cart_, delta);
+      vec3::iadd(delta, center, -1.0);
+      double metric_delta[3];
+      vec3::matvec(metric, delta, metric_delta);
+      const double distance = sqrt(vec3::dot(delta, metric_delta));
+      if (distance <= cutoff) {
+        results_ref.push_back(std::array<double, 2>{
+          static_cast<double>(ipoint), distance});
+      }
+    }
+
+    // Results of the iterator, which must have a Cartesian delta.
+    std::vector<std::array<double, 2>> results;
+    for (cl::DeltaIterator dit(*subcell, nullptr, center, metric, cutoff, points.data(),
+         points.size(), sizeof(cl::Point), *cell_map); dit.busy(); ++dit) {
+      double delta[3];
+      vec3::copy(points[dit.ipoint()].cart_, delta);
+      vec3::iadd(delta, center, -1.0);
+      EXPECT_NEAR(delta[0], dit.delta()[0], EPS);
+      EXPECT_NEAR(delta[1], dit.delta()[1], EPS);
+      EXPECT_NEAR(delta[2], dit.delta()[2], EPS);
+      results.push_back(std::array<double, 2>{
+        static_cast<double>(dit.ipoint()), dit.distance()});
+    }
+    std::sort(results.begin(), results.end());
+    ASSERT_EQ(results_ref.size(), results.size());
+    for (size_t iresult = 0; iresult < results.size(); ++iresult) {
+      EXPECT_EQ(results_ref[iresult][0], results[iresult][0]);
+      EXPECT_NEAR(results_ref[iresult][1], results[iresult][1], EPS);
+    }
+    npoint_total += results.size();
+
+    // The identity matrix gives the same results as without a metric.
+    const double identity[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+    size_t npoint_identity = 0;
+    for (cl::DeltaIterator dit(*subcell, nullptr, center, identity, cutoff,
+         points.data(), points.size(), sizeof(cl::Point), *cell_map); dit.busy(); ++dit)
+      ++npoint_identity;
+    size_t npoint_sphere = 0;
+    for (cl::DeltaIterator dit(*subcell, center, cutoff, points.data(), points.size(),
+         sizeof(cl::Point), *cell_map); dit.busy(); ++dit)
+      ++npoint_sphere;
+    EXPECT_EQ(npoint_sphere, npoint_identity);
+  }
+  // Sufficiency check
+  EXPECT_LE(NREP*10, npoint_total);
+}
+
+
+// CellWalker
+// ~~~~~~~~~~
+
+TEST(CellWalkerTest, periodic_cell) {
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    RandomSystem sys(irep, 10.0, NPOINT);
+    double origin[3];
+    fill_random_double(irep + 5, origin, 3, -5.0, 5.0);
+    // Bars covering the periodic cell exactly once.
+    std::vector<int> bars{0, sys.shape[0]};
+    for (int icell0 = 0; icell0 < sys.shape[0]; ++icell0) {
+      bars.insert(bars.end(), {0, sys.shape[1]});
+      for (int icell1 = 0; icell1 < sys.shape[1]; ++icell1)
+        bars.insert(bars.end(), {0, sys.shape[2]});
+    }
+    std::vector<int> counts(sys.points.size(), 0);
+    cl::CellWalker walker(*sys.subcell, sys.shape, origin, bars, sys.points.data(),
+        sys.points.size(), sizeof(cl::Point), *sys.cell_map);
+    for (walker.next(); walker.busy(); walker.next()) {
+      ASSERT_LT(walker.ipoint(), sys.points.size());
+      EXPECT_EQ(&sys.points[walker.ipoint()], walker.point());
+      ++counts[walker.ipoint()];
+      // All points lie in the periodic cell, so no translation is needed.
+      double delta[3];
+      walker.delta(delta);
+      const double* cart = sys.points[walker.ipoint()].cart_;
+      EXPECT_NEAR(cart[0] - origin[0], delta[0], EPS);
+      EXPECT_NEAR(cart[1] - origin[1], delta[1], EPS);
+      EXPECT_NEAR(cart[2] - origin[2], delta[2], EPS);
+    }
+    EXPECT_EQ(std::vector<int>(sys.points.size(), 1), counts);
+  }
+}
+
+
+// LevelDeltaIterator
+// ~~~~~~~~~~~~~~~~~~
+
+TEST(LevelDeltaIteratorTest, exceptions) {
+  double vecs[9]{2.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell(vecs, 3);
+  const double center[3]{0.0, 0.0, 0.0};
+  std::vector<cl::Point> points;
+  cl::CellMap cell_map;
+  const double cutoffs[3]{1.0, 2.0, 2.0};
+  const double bad_cutoffs[2]{0.0, 1.0};
+  EXPECT_THROW(cl::LevelDeltaIterator(subcell, nullptr, center, cutoffs, 0,
+               points.data(), points.size(), sizeof(cl::Point), cell_map),
+               std::domain_error);
+  EXPECT_THROW(cl::LevelDeltaIterator(subcell, nullptr, center, cutoffs, 3,
+               points.data(), points.size(), sizeof(cl::Point), cell_map),
+               std::domain_error);
+  EXPECT_THROW(cl::LevelDeltaIterator(subcell, nullptr, center, bad_cutoffs, 2,
+               points.data(), points.size(), sizeof(cl::Point), cell_map),
+               std::domain_error);
+  cl::LevelDeltaIterator ldit(subcell, nullptr, center, cutoffs, 2, points.data(),
+      points.size(), sizeof(cl::Point), cell_map);
+  EXPECT_FALSE(ldit.busy());
+  EXPECT_EQ(-1, ldit.level());
+  EXPECT_THROW(ldit++, std::logic_error);
+}
+
+
+TEST(LevelDeltaIteratorTest, random) {
+  size_t npoint_total = 0;
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    RandomSystem sys(irep, 10.0, NPOINT);
+    double center[3];
+    fill_random_double(irep + 5, center, 3, -5.0, 5.0);
+    const int nlevel = 1 + irep%3;
+    double cutoffs[3];
+    for (int ilevel = 0; ilevel < nlevel; ++ilevel)
+      cutoffs[ilevel] = 1.0 + ilevel*1.5 + irep*0.2;
+
+    // One pass over all levels
+    std::vector<std::vector<std::array<double, 2>>> results_levels(nlevel);
+    for (cl::LevelDeltaIterator ldit(*sys.subcell, sys.shape, center, cutoffs, nlevel,
+         sys.points.data(), sys.points.size(), sizeof(cl::Point), *sys.cell_map);
+         ldit.busy(); ++ldit) {
+      ASSERT_LE(0, ldit.level());
+      ASSERT_GT(nlevel, ldit.level());
+      EXPECT_GE(cutoffs[ldit.level()], ldit.distance());
+      if (ldit.level() > 0) {
+        EXPECT_LT(cutoffs[ldit.level() - 1], ldit.distance());
+      }
+      for (int ilevel = ldit.level(); ilevel < nlevel; ++ilevel) {
+        results_levels[ilevel].push_back(std::array<double, 2>{
+          ldit.distance(), static_cast<double>(ldit.ipoint())});
+      }
+    }
+
+    // The same neighbors in compressed sparse row format
+    size_t level_offsets[4];
+    std::vector<size_t> ipoints;
+    std::vector<double> distances;
+    cl::neighbors_by_level(*sys.subcell, sys.shape, center, cutoffs, nlevel,
+        sys.points.data(), sys.points.size(), sizeof(cl::Point), *sys.cell_map,
+        level_offsets, &ipoints, &distances);
+    EXPECT_EQ(0u, level_offsets[0]);
+    EXPECT_EQ(ipoints.size(), level_offsets[nlevel]);
+    EXPECT_EQ(distances.size(), level_offsets[nlevel]);
+
+    // Compare with one DeltaIterator per cutoff.
+    for (int ilevel = 0; ilevel < nlevel; ++ilevel) {
+      std::vector<std::array<double, 2>> results_ref;
+      for (cl::DeltaIterator dit(*sys.subcell, sys.shape, center, cutoffs[ilevel],
+           sys.points.data(), sys.points.size(), sizeof(cl::Point), *sys.cell_map);
+           dit.busy(); ++dit) {
+        results_ref.push_back(std::array<double, 2>{
+          dit.distance(), static_cast<double>(dit.ipoint())});
+      }
+      std::sort(results_ref.begin(), results_ref.end());
+      std::vector<std::array<double, 2>>& results = results_levels[ilevel];
+      std::sort(results.begin(), results.end());
+      EXPECT_EQ(results_ref, results);
+      std::vector<std::array<double, 2>> results_csr;
+      for (size_t i = 0; i < level_offsets[ilevel + 1]; ++i) {
+        results_csr.push_back(std::array<double, 2>{
+          distances[i], static_cast<double>(ipoints[i])});
+      }
+      std::sort(results_csr.begin(), results_csr.end());
+      EXPECT_EQ(results_ref, results_csr);
+      npoint_total += results.size();
+    }
+  }
+  // Sufficiency check
+  EXPECT_LE(NREP*10, npoint_total);
+}
+
+
+// ShellIterator
+// ~~~~~~~~~~~~~
+
+TEST(ShellIteratorTest, exceptions) {
+  double vecs[9]{2.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell(vecs, 3);
+  cl::Cell subcell2(vecs, 2);
+  const double center[3]{0.0, 0.0, 0.0};
+  std::vector<cl::Point> points;
+  cl::CellMap cell_map;
+  EXPECT_THROW(cl::ShellIterator(subcell2, nullptr, center, 0.5, 1.0, points.data(),
+               points.size(), sizeof(cl::Point), cell_map), std::domain_error);
+  EXPECT_THROW(cl::ShellIterator(subcell, nullptr, center, -0.5, 1.0, points.data(),
+               points.size(), sizeof(cl::Point), cell_map), std::domain_error);
+  EXPECT_THROW(cl::ShellIterator(subcell, nullptr, center, 1.0, 1.0, points.data(),
+               points.size(), sizeof(cl::Point), cell_map), std::domain_error);
+  cl::ShellIterator sit(subcell, nullptr, center, 0.5, 1.0, points.data(),
+      points.size(), sizeof(cl::Point), cell_map);
+  EXPECT_FALSE(sit.busy());
+  EXPECT_THROW(sit++, std::logic_error);
+}
+
+
+TEST(ShellIteratorTest, random) {
+  size_t npoint_total = 0;
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    RandomSystem sys(irep, 10.0, NPOINT);
+    double center[3];
+    fill_random_double(irep + 5, center, 3, -5.0, 5.0);
+    // Thick and thin shells, and a full sphere
+    const double inner = (irep%3 == 0) ? 0.0 : 1.0 + irep*0.7;
+    const double outer = (irep%3 == 1) ? inner + 0.3 : inner + 2.0;
+
+    // Reference results with a DeltaIterator over the outer sphere
+    std::vector<std::array<double, 2>> results_ref;
+    for (cl::DeltaIterator dit(*sys.subcell, sys.shape, center, outer, sys.points.data(),
+         sys.points.size(), sizeof(cl::Point), *sys.cell_map); dit.busy(); ++dit) {
+      if ((dit.distance() < inner) || (dit.distance() >= outer)) continue;
+      results_ref.push_back(std::array<double, 2>{
+        dit.distance(), static_cast<double>(dit.ipoint())});
+    }
+    std::sort(results_ref.begin(), results_ref.end());
+
+    // Shell iterator
+    std::vector<std::array<double, 2>> results;
+    for (cl::ShellIterator sit(*sys.subcell, sys.shape, center, inner, outer,
+         sys.points.data(), sys.points.size(), sizeof(cl::Point), *sys.cell_map);
+         sit.busy(); ++sit) {
+      EXPECT_NEAR(sit.distance(), vec3::norm(sit.delta()), EPS);
+      EXPECT_LE(inner, sit.distance());
+      EXPECT_GT(outer, sit.distance());
+      results.push_back(std::array<double, 2>{
+        sit.distance(), static_cast<double>(sit.ipoint())});
+    }
+    std::sort(results.begin(), results.end());
+    EXPECT_EQ(results_ref, results);
+    npoint_total += results.size();
+  }
+  // Sufficiency check
+  EXPECT_LE(NREP*10, npoint_total);
+}
+
+
+template <typename PointType, typename Index = size_t>
+std::vector<std::array<double, 2>> shell_iterator_results(
+    const cl::Cell& subcell, const int* shape, const double* center, double inner,
+    double outer, const std::vector<std::array<double, 3>>& carts) {
+  // Points with their original index.
+  std::vector<IndexedPoint<PointType>> points;
+  for (size_t ipoint = 0; ipoint < carts.size(); ++ipoint)
+    points.push_back(IndexedPoint<PointType>{PointType(carts[ipoint].data()), ipoint});
+  const size_t point_size = sizeof(IndexedPoint<PointType>);
+  cl::assign_icell<PointType>(subcell, shape, points.data(), points.size(), point_size);
+  cl::sort_by_icell<PointType>(points.data(), points.size(), point_size);
+  std::unique_ptr<cl::BasicCellMap<Index>> cell_map(
+      cl::create_cell_map<PointType, Index>(points.data(), points.size(), point_size));
+  // Iterate and collect the original indexes and distances.
+  std::vector<std::array<double, 2>> results;
+  for (cl::BasicShellIterator<PointType, Index> sit(subcell, shape, center, inner, outer,
+       points.data(), points.size(), point_size, *cell_map); sit.busy(); ++sit) {
+    const IndexedPoint<PointType>& point = points[sit.ipoint()];
+    results.push_back(std::array<double, 2>{
+      static_cast<double>(point.index), static_cast<double>(sit.distance())});
+  }
+  std::sort(results.begin(), results.end());
+  return results;
+}
+
+
+template <typename PointType, typename Index = size_t>
+std::vector<std::array<double, 2>> shell_iterator_random_results(
+    const cl::Cell& subcell, const int* shape, const double* center, double inner,
+    double outer, unsigned int seed) {
+  std::vector<std::array<double, 3>> carts(NPOINT);
+  for (int ipoint = 0; ipoint < NPOINT; ++ipoint)
+    fill_random_double(seed + ipoint, carts[ipoint].data(), 3, -5.0, 5.0);
+  return shell_iterator_results<PointType, Index>(subcell, shape, center, inner, outer,
+                                                  carts);
+}
+
+
+TEST(ShellIteratorTest, random_float_index32) {
+  size_t npoint_total = 0;
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, 3, 10.0, 0.5));
+    int shape[3];
+    std::unique_ptr<cl::Cell> subcell(cell->create_subcell(1.0, shape));
+    double center[3];
+    fill_random_double(irep + 5, center, 3, -5.0, 5.0);
+    const double inner = 1.0 + irep*0.3;
+    const double outer = inner + 1.0;
+    auto results = shell_iterator_random_results<cl::Point>(
+        *subcell, shape, center, inner, outer, irep*NPOINT);
+    auto results32 = shell_iterator_random_results<cl::Point, uint32_t>(
+        *subcell, shape, center, inner, outer, irep*NPOINT);
+    auto results_float = shell_iterator_random_results<cl::PointF>(
+        *subcell, shape, center, inner, outer, irep*NPOINT);
+    auto results_float32 = shell_iterator_random_results<cl::PointF, uint32_t>(
+        *subcell, shape, center, inner, outer, irep*NPOINT);
+    // The index type has no effect on the results.
+    EXPECT_EQ(results, results32);
+    EXPECT_EQ(results_float, results_float32);
+    // Points very close to either sphere may be missing in one of both precisions.
+    const double eps_float = 1e-4;
+    auto near_boundary = [inner, outer, eps_float](double distance) {
+      return (std::abs(distance - inner) < eps_float) ||
+             (std::abs(distance - outer) < eps_float);
+    };
+    size_t iresult_float = 0;
+    for (const auto& result : results) {
+      while ((iresult_float < results_float.size()) &&
+             (results_float[iresult_float][0] < result[0])) {
+        EXPECT_TRUE(near_boundary(results_float[iresult_float][1]));
+        ++iresult_float;
+      }
+      if ((iresult_float < results_float.size()) &&
+          (results_float[iresult_float][0] == result[0])) {
+        EXPECT_NEAR(result[1], results_float[iresult_float][1], eps_float);
+        ++iresult_float;
+      } else {
+        EXPECT_TRUE(near_boundary(result[1]));
+      }
+    }
+    for (; iresult_float < results_float.size(); ++iresult_float)
+      EXPECT_TRUE(near_boundary(results_float[iresult_float][1]));
+    npoint_total += results.size();
+  }
+  // Sufficiency check
+  EXPECT_LE(NREP*10, npoint_total);
+}
+
+
+TEST(ShellIteratorTest, float_large_translation) {
+  // See DeltaIteratorTest.float_large_translation
+  double vecs[9]{1000.0, 0.0, 0.0, 0.0, 1000.0, 0.0, 0.0, 0.0, 1000.0};
+  cl::Cell cell(vecs, 3);
+  int shape[3];
+  std::unique_ptr<cl::Cell> subcell(cell.create_subcell(1.0, shape));
+  std::vector<int> ints(3*NPOINT);
+  fill_random_int(19, ints.data(), 3*NPOINT, -128, 128);
+  std::vector<std::array<double, 3>> carts(NPOINT);
+  for (int ipoint = 0; ipoint < NPOINT; ++ipoint) {
+    for (int ivec = 0; ivec < 3; ++ivec)
+      carts[ipoint][ivec] = ints[3*ipoint + ivec]/64.0;
+  }
+  const double center[3]{0.3, 0.7, 0.1};
+  auto results = shell_iterator_results<cl::Point>(*subcell, shape, center, 0.7, 1.5,
+                                                   carts);
+  auto results_float = shell_iterator_results<cl::PointF>(*subcell, shape, center,
+                                                          0.7, 1.5, carts);
+  ASSERT_EQ(results.size(), results_float.size());
+  for (size_t iresult = 0; iresult < results.size(); ++iresult) {
+    EXPECT_EQ(results[iresult][0], results_float[iresult][0]);
+    EXPECT_NEAR(results[iresult][1], results_float[iresult][1], 1e-6);
+  }
+  EXPECT_LT(0, results.size());
+}
+
+
+// BoxIterator
+// ~~~~~~~~~~~
+
+TEST(BoxIteratorTest, exceptions) {
+  double vecs[9]{2.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell(vecs, 3);
+  cl::Cell subcell2(vecs, 2);
+  const double origin[3]{0.0, 0.0, 0.0};
+  const double edges[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  const double bad_edges[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 1.0, 1.0, 0.0};
+  std::vector<cl::Point> points;
+  cl::CellMap cell_map;
+  EXPECT_THROW(cl::BoxIterator(subcell2, nullptr, origin, edges, points.data(),
+               points.size(), sizeof(cl::Point), cell_map), std::domain_error);
+  EXPECT_THROW(cl::BoxIterator(subcell, nullptr, origin, bad_edges, points.data(),
+               points.size(), sizeof(cl::Point), cell_map), std::domain_error);
+  cl::BoxIterator bit(subcell, nullptr, origin, edges, points.data(), points.size(),
+      sizeof(cl::Point), cell_map);
+  EXPECT_FALSE(bit.busy());
+  EXPECT_THROW(bit++, std::logic_error);
+}
+
+
+TEST(BoxIteratorTest, random) {
+  size_t npoint_total = 0;
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    RandomSystem sys(irep, 10.0, NPOINT);
+    // Random box, which may be larger than the periodic cell. The seeds differ from
+    // those of the points, to avoid points on the corner of the box.
+    double origin[3];
+    fill_random_double(NREP*NPOINT + 2*irep, origin, 3, -5.0, 5.0);
+    double edges[9];
+    fill_random_double(NREP*NPOINT + 2*irep + 1, edges, 9, -2.0 - irep, 2.0 + irep);
+
+    // Box iterator
+    std::vector<std::array<double, 4>> results;
+    for (cl::BoxIterator bit(*sys.subcell, sys.shape, origin, edges, sys.points.data(),
+         sys.points.size(), sizeof(cl::Point), *sys.cell_map); bit.busy(); ++bit) {
+      double delta[3];
+      vec3::copy(bit.delta(), delta);
+      for (int k = 0; k < 3; ++k) {
+        EXPECT_LE(0.0, bit.box_frac()[k]);
+        EXPECT_GE(1.0, bit.box_frac()[k]);
+        vec3::iadd(delta, edges + 3*k, -bit.box_frac()[k]);
+      }
+      EXPECT_NEAR(0.0, vec3::norm(delta), EPS);
+      results.push_back(std::array<double, 4>{static_cast<double>(bit.ipoint()),
+        bit.delta()[0], bit.delta()[1], bit.delta()[2]});
+    }
+    std::sort(results.begin(), results.end());
+    npoint_total += results.size();
+
+    // Reference results with a DeltaIterator over a sphere that contains the box.
+    double center[3];
+    vec3::copy(origin, center);
+    double radius = 0.0;
+    for (int k = 0; k < 3; ++k) {
+      vec3::iadd(center, edges + 3*k, 0.5);
+      radius += 0.5*vec3::norm(edges + 3*k);
+    }
+    cl::Cell box(edges, 3);
+    std::vector<std::array<double, 4>> results_ref;
+    for (cl::DeltaIterator dit(*sys.subcell, sys.shape, center, radius, sys.points.data(),
+         sys.points.size(), sizeof(cl::Point), *sys.cell_map); dit.busy(); ++dit) {
+      double delta[3];
+      vec3::copy(dit.delta(), delta);
+      vec3::iadd(delta, center);
+      vec3::iadd(delta, origin, -1.0);
+      double box_frac[3];
+      box.to_frac(delta, box_frac);
+      if ((box_frac[0] < 0) || (box_frac[0] > 1) || (box_frac[1] < 0) ||
+          (box_frac[1] > 1) || (box_frac[2] < 0) || (box_frac[2] > 1)) continue;
+      results_ref.push_back(std::array<double, 4>{static_cast<double>(dit.ipoint()),
+        delta[0], delta[1], delta[2]});
+    }
+    std::sort(results_ref.begin(), results_ref.end());
+
+    // Compare
+    ASSERT_EQ(results_ref.size(), results.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+      EXPECT_EQ(results_ref[i][0], results[i][0]);
+      for (int k = 1; k < 4; ++k)
+        EXPECT_NEAR(results_ref[i][k], results[i][k], EPS);
+    }
+  }
+  // Sufficiency check
+  EXPECT_LE(NREP*10, npoint_total);
+}
+
+
+// SortedDeltaIterator
+// ~~~~~~~~~~~~~~~~~~~
+
+TEST(SortedDeltaIteratorTest, exception) {
+  double vecs[9]{2.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell(vecs, 3);
+  const double center[3]{0.0, 0.0, 0.0};
+  std::vector<cl::Point> points;
+  cl::CellMap cell_map;
+  cl::Cell subcell2(vecs, 2);
+  EXPECT_THROW(cl::SortedDeltaIterator(subcell2, center, 1.0, points.data(),
+               points.size(), sizeof(cl::Point), cell_map), std::domain_error);
+  cl::SortedDeltaIterator sdit(subcell, center, 1.0, points.data(), points.size(),
+      sizeof(cl::Point), cell_map);
+  EXPECT_FALSE(sdit.busy());
+  EXPECT_THROW(sdit++, std::logic_error);
+}
+
+
+TEST(SortedDeltaIteratorTest, random) {
+  size_t npoint_total = 0;
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    RandomSystem sys(irep, 10.0, NPOINT);
+    double center[3];
+    fill_random_double(irep + 5, center, 3, -5.0, 5.0);
+    double cutoff = 2.0 + irep*0.5;
+
+    // Reference results in bar/cell order
+    std::vector<std::array<double, 2>> results_ref;
+    for (cl::DeltaIterator dit(*sys.subcell, sys.shape, center, cutoff, sys.points.data(),
+         sys.points.size(), sizeof(cl::Point), *sys.cell_map); dit.busy(); ++dit) {
+      results_ref.push_back(std::array<double, 2>{
+        dit.distance(), static_cast<double>(dit.ipoint())});
+    }
+    std::sort(results_ref.begin(), results_ref.end());
+
+    // Sorted results must come in nondecreasing order
+    std::vector<std::array<double, 2>> results;
+    for (cl::SortedDeltaIterator sdit(*sys.subcell, sys.shape, center, cutoff,
+         sys.points.data(), sys.points.size(), sizeof(cl::Point), *sys.cell_map);
+         sdit.busy(); ++sdit) {
+      EXPECT_NEAR(sdit.distance(), vec3::norm(sdit.delta()), EPS);
+      if (!results.empty()) {
+        EXPECT_LE(results.back()[0], sdit.distance());
+      }
+      results.push_back(std::array<double, 2>{
+        sdit.distance(), static_cast<double>(sdit.ipoint())});
+    }
+    std::sort(results.begin(), results.end());
+    EXPECT_EQ(results_ref, results);
+    npoint_total += results.size();
+  }
+  // Sufficiency check
+  EXPECT_LE(NREP*10, npoint_total);
+}
+
+
+TEST(SortedDeltaIteratorTest, lazy_lookups) {
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    RandomSystem sys(irep, 10.0, NPOINT);
+    double center[3];
+    fill_random_double(irep + 5, center, 3, -5.0, 5.0);
+    const double cutoff = 6.0;
+    // A full sweep looks up every subcell within the cutoff sphere once.
+    cl::SortedDeltaIterator sdit_full(*sys.subcell, sys.shape, center, cutoff,
+        sys.points.data(), sys.points.size(), sizeof(cl::Point), *sys.cell_map);
+    size_t npoint_full = 0;
+    for (; sdit_full.busy(); ++sdit_full) ++npoint_full;
+    std::vector<int> bars;
+    sys.subcell->bars_cutoff(center, cutoff, &bars);
+    size_t ncell = 0;
+    for (cl::BarIterator bit(bars, 3, sys.shape); bit.busy(); ++bit) ++ncell;
+    EXPECT_EQ(ncell, sdit_full.nlookup());
+    // Only the nearest neighbors, which requires much fewer lookups.
+    ASSERT_LT(10, npoint_full);
+    cl::SortedDeltaIterator sdit(*sys.subcell, sys.shape, center, cutoff,
+        sys.points.data(), sys.points.size(), sizeof(cl::Point), *sys.cell_map);
+    for (int ineighbor = 0; ineighbor < 10; ++ineighbor) {
+      ASSERT_TRUE(sdit.busy());
+      ++sdit;
+    }
+    EXPECT_LT(sdit.nlookup(), sdit_full.nlookup()/2);
+  }
+}
+
+
+template <typename PointType>
+std::vector<std::array<double, 2>> sorted_delta_iterator_results(
+    const cl::Cell& subcell, const int* shape, const double* center, double cutoff,
+    const std::vector<std::array<double, 3>>& carts) {
+  // Points with their original index.
+  std::vector<IndexedPoint<PointType>> points;
+  for (size_t ipoint = 0; ipoint < carts.size(); ++ipoint)
+    points.push_back(IndexedPoint<PointType>{PointType(carts[ipoint].data()), ipoint});
+  const size_t point_size = sizeof(IndexedPoint<PointType>);
+  cl::assign_icell<PointType>(subcell, shape, points.data(), points.size(), point_size);
+  cl::sort_by_icell<PointType>(points.data(), points.size(), point_size);
+  std::unique_ptr<cl::CellMap> cell_map(
+      cl::create_cell_map<PointType>(points.data(), points.size(), point_size));
+  // Iterate and collect the original indexes and distances.
+  std::vector<std::array<double, 2>> results;
+  for (cl::BasicSortedDeltaIterator<PointType> sdit(subcell, shape, center, cutoff,
+       points.data(), points.size(), point_size, *cell_map); sdit.busy(); ++sdit) {
+    const IndexedPoint<PointType>& point = points[sdit.ipoint()];
+    results.push_back(std::array<double, 2>{
+      static_cast<double>(point.index), static_cast<double>(sdit.distance())});
+  }
+  std::sort(results.begin(), results.end());
+  return results;
+}
+
+
+TEST(SortedDeltaIteratorTest, float_large_translation) {
+  // See DeltaIteratorTest.float_large_translation
+  double vecs[9]{1000.0, 0.0, 0.0, 0.0, 1000.0, 0.0, 0.0, 0.0, 1000.0};
+  cl::Cell cell(vecs, 3);
+  int shape[3];
+  std::unique_ptr<cl::Cell> subcell(cell.create_subcell(1.0, shape));
+  std::vector<int> ints(3*NPOINT);
+  fill_random_int(23, ints.data(), 3*NPOINT, -128, 128);
+  std::vector<std::array<double, 3>> carts(NPOINT);
+  for (int ipoint = 0; ipoint < NPOINT; ++ipoint) {
+    for (int ivec = 0; ivec < 3; ++ivec)
+      carts[ipoint][ivec] = ints[3*ipoint + ivec]/64.0;
+  }
+  const double center[3]{0.3, 0.7, 0.1};
+  const double cutoff = 1.5;
+  auto results = sorted_delta_iterator_results<cl::Point>(*subcell, shape, center,
+                                                          cutoff, carts);
+  auto results_float = sorted_delta_iterator_results<cl::PointF>(*subcell, shape, center,
+                                                                 cutoff, carts);
+  ASSERT_EQ(results.size(), results_float.size());
+  for (size_t iresult = 0; iresult < results.size(); ++iresult) {
+    EXPECT_EQ(results[iresult][0], results_float[iresult][0]);
+    EXPECT_NEAR(results[iresult][1], results_float[iresult][1], 1e-6);
+  }
+  EXPECT_LT(0, results.size());
+}
+
+
+// TripletIterator
+// ~~~~~~~~~~~~~~~
+
+TEST(TripletIteratorTest, exceptions) {
+  double vecs[9]{2.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell2(vecs, 2);
+  std::vector<cl::Point> points;
+  cl::CellMap cell_map;
+  EXPECT_THROW(cl::TripletIterator(subcell2, nullptr, 1.0, points.data(), points.size(),
+               sizeof(cl::Point), cell_map, true), std::domain_error);
+  cl::Cell subcell(vecs, 3);
+  cl::TripletIterator tit(subcell, nullptr, 1.0, points.data(), points.size(),
+      sizeof(cl::Point), cell_map, true);
+  const double center[3]{0.0, 0.0, 0.0};
+  tit.reset(center);
+  EXPECT_FALSE(tit.busy());
+  EXPECT_THROW(tit++, std::logic_error);
+}
+
+
+TEST(TripletIteratorTest, example) {
+  // Three points, of which the first is used as center.
+  std::vector<cl::Point> points;
+  double cart_0[3]{0.5, 0.5, 0.5};
+  double cart_1[3]{1.5, 0.5, 0.5};
+  double cart_2[3]{2.5, 1.5, 0.5};
+  points.emplace_back(cart_0);
+  points.emplace_back(cart_1);
+  points.emplace_back(cart_2);
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell(vecs, 3);
+  cl::assign_icell(subcell, points.data(), points.size(), sizeof(cl::Point));
+  std::unique_ptr<cl::CellMap> cell_map(
+      cl::create_cell_map(points.data(), points.size(), sizeof(cl::Point)));
+  cl::TripletIterator tit(subcell, nullptr, 3.0, points.data(), points.size(),
+      sizeof(cl::Point), *cell_map, true);
+  tit.reset(cart_0);
+  EXPECT_EQ(2, tit.nneighbor());
+  ASSERT_TRUE(tit.busy());
+  EXPECT_EQ(1, tit.ipoint0());
+  EXPECT_EQ(2, tit.ipoint1());
+  EXPECT_NEAR(1.0, tit.distance0(), EPS);
+  EXPECT_NEAR(sqrt(5.0), tit.distance1(), EPS);
+  EXPECT_NEAR(1.0, tit.delta0()[0], EPS);
+  EXPECT_NEAR(1.0, tit.delta1()[1], EPS);
+  EXPECT_NEAR(1.0, tit.delta01()[0], EPS);
+  EXPECT_NEAR(1.0, tit.delta01()[1], EPS);
+  EXPECT_NEAR(0.0, tit.delta01()[2], EPS);
+  EXPECT_NEAR(sqrt(2.0), tit.distance01(), EPS);
+  ++tit;
+  EXPECT_FALSE(tit.busy());
+  // Another center, reusing the buffer
+  tit.reset(cart_2);
+  EXPECT_EQ(2, tit.nneighbor());
+  ASSERT_TRUE(tit.busy());
+  EXPECT_EQ(0, tit.ipoint0());
+  EXPECT_EQ(1, tit.ipoint1());
+  EXPECT_NEAR(1.0, tit.distance01(), EPS);
+  ++tit;
+  EXPECT_FALSE(tit.busy());
+}
+
+
+TEST(TripletIteratorTest, random) {
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    RandomSystem sys(irep, 5.0, NPOINT/10);
+    const double cutoff = 2.0;
+    cl::TripletIterator tit_sym(*sys.subcell, sys.shape, cutoff, sys.points.data(),
+        sys.points.size(), sizeof(cl::Point), *sys.cell_map, true);
+    cl::TripletIterator tit_all(*sys.subcell, sys.shape, cutoff, sys.points.data(),
+        sys.points.size(), sizeof(cl::Point), *sys.cell_map, false);
+    for (int icenter = 0; icenter < 10; ++icenter) {
+      double center[3];
+      fill_random_double(7919 + irep*100 + icenter, center, 3, -5.0, 5.0);
+      // Reference neighbors
+      size_t nneighbor = 0;
+      for (cl::DeltaIterator dit(*sys.subcell, sys.shape, center, cutoff,
+           sys.points.data(), sys.points.size(), sizeof(cl::Point), *sys.cell_map);
+           dit.busy(); ++dit)
+        ++nneighbor;
+      // Symmetric pairs
+      size_t npair = 0;
+      for (tit_sym.reset(center); tit_sym.busy(); ++tit_sym) {
+        double delta01[3];
+        vec3::delta(tit_sym.delta0(), tit_sym.delta1(), delta01);
+        EXPECT_NEAR(delta01[0], tit_sym.delta01()[0], EPS);
+        EXPECT_NEAR(delta01[1], tit_sym.delta01()[1], EPS);
+        EXPECT_NEAR(delta01[2], tit_sym.delta01()[2], EPS);
+        EXPECT_NEAR(vec3::norm(delta01), tit_sym.distance01(), EPS);
+        EXPECT_NEAR(vec3::norm(tit_sym.delta0()), tit_sym.distance0(), EPS);
+        EXPECT_GE(cutoff, tit_sym.distance0());
+        EXPECT_GE(cutoff, tit_sym.distance1());
+        ++npair;
+      }
+      EXPECT_EQ(nneighbor, tit_sym.nneighbor());
+      EXPECT_EQ((nneighbor*(nneighbor - 1))/2, npair);
+      // All pairs
+      npair = 0;
+      for (tit_all.reset(center); tit_all.busy(); ++tit_all)
+        ++npair;
+      EXPECT_EQ(nneighbor*(nneighbor - 1), npair);
+    }
+  }
+}
+
+
+// GridIterator
+// ~~~~~~~~~~~~
+
+TEST(GridIteratorTest, exceptions) {
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  const double center[3]{0.0, 0.0, 0.0};
+  const int shape[3]{4, 4, 4};
+  const int bad_shape[3]{4, 0, 4};
+  cl::Cell grid_cell2(vecs, 2);
+  EXPECT_THROW(cl::GridIterator(grid_cell2, shape, center, 1.0), std::domain_error);
+  cl::Cell grid_cell(vecs, 3);
+  EXPECT_THROW(cl::GridIterator(grid_cell, bad_shape, center, 1.0), std::domain_error);
+  EXPECT_THROW(cl::GridIterator(grid_cell, shape, center, 0.0), std::domain_error);
+  const double bad_metric[9]{1.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0};
+  EXPECT_THROW(cl::GridIterator(grid_cell, shape, center, bad_metric, 1.0),
+               std::domain_error);
+  cl::GridIterator git(grid_cell, shape, center, 1.0);
+  EXPECT_THROW(git++, std::logic_error);
+}
+
+
+TEST(GridIteratorTest, example) {
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell grid_cell(vecs, 3);
+  const int shape[3]{4, 4, 4};
+  const double center[3]{0.0, 0.0, 0.0};
+  cl::GridIterator git(grid_cell, shape, center, 1.01);
+  const size_t ipoints[7]{48, 12, 3, 0, 1, 4, 16};
+  const int coeff0[7]{-1, 0, 0, 0, 0, 0, 0};
+  for (int i = 0; i < 7; ++i) {
+    EXPECT_TRUE(git.busy());
+    EXPECT_EQ(ipoints[i], git.ipoint());
+    EXPECT_EQ(coeff0[i], git.coeffs()[0]);
+    EXPECT_NEAR(i == 3 ? 0.0 : 1.0, git.distance(), EPS);
+    EXPECT_NEAR(git.distance(), vec3::norm(git.delta()), EPS);
+    ++git;
+  }
+  EXPECT_FALSE(git.busy());
+}
+
+
+TEST(GridIteratorTest, random) {
+  size_t npoint_total = 0;
+  for (int irep = 0; irep < NREP; ++irep) {
+    // Random grid and a cutoff sphere that may be larger than the periodic cell. Every
+    // other grid is cuboid, for which a closed-form solution is used.
+    std::unique_ptr<cl::Cell> grid_cell(create_random_cell_nvec(irep, 3, 0.5, 0.2,
+                                                                irep%2 == 1));
+    int shape[3];
+    fill_random_int(irep + 11, shape, 3, 1, 6);
+    double cutoff = 0.5 + 2.0*static_cast<double>(irep)/NREP;
+    double center[3];
+    fill_random_double(irep + 7, center, 3, -2.0, 2.0);
+
+    // Use the GridIterator.
+    std::vector<std::array<double, 2>> results_grid;
+    for (cl::GridIterator git(*grid_cell, shape, center, cutoff); git.busy(); ++git) {
+      EXPECT_NEAR(git.distance(), vec3::norm(git.delta()), EPS);
+      // Check consistency of the grid indexes and the relative vector
+      double frac[3];
+      double delta[3];
+      vec3::copy(git.delta(), delta);
+      vec3::iadd(delta, center);
+      grid_cell->to_frac(delta, frac);
+      for (int ivec = 0; ivec < 3; ++ivec) {
+        EXPECT_EQ(git.igrid()[ivec] + git.coeffs()[ivec]*shape[ivec], round(frac[ivec]));
+        EXPECT_NEAR(git.igrid()[ivec] + git.coeffs()[ivec]*shape[ivec], frac[ivec], EPS);
+      }
+      results_grid.push_back(std::array<double, 2>{
+        static_cast<double>(git.ipoint()), git.distance()});
+    }
+    std::sort(results_grid.begin(), results_grid.end());
+    npoint_total += results_grid.size();
+
+    // Brute-force loop over all candidates in the ranges of the cutoff sphere.
+    std::vector<std::array<double, 2>> results_brute;
+    int ranges_begin[3];
+    int ranges_end[3];
+    grid_cell->ranges_cutoff(center, cutoff, ranges_begin, ranges_end);
+    int igrid[3];
+    for (igrid[0] = ranges_begin[0]; igrid[0] <= ranges_end[0]; ++igrid[0]) {
+      for (igrid[1] = ranges_begin[1]; igrid[1] <= ranges_end[1]; ++igrid[1]) {
+        for (igrid[2] = ranges_begin[2]; igrid[2] <= ranges_end[2]; ++igrid[2]) {
+          double delta[3]{-center[0], -center[1], -center[2]};
+          grid_cell->iadd_vec(delta, igrid);
+          double distance = vec3::norm(delta);
+          if (distance < cutoff) {
+            size_t ipoint = (cl::robust_wrap(igrid[0], shape[0])*shape[1] +
+                             cl::robust_wrap(igrid[1], shape[1]))*shape[2] +
+                            cl::robust_wrap(igrid[2], shape[2]);
+            results_brute.push_back(std::array<double, 2>{
+              static_cast<double>(ipoint), distance});
+          }
+        }
+      }
+    }
+    std::sort(results_brute.begin(), results_brute.end());
+
+    // Compare
+    ASSERT_EQ(results_brute.size(), results_grid.size());
+    for (size_t i = 0; i < results_grid.size(); ++i) {
+      EXPECT_EQ(results_brute[i][0], results_grid[i][0]);
+      EXPECT_NEAR(results_brute[i][1], results_grid[i][1], EPS);
+    }
+  }
+  // Sufficiency check
+  EXPECT_LE(NREP*10, npoint_total);
+}
+
+
+TEST(GridIteratorTest, random_metric) {
+  size_t npoint_total = 0;
+  for (int irep = 0; irep < NREP; ++irep) {
+    // Random grid and a random ellipsoid. Cuboid grids use the general algorithm too.
+    std::unique_ptr<cl::Cell> grid_cell(create_random_cell_nvec(irep, 3, 0.5, 0.2,
+                                                                irep%2 == 1));
+    int shape[3];
+    fill_random_int(irep + 11, shape, 3, 1, 6);
+    double cutoff = 0.5 + 1.0*static_cast<double>(irep)/NREP;
+    double center[3];
+    fill_random_double(irep + 7, center, 3, -2.0, 2.0);
+    double metric[9];
+    fill_random_metric(irep + 5, metric);
+
+    // Use the GridIterator.
+    std::vector<std::array<double, 2>> results_grid;
+    for (cl::GridIterator git(*grid_cell, shape, center, metric, cutoff); git.busy();
+         ++git) {
+      double metric_delta[3];
+      vec3::matvec(metric, git.delta(), metric_delta);
+      EXPECT_NEAR(git.distance(), sqrt(vec3::dot(git.delta(), metric_delta)), EPS);
+      results_grid.push_back(std::array<double, 2>{
+        static_cast<double>(git.ipoint()), git.distance()});
+    }
+    std::sort(results_grid.begin(), results_grid.end());
+    npoint_total += results_grid.size();
+
+    // Brute-force loop over all candidates in the ranges of a sphere that contains the
+    // ellipsoid. The smallest eigenvalue of the metric is at least 0.1.
+    std::vector<std::array<double, 2>> results_brute;
+    int ranges_begin[3];
+    int ranges_end[3];
+    grid_cell->ranges_cutoff(center, cutoff/sqrt(0.1), ranges_begin, ranges_end);
+    int igrid[3];
+    for (igrid[0] = ranges_begin[0]; igrid[0] <= ranges_end[0]; ++igrid[0]) {
+      for (igrid[1] = ranges_begin[1]; igrid[1] <= ranges_end[1]; ++igrid[1]) {
+        for (igrid[2] = ranges_begin[2]; igrid[2] <= ranges_end[2]; ++igrid[2]) {
+          double delta[3]{-center[0], -center[1], -center[2]};
+          grid_cell->iadd_vec(delta, igrid);
+          double metric_delta[3];
+          vec3::matvec(metric, delta, metric_delta);
+          double distance = sqrt(vec3::dot(delta, metric_delta));
+          if (distance < cutoff) {
+            size_t ipoint = (cl::robust_wrap(igrid[0], shape[0])*shape[1] +
+                             cl::robust_wrap(igrid[1], shape[1]))*shape[2] +
+                            cl::robust_wrap(igrid[2], shape[2]);
+            results_brute.push_back(std::array<double, 2>{
+              static_cast<double>(ipoint), distance});
+          }
+        }
+      }
+    }
+    std::sort(results_brute.begin(), results_brute.end());
+
+    // Compare
+    ASSERT_EQ(results_brute.size(), results_grid.size());
+    for (size_t i = 0; i < results_grid.size(); ++i) {
+      EXPECT_EQ(results_brute[i][0], results_grid[i][0]);
+      EXPECT_NEAR(results_brute[i][1], results_grid[i][1], EPS);
+    }
+  }
+  // Sufficiency check
+  EXPECT_LE(NREP*10, npoint_total);
+}
+
 // Instantiation of parameterized tests
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
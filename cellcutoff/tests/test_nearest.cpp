@@ -0,0 +1,180 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <cellcutoff/cell.h>
+#include <cellcutoff/decomposition.h>
+#include <cellcutoff/iterators.h>
+#include <cellcutoff/nearest.h>
+#include <cellcutoff/vec3.h>
+
+#include "common.h"
+
+
+namespace cl = cellcutoff;
+namespace vec3 = cellcutoff::vec3;
+
+
+TEST(NearestTest, exceptions) {
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell(vecs, 2);
+  double center[3]{0.0, 0.0, 0.0};
+  cl::CellMap cell_map;
+  size_t ipoints[1];
+  double distances[1];
+  EXPECT_THROW(cl::nearest_neighbors(subcell, nullptr, center, 1, nullptr, 0,
+               sizeof(cl::Point), cell_map, ipoints, distances, nullptr), std::domain_error);
+}
+
+
+TEST(NearestTest, example) {
+  // Four points along the x-axis, non-periodic
+  std::vector<cl::Point> points;
+  double cart_0[3]{0.5, 0.5, 0.5};
+  double cart_1[3]{3.5, 0.5, 0.5};
+  double cart_2[3]{-1.5, 0.5, 0.5};
+  double cart_3[3]{10.5, 0.5, 0.5};
+  points.emplace_back(cart_0);
+  points.emplace_back(cart_1);
+  points.emplace_back(cart_2);
+  points.emplace_back(cart_3);
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell(vecs, 3);
+  cl::assign_icell(subcell, points.data(), points.size(), sizeof(cl::Point));
+  cl::sort_by_icell(points.data(), points.size(), sizeof(cl::Point));
+  std::unique_ptr<cl::CellMap> cell_map(
+      cl::create_cell_map(points.data(), points.size(), sizeof(cl::Point)));
+  double center[3]{1.0, 0.5, 0.5};
+
+  // Three nearest neighbors
+  size_t ipoints[5];
+  double distances[5];
+  double deltas[15];
+  EXPECT_EQ(3, cl::nearest_neighbors(subcell, nullptr, center, 3, points.data(),
+            points.size(), sizeof(cl::Point), *cell_map, ipoints, distances, deltas));
+  EXPECT_NEAR(0.5, distances[0], EPS);
+  EXPECT_NEAR(2.5, distances[1], EPS);
+  EXPECT_NEAR(2.5, distances[2], EPS);
+  EXPECT_NEAR(-0.5, deltas[0], EPS);
+  EXPECT_NEAR(0.0, deltas[1], EPS);
+  EXPECT_NEAR(0.0, deltas[2], EPS);
+  EXPECT_NEAR(0.5, points[ipoints[0]].cart_[0], EPS);
+
+  // Asking for more neighbors than points
+  EXPECT_EQ(4, cl::nearest_neighbors(subcell, nullptr, center, 5, points.data(),
+            points.size(), sizeof(cl::Point), *cell_map, ipoints, distances, nullptr));
+  EXPECT_NEAR(9.5, distances[3], EPS);
+  EXPECT_NEAR(10.5, points[ipoints[3]].cart_[0], EPS);
+
+  // Nothing to find
+  EXPECT_EQ(0, cl::nearest_neighbors(subcell, nullptr, center, 0, points.data(),
+            points.size(), sizeof(cl::Point), *cell_map, ipoints, distances, nullptr));
+}
+
+
+TEST(NearestTest, subset) {
+  // Points along the x-axis, non-periodic
+  std::vector<cl::Point> points;
+  for (int ipoint = 0; ipoint < 10; ++ipoint) {
+    double cart[3]{0.5 + ipoint, 0.5, 0.5};
+    points.emplace_back(cart);
+  }
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell(vecs, 3);
+  cl::assign_icell(subcell, points.data(), points.size(), sizeof(cl::Point));
+  // The cell map only covers the first four points.
+  std::unique_ptr<cl::CellMap> cell_map(
+      cl::create_cell_map(points.data(), 4, sizeof(cl::Point)));
+  double center[3]{2.0, 0.5, 0.5};
+  size_t ipoints[5];
+  double distances[5];
+  EXPECT_EQ(4, cl::nearest_neighbors(subcell, nullptr, center, 5, points.data(),
+            points.size(), sizeof(cl::Point), *cell_map, ipoints, distances, nullptr));
+  EXPECT_NEAR(0.5, distances[0], EPS);
+  EXPECT_NEAR(0.5, distances[1], EPS);
+  EXPECT_NEAR(1.5, distances[2], EPS);
+  EXPECT_NEAR(1.5, distances[3], EPS);
+  std::sort(ipoints, ipoints + 4);
+  EXPECT_EQ(0, ipoints[0]);
+  EXPECT_EQ(3, ipoints[3]);
+
+  // An empty cell map, also with periodic boundary conditions
+  cl::CellMap empty_map;
+  EXPECT_EQ(0, cl::nearest_neighbors(subcell, nullptr, center, 5, points.data(),
+            points.size(), sizeof(cl::Point), empty_map, ipoints, distances, nullptr));
+  int shape[3]{10, 1, 1};
+  EXPECT_EQ(0, cl::nearest_neighbors(subcell, shape, center, 5, points.data(),
+            points.size(), sizeof(cl::Point), empty_map, ipoints, distances, nullptr));
+}
+
+
+TEST(NearestTest, random) {
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    // Random periodic system
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, 3, 5.0, 0.5));
+    int shape[3];
+    std::unique_ptr<cl::Cell> subcell(cell->create_subcell(0.6 + 0.1*irep, shape));
+    std::vector<cl::Point> points;
+    for (int ipoint = 0; ipoint < NPOINT/10; ++ipoint) {
+      double cart[3];
+      fill_random_double(irep*NPOINT + ipoint, cart, 3, -5.0, 5.0);
+      points.push_back(cl::Point(cart));
+    }
+    cl::assign_icell(*subcell, shape, points.data(), points.size(), sizeof(cl::Point));
+    cl::sort_by_icell(points.data(), points.size(), sizeof(cl::Point));
+    std::unique_ptr<cl::CellMap> cell_map(
+        cl::create_cell_map(points.data(), points.size(), sizeof(cl::Point)));
+    double center[3];
+    fill_random_double(irep + 11, center, 3, -5.0, 5.0);
+
+    // k nearest neighbors, with k larger than the number of points.
+    const size_t k = 2*points.size();
+    std::vector<size_t> ipoints(k);
+    std::vector<double> distances(k);
+    std::vector<double> deltas(3*k);
+    ASSERT_EQ(k, cl::nearest_neighbors(*subcell, shape, center, k, points.data(),
+              points.size(), sizeof(cl::Point), *cell_map, ipoints.data(),
+              distances.data(), deltas.data()));
+    for (size_t ineighbor = 0; ineighbor < k; ++ineighbor) {
+      EXPECT_NEAR(distances[ineighbor], vec3::norm(&deltas[3*ineighbor]), EPS);
+      if (ineighbor > 0) {
+        EXPECT_LE(distances[ineighbor - 1], distances[ineighbor]);
+      }
+    }
+
+    // Compare with all points within the k-th distance.
+    std::vector<double> distances_ref;
+    for (cl::DeltaIterator dit(*subcell, shape, center, distances[k - 1] + 1e-8,
+         points.data(), points.size(), sizeof(cl::Point), *cell_map); dit.busy(); ++dit)
+      distances_ref.push_back(dit.distance());
+    std::sort(distances_ref.begin(), distances_ref.end());
+    ASSERT_LE(k, distances_ref.size());
+    for (size_t ineighbor = 0; ineighbor < k; ++ineighbor)
+      EXPECT_NEAR(distances_ref[ineighbor], distances[ineighbor], EPS);
+  }
+}
+
+
+// vim: textwidth=90 et ts=2 sw=2
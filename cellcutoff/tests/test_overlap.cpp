@@ -0,0 +1,204 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <cellcutoff/cell.h>
+#include <cellcutoff/cell_list.h>
+#include <cellcutoff/overlap.h>
+#include <cellcutoff/vec3.h>
+
+#include "common.h"
+
+
+namespace cl = cellcutoff;
+namespace vec3 = cellcutoff::vec3;
+
+
+//! Brute-force reference over all relevant periodic images.
+std::vector<cl::Overlap> find_overlaps_brute(const cl::Cell& cell, const double* carts,
+    const double* radii, size_t npoint) {
+  const double cutoff = 2*(*std::max_element(radii, radii + npoint));
+  int ranges_begin[3]{0, 0, 0};
+  int ranges_end[3]{0, 0, 0};
+  double origin[3]{0.0, 0.0, 0.0};
+  cell.ranges_cutoff(origin, cutoff, ranges_begin, ranges_end);
+  for (int ivec = 0; ivec < cell.nvec(); ++ivec) {
+    // Relative vectors are wrapped, so their fractional coordinates are in [-0.5, 0.5[.
+    --ranges_begin[ivec];
+    ++ranges_end[ivec];
+  }
+  std::vector<cl::Overlap> overlaps;
+  for (size_t ipoint0 = 0; ipoint0 < npoint; ++ipoint0) {
+    for (size_t ipoint1 = ipoint0; ipoint1 < npoint; ++ipoint1) {
+      double delta_wrapped[3];
+      vec3::delta(carts + 3*ipoint0, carts + 3*ipoint1, delta_wrapped);
+      cell.iwrap_mic(delta_wrapped);
+      int coeffs[3];
+      for (coeffs[0] = ranges_begin[0]; coeffs[0] <= ranges_end[0]; ++coeffs[0]) {
+        for (coeffs[1] = ranges_begin[1]; coeffs[1] <= ranges_end[1]; ++coeffs[1]) {
+          for (coeffs[2] = ranges_begin[2]; coeffs[2] <= ranges_end[2]; ++coeffs[2]) {
+            double delta[3];
+            std::copy(delta_wrapped, delta_wrapped + 3, delta);
+            cell.iadd_vec(delta, coeffs);
+            double distance = vec3::norm(delta);
+            if (distance >= radii[ipoint0] + radii[ipoint1]) continue;
+            if (ipoint0 == ipoint1) {
+              // Self-images come in pairs of opposite translations, keep one.
+              if (std::array<int, 3>{coeffs[0], coeffs[1], coeffs[2]} <=
+                  std::array<int, 3>{0, 0, 0}) continue;
+            }
+            overlaps.push_back(cl::Overlap{ipoint0, ipoint1, distance});
+          }
+        }
+      }
+    }
+  }
+  std::sort(overlaps.begin(), overlaps.end(), [](const cl::Overlap& overlap0,
+      const cl::Overlap& overlap1) {
+    if (overlap0.ipoint0 != overlap1.ipoint0) return overlap0.ipoint0 < overlap1.ipoint0;
+    if (overlap0.ipoint1 != overlap1.ipoint1) return overlap0.ipoint1 < overlap1.ipoint1;
+    return overlap0.distance < overlap1.distance;
+  });
+  return overlaps;
+}
+
+
+TEST(OverlapTest, exceptions) {
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell cell(vecs, 3);
+  double radii[3]{1.0, -1.0, 1.0};
+  EXPECT_THROW(cl::find_overlaps(cell, vecs, radii, 3, 1), std::domain_error);
+  EXPECT_THROW(cl::any_overlap(cell, vecs, radii, 3, 1), std::domain_error);
+  int shape[3]{1, 1, 1};
+  cl::CellList cell_list(cell, shape);
+  EXPECT_THROW(cl::any_overlap(cell_list, radii, 1.0, vecs, -1.0, 0), std::domain_error);
+}
+
+
+TEST(OverlapTest, example) {
+  double vecs[9]{10.0, 0.0, 0.0, 0.0, 10.0, 0.0, 0.0, 0.0, 10.0};
+  cl::Cell cell(vecs, 3);
+  // Touching spheres do not overlap, overlap is found through the periodic boundary.
+  double carts[9]{
+    1.0, 1.0, 1.0,
+    3.0, 1.0, 1.0,
+    9.5, 1.0, 1.0};
+  double radii[3]{1.0, 1.0, 0.6};
+  std::vector<cl::Overlap> overlaps(cl::find_overlaps(cell, carts, radii, 3, 2));
+  ASSERT_EQ(1, overlaps.size());
+  EXPECT_EQ(0, overlaps[0].ipoint0);
+  EXPECT_EQ(2, overlaps[0].ipoint1);
+  EXPECT_NEAR(1.5, overlaps[0].distance, 1e-10);
+  EXPECT_TRUE(cl::any_overlap(cell, carts, radii, 3, 2));
+  radii[2] = 0.5;
+  EXPECT_FALSE(cl::any_overlap(cell, carts, radii, 3, 2));
+  double radii_zero[3]{0.0, 0.0, 0.0};
+  EXPECT_FALSE(cl::any_overlap(cell, carts, radii_zero, 3, 2));
+}
+
+
+TEST(OverlapTest, random_brute) {
+  size_t noverlap_total = 0;
+  for (int irep = 0; irep < NREP; ++irep) {
+    const int nvec = irep % 4;
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, nvec, 5.0, 0.5));
+    const size_t npoint = 60;
+    std::vector<double> carts(3*npoint);
+    std::vector<double> radii(npoint);
+    unsigned int seed = fill_random_double(irep + 5309, carts.data(),
+                                           static_cast<int>(3*npoint), -5.0, 5.0);
+    fill_random_double(seed, radii.data(), static_cast<int>(npoint), 0.0,
+                       0.2 + 0.01*irep);
+    std::vector<cl::Overlap> overlaps_brute(
+        find_overlaps_brute(*cell, carts.data(), radii.data(), npoint));
+    for (size_t nthread = 1; nthread < 5; nthread += 3) {
+      std::vector<cl::Overlap> overlaps(
+          cl::find_overlaps(*cell, carts.data(), radii.data(), npoint, nthread));
+      ASSERT_EQ(overlaps_brute.size(), overlaps.size());
+      for (size_t ioverlap = 0; ioverlap < overlaps.size(); ++ioverlap) {
+        EXPECT_EQ(overlaps_brute[ioverlap].ipoint0, overlaps[ioverlap].ipoint0);
+        EXPECT_EQ(overlaps_brute[ioverlap].ipoint1, overlaps[ioverlap].ipoint1);
+        EXPECT_NEAR(overlaps_brute[ioverlap].distance, overlaps[ioverlap].distance,
+                    1e-10);
+      }
+      EXPECT_EQ(!overlaps.empty(),
+                cl::any_overlap(*cell, carts.data(), radii.data(), npoint, nthread));
+    }
+    noverlap_total += overlaps_brute.size();
+  }
+  // Sufficiency check
+  EXPECT_LE(NREP, noverlap_total);
+}
+
+
+TEST(OverlapTest, random_cell_list) {
+  int ntrue = 0;
+  for (int irep = 0; irep < NREP; ++irep) {
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, 3, 5.0, 0.5));
+    const size_t npoint = 60;
+    std::vector<double> carts(3*npoint);
+    std::vector<double> radii(npoint);
+    unsigned int seed = fill_random_double(irep + 7411, carts.data(),
+                                           static_cast<int>(3*npoint), -5.0, 5.0);
+    seed = fill_random_double(seed, radii.data(), static_cast<int>(npoint), 0.0, 0.3);
+    // Persistent decomposition, reused for all trial spheres
+    int shape[3];
+    std::unique_ptr<cl::Cell> subcell(cell->create_subcell(0.4, shape));
+    cl::CellList cell_list(*subcell, shape);
+    for (size_t ipoint = 0; ipoint < npoint; ++ipoint)
+      EXPECT_EQ(ipoint, cell_list.insert(carts.data() + 3*ipoint));
+    for (int itrial = 0; itrial < 10; ++itrial) {
+      int iskip;
+      seed = fill_random_int(seed, &iskip, 1, 0, static_cast<int>(npoint) - 1);
+      double center[3];
+      seed = fill_random_double(seed, center, 3, -5.0, 5.0);
+      double radius;
+      seed = fill_random_double(seed, &radius, 1, 0.0, 0.3);
+      // Reference: replace the skipped sphere by the trial sphere.
+      std::vector<double> carts_trial(carts);
+      std::vector<double> radii_trial(radii);
+      std::copy(center, center + 3, carts_trial.begin() + 3*iskip);
+      radii_trial[iskip] = radius;
+      bool expected = false;
+      for (const cl::Overlap& overlap : find_overlaps_brute(
+               *cell, carts_trial.data(), radii_trial.data(), npoint)) {
+        if ((overlap.ipoint0 != overlap.ipoint1) &&
+            ((overlap.ipoint0 == static_cast<size_t>(iskip)) ||
+             (overlap.ipoint1 == static_cast<size_t>(iskip))))
+          expected = true;
+      }
+      EXPECT_EQ(expected, cl::any_overlap(cell_list, radii.data(), 0.3, center, radius,
+                                          iskip));
+      if (expected) ++ntrue;
+    }
+  }
+  // Sufficiency check
+  EXPECT_LE(NREP, ntrue);
+  EXPECT_GE(9*NREP, ntrue);
+}
+
+// vim: textwidth=90 et ts=2 sw=2
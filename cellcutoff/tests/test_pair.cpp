@@ -0,0 +1,189 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <cellcutoff/cell.h>
+#include <cellcutoff/pair.h>
+#include <cellcutoff/vec3.h>
+
+#include "common.h"
+
+
+namespace cl = cellcutoff;
+namespace vec3 = cellcutoff::vec3;
+
+
+//! Lennard-Jones potential with two types and a shifted energy at the cutoff.
+class LennardJones {
+ public:
+  LennardJones(const int* types, double cutoff) : types_(types), cutoff_(cutoff) {}
+
+  double operator()(size_t ipoint0, size_t ipoint1, double distance_sq,
+      double* dvdr) const {
+    const double sigma = 1.0 + 0.2*(types_[ipoint0] + types_[ipoint1]);
+    const double epsilon = 1.0 + types_[ipoint0]*types_[ipoint1];
+    double dvdr_cutoff;
+    return lj(sigma, epsilon, distance_sq, dvdr) -
+           lj(sigma, epsilon, cutoff_*cutoff_, &dvdr_cutoff);
+  }
+
+ private:
+  static double lj(double sigma, double epsilon, double distance_sq, double* dvdr) {
+    const double x6 = pow(sigma*sigma/distance_sq, 3);
+    *dvdr = -24.0*epsilon*(2.0*x6*x6 - x6)/sqrt(distance_sq);
+    return 4.0*epsilon*(x6*x6 - x6);
+  }
+
+  const int* types_;
+  double cutoff_;
+};
+
+
+//! Brute-force reference over all relevant periodic images.
+template <typename Potential>
+double pair_potential_brute(const cl::Cell& cell, const double* carts, size_t npoint,
+    double cutoff, const Potential& potential, double* forces, double* virial) {
+  int ranges_begin[3]{0, 0, 0};
+  int ranges_end[3]{0, 0, 0};
+  double origin[3]{0.0, 0.0, 0.0};
+  cell.ranges_cutoff(origin, cutoff, ranges_begin, ranges_end);
+  for (int ivec = 0; ivec < cell.nvec(); ++ivec) {
+    // Relative vectors are wrapped, so their fractional coordinates are in [-0.5, 0.5[.
+    --ranges_begin[ivec];
+    ++ranges_end[ivec];
+  }
+  std::fill(forces, forces + 3*npoint, 0.0);
+  std::fill(virial, virial + 9, 0.0);
+  double energy = 0.0;
+  // Loop over ordered pairs, such that every pair is counted twice.
+  for (size_t ipoint0 = 0; ipoint0 < npoint; ++ipoint0) {
+    for (size_t ipoint1 = 0; ipoint1 < npoint; ++ipoint1) {
+      double delta_wrapped[3];
+      vec3::delta(carts + 3*ipoint0, carts + 3*ipoint1, delta_wrapped);
+      cell.iwrap_mic(delta_wrapped);
+      int coeffs[3];
+      for (coeffs[0] = ranges_begin[0]; coeffs[0] <= ranges_end[0]; ++coeffs[0]) {
+        for (coeffs[1] = ranges_begin[1]; coeffs[1] <= ranges_end[1]; ++coeffs[1]) {
+          for (coeffs[2] = ranges_begin[2]; coeffs[2] <= ranges_end[2]; ++coeffs[2]) {
+            double delta[3];
+            std::copy(delta_wrapped, delta_wrapped + 3, delta);
+            cell.iadd_vec(delta, coeffs);
+            double distance = vec3::norm(delta);
+            if ((distance > cutoff) || (distance == 0.0)) continue;
+            double dvdr;
+            energy += 0.5*potential(ipoint0, ipoint1, distance*distance, &dvdr);
+            for (int irow = 0; irow < 3; ++irow) {
+              forces[3*ipoint1 + irow] -= dvdr*delta[irow]/distance;
+              for (int icol = 0; icol < 3; ++icol)
+                virial[3*irow + icol] -= 0.5*dvdr*delta[irow]*delta[icol]/distance;
+            }
+          }
+        }
+      }
+    }
+  }
+  return energy;
+}
+
+
+TEST(PairTest, exceptions) {
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell cell(vecs, 3);
+  int types[3]{0, 0, 0};
+  LennardJones potential(types, 1.0);
+  EXPECT_THROW(cl::pair_potential(cell, vecs, 3, 0.0, potential, nullptr, nullptr, 1),
+               std::domain_error);
+  EXPECT_EQ(0.0, cl::pair_potential(cell, nullptr, 0, 1.0, potential, nullptr, nullptr,
+                                    1));
+}
+
+
+TEST(PairTest, random_lennard_jones) {
+  for (int irep = 0; irep < NREP/2; ++irep) {
+    const int nvec = irep % 4;
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, nvec, 5.0, 0.5));
+    const size_t npoint = 40;
+    std::vector<double> carts(3*npoint);
+    std::vector<int> types(npoint);
+    unsigned int seed = fill_random_double(irep + 2377, carts.data(),
+                                           static_cast<int>(3*npoint), -5.0, 5.0);
+    fill_random_int(seed, types.data(), static_cast<int>(npoint), 0, 1);
+    const double cutoff = 2.5 + 0.02*irep;
+    LennardJones potential(types.data(), cutoff);
+
+    std::vector<double> forces_brute(3*npoint);
+    double virial_brute[9];
+    double energy_brute = pair_potential_brute(*cell, carts.data(), npoint, cutoff,
+        potential, forces_brute.data(), virial_brute);
+    for (size_t nthread = 1; nthread < 5; nthread += 3) {
+      std::vector<double> forces(3*npoint);
+      double virial[9];
+      double energy = cl::pair_potential(*cell, carts.data(), npoint, cutoff, potential,
+          forces.data(), virial, nthread);
+      // Random points may get very close, giving huge LJ terms.
+      const double eps = 1e-10*std::max(1.0, fabs(energy_brute));
+      EXPECT_NEAR(energy_brute, energy, eps);
+      for (size_t i = 0; i < 3*npoint; ++i)
+        EXPECT_NEAR(forces_brute[i], forces[i], 1e-10*std::max(1.0, fabs(forces[i])));
+      for (int i = 0; i < 9; ++i)
+        EXPECT_NEAR(virial_brute[i], virial[i], 1e-10*std::max(1.0, fabs(virial[i])));
+    }
+  }
+}
+
+
+TEST(PairTest, finite_differences) {
+  std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(7, 3, 5.0, 0.5));
+  const size_t npoint = 10;
+  std::vector<double> carts(3*npoint);
+  std::vector<int> types(npoint, 0);
+  fill_random_double(8627, carts.data(), static_cast<int>(3*npoint), -5.0, 5.0);
+  // A soft potential, such that random points do not give huge forces.
+  auto potential = [](size_t, size_t, double distance_sq, double* dvdr) {
+    const double distance = sqrt(distance_sq);
+    *dvdr = -2.0*distance*exp(-distance_sq);
+    return exp(-distance_sq);
+  };
+  const double cutoff = 6.0;
+  std::vector<double> forces(3*npoint);
+  cl::pair_potential(*cell, carts.data(), npoint, cutoff, potential, forces.data(),
+                     nullptr, 2);
+  const double eps = 1e-5;
+  for (size_t i = 0; i < 3*npoint; ++i) {
+    std::vector<double> carts_plus(carts);
+    carts_plus[i] += eps;
+    std::vector<double> carts_min(carts);
+    carts_min[i] -= eps;
+    double energy_plus = cl::pair_potential(*cell, carts_plus.data(), npoint, cutoff,
+        potential, nullptr, nullptr, 2);
+    double energy_min = cl::pair_potential(*cell, carts_min.data(), npoint, cutoff,
+        potential, nullptr, nullptr, 2);
+    EXPECT_NEAR(-(energy_plus - energy_min)/(2*eps), forces[i], 1e-6);
+  }
+}
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -0,0 +1,196 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <cellcutoff/cell.h>
+#include <cellcutoff/decomposition.h>
+#include <cellcutoff/parallel.h>
+#include <cellcutoff/rdf.h>
+#include <cellcutoff/vec3.h>
+
+#include "common.h"
+
+
+namespace cl = cellcutoff;
+namespace vec3 = cellcutoff::vec3;
+
+
+TEST(ParallelTest, parallel_for) {
+  for (size_t nthread = 1; nthread < 6; ++nthread) {
+    std::vector<int> visits(100, 0);
+    std::vector<size_t> threads(100, 0);
+    cl::parallel_for(visits.size(), nthread, [&visits, &threads](size_t ithread, size_t iitem) {
+      ++visits[iitem];
+      threads[iitem] = ithread;
+    });
+    for (size_t iitem = 0; iitem < visits.size(); ++iitem) {
+      EXPECT_EQ(1, visits[iitem]);
+      EXPECT_EQ(iitem % nthread, threads[iitem]);
+    }
+  }
+  EXPECT_THROW(cl::parallel_for(10, 3, [](size_t, size_t iitem) {
+    if (iitem == 5) throw std::domain_error("foo");
+  }), std::domain_error);
+  EXPECT_LE(1, cl::get_nthread(0));
+}
+
+
+TEST(RadialDistributionTest, exceptions) {
+  EXPECT_THROW(cl::RadialDistribution(0.0, 10), std::domain_error);
+  EXPECT_THROW(cl::RadialDistribution(1.0, 0), std::domain_error);
+  EXPECT_THROW(cl::RadialDistribution(1.0, 10, 0), std::domain_error);
+  cl::RadialDistribution rdf(1.0, 10, 2);
+  EXPECT_THROW(rdf.counts(2, 0), std::domain_error);
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell(vecs, 3);
+  int shape[3]{1, 0, 1};
+  std::vector<cl::Point> points;
+  cl::CellMap cell_map;
+  EXPECT_THROW(rdf.add_frame(subcell, nullptr, points.data(), 0, sizeof(cl::Point),
+               cell_map, nullptr, 1), std::domain_error);
+  EXPECT_THROW(rdf.add_frame(subcell, shape, points.data(), 0, sizeof(cl::Point),
+               cell_map, nullptr, 1), std::domain_error);
+  double cart[3]{0.5, 0.5, 0.5};
+  points.emplace_back(cart);
+  shape[1] = 1;
+  int types[1]{2};
+  EXPECT_THROW(rdf.add_frame(subcell, shape, points.data(), 1, sizeof(cl::Point),
+               cell_map, types, 1), std::domain_error);
+}
+
+
+TEST(RadialDistributionTest, random_brute) {
+  for (int irep = 0; irep < NREP/20; ++irep) {
+    // Random periodic system with two types
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, 3, 4.0, 0.5));
+    int shape[3];
+    std::unique_ptr<cl::Cell> subcell(cell->create_subcell(1.0, shape));
+    std::vector<cl::Point> points;
+    for (int ipoint = 0; ipoint < 50; ++ipoint) {
+      double cart[3];
+      fill_random_double(irep*NPOINT + ipoint, cart, 3, -5.0, 5.0);
+      points.push_back(cl::Point(cart));
+    }
+    cl::assign_icell(*subcell, shape, points.data(), points.size(), sizeof(cl::Point));
+    cl::sort_by_icell(points.data(), points.size(), sizeof(cl::Point));
+    std::unique_ptr<cl::CellMap> cell_map(
+        cl::create_cell_map(points.data(), points.size(), sizeof(cl::Point)));
+    std::vector<int> types(points.size());
+    for (size_t ipoint = 0; ipoint < points.size(); ++ipoint)
+      types[ipoint] = static_cast<int>(ipoint % 3 == 0);
+
+    // Histograms with one and with several threads
+    const double rmax = 3.0;
+    const size_t nbin = 30;
+    cl::RadialDistribution rdf1(rmax, nbin, 2);
+    rdf1.add_frame(*subcell, shape, points.data(), points.size(), sizeof(cl::Point),
+                   *cell_map, types.data(), 1);
+    cl::RadialDistribution rdf4(rmax, nbin, 2);
+    rdf4.add_frame(*subcell, shape, points.data(), points.size(), sizeof(cl::Point),
+                   *cell_map, types.data(), 4);
+    EXPECT_EQ(1, rdf4.nframe());
+
+    // Brute force, over a sufficiently large range of periodic images
+    std::vector<uint64_t> counts_brute(4*nbin, 0);
+    int ranges_begin[3];
+    int ranges_end[3];
+    double origin[3]{0.0, 0.0, 0.0};
+    cell->ranges_cutoff(origin, rmax, ranges_begin, ranges_end);
+    for (int ivec = 0; ivec < 3; ++ivec) {
+      // Points are wrapped in the cell, so their relative fractional coordinates are
+      // within ]-1, 1[.
+      --ranges_begin[ivec];
+      ++ranges_end[ivec];
+    }
+    for (size_t ipoint0 = 0; ipoint0 < points.size(); ++ipoint0) {
+      for (size_t ipoint1 = 0; ipoint1 < points.size(); ++ipoint1) {
+        int coeffs[3];
+        for (coeffs[0] = ranges_begin[0]; coeffs[0] <= ranges_end[0]; ++coeffs[0]) {
+          for (coeffs[1] = ranges_begin[1]; coeffs[1] <= ranges_end[1]; ++coeffs[1]) {
+            for (coeffs[2] = ranges_begin[2]; coeffs[2] <= ranges_end[2]; ++coeffs[2]) {
+              double delta[3];
+              vec3::delta(points[ipoint0].cart_, points[ipoint1].cart_, delta);
+              cell->iadd_vec(delta, coeffs);
+              double distance = vec3::norm(delta);
+              bool self = (ipoint0 == ipoint1) && (coeffs[0] == 0) && (coeffs[1] == 0) &&
+                          (coeffs[2] == 0);
+              if (self || (distance >= rmax)) continue;
+              size_t ibin = static_cast<size_t>(distance/rmax*nbin);
+              ++counts_brute[(types[ipoint0]*2 + types[ipoint1])*nbin + ibin];
+            }
+          }
+        }
+      }
+    }
+
+    // Compare
+    uint64_t npair = 0;
+    for (int type0 = 0; type0 < 2; ++type0) {
+      for (int type1 = 0; type1 < 2; ++type1) {
+        for (size_t ibin = 0; ibin < nbin; ++ibin) {
+          uint64_t count_brute = counts_brute[(type0*2 + type1)*nbin + ibin];
+          EXPECT_EQ(count_brute, rdf1.counts(type0, type1)[ibin]);
+          EXPECT_EQ(count_brute, rdf4.counts(type0, type1)[ibin]);
+          npair += count_brute;
+        }
+      }
+    }
+    EXPECT_LT(1000, npair);
+  }
+}
+
+
+TEST(RadialDistributionTest, ideal_gas) {
+  // Uniform random points should have an RDF close to one.
+  double vecs[9]{5.0, 0.0, 0.0, 1.0, 5.0, 0.0, 0.0, -1.0, 5.0};
+  cl::Cell cell(vecs, 3);
+  int shape[3];
+  std::unique_ptr<cl::Cell> subcell(cell.create_subcell(1.0, shape));
+  const size_t nbin = 10;
+  cl::RadialDistribution rdf(2.0, nbin);
+  for (int iframe = 0; iframe < 5; ++iframe) {
+    // A single call to fill_random_double, to avoid correlations between the points.
+    std::vector<double> carts(3*NPOINT);
+    fill_random_double(iframe, carts.data(), 3*NPOINT, -10.0, 10.0);
+    std::vector<cl::PointF> points;
+    for (int ipoint = 0; ipoint < NPOINT; ++ipoint)
+      points.push_back(cl::PointF(&carts[3*ipoint]));
+    cl::assign_icell<cl::PointF>(*subcell, shape, points.data(), points.size(),
+        sizeof(cl::PointF));
+    cl::sort_by_icell<cl::PointF>(points.data(), points.size(), sizeof(cl::PointF));
+    std::unique_ptr<cl::CellMap> cell_map(cl::create_cell_map<cl::PointF>(
+        points.data(), points.size(), sizeof(cl::PointF)));
+    rdf.add_frame<cl::PointF>(*subcell, shape, points.data(), points.size(),
+        sizeof(cl::PointF), *cell_map, nullptr, 0);
+  }
+  EXPECT_EQ(5, rdf.nframe());
+  std::vector<double> values(nbin);
+  rdf.compute_rdf(0, 0, values.data());
+  for (size_t ibin = 2; ibin < nbin; ++ibin)
+    EXPECT_NEAR(1.0, values[ibin], 0.1);
+}
+
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -19,11 +19,13 @@
 // --
 
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <memory>
 #include <stdexcept>
 #include <utility>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -94,6 +96,8 @@ TEST_F(SphereSliceTest, domain) {
   EXPECT_THROW(cl::SphereSlice(my_center, easy_normals, -1.0), std::domain_error);
   const double degenerate_normals[9] = {1.0, 1.0, 0.0, 0.0, 1.0, 0.0, 1.0, 0.0, 0.0};
   EXPECT_THROW(cl::SphereSlice(my_center, degenerate_normals, 5.0), std::domain_error);
+  EXPECT_THROW(cl::SphereSliceGeometry(easy_normals, 0.0), std::domain_error);
+  EXPECT_THROW(cl::SphereSliceGeometry(degenerate_normals, 5.0), std::domain_error);
   cl::SphereSlice slice(my_center, easy_normals, 5.0);
   double begin, end;
   EXPECT_THROW(slice.solve_range(-1, &begin, &end), std::domain_error);
@@ -118,6 +122,10 @@ TEST_F(SphereSliceTest, domain) {
   EXPECT_THROW(slice.compute_plane_intersection(3, 0, 0.0, 0.0, nullptr), std::domain_error);
   EXPECT_THROW(slice.compute_plane_intersection(0, -1, 0.0, 0.0, nullptr), std::domain_error);
   EXPECT_THROW(slice.compute_plane_intersection(0, 3, 0.0, 0.0, nullptr), std::domain_error);
+  const double cuts[2]{0.0, 1.0};
+  EXPECT_THROW(slice.solve_range_batch(0, 1, cuts, &begin, &end), std::domain_error);
+  EXPECT_THROW(slice.solve_range_batch(3, 1, cuts, &begin, &end), std::domain_error);
+  EXPECT_THROW(slice.solve_range_batch(1, -1, cuts, &begin, &end), std::domain_error);
 }
 
 
@@ -913,6 +921,126 @@ TEST_F(SphereSliceTest, solve_range_2_random) {
 }
 
 
+TEST_F(SphereSliceTest, solve_range_batch_example) {
+  cl::SphereSlice slice(my_center, easy_normals, 5.0);
+  const double cuts[4]{-3.6, -2.6, 3.4, 4.4};
+  double begins[3];
+  double ends[3];
+  slice.solve_range_batch(1, 3, cuts, begins, ends);
+  EXPECT_DOUBLE_EQ(-6.0, begins[0]);
+  EXPECT_DOUBLE_EQ(2.0, ends[0]);
+  EXPECT_DOUBLE_EQ(-7.0, begins[1]);
+  EXPECT_DOUBLE_EQ(3.0, ends[1]);
+  EXPECT_DOUBLE_EQ(-6.0, begins[2]);
+  EXPECT_DOUBLE_EQ(2.0, ends[2]);
+}
+
+
+TEST_F(SphereSliceTest, solve_range_batch_nofound) {
+  cl::SphereSlice slice(my_center, easy_normals, 5.0);
+  const double cuts[3]{-10.0, -9.0, 0.0};
+  double begins[2];
+  double ends[2];
+  EXPECT_THROW(slice.solve_range_batch(1, 2, cuts, begins, ends), cl::no_solution_found);
+}
+
+
+TEST_F(SphereSliceTest, solve_range_batch_random) {
+  int num_compared = 0;
+  for (int irep=0; irep < NREP; ++irep) {
+    double radius = (irep + 1)*0.1;
+    double center[3];
+    double normals[9];
+    std::unique_ptr<cl::SphereSlice> slice(create_random_problem(irep, radius, center, normals));
+    const int ncut = 1 + irep%2;
+    const int id_cut = ncut - 1;
+    if (ncut == 2) {
+      double cut0_begin, cut0_end, cut0_min, cut0_max;
+      random_slice(irep*3 + 1, *slice, 0, &cut0_begin, &cut0_end, &cut0_min, &cut0_max);
+      slice->set_cut_begin_end(0, cut0_begin, cut0_end);
+    }
+
+    // Random slices, compared to solve_range for each slice.
+    double cut_min, cut_max;
+    slice->solve_full_low(id_cut, &cut_min, &cut_max, nullptr, nullptr);
+    const int nslice = 40 + irep%30;
+    std::vector<double> cuts(nslice + 1);
+    fill_random_double(irep*3 + 2, cuts.data(), nslice + 1, cut_min, cut_max);
+    std::sort(cuts.begin(), cuts.end());
+    std::vector<double> begins(nslice);
+    std::vector<double> ends(nslice);
+    bool batch_found = true;
+    try {
+      slice->solve_range_batch(ncut, nslice, cuts.data(), begins.data(), ends.data());
+    } catch (const cl::no_solution_found&) {
+      batch_found = false;
+    }
+    bool all_found = true;
+    for (int islice = 0; islice < nslice; ++islice) {
+      double begin, end;
+      slice->set_cut_begin_end(id_cut, cuts[islice], cuts[islice + 1]);
+      try {
+        slice->solve_range(ncut, &begin, &end);
+      } catch (const cl::no_solution_found&) {
+        all_found = false;
+        continue;
+      }
+      if (batch_found) {
+        EXPECT_NEAR(begin, begins[islice], EPS);
+        EXPECT_NEAR(end, ends[islice], EPS);
+        ++num_compared;
+      }
+    }
+    EXPECT_EQ(all_found, batch_found);
+  }
+  // Sufficiency check
+  EXPECT_LT(NREP*10, num_compared);
+}
+
+
+TEST_F(SphereSliceTest, recenter_random) {
+  for (int irep=0; irep < NREP; ++irep) {
+    // One geometry for a series of centers
+    double radius = (irep + 1)*0.1;
+    double normals[9];
+    double center[3];
+    std::unique_ptr<cl::SphereSlice> slice(create_random_problem(irep, radius, center, normals));
+    cl::SphereSliceGeometry geometry(normals, radius);
+    EXPECT_EQ(radius, geometry.radius());
+    cl::SphereSlice shared_slice(geometry, center);
+    for (int icenter = 0; icenter < 5; ++icenter) {
+      double other_center[3];
+      fill_random_double(irep*5 + icenter + 1000, other_center, 3);
+      cl::SphereSlice fresh_slice(other_center, normals, radius);
+      shared_slice.recenter(other_center);
+      // Compare the solutions with those of a fresh SphereSlice.
+      double cut0_begin, cut0_end, cut0_min, cut0_max;
+      random_slice(irep*3 + 1, fresh_slice, 0, &cut0_begin, &cut0_end, &cut0_min, &cut0_max);
+      double cut1_begin, cut1_end, cut1_min, cut1_max;
+      random_slice(irep*3 + 2, fresh_slice, 1, &cut1_begin, &cut1_end, &cut1_min, &cut1_max);
+      for (cl::SphereSlice* s : {&fresh_slice, &shared_slice}) {
+        s->set_cut_begin_end(0, cut0_begin, cut0_end);
+        s->set_cut_begin_end(1, cut1_begin, cut1_end);
+      }
+      for (int ncut = 0; ncut < 3; ++ncut) {
+        double begin_fresh = NAN, end_fresh = NAN;
+        double begin_shared = NAN, end_shared = NAN;
+        try {
+          fresh_slice.solve_range(ncut, &begin_fresh, &end_fresh);
+        } catch (const cl::no_solution_found&) {
+          EXPECT_THROW(shared_slice.solve_range(ncut, &begin_shared, &end_shared),
+                       cl::no_solution_found);
+          continue;
+        }
+        shared_slice.solve_range(ncut, &begin_shared, &end_shared);
+        EXPECT_EQ(begin_fresh, begin_shared);
+        EXPECT_EQ(end_fresh, end_shared);
+      }
+    }
+  }
+}
+
+
 TEST(ComputeBeginEndTest, example1) {
   // Test parameters
   const double center[3] = {1.0, 0.5, -2.0};
@@ -941,4 +1069,53 @@ TEST(ComputeBeginEndTest, example1) {
   EXPECT_DOUBLE_EQ(end, end_bis);
 }
 
+
+TEST(MetricToSphereTest, identity) {
+  const double metric[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  const double center[3]{0.3, -1.2, 2.5};
+  const double normals[9]{1.0, 0.2, 0.0, -0.5, 2.0, 0.1, 0.3, 0.3, 1.5};
+  double sphere_center[3];
+  double sphere_normals[9];
+  cl::metric_to_sphere(metric, center, normals, sphere_center, sphere_normals);
+  for (int i = 0; i < 3; ++i) EXPECT_EQ(center[i], sphere_center[i]);
+  for (int i = 0; i < 9; ++i) EXPECT_EQ(normals[i], sphere_normals[i]);
+}
+
+
+TEST(MetricToSphereTest, domain) {
+  const double normals[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  const double metric1[9]{1.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0};
+  const double metric2[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 2.0, 0.0, 1.0};
+  const double metric3[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, NAN};
+  double sphere_normals[9];
+  for (const double* metric : {metric1, metric2, metric3}) {
+    EXPECT_THROW(cl::metric_to_sphere(metric, nullptr, normals, nullptr, sphere_normals),
+                 std::domain_error);
+  }
+}
+
+
+TEST(MetricToSphereTest, random) {
+  for (int irep = 0; irep < NREP; ++irep) {
+    double metric[9];
+    fill_random_metric(irep + 1, metric);
+    double normals[9];
+    fill_random_double(irep + 3, normals, 9, -2.0, 2.0);
+    double point[3];
+    fill_random_double(irep + 5, point, 3, -2.0, 2.0);
+    double sphere_point[3];
+    double sphere_normals[9];
+    cl::metric_to_sphere(metric, point, normals, sphere_point, sphere_normals);
+    // The transformed point has the same projections on the transformed normals.
+    for (int inormal = 0; inormal < 3; ++inormal) {
+      EXPECT_NEAR(vec3::dot(normals + 3*inormal, point),
+                  vec3::dot(sphere_normals + 3*inormal, sphere_point), EPS);
+    }
+    // The metric distance becomes a Euclidean distance.
+    double metric_point[3];
+    vec3::matvec(metric, point, metric_point);
+    EXPECT_NEAR(vec3::dot(point, metric_point), vec3::normsq(sphere_point), EPS);
+  }
+}
+
 // vim: textwidth=90 et ts=2 sw=2
@@ -0,0 +1,121 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <cellcutoff/cell.h>
+#include <cellcutoff/stencil.h>
+#include <cellcutoff/vec3.h>
+
+#include "common.h"
+
+
+namespace cl = cellcutoff;
+namespace vec3 = cellcutoff::vec3;
+
+
+TEST(StencilTest, exceptions) {
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell cell(vecs, 2);
+  int delta_icell[3]{0, 0, 0};
+  EXPECT_THROW(cl::subcell_distance(cell, delta_icell), std::domain_error);
+  EXPECT_THROW(cl::create_stencil(cell, 1.0, false), std::domain_error);
+}
+
+
+TEST(StencilTest, example_cubic) {
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell(vecs, 3);
+  int delta_icell0[3]{1, -1, 1};
+  EXPECT_DOUBLE_EQ(0.0, cl::subcell_distance(subcell, delta_icell0));
+  int delta_icell1[3]{2, 0, -1};
+  EXPECT_DOUBLE_EQ(1.0, cl::subcell_distance(subcell, delta_icell1));
+  int delta_icell2[3]{-2, 3, 0};
+  EXPECT_DOUBLE_EQ(sqrt(5.0), cl::subcell_distance(subcell, delta_icell2));
+  // 27 touching subcells, 6*9 at distance 1 and 12*3 at distance sqrt(2).
+  EXPECT_EQ(117, cl::create_stencil(subcell, 1.5, false).size());
+  EXPECT_EQ(59, cl::create_stencil(subcell, 1.5, true).size());
+  EXPECT_EQ(27, cl::create_stencil(subcell, 0.5, false).size());
+}
+
+
+TEST(StencilTest, random_half_full) {
+  for (int irep = 0; irep < NREP; ++irep) {
+    std::unique_ptr<cl::Cell> subcell(create_random_cell_nvec(irep, 3, 1.0, 0.5));
+    const double cutoff = 0.5 + 0.05*irep;
+    std::vector<std::array<int, 3>> full(cl::create_stencil(*subcell, cutoff, false));
+    std::vector<std::array<int, 3>> half(cl::create_stencil(*subcell, cutoff, true));
+    EXPECT_TRUE(std::is_sorted(full.begin(), full.end()));
+    EXPECT_TRUE(std::is_sorted(half.begin(), half.end()));
+    // The half stencil and its mirror image, without duplicate zero, is the full one.
+    std::vector<std::array<int, 3>> mirror(half);
+    for (const auto& delta_icell : half) {
+      if (delta_icell == std::array<int, 3>{0, 0, 0}) continue;
+      mirror.push_back(std::array<int, 3>{-delta_icell[0], -delta_icell[1],
+                                          -delta_icell[2]});
+    }
+    std::sort(mirror.begin(), mirror.end());
+    EXPECT_EQ(full, mirror);
+  }
+}
+
+
+TEST(StencilTest, random_distance) {
+  for (int irep = 0; irep < NREP; ++irep) {
+    std::unique_ptr<cl::Cell> subcell(create_random_cell_nvec(irep, 3, 1.0, 0.3));
+    int delta_icell[3];
+    fill_random_int(irep + 3571, delta_icell, 3, -3, 3);
+    const double distance = cl::subcell_distance(*subcell, delta_icell);
+    // Compare with a grid search over the relative fractional coordinates, which are
+    // in the box [delta_icell - 1, delta_icell + 1].
+    const int ngrid = 40;
+    double distance_grid = std::numeric_limits<double>::infinity();
+    int igrid[3];
+    for (igrid[0] = 0; igrid[0] <= ngrid; ++igrid[0]) {
+      for (igrid[1] = 0; igrid[1] <= ngrid; ++igrid[1]) {
+        for (igrid[2] = 0; igrid[2] <= ngrid; ++igrid[2]) {
+          double frac[3];
+          for (int ivec = 0; ivec < 3; ++ivec)
+            frac[ivec] = delta_icell[ivec] - 1.0 + (2.0*igrid[ivec])/ngrid;
+          double delta[3];
+          subcell->to_cart(frac, delta);
+          distance_grid = std::min(distance_grid, vec3::norm(delta));
+        }
+      }
+    }
+    EXPECT_LE(distance, distance_grid + 1e-10);
+    // The grid point nearest to the minimizer is at most half a grid step away along
+    // each cell vector.
+    double error = 0.0;
+    for (int ivec = 0; ivec < 3; ++ivec)
+      error += vec3::norm(subcell->vec(ivec))/ngrid;
+    EXPECT_GE(distance + error, distance_grid);
+  }
+}
+
+// vim: textwidth=90 et ts=2 sw=2
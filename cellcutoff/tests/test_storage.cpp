@@ -0,0 +1,330 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <cellcutoff/decomposition.h>
+#include <cellcutoff/iterators.h>
+#include <cellcutoff/storage.h>
+
+#include "common.h"
+
+
+namespace cl = cellcutoff;
+
+
+TEST(StorageTest, exceptions) {
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell(vecs, 3);
+  cl::Cell subcell2(vecs, 2);
+  std::string filename = create_temporary_file();
+  // Wrong arguments
+  EXPECT_THROW(cl::save_decomposition(filename, subcell, nullptr, nullptr, 0, 4),
+               std::domain_error);
+  EXPECT_THROW(cl::save_decomposition(filename, subcell2, nullptr, nullptr, 0,
+               sizeof(cl::Point)), std::domain_error);
+  // Points not sorted
+  double cart0[3]{2.5, 0.0, 0.0};
+  double cart1[3]{0.5, 0.0, 0.0};
+  std::vector<cl::Point> points{cl::Point(cart0), cl::Point(cart1)};
+  cl::assign_icell(subcell, points.data(), points.size(), sizeof(cl::Point));
+  EXPECT_THROW(cl::save_decomposition(filename, subcell, nullptr, points.data(),
+               points.size(), sizeof(cl::Point)), cl::points_not_grouped);
+  // Not a decomposition file
+  EXPECT_THROW(cl::MappedDecomposition md(filename), cl::io_error);
+  FILE* f = fopen(filename.c_str(), "wb");
+  std::vector<char> garbage(1000, 'x');
+  fwrite(garbage.data(), 1, garbage.size(), f);
+  fclose(f);
+  EXPECT_THROW(cl::MappedDecomposition md(filename), cl::io_error);
+  // Truncated file
+  std::sort(points.begin(), points.end());
+  cl::save_decomposition(filename, subcell, nullptr, points.data(), points.size(),
+                         sizeof(cl::Point));
+  EXPECT_EQ(0, truncate(filename.c_str(), 100));
+  EXPECT_THROW(cl::MappedDecomposition md(filename), cl::io_error);
+  // Box of icells that does not match the offset table
+  for (int32_t extent : {0, -1, 7}) {
+    cl::save_decomposition(filename, subcell, nullptr, points.data(), points.size(),
+                           sizeof(cl::Point));
+    f = fopen(filename.c_str(), "r+b");
+    fseek(f, offsetof(cl::DecompositionHeader, icell_shape), SEEK_SET);
+    fwrite(&extent, sizeof(int32_t), 1, f);
+    fclose(f);
+    EXPECT_THROW(cl::MappedDecomposition md(filename), cl::io_error);
+  }
+  // Number of cells that overflows the size computations
+  cl::save_decomposition(filename, subcell, nullptr, points.data(), points.size(),
+                         sizeof(cl::Point));
+  f = fopen(filename.c_str(), "r+b");
+  uint64_t huge = ~static_cast<uint64_t>(0)/sizeof(uint64_t);
+  fseek(f, offsetof(cl::DecompositionHeader, ncell), SEEK_SET);
+  fwrite(&huge, sizeof(uint64_t), 1, f);
+  fclose(f);
+  EXPECT_THROW(cl::MappedDecomposition md(filename), cl::io_error);
+  remove(filename.c_str());
+}
+
+
+TEST(StorageTest, empty) {
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell(vecs, 3);
+  std::string filename = create_temporary_file();
+  cl::save_decomposition(filename, subcell, nullptr, nullptr, 0, sizeof(cl::Point));
+  cl::MappedDecomposition md(filename);
+  EXPECT_EQ(0, md.npoint());
+  EXPECT_EQ(0, md.cell_map().size());
+  EXPECT_EQ(nullptr, md.shape());
+  remove(filename.c_str());
+}
+
+
+TEST(StorageTest, random_round_trip) {
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    // Random points and a random cell, half of the cases without periodic wrapping.
+    const bool periodic = (irep % 2 == 0);
+    std::vector<cl::Point> points;
+    for (int ipoint = 0; ipoint < NPOINT; ++ipoint) {
+      double cart[3];
+      fill_random_double(ipoint + irep*NPOINT, cart, 3, -5.0, 5.0);
+      points.push_back(cl::Point(cart));
+    }
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, 3, 10.0, 0.5));
+    int shape[3];
+    std::unique_ptr<cl::Cell> subcell(cell->create_subcell(1.0 + 0.1*irep, shape));
+    const int* shape_ptr = periodic ? shape : nullptr;
+    if (periodic) {
+      cl::assign_icell(*subcell, shape, points.data(), points.size(), sizeof(cl::Point));
+    } else {
+      cl::assign_icell(*subcell, points.data(), points.size(), sizeof(cl::Point));
+    }
+    cl::sort_by_icell(points.data(), points.size(), sizeof(cl::Point));
+    std::unique_ptr<cl::CellMap> cell_map(
+        cl::create_cell_map(points.data(), points.size(), sizeof(cl::Point)));
+
+    // Save and load
+    std::string filename = create_temporary_file();
+    cl::save_decomposition(filename, *subcell, shape_ptr, points.data(), points.size(),
+                           sizeof(cl::Point));
+    cl::MappedDecomposition md(filename);
+
+    // Compare
+    EXPECT_EQ(0, memcmp(subcell->vecs(), md.subcell().vecs(), 9*sizeof(double)));
+    EXPECT_EQ(0, memcmp(subcell->gvecs(), md.subcell().gvecs(), 9*sizeof(double)));
+    if (periodic) {
+      ASSERT_NE(nullptr, md.shape());
+      EXPECT_EQ(shape[0], md.shape()[0]);
+      EXPECT_EQ(shape[1], md.shape()[1]);
+      EXPECT_EQ(shape[2], md.shape()[2]);
+    } else {
+      EXPECT_EQ(nullptr, md.shape());
+    }
+    EXPECT_EQ(points.size(), md.npoint());
+    EXPECT_EQ(sizeof(cl::Point), md.point_size());
+    EXPECT_EQ(0, reinterpret_cast<size_t>(md.points()) % alignof(cl::Point));
+    EXPECT_EQ(0, memcmp(points.data(), md.points(), points.size()*sizeof(cl::Point)));
+    EXPECT_EQ(*cell_map, md.cell_map());
+
+    // The loaded decomposition is ready for queries.
+    double center[3]{0.3, -0.2, 0.1};
+    double cutoff = 3.0;
+    std::vector<size_t> ipoints_ref;
+    for (cl::DeltaIterator dit(*subcell, shape_ptr, center, cutoff, points.data(),
+         points.size(), sizeof(cl::Point), *cell_map); dit.busy(); ++dit)
+      ipoints_ref.push_back(dit.ipoint());
+    std::vector<size_t> ipoints;
+    for (cl::DeltaIterator dit(md.subcell(), md.shape(), center, cutoff, md.points(),
+         md.npoint(), md.point_size(), md.cell_map()); dit.busy(); ++dit)
+      ipoints.push_back(dit.ipoint());
+    EXPECT_EQ(ipoints_ref, ipoints);
+    EXPECT_LT(0, ipoints.size());
+    remove(filename.c_str());
+  }
+}
+
+
+
+TEST(StorageTest, random_streaming) {
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    // Write random points to a file
+    const bool periodic = (irep % 2 == 0);
+    std::vector<cl::Point> points;
+    for (int ipoint = 0; ipoint < NPOINT; ++ipoint) {
+      double cart[3];
+      fill_random_double(ipoint + irep*NPOINT, cart, 3, -5.0, 5.0);
+      points.push_back(cl::Point(cart));
+    }
+    std::string fn_input = create_temporary_file();
+    FILE* f = fopen(fn_input.c_str(), "wb");
+    fwrite(points.data(), sizeof(cl::Point), points.size(), f);
+    fclose(f);
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, 3, 10.0, 0.5));
+    int shape[3];
+    std::unique_ptr<cl::Cell> subcell(cell->create_subcell(1.0 + irep, shape));
+    const int* shape_ptr = periodic ? shape : nullptr;
+
+    // Streaming save with a small memory budget
+    std::string fn_streamed = create_temporary_file();
+    cl::FilePointSource source(fn_input);
+    cl::save_decomposition_streaming(fn_streamed, *subcell, shape_ptr, &source,
+                                     sizeof(cl::Point), 50*sizeof(cl::Point));
+
+    // In-memory reference, with a stable sort to get the same order within cells.
+    if (periodic) {
+      cl::assign_icell(*subcell, shape, points.data(), points.size(), sizeof(cl::Point));
+    } else {
+      cl::assign_icell(*subcell, points.data(), points.size(), sizeof(cl::Point));
+    }
+    std::stable_sort(points.begin(), points.end());
+    std::string fn_ref = create_temporary_file();
+    cl::save_decomposition(fn_ref, *subcell, shape_ptr, points.data(), points.size(),
+                           sizeof(cl::Point));
+
+    // Both files must be identical and loadable.
+    cl::MappedFile mapped_streamed(fn_streamed);
+    cl::MappedFile mapped_ref(fn_ref);
+    ASSERT_EQ(mapped_ref.size(), mapped_streamed.size());
+    EXPECT_EQ(0, memcmp(mapped_ref.data(), mapped_streamed.data(), mapped_ref.size()));
+    cl::MappedDecomposition md(fn_streamed);
+    EXPECT_EQ(points.size(), md.npoint());
+    EXPECT_LT(0, md.cell_map().size());
+    remove(fn_input.c_str());
+    remove(fn_streamed.c_str());
+    remove(fn_ref.c_str());
+  }
+}
+
+
+TEST(StorageTest, point_type) {
+  // Random single precision points in a file
+  std::vector<double> carts(3*NPOINT);
+  fill_random_double(8841, carts.data(), carts.size(), -5.0, 5.0);
+  std::vector<cl::PointF> points;
+  for (int ipoint = 0; ipoint < NPOINT; ++ipoint)
+    points.push_back(cl::PointF(carts.data() + 3*ipoint));
+  std::string fn_input = create_temporary_file();
+  FILE* f = fopen(fn_input.c_str(), "wb");
+  fwrite(points.data(), sizeof(cl::PointF), points.size(), f);
+  fclose(f);
+  double vecs[9]{1.3, 0.1, 0.0, 0.2, 1.1, 0.0, -0.1, 0.0, 0.9};
+  cl::Cell subcell(vecs, 3);
+
+  // Streaming and in-memory save give the same file.
+  std::string fn_streamed = create_temporary_file();
+  cl::FilePointSource source(fn_input);
+  cl::save_decomposition_streaming<cl::PointF>(fn_streamed, subcell, nullptr, &source,
+      sizeof(cl::PointF), 50*sizeof(cl::PointF));
+  cl::assign_icell<cl::PointF>(subcell, points.data(), points.size(),
+                               sizeof(cl::PointF));
+  std::stable_sort(points.begin(), points.end());
+  std::string fn_ref = create_temporary_file();
+  cl::save_decomposition<cl::PointF>(fn_ref, subcell, nullptr, points.data(),
+      points.size(), sizeof(cl::PointF));
+  cl::MappedFile mapped_streamed(fn_streamed);
+  cl::MappedFile mapped_ref(fn_ref);
+  ASSERT_EQ(mapped_ref.size(), mapped_streamed.size());
+  EXPECT_EQ(0, memcmp(mapped_ref.data(), mapped_streamed.data(), mapped_ref.size()));
+
+  // Only the same point type can load the file.
+  cl::MappedDecompositionF md(fn_ref);
+  EXPECT_EQ(points.size(), md.npoint());
+  EXPECT_EQ(sizeof(cl::PointF), md.point_size());
+  std::unique_ptr<cl::CellMap> cell_map(cl::create_cell_map<cl::PointF>(
+      points.data(), points.size(), sizeof(cl::PointF)));
+  EXPECT_EQ(*cell_map, md.cell_map());
+  EXPECT_THROW(cl::MappedDecomposition md_double(fn_ref), cl::io_error);
+  remove(fn_input.c_str());
+  remove(fn_streamed.c_str());
+  remove(fn_ref.c_str());
+}
+
+
+TEST(StorageTest, sparse_table) {
+  // Few points spread over a huge box of small cells
+  const size_t npoint = 100;
+  std::vector<double> carts(3*npoint);
+  fill_random_double(3317, carts.data(), carts.size(), -5.0, 5.0);
+  std::vector<cl::Point> points;
+  for (size_t ipoint = 0; ipoint < npoint; ++ipoint)
+    points.push_back(cl::Point(carts.data() + 3*ipoint));
+  std::string fn_input = create_temporary_file();
+  FILE* f = fopen(fn_input.c_str(), "wb");
+  fwrite(points.data(), sizeof(cl::Point), points.size(), f);
+  fclose(f);
+  double vecs[9]{0.01, 0.0, 0.0, 0.0, 0.01, 0.0, 0.0, 0.0, 0.01};
+  cl::Cell subcell(vecs, 3);
+
+  // Streaming and in-memory save give the same file, with one entry per cell.
+  std::string fn_streamed = create_temporary_file();
+  cl::FilePointSource source(fn_input);
+  cl::save_decomposition_streaming(fn_streamed, subcell, nullptr, &source,
+                                   sizeof(cl::Point), 20*sizeof(cl::Point));
+  cl::assign_icell(subcell, points.data(), points.size(), sizeof(cl::Point));
+  std::stable_sort(points.begin(), points.end());
+  std::string fn_ref = create_temporary_file();
+  cl::save_decomposition(fn_ref, subcell, nullptr, points.data(), points.size(),
+                         sizeof(cl::Point));
+  std::unique_ptr<cl::CellMap> cell_map(
+      cl::create_cell_map(points.data(), points.size(), sizeof(cl::Point)));
+  {
+    cl::MappedFile mapped_streamed(fn_streamed);
+    cl::MappedFile mapped_ref(fn_ref);
+    ASSERT_EQ(mapped_ref.size(), mapped_streamed.size());
+    EXPECT_EQ(0, memcmp(mapped_ref.data(), mapped_streamed.data(), mapped_ref.size()));
+    const cl::DecompositionHeader* header(
+        reinterpret_cast<const cl::DecompositionHeader*>(mapped_ref.data()));
+    EXPECT_EQ(1, header->sparse_table);
+    EXPECT_LT(1000000, header->ncell);
+    EXPECT_EQ(header->table_begin + cell_map->size()*sizeof(cl::DecompositionTableEntry),
+              mapped_ref.size());
+  }
+  cl::MappedDecomposition md(fn_ref);
+  EXPECT_EQ(npoint, md.npoint());
+  EXPECT_EQ(*cell_map, md.cell_map());
+
+  // Entries in the wrong order are detected.
+  ASSERT_LT(1, cell_map->size());
+  cl::DecompositionTableEntry entries[2];
+  f = fopen(fn_ref.c_str(), "r+b");
+  fseek(f, -static_cast<int64_t>(sizeof(entries)), SEEK_END);
+  ASSERT_EQ(2, fread(entries, sizeof(cl::DecompositionTableEntry), 2, f));
+  std::swap(entries[0].icell, entries[1].icell);
+  fseek(f, -static_cast<int64_t>(sizeof(entries)), SEEK_END);
+  fwrite(entries, sizeof(cl::DecompositionTableEntry), 2, f);
+  fclose(f);
+  EXPECT_THROW(cl::MappedDecomposition md_wrong(fn_ref), cl::io_error);
+  remove(fn_input.c_str());
+  remove(fn_streamed.c_str());
+  remove(fn_ref.c_str());
+}
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -0,0 +1,317 @@
+// CellCutoff is a library for periodic boundary conditions and real-space cutoff calculations.
+// Copyright (C) 2017 The CellCutoff Development Team
+//
+// This file is part of CellCutoff.
+//
+// CellCutoff is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 3
+// of the License, or (at your option) any later version.
+//
+// CellCutoff is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>
+//
+// --
+
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <cellcutoff/decomposition.h>
+#include <cellcutoff/iterators.h>
+#include <cellcutoff/streaming.h>
+
+#include "common.h"
+
+
+namespace cl = cellcutoff;
+
+
+//! Point source that generates random points on the fly, instead of reading a file.
+class RandomPointSource : public cl::PointSource {
+ public:
+  RandomPointSource(unsigned int seed, size_t npoint)
+      : seed_(seed), npoint_(npoint), ipoint_(0) {}
+
+  size_t read(void* points, size_t npoint, size_t point_size) {
+    char* points_char = reinterpret_cast<char*>(points);
+    size_t nread = 0;
+    while ((nread < npoint) && (ipoint_ < npoint_)) {
+      double cart[3];
+      fill_random_double(seed_ + static_cast<unsigned int>(ipoint_), cart, 3, -5.0, 5.0);
+      *reinterpret_cast<cl::Point*>(points_char + nread*point_size) = cl::Point(cart);
+      ++nread;
+      ++ipoint_;
+    }
+    return nread;
+  }
+
+  void rewind() { ipoint_ = 0; }
+
+ private:
+  unsigned int seed_;
+  size_t npoint_;
+  size_t ipoint_;
+};
+
+
+//! Runs stream_decomposition and collects the reported ranges in a cell map.
+cl::CellMap* stream_cell_map(const cl::Cell& subcell, const int* shape,
+    cl::PointSource* source, const std::string& filename, size_t memory_budget) {
+  std::unique_ptr<cl::CellMap> cell_map(new cl::CellMap);
+  size_t end_previous = 0;
+  std::array<int, 3> icell_previous{0, 0, 0};
+  cl::stream_decomposition(subcell, shape, source, sizeof(cl::Point), filename,
+      memory_budget, [&cell_map, &end_previous, &icell_previous](
+      const int* icell, size_t begin, size_t end) {
+    // Cells are reported once, in the order of sort_by_icell, without gaps.
+    std::array<int, 3> key{icell[0], icell[1], icell[2]};
+    EXPECT_EQ(end_previous, begin);
+    EXPECT_LT(begin, end);
+    if (begin > 0) EXPECT_LT(icell_previous, key);
+    EXPECT_TRUE(cell_map->emplace(key, std::array<size_t, 2>{begin, end}).second);
+    end_previous = end;
+    icell_previous = key;
+  });
+  return cell_map.release();
+}
+
+
+//! Checks that the streamed points and cell_map are equivalent to the in-memory result.
+void check_stream_result(const std::vector<cl::Point>& points_ref,
+    const cl::CellMap& cell_map_ref, const cl::Point* points, size_t npoint,
+    const cl::CellMap& cell_map) {
+  ASSERT_EQ(points_ref.size(), npoint);
+  ASSERT_EQ(cell_map_ref.size(), cell_map.size());
+  for (const auto& kv : cell_map_ref) {
+    // Same ranges for each cell
+    const auto& range = cell_map.at(kv.first);
+    EXPECT_EQ(kv.second[0], range[0]);
+    EXPECT_EQ(kv.second[1], range[1]);
+    // Same points in each range, possibly in a different order.
+    std::vector<std::array<double, 3>> carts_ref;
+    std::vector<std::array<double, 3>> carts;
+    for (size_t ipoint = range[0]; ipoint < range[1]; ++ipoint) {
+      const double* c_ref = points_ref[ipoint].cart_;
+      carts_ref.push_back(std::array<double, 3>{c_ref[0], c_ref[1], c_ref[2]});
+      const double* c = points[ipoint].cart_;
+      carts.push_back(std::array<double, 3>{c[0], c[1], c[2]});
+      EXPECT_EQ(kv.first[0], points[ipoint].icell_[0]);
+      EXPECT_EQ(kv.first[1], points[ipoint].icell_[1]);
+      EXPECT_EQ(kv.first[2], points[ipoint].icell_[2]);
+    }
+    std::sort(carts_ref.begin(), carts_ref.end());
+    std::sort(carts.begin(), carts.end());
+    EXPECT_EQ(carts_ref, carts);
+  }
+}
+
+
+TEST(StreamingTest, exceptions) {
+  EXPECT_THROW(cl::FilePointSource("/nonexisting/file"), cl::io_error);
+  EXPECT_THROW(cl::MappedFile("/nonexisting/file"), cl::io_error);
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell(vecs, 3);
+  cl::Cell subcell2(vecs, 2);
+  RandomPointSource source(1, 10);
+  cl::CellRangeCallback ignore = [](const int*, size_t, size_t) {};
+  EXPECT_THROW(cl::stream_decomposition(subcell, nullptr, &source, 4, "foo", 1000,
+               ignore), std::domain_error);
+  EXPECT_THROW(cl::stream_decomposition(subcell, nullptr, &source, sizeof(cl::Point),
+               "foo", 3*sizeof(cl::Point), ignore), std::domain_error);
+  EXPECT_THROW(cl::stream_decomposition(subcell2, nullptr, &source, sizeof(cl::Point),
+               "foo", 1000, ignore), std::domain_error);
+}
+
+
+TEST(StreamingTest, empty) {
+  double vecs[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  cl::Cell subcell(vecs, 3);
+  RandomPointSource source(1, 0);
+  std::string filename = create_temporary_file();
+  std::unique_ptr<cl::CellMap> cell_map(
+      stream_cell_map(subcell, nullptr, &source, filename, 1000));
+  EXPECT_EQ(0, cell_map->size());
+  cl::MappedFile mapped(filename);
+  EXPECT_EQ(nullptr, mapped.data());
+  EXPECT_EQ(0, mapped.size());
+  remove(filename.c_str());
+}
+
+
+TEST(StreamingTest, random_file) {
+  for (int irep = 0; irep < NREP/10; ++irep) {
+    // Write random points to a file
+    std::vector<cl::Point> points;
+    for (int ipoint = 0; ipoint < NPOINT; ++ipoint) {
+      double cart[3];
+      fill_random_double(ipoint + irep*NPOINT, cart, 3, -5.0, 5.0);
+      points.push_back(cl::Point(cart));
+    }
+    std::string fn_input = create_temporary_file();
+    FILE* f = fopen(fn_input.c_str(), "wb");
+    fwrite(points.data(), sizeof(cl::Point), points.size(), f);
+    fclose(f);
+
+    // Random cell and subcell, such that there are cells with few and many points.
+    std::unique_ptr<cl::Cell> cell(create_random_cell_nvec(irep, 3, 10.0, 0.5));
+    int shape[3];
+    std::unique_ptr<cl::Cell> subcell(cell->create_subcell(1.0 + irep, shape));
+
+    // Streaming decomposition with a small memory budget
+    std::string fn_output = create_temporary_file();
+    cl::FilePointSource source(fn_input);
+    std::unique_ptr<cl::CellMap> cell_map(
+        stream_cell_map(*subcell, shape, &source, fn_output, 50*sizeof(cl::Point)));
+    cl::MappedFile mapped(fn_output);
+    EXPECT_EQ(NPOINT*sizeof(cl::Point), mapped.size());
+    const cl::Point* points_mapped = reinterpret_cast<const cl::Point*>(mapped.data());
+
+    // In-memory reference
+    cl::assign_icell(*subcell, shape, points.data(), points.size(), sizeof(cl::Point));
+    std::sort(points.begin(), points.end());
+    std::unique_ptr<cl::CellMap> cell_map_ref(
+        cl::create_cell_map(points.data(), points.size(), sizeof(cl::Point)));
+    check_stream_result(points, *cell_map_ref, points_mapped, NPOINT, *cell_map);
+
+    // The mapped points can be used directly in a DeltaIterator
+    double center[3]{0.0, 0.0, 0.0};
+    double cutoff = 3.0;
+    std::vector<double> distances_ref;
+    for (cl::DeltaIterator dit(*subcell, shape, center, cutoff, points.data(), NPOINT,
+         sizeof(cl::Point), *cell_map_ref); dit.busy(); ++dit)
+      distances_ref.push_back(dit.distance());
+    std::vector<double> distances;
+    for (cl::DeltaIterator dit(*subcell, shape, center, cutoff, points_mapped, NPOINT,
+         sizeof(cl::Point), *cell_map); dit.busy(); ++dit)
+      distances.push_back(dit.distance());
+    std::sort(distances_ref.begin(), distances_ref.end());
+    std::sort(distances.begin(), distances.end());
+    EXPECT_EQ(distances_ref, distances);
+    EXPECT_LT(0, distances.size());
+
+    // No temporary files should be left behind
+    EXPECT_NE(0, access((fn_output + ".block0").c_str(), F_OK));
+    remove(fn_input.c_str());
+    remove(fn_output.c_str());
+  }
+}
+
+
+TEST(StreamingTest, random_callback_no_shape) {
+  const size_t npoint = NPOINT;
+  double vecs[9]{1.3, 0.1, 0.0, 0.2, 1.1, 0.0, -0.1, 0.0, 0.9};
+  cl::Cell subcell(vecs, 3);
+  RandomPointSource source(4231, npoint);
+  std::string fn_output = create_temporary_file();
+  std::unique_ptr<cl::CellMap> cell_map(
+      stream_cell_map(subcell, nullptr, &source, fn_output, 100*sizeof(cl::Point)));
+  cl::MappedFile mapped(fn_output);
+
+  // In-memory reference
+  std::vector<cl::Point> points(npoint, cl::Point(vecs));
+  source.rewind();
+  EXPECT_EQ(npoint, source.read(points.data(), npoint, sizeof(cl::Point)));
+  cl::assign_icell(subcell, points.data(), points.size(), sizeof(cl::Point));
+  std::sort(points.begin(), points.end());
+  std::unique_ptr<cl::CellMap> cell_map_ref(
+      cl::create_cell_map(points.data(), points.size(), sizeof(cl::Point)));
+  check_stream_result(points, *cell_map_ref,
+      reinterpret_cast<const cl::Point*>(mapped.data()), npoint, *cell_map);
+  remove(fn_output.c_str());
+}
+
+
+TEST(StreamingTest, random_float) {
+  // Write random single precision points to a file
+  std::vector<double> carts(3*NPOINT);
+  fill_random_double(2713, carts.data(), carts.size(), -5.0, 5.0);
+  std::vector<cl::PointF> points;
+  for (int ipoint = 0; ipoint < NPOINT; ++ipoint)
+    points.push_back(cl::PointF(carts.data() + 3*ipoint));
+  std::string fn_input = create_temporary_file();
+  FILE* f = fopen(fn_input.c_str(), "wb");
+  fwrite(points.data(), sizeof(cl::PointF), points.size(), f);
+  fclose(f);
+
+  // Streaming decomposition of the single precision points
+  double vecs[9]{1.3, 0.1, 0.0, 0.2, 1.1, 0.0, -0.1, 0.0, 0.9};
+  cl::Cell subcell(vecs, 3);
+  std::string fn_output = create_temporary_file();
+  cl::FilePointSource source(fn_input);
+  cl::CellMap cell_map;
+  cl::stream_decomposition<cl::PointF>(subcell, nullptr, &source, sizeof(cl::PointF),
+      fn_output, 50*sizeof(cl::PointF), [&cell_map](
+      const int* icell, size_t begin, size_t end) {
+    cell_map.emplace(std::array<int, 3>{icell[0], icell[1], icell[2]},
+                     std::array<size_t, 2>{begin, end});
+  });
+  cl::MappedFile mapped(fn_output);
+  ASSERT_EQ(NPOINT*sizeof(cl::PointF), mapped.size());
+  const cl::PointF* points_mapped = reinterpret_cast<const cl::PointF*>(mapped.data());
+
+  // In-memory reference, in which the order within a cell is preserved.
+  cl::assign_icell<cl::PointF>(subcell, points.data(), points.size(),
+                               sizeof(cl::PointF));
+  std::stable_sort(points.begin(), points.end());
+  std::unique_ptr<cl::CellMap> cell_map_ref(cl::create_cell_map<cl::PointF>(
+      points.data(), points.size(), sizeof(cl::PointF)));
+  EXPECT_EQ(*cell_map_ref, cell_map);
+  for (int ipoint = 0; ipoint < NPOINT; ++ipoint) {
+    for (int ivec = 0; ivec < 3; ++ivec) {
+      EXPECT_EQ(points[ipoint].cart_[ivec], points_mapped[ipoint].cart_[ivec]);
+      EXPECT_EQ(points[ipoint].icell_[ivec], points_mapped[ipoint].icell_[ivec]);
+    }
+  }
+  remove(fn_input.c_str());
+  remove(fn_output.c_str());
+}
+
+
+TEST(StreamingTest, large_cells) {
+  // Few cells with many more points than fit in the memory budget.
+  const size_t npoint = NPOINT;
+  double vecs[9]{4.0, 0.0, 0.0, 0.0, 4.0, 0.0, 0.0, 0.0, 4.0};
+  cl::Cell subcell(vecs, 3);
+  RandomPointSource source(1487, npoint);
+  std::string fn_output = create_temporary_file();
+  std::unique_ptr<cl::CellMap> cell_map(
+      stream_cell_map(subcell, nullptr, &source, fn_output, 10*sizeof(cl::Point)));
+  cl::MappedFile mapped(fn_output);
+  EXPECT_GE(64, cell_map->size());
+
+  // In-memory reference, in which the order within a cell is preserved.
+  std::vector<cl::Point> points(npoint, cl::Point(vecs));
+  source.rewind();
+  EXPECT_EQ(npoint, source.read(points.data(), npoint, sizeof(cl::Point)));
+  cl::assign_icell(subcell, points.data(), points.size(), sizeof(cl::Point));
+  std::stable_sort(points.begin(), points.end());
+  std::unique_ptr<cl::CellMap> cell_map_ref(
+      cl::create_cell_map(points.data(), points.size(), sizeof(cl::Point)));
+  check_stream_result(points, *cell_map_ref,
+      reinterpret_cast<const cl::Point*>(mapped.data()), npoint, *cell_map);
+  ASSERT_EQ(npoint*sizeof(cl::Point), mapped.size());
+  const cl::Point* points_mapped = reinterpret_cast<const cl::Point*>(mapped.data());
+  for (size_t ipoint = 0; ipoint < npoint; ++ipoint) {
+    EXPECT_EQ(points[ipoint].cart_[0], points_mapped[ipoint].cart_[0]);
+    EXPECT_EQ(points[ipoint].cart_[1], points_mapped[ipoint].cart_[1]);
+    EXPECT_EQ(points[ipoint].cart_[2], points_mapped[ipoint].cart_[2]);
+  }
+  remove(fn_output.c_str());
+}
+
+// vim: textwidth=90 et ts=2 sw=2
@@ -26,6 +26,7 @@
 
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <vector>
 
@@ -144,6 +145,29 @@ TEST_P(UsageTestP, points_within_cutoff) {
       EXPECT_EQ(ipoints_bars.at(i), ipoints_ranges.at(i));
     }
 
+    // Compute the points within the cutoff with the pruned ranges, i.e. using
+    // Cell::bars_cutoff_pruned, which avoids the SphereSlice. Results should match.
+    if (subcell->nvec() > 0) {
+      std::vector<int> bars;
+      subcell->bars_cutoff_pruned(center, cutoff, &bars);
+      std::vector<size_t> ipoints_pruned;
+      for (cl::BarIterator bit(bars, subcell->nvec(), shape); bit.busy(); ++bit) {
+        std::array<int, 3> icell{0, 0, 0};
+        std::copy(bit.icell(), bit.icell() + subcell->nvec(), icell.begin());
+        auto it = cell_map->find(icell);
+        if (it == cell_map->end()) continue;
+        for (size_t ipoint = it->second[0]; ipoint < it->second[1]; ++ipoint) {
+          double cart[3];
+          std::copy(points[ipoint].cart_, points[ipoint].cart_ + 3, cart);
+          cell->iadd_vec(cart, bit.coeffs());
+          if (vec3::distance(center, cart) < cutoff)
+            ipoints_pruned.push_back(ipoint);
+        }
+      }
+      std::sort(ipoints_pruned.begin(), ipoints_pruned.end());
+      EXPECT_EQ(ipoints_ranges, ipoints_pruned);
+    }
+
     // If aperiodic, compute the points within the cutoff in a dumb way: just try them
     // all! Results should match.
     if (nvec == 0) {
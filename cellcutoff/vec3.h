@@ -130,11 +130,11 @@ inline void tmatvec(const double* mat, const double* vec, double* output) {
 }
 
 
-#endif  // CELLCUTOFF_VEC3_H_
-
-
 }  // namespace vec3
 }  // namespace cellcutoff
 
 
+#endif  // CELLCUTOFF_VEC3_H_
+
+
 // vim: textwidth=90 et ts=2 sw=2